@@ -1,8 +1,27 @@
 #include "ESP32MQTTClient.h"
 #include "ESP32MQTTClientLogging.h"
 #include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include <algorithm>
+
+namespace
+{
+    // Nesting of onEventCallback() on this task, above 0 on the MQTT task while it dispatches an event
+    thread_local int eventDepth = 0;
+
+    // Period of the housekeeping timer when a paused restore of the subscriptions creates it
+    const uint32_t ResubscribeRetryMs = 1000;
+
+    struct EventScope
+    {
+        EventScope() { eventDepth++; }
+        ~EventScope() { eventDepth--; }
+    };
+}
 
 ESP32MQTTClient::ESP32MQTTClient(/* args */)
+    : _subscriptions(new SubscriptionTable()), _connectionEpoch(0), _subscriptionIdsRefused(false),
+      _lastSubscriptionId(0), _subscriptionIdsAssigned(0), _directDispatches(0), _fallbackDispatches(0)
 {
     _mqtt_client = nullptr;
     memset(&_mqtt_config, 0, sizeof(_mqtt_config));
@@ -10,6 +29,10 @@ ESP32MQTTClient::ESP32MQTTClient(/* args */)
     _mqttConnected = false;
     _mqttMaxInPacketSize = 512;  // Reduced from 1024 to save memory
     _mqttMaxOutPacketSize = _mqttMaxInPacketSize;
+    _mqttOutboxLimit = 0;
+    _mqtt5 = false;
+    _aliasEpoch = 0;
+    _subscriptionIds = true;
     _mqttLastWillTopic = nullptr;
     _mqttLastWillMessage = nullptr;
     _mqttLastWillQos = 0;
@@ -22,16 +45,83 @@ ESP32MQTTClient::ESP32MQTTClient(/* args */)
     _mqttPassword = nullptr;
     _mqttClientName = nullptr;
     _globalMessageReceivedCallback = nullptr;
+    _globalMessageViewCallback = nullptr;
     _subscribeAckCallback = nullptr;
+    _fragment.mode = FragmentMode::None;
+    _fragment.totalLen = 0;
+    _fragment.nextOffset = 0;
+    _maxMessageSize = 4096;
+    _reassemblyBuffer = nullptr;
+    _reassemblyCapacity = 0;
+    _messageChunkCallback = nullptr;
+    _housekeepingTimer = nullptr;
+    _housekeepingPeriodUs = 0;
+    _publishTimer = nullptr;
+    _requestTimer = nullptr;
+    _requestTickUs = 0;
+    _replyQos = 0;
+    _statsTimer = nullptr;
+    _statsQos = 0;
+    _autoResubscribe = true;
+    _resubscribeWindow = 4;
+    _resubscribeRound = 0;
+
+#ifdef ESP32MQTTCLIENT_DEFERRED_LOG
+    // Shared by all clients, already running when another client started it
+    mqttDeferredLog().start(&ESP32MQTTClient::printDeferredLog);
+#endif
+}
+
+#ifdef ESP32MQTTCLIENT_DEFERRED_LOG
+void ESP32MQTTClient::printDeferredLog(uint8_t level, int64_t timeUs, const char *line)
+{
+#ifdef ESP32MQTTCLIENT_USE_LOGGER
+    getLogger().log((esp_log_level_t)level, MQTTC_LOG_TAG, "(%lu) %s", (unsigned long)(timeUs / 1000), line);
+#else
+    // The ESP_LOGx macros need a literal format, the timestamp is that of the log call
+    static const char letters[] = "NEWIDV";
+    char letter = level < sizeof(letters) - 1 ? letters[level] : 'V';
+    esp_log_write((esp_log_level_t)level, MQTTC_LOG_TAG, "%c (%lu) %s: %s\n", letter, (unsigned long)(timeUs / 1000), MQTTC_LOG_TAG, line);
+#endif
+}
+#endif
+
+ESP32MQTTClient::StatsCounters::StatsCounters()
+    : messagesIn(0), bytesIn(0), messagesOut(0), bytesOut(0), publishFailures(0), inboundDropped(0),
+      connects(0), disconnects(0), connectedSinceUs(0), connectedTotalUs(0)
+{
 }
 
 ESP32MQTTClient::~ESP32MQTTClient()
 {
+    if (_statsTimer != nullptr) {
+        esp_timer_stop(_statsTimer);
+        esp_timer_delete(_statsTimer);
+        _statsTimer = nullptr;
+    }
+    if (_housekeepingTimer != nullptr) {
+        esp_timer_stop(_housekeepingTimer);
+        esp_timer_delete(_housekeepingTimer);
+        _housekeepingTimer = nullptr;
+    }
+    if (_publishTimer != nullptr) {
+        esp_timer_stop(_publishTimer);
+        esp_timer_delete(_publishTimer);
+        _publishTimer = nullptr;
+    }
+    if (_requestTimer != nullptr) {
+        esp_timer_stop(_requestTimer);
+        esp_timer_delete(_requestTimer);
+        _requestTimer = nullptr;
+    }
     if (_mqtt_client != nullptr) {
         esp_mqtt_client_stop(_mqtt_client);
         esp_mqtt_client_destroy(_mqtt_client);
         _mqtt_client = nullptr;
     }
+    // Deliver what is still queued while the subscriptions are alive
+    _dispatchQueue.stop();
+    free(_reassemblyBuffer);
 }
 
 // =============== Configuration functions, most of them must be called before the first loop() call ==============
@@ -104,6 +194,11 @@ void ESP32MQTTClient::setOnMessageCallback(MessageReceivedCallbackWithTopic call
     _globalMessageReceivedCallback = callback;
 }
 
+void ESP32MQTTClient::setOnMessageCallback(MessageViewCallback callback)
+{
+    _globalMessageViewCallback = callback;
+}
+
 void ESP32MQTTClient::setConnectionState(bool state)
 {
     _mqttConnected = state;
@@ -133,19 +228,147 @@ bool ESP32MQTTClient::setMaxPacketSize(const uint16_t size)
     return true;
 }
 
+void ESP32MQTTClient::setMaxMessageSize(size_t size)
+{
+    _maxMessageSize = size;
+}
+
+void ESP32MQTTClient::setOnMessageChunkCallback(MessageChunkCallback callback)
+{
+    _messageChunkCallback = callback;
+}
+
 bool ESP32MQTTClient::publish(const std::string &topic, const std::string &payload, int qos, bool retain)
 {
+    return publish(topic, payload, qos, retain, 0);
+}
+
+bool ESP32MQTTClient::publish(const std::string &topic, const std::string &payload, int qos, bool retain, uint32_t offlineTtlMs)
+{
+    return publishBuffer(topic.c_str(), topic.size(), payload.data(), payload.size(), qos, retain, offlineTtlMs);
+}
+
+bool ESP32MQTTClient::publish(const char *topic, const char *payload, int qos, bool retain)
+{
+    return publishBuffer(topic, strlen(topic), payload, payload ? strlen(payload) : 0, qos, retain, 0);
+}
+
+bool ESP32MQTTClient::publish(const char *topic, const uint8_t *payload, size_t length, int qos, bool retain)
+{
+    return publishBuffer(topic, strlen(topic), reinterpret_cast<const char *>(payload), length, qos, retain, 0);
+}
+
+bool ESP32MQTTClient::publish(const char *topic, const MqttPayloadSegment *segments, size_t count, int qos, bool retain)
+{
+    return publishSegments(topic, strlen(topic), segments, count, qos, retain);
+}
+
+MqttTopicHandle ESP32MQTTClient::internTopic(const std::string &topic)
+{
+    MqttTopicHandle handle = _topicArena.intern(topic);
+    if (!handle.isValid() && _enableSerialLogs)
+        MQTTC_LOG_W( "MQTT! Topic [%s] not interned, empty, too long or out of memory", topic.c_str());
+    return handle;
+}
+
+bool ESP32MQTTClient::publish(MqttTopicHandle topic, const std::string &payload, int qos, bool retain)
+{
+    if (!topic.isValid())
+        return false;
+    uint32_t hash = topic.hash();
+    return publishBuffer(topic.c_str(), topic.length(), payload.data(), payload.size(), qos, retain, 0, &hash);
+}
+
+bool ESP32MQTTClient::publish(MqttTopicHandle topic, const char *payload, int qos, bool retain)
+{
+    if (!topic.isValid())
+        return false;
+    uint32_t hash = topic.hash();
+    return publishBuffer(topic.c_str(), topic.length(), payload, payload ? strlen(payload) : 0, qos, retain, 0, &hash);
+}
+
+bool ESP32MQTTClient::publish(MqttTopicHandle topic, const uint8_t *payload, size_t length, int qos, bool retain)
+{
+    if (!topic.isValid())
+        return false;
+    uint32_t hash = topic.hash();
+    return publishBuffer(topic.c_str(), topic.length(), reinterpret_cast<const char *>(payload), length, qos, retain, 0, &hash);
+}
+
+bool ESP32MQTTClient::publish(MqttTopicHandle topic, const MqttPayloadSegment *segments, size_t count, int qos, bool retain)
+{
+    if (!topic.isValid())
+        return false;
+    uint32_t hash = topic.hash();
+    return publishSegments(topic.c_str(), topic.length(), segments, count, qos, retain, &hash);
+}
+
+bool ESP32MQTTClient::publishSegments(const char *topic, size_t topicLen, const MqttPayloadSegment *segments, size_t count, int qos, bool retain,
+                                      const uint32_t *topicHash)
+{
+    size_t length = 0;
+    for (size_t i = 0; i < count; i++)
+        length += segments[i].length;
+
+    // Never waits for the shared buffer: its holder may be blocked in esp-mqtt on the
+    // MQTT task, which could be the one calling here
+    std::unique_lock<std::mutex> lock(_gatherMutex, std::try_to_lock);
+    std::vector<char> local;
+    std::vector<char> &buffer = lock.owns_lock() ? _gatherBuffer : local;
+    if (buffer.size() < length)
+        buffer.resize(length);
+
+    size_t offset = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (segments[i].length > 0)
+            memcpy(buffer.data() + offset, segments[i].data, segments[i].length);
+        offset += segments[i].length;
+    }
+    return publishBuffer(topic, topicLen, buffer.data(), length, qos, retain, 0, topicHash);
+}
+
+bool ESP32MQTTClient::publishBuffer(const char *topic, size_t topicLen, const char *payload, size_t length, int qos, bool retain, uint32_t offlineTtlMs,
+                                    const uint32_t *topicHash)
+{
+    // esp-mqtt takes a length of 0 as "payload is a C string"
+    if (length == 0 || payload == nullptr)
+    {
+        payload = "";
+        length = 0;
+    }
+
+    // Queue while disconnected, and behind a backlog that is still being sent to keep the order
+    if (_offlineQueue.isEnabled() && (!isConnected() || !_offlineQueue.empty()))
+    {
+        bool queued = _offlineQueue.push(topic, topicLen, payload, length, qos, retain, offlineTtlMs, esp_timer_get_time());
+        if (_enableSerialLogs)
+        {
+            if (queued)
+                MQTTC_LOG_I( "MQTT: Queued [%s] for sending after reconnect", topic);
+            else
+                MQTTC_LOG_W( "MQTT! Offline queue full, message on [%s] dropped", topic);
+        }
+        if (queued && isConnected())
+            startHousekeeping();
+        return queued;
+    }
+
     // Do not try to publish if MQTT is not connected.
     if (!isConnected()) //! isConnected())
     {
         if (_enableSerialLogs)
             MQTTC_LOG_I( "Trying to publish when disconnected, skipping.");
 
+        _stats.publishFailures.fetch_add(1, std::memory_order_relaxed);
         return false;
     }
 
     bool success = false;
-    if (esp_mqtt_client_publish(_mqtt_client, topic.c_str(), payload.c_str(), 0, qos, retain) != -1)
+    int msgId = sendPublish(topic, topicLen, payload, length, qos, retain, false, nullptr, topicHash);
+    countPublish(msgId, length);
+    // -2 when esp-mqtt's outbox is at outbox.limit (IDF 5.1+)
+    if (msgId >= 0)
     {
         success = true;
     }
@@ -153,7 +376,7 @@ bool ESP32MQTTClient::publish(const std::string &topic, const std::string &paylo
     if (_enableSerialLogs)
     {
         if (success)
-            MQTTC_LOG_I( "MQTT << [%s] %s", topic.c_str(), payload.c_str());
+            MQTTC_LOG_MSG_I("MQTT << [%.*s] %.*s (%u bytes)", topic, topicLen, payload, length);
         else
             MQTTC_LOG_W( "Publish failed, is the message too long ? (see setMaxPacketSize())"); // This can occurs if the message is too long according to the maximum defined in PubsubClient.h
     }
@@ -161,53 +384,1006 @@ bool ESP32MQTTClient::publish(const std::string &topic, const std::string &paylo
     return success;
 }
 
-bool ESP32MQTTClient::subscribe(const std::string &topic, MessageReceivedCallback messageReceivedCallback, uint8_t qos)
+int ESP32MQTTClient::sendPublish(const char *topic, size_t topicLen, const char *payload, size_t length, int qos, bool retain, bool enqueue,
+                                 const RequestProperties *request, const uint32_t *topicHash)
 {
-    int msgId = esp_mqtt_client_subscribe(_mqtt_client, topic.c_str(), qos);
-    bool success = (msgId != -1);
+#ifdef ESP32MQTTCLIENT_MQTT5
+    // esp-mqtt takes the properties of the next publish in a call of their own, no other
+    // publish may come in between. The MQTT task does not wait for the lock: its holder
+    // may be waiting for the esp-mqtt lock, held by the MQTT task while it dispatches events.
+    std::unique_lock<std::mutex> lock(_propertyMutex, std::defer_lock);
+    if (_topicAliases.isEnabled() || (_mqtt5 && _requests.isEnabled()))
+    {
+        if (eventDepth == 0)
+            lock.lock();
+        else if (!lock.try_lock())
+        {
+            if (_topicAliases.isEnabled())
+                _topicAliases.countBusy();
+            if (_enableSerialLogs)
+                MQTTC_LOG_W( "MQTT! Publish properties in use by another task, publish on [%s] from the MQTT task failed", topic);
+            return -1;
+        }
+    }
 
-    if (success)
+    esp_mqtt5_publish_property_config_t property = {};
+    bool established = false;
+    if (_topicAliases.isEnabled())
     {
-        // Add the record to the subscription list only if it does not exist
-        bool found = false;
-        for (std::size_t i = 0; i < _topicSubscriptionList.size() && !found; i++) {
-            if (_topicSubscriptionList[i].topic == topic) {
-                found = true;
-                // Reset confirmation status for re-subscription
-                _topicSubscriptionList[i].confirmed = false;
-                _topicSubscriptionList[i].grantedQos = -1;
-            }
+        // A reconnect between here and the publish goes unnoticed; the broker then closes the
+        // connection over the unknown alias and the next one starts over
+        uint32_t epoch = _connectionEpoch.load();
+        if (_aliasEpoch != epoch)
+        {
+            _topicAliases.reset();
+            _aliasEpoch = epoch;
         }
 
-        if (!found) {
-            _topicSubscriptionList.push_back({topic, messageReceivedCallback, nullptr, false, -1});
+        // QoS 0 sent right away only: esp-mqtt resends QoS 1/2 packets unchanged from its
+        // outbox after a reconnect, when the broker no longer knows the alias
+        if (qos == 0 && !enqueue)
+        {
+            uint32_t hash = topicHash != nullptr ? *topicHash : MqttTopicIndex::hash(topic, topicLen);
+            property.topic_alias = _topicAliases.lookup(topic, topicLen, hash, established);
+        }
+    }
+    if (request != nullptr && _mqtt5)
+    {
+        property.response_topic = request->responseTopic;
+        property.correlation_data = request->correlationData;
+        property.correlation_data_len = request->correlationDataLen;
+    }
+
+    bool propertySet = false;
+    if (property.topic_alias != 0)
+    {
+        propertySet = esp_mqtt5_client_set_publish_property(_mqtt_client, &property) == ESP_OK;
+        if (!propertySet)
+        {
+            // Above the broker's Topic Alias Maximum, esp-mqtt does not report it otherwise
+            if (_enableSerialLogs)
+                MQTTC_LOG_I( "MQTT: broker accepts fewer than %u topic aliases", (unsigned)property.topic_alias);
+            _topicAliases.limitTo(property.topic_alias);
+            property.topic_alias = 0;
+        }
+    }
+    if (!propertySet && property.response_topic != nullptr)
+    {
+        if (esp_mqtt5_client_set_publish_property(_mqtt_client, &property) != ESP_OK)
+            return -1;
+        propertySet = true;
+    }
+    if (propertySet)
+    {
+        const char *sent = property.topic_alias != 0 && established ? "" : topic;
+        int msgId = enqueue ? esp_mqtt_client_enqueue(_mqtt_client, sent, payload, length, qos, retain, true)
+                            : esp_mqtt_client_publish(_mqtt_client, sent, payload, length, qos, retain);
+        if (msgId < 0)
+        {
+            if (property.topic_alias != 0 && !established)
+                _topicAliases.forget(property.topic_alias);
+            // Not left to the next publish
+            esp_mqtt5_publish_property_config_t none = {};
+            esp_mqtt5_client_set_publish_property(_mqtt_client, &none);
+        }
+        return msgId;
+    }
+#else
+    (void)topicLen;
+    (void)request;
+    (void)topicHash;
+#endif
+
+    if (enqueue)
+        return esp_mqtt_client_enqueue(_mqtt_client, topic, payload, length, qos, retain, true);
+    return esp_mqtt_client_publish(_mqtt_client, topic, payload, length, qos, retain);
+}
+
+bool ESP32MQTTClient::publishAsync(const std::string &topic, const std::string &payload, int qos, bool retain)
+{
+    if (_mqtt_client == nullptr)
+    {
+        _stats.publishFailures.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0) && ESP_IDF_VERSION < ESP_IDF_VERSION_VAL(5, 1, 0)
+    // esp-mqtt enforces the limit itself from IDF 5.1 on
+    if (_mqttOutboxLimit > 0 && (size_t)esp_mqtt_client_get_outbox_size(_mqtt_client) + topic.size() + payload.size() > _mqttOutboxLimit)
+    {
+        if (_enableSerialLogs)
+            MQTTC_LOG_W( "MQTT! Outbox limit reached, message on [%s] dropped", topic.c_str());
+        _stats.publishFailures.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+#endif // IDF CHECK
+
+    int msgId = sendPublish(topic.c_str(), topic.size(), payload.data(), payload.size(), qos, retain, true);
+    if (msgId < 0)
+    {
+        _stats.publishFailures.fetch_add(1, std::memory_order_relaxed);
+        if (_enableSerialLogs)
+        {
+            if (msgId == -2)
+                MQTTC_LOG_W( "MQTT! Outbox limit reached, message on [%s] dropped", topic.c_str());
+            else
+                MQTTC_LOG_W( "Enqueueing failed, is the message too long ? (see setMaxPacketSize())");
         }
+        return false;
+    }
+    countPublish(msgId, payload.size());
 
-        // Track pending subscription for SUBACK correlation
-        _pendingSubscriptions.push_back({msgId, topic, qos});
+    if (_enableSerialLogs)
+        MQTTC_LOG_MSG_I("MQTT << [%.*s] %.*s (%u bytes, queued)", topic.data(), topic.size(), payload.data(), payload.size());
+    return true;
+}
 
+bool ESP32MQTTClient::setOutboxLimit(size_t bytes)
+{
+#if ESP_IDF_VERSION < ESP_IDF_VERSION_VAL(5, 0, 0)
+    (void)bytes;
+    if (_enableSerialLogs)
+        MQTTC_LOG_W( "MQTT! outbox limit needs IDF 5.0 or later");
+    return false;
+#else  // IDF CHECK
+    _mqttOutboxLimit = bytes;
+    return true;
+#endif // IDF CHECK
+}
+
+bool ESP32MQTTClient::enableMqtt5()
+{
+#ifdef ESP32MQTTCLIENT_MQTT5
+    _mqtt5 = true;
+    return true;
+#else
+    if (_enableSerialLogs)
+        MQTTC_LOG_W( "MQTT! MQTT 5 needs IDF 5.1 or later with CONFIG_MQTT_PROTOCOL_5 enabled");
+    return false;
+#endif
+}
+
+bool ESP32MQTTClient::enableTopicAliases(uint16_t maximum)
+{
+    if (!_mqtt5)
+    {
         if (_enableSerialLogs)
-            MQTTC_LOG_I( "MQTT: Subscribe request sent for [%s] (msg_id=%d, qos=%d)", topic.c_str(), msgId, qos);
+            MQTTC_LOG_W( "MQTT! topic aliases need MQTT 5, call enableMqtt5() first");
+        return false;
+    }
+    if (!_topicAliases.begin(maximum))
+        return false;
+
+    if (_enableSerialLogs)
+        MQTTC_LOG_I( "MQTT: up to %u topic aliases", (unsigned)maximum);
+    return true;
+}
+
+size_t ESP32MQTTClient::subscribePacketTopics(const TopicSubscriptionPtr *records, size_t count) const
+{
+#if ESP_IDF_VERSION < ESP_IDF_VERSION_VAL(5, 1, 0)
+    // No multi-topic SUBSCRIBE before IDF 5.1, one packet per topic
+    (void)records;
+    return count ? 1 : 0;
+#else  // IDF CHECK
+    if (count == 0)
+        return 0;
+
+    // SUBSCRIBE packet: fixed header (at most 5 bytes) and packet id, then per topic
+    // a length prefix, the filter and the requested QoS. MQTT 5 adds the properties: their
+    // length and the subscription identifier (property id and up to 3 bytes of varint).
+    const size_t packetOverhead = 5 + 2 + (_mqtt5 ? 1 + 4 : 0);
+    const size_t packetLimit = _mqttMaxOutPacketSize > (int)packetOverhead ? _mqttMaxOutPacketSize - packetOverhead : 0;
+
+    // At least one topic per packet, esp-mqtt rejects one that does not fit on its own
+    size_t topics = 1;
+    size_t size = 2 + records[0]->topic.size() + 1;
+    while (topics < count && size + 2 + records[topics]->topic.size() + 1 <= packetLimit)
+    {
+        size += 2 + records[topics]->topic.size() + 1;
+        topics++;
+    }
+    return topics;
+#endif // IDF CHECK
+}
+
+bool ESP32MQTTClient::useSubscriptionIds() const
+{
+    return _mqtt5 && _subscriptionIds && !_subscriptionIdsRefused.load(std::memory_order_relaxed);
+}
+
+void ESP32MQTTClient::assignSubscriptionId(const TopicSubscriptionPtr *records, size_t count)
+{
+    if (!useSubscriptionIds())
+        return;
+
+    // Wraps after 65535 packets; a reused identifier only costs the direct dispatch, see matchSubscriptions()
+    uint16_t subscriptionId = _lastSubscriptionId.fetch_add(1) + 1;
+    if (subscriptionId == 0)
+        subscriptionId = _lastSubscriptionId.fetch_add(1) + 1;
+    for (size_t i = 0; i < count; i++)
+        records[i]->subscriptionId = subscriptionId;
+    _subscriptionIdsAssigned.fetch_add(1, std::memory_order_relaxed);
+}
+
+MqttSubscriptionIdStats ESP32MQTTClient::getSubscriptionIdStats() const
+{
+    MqttSubscriptionIdStats stats;
+    stats.enabled = useSubscriptionIds();
+    stats.refused = _subscriptionIdsRefused.load(std::memory_order_relaxed);
+    stats.assigned = _subscriptionIdsAssigned.load(std::memory_order_relaxed);
+    stats.direct = _directDispatches.load(std::memory_order_relaxed);
+    stats.fallback = _fallbackDispatches.load(std::memory_order_relaxed);
+    return stats;
+}
+
+int ESP32MQTTClient::sendSubscribe(const TopicSubscriptionPtr *records, size_t count)
+{
+#ifdef ESP32MQTTCLIENT_MQTT5
+    // The subscribe property applies to the next SUBSCRIBE of any task, no other subscribe may
+    // come in between. The MQTT task does not wait for the lock, see sendPublish().
+    std::unique_lock<std::mutex> lock(_subscribePropertyMutex, std::defer_lock);
+    if (_mqtt5)
+    {
+        if (eventDepth == 0)
+            lock.lock();
+        else if (!lock.try_lock())
+        {
+            if (_enableSerialLogs)
+                MQTTC_LOG_W( "MQTT! Subscribe properties in use by another task, subscribe to [%s] from the MQTT task failed", records[0]->topic.c_str());
+            return -1;
+        }
+    }
+#endif
+
+    uint16_t subscriptionId = useSubscriptionIds() ? records[0]->subscriptionId.load() : 0;
+    int msgId = writeSubscribe(records, count, subscriptionId);
+    if (msgId < 0 && subscriptionId != 0)
+    {
+        // esp-mqtt refuses identifiers unless the broker announced support for them in its CONNACK.
+        // Only -1 says so, -2 is a full outbox (IDF 5.1+)
+        bool refused = msgId == -1;
+        msgId = writeSubscribe(records, count, 0);
+        if (msgId >= 0 && refused)
+        {
+            _subscriptionIdsRefused = true;
+            if (_enableSerialLogs)
+                MQTTC_LOG_W( "MQTT! broker does not support subscription identifiers, subscribing without");
+        }
+    }
+
+    if (_enableSerialLogs)
+    {
+        if (msgId < 0 && count == 1)
+            MQTTC_LOG_W( "MQTT! subscribe failed for [%s]", records[0]->topic.c_str());
+        else if (msgId < 0)
+            MQTTC_LOG_W( "MQTT! subscribe failed for %u topic(s) starting with [%s]", (unsigned)count, records[0]->topic.c_str());
+        else if (count == 1)
+            MQTTC_LOG_I( "MQTT: Subscribe request sent for [%s] (msg_id=%d, qos=%d)", records[0]->topic.c_str(), msgId, records[0]->requestedQos);
+        else
+            MQTTC_LOG_I( "MQTT: Subscribe request sent for %u topic(s) starting with [%s] (msg_id=%d)", (unsigned)count, records[0]->topic.c_str(), msgId);
+    }
+    return msgId;
+}
+
+int ESP32MQTTClient::writeSubscribe(const TopicSubscriptionPtr *records, size_t count, uint16_t subscriptionId)
+{
+#ifdef ESP32MQTTCLIENT_MQTT5
+    // Called under _subscribePropertyMutex, see sendSubscribe()
+    esp_mqtt5_subscribe_property_config_t property = {};
+    if (subscriptionId != 0)
+    {
+        property.subscribe_id = subscriptionId;
+        esp_mqtt5_client_set_subscribe_property(_mqtt_client, &property);
+    }
+#else
+    (void)subscriptionId;
+#endif
+
+    // esp-mqtt is called outside of the subscription lock: the MQTT task may hold its
+    // internal lock while it waits for ours in onSubscribeAck()
+    int msgId;
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 1, 0)
+    if (count > 1)
+    {
+        std::vector<esp_mqtt_topic_t> topics(count);
+        for (size_t i = 0; i < count; i++) {
+            topics[i].filter = records[i]->topic.c_str();
+            topics[i].qos = records[i]->requestedQos;
+        }
+        msgId = esp_mqtt_client_subscribe_multiple(_mqtt_client, topics.data(), count);
     }
     else
+#else  // IDF CHECK
+    (void)count; // One topic per packet, see subscribePacketTopics()
+#endif // IDF CHECK
+    {
+        msgId = esp_mqtt_client_subscribe(_mqtt_client, records[0]->topic.c_str(), records[0]->requestedQos);
+    }
+
+#ifdef ESP32MQTTCLIENT_MQTT5
+    if (msgId < 0 && subscriptionId != 0)
+    {
+        // Not left to the next SUBSCRIBE
+        property.subscribe_id = 0;
+        esp_mqtt5_client_set_subscribe_property(_mqtt_client, &property);
+    }
+#endif
+    return msgId;
+}
+
+bool ESP32MQTTClient::subscribeRecord(const TopicSubscriptionPtr &record, uint8_t qos)
+{
+    if (!mqttTopicFilterValid(record->topic))
     {
         if (_enableSerialLogs)
-            MQTTC_LOG_W( "MQTT! subscribe failed for [%s]", topic.c_str());
+            MQTTC_LOG_W( "MQTT! Malformed topic filter [%s], '#' is only allowed as the last level", record->topic.c_str());
+        return false;
+    }
+    record->requestedQos = qos;
+    assignSubscriptionId(&record, 1);
+    int msgId = sendSubscribe(&record, 1);
+    if (msgId < 0)
+        return false;
+    addSubscriptions(&record, 1, msgId);
+    return true;
+}
+
+void ESP32MQTTClient::addSubscriptions(const TopicSubscriptionPtr *records, size_t count, int msgId)
+{
+    bool earlyAck = false;
+    {
+        std::lock_guard<std::mutex> lock(_subscriptions.writeMutex());
+        const SubscriptionTable *current = _subscriptions.writerView();
+
+        // One copy of the table for all records of the packet
+        SubscriptionTable *next = new SubscriptionTable();
+        next->records = current->records;
+        next->index = current->index; // Kept up to date below for duplicates within the packet
+        next->overlapping = current->overlapping;
+        size_t added = next->records.size();
+        for (size_t i = 0; i < count; i++)
+        {
+            const TopicSubscriptionPtr &record = records[i];
+            int index = next->find(record->topic, record->topicHash);
+            if (index >= 0)
+            {
+                // Re-subscription: keep the callbacks this call does not replace
+                const TopicSubscriptionRecord &existing = *next->records[index];
+                if (!record->callback)
+                    record->callback = existing.callback;
+                if (!record->callbackWithTopic)
+                    record->callbackWithTopic = existing.callbackWithTopic;
+                if (!record->callbackView)
+                    record->callbackView = existing.callbackView;
+                if (!record->stream)
+                    record->stream = existing.stream;
+                record->orderKey = existing.orderKey;
+                next->records[index] = record;
+            }
+            else
+            {
+                next->records.push_back(record);
+                next->overlapping.push_back(false);
+                next->index.insert(record->topicHash, next->records.size() - 1);
+            }
+
+            // Track pending subscription for SUBACK correlation
+            _pendingSubscriptions.push_back({msgId, record->topic, record->requestedQos});
+        }
+        next->rebuildIndex();
+        for (size_t i = added; i < next->records.size(); i++)
+            next->addOverlaps(i);
+        _subscriptions.replace(next);
+
+        for (std::size_t i = 0; i < _earlySubAcks.size(); i++) {
+            if (_earlySubAcks[i] == msgId) {
+                earlyAck = true;
+                _earlySubAcks.erase(_earlySubAcks.begin() + i);
+                break;
+            }
+        }
+    }
+
+    if (earlyAck)
+        onSubscribeAck(msgId);
+}
+
+bool ESP32MQTTClient::subscribeMany(const MqttSubscribeRequest *requests, size_t count)
+{
+    bool success = true;
+    std::vector<TopicSubscriptionPtr> records;
+    records.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+        if (!mqttTopicFilterValid(requests[i].topic)) {
+            if (_enableSerialLogs)
+                MQTTC_LOG_W( "MQTT! Malformed topic filter [%s], '#' is only allowed as the last level", requests[i].topic.c_str());
+            success = false;
+            continue;
+        }
+        TopicSubscriptionPtr record(new TopicSubscriptionRecord(requests[i].topic));
+        record->requestedQos = requests[i].qos;
+        record->callbackView = requests[i].callback;
+        records.push_back(record);
     }
 
+    size_t begin = 0;
+    while (begin < records.size())
+    {
+        size_t topics = subscribePacketTopics(&records[begin], records.size() - begin);
+        assignSubscriptionId(&records[begin], topics);
+        int msgId = sendSubscribe(&records[begin], topics);
+        if (msgId < 0)
+            success = false;
+        else
+            addSubscriptions(&records[begin], topics, msgId);
+        begin += topics;
+    }
     return success;
 }
 
+bool ESP32MQTTClient::subscribe(const std::string &topic, MessageReceivedCallback messageReceivedCallback, uint8_t qos)
+{
+    TopicSubscriptionPtr record(new TopicSubscriptionRecord(topic));
+    record->callback = messageReceivedCallback;
+    return subscribeRecord(record, qos);
+}
+
 bool ESP32MQTTClient::subscribe(const std::string &topic, MessageReceivedCallbackWithTopic messageReceivedCallback, uint8_t qos)
 {
+    TopicSubscriptionPtr record(new TopicSubscriptionRecord(topic));
+    record->callbackWithTopic = messageReceivedCallback;
+    return subscribeRecord(record, qos);
+}
+
+bool ESP32MQTTClient::subscribe(const std::string &topic, MessageViewCallback messageReceivedCallback, uint8_t qos)
+{
+    TopicSubscriptionPtr record(new TopicSubscriptionRecord(topic));
+    record->callbackView = messageReceivedCallback;
+    return subscribeRecord(record, qos);
+}
+
+bool ESP32MQTTClient::subscribe(MqttTopicHandle topic, MessageViewCallback messageReceivedCallback, uint8_t qos)
+{
+    if (!topic.isValid())
+        return false;
+    TopicSubscriptionPtr record(new TopicSubscriptionRecord(std::string(topic.c_str(), topic.length()), topic.hash()));
+    record->callbackView = messageReceivedCallback;
+    return subscribeRecord(record, qos);
+}
+
+bool ESP32MQTTClient::subscribeStream(const std::string &topic, StreamBeginCallback onBegin, StreamChunkCallback onChunk, StreamEndCallback onEnd, uint8_t qos)
+{
+    TopicSubscriptionPtr record(new TopicSubscriptionRecord(topic));
+    record->stream.reset(new StreamSubscription{onBegin, onChunk, onEnd});
+    return subscribeRecord(record, qos);
+}
 
-    if (subscribe(topic, (MessageReceivedCallback)nullptr, qos))
+void ESP32MQTTClient::setAutoResubscribe(bool enabled, size_t window)
+{
+    _autoResubscribe = enabled;
+    _resubscribeWindow = window > 0 ? window : 1;
+}
+
+void ESP32MQTTClient::startResubscribe(bool sessionPresent)
+{
     {
-        _topicSubscriptionList[_topicSubscriptionList.size() - 1].callbackWithTopic = messageReceivedCallback;
-        return true;
+        std::lock_guard<std::mutex> lock(_resubscribeMutex);
+        _resubscribe = ResubscribeState();
+        _resubscribeRound++;
+    }
+
+    auto table = _subscriptions.read();
+    if (sessionPresent) {
+        // The broker kept the subscriptions of the previous session, granted as on SUBACK
+        for (std::size_t i = 0; i < table->records.size(); i++) {
+            table->records[i]->grantedQos = table->records[i]->requestedQos;
+            table->records[i]->confirmed = true;
+        }
+        return;
+    }
+    if (!_autoResubscribe)
+        return;
+
+    std::vector<TopicSubscriptionPtr> records;
+    {
+        // Pending now means subscribed again by the onMqttConnect() hook
+        std::lock_guard<std::mutex> lock(_subscriptions.writeMutex());
+        std::vector<std::string> renewed;
+        renewed.reserve(_pendingSubscriptions.size());
+        for (std::size_t i = 0; i < _pendingSubscriptions.size(); i++)
+            renewed.push_back(_pendingSubscriptions[i].topic);
+        std::sort(renewed.begin(), renewed.end());
+
+        records.reserve(table->records.size());
+        for (std::size_t i = 0; i < table->records.size(); i++) {
+            if (!std::binary_search(renewed.begin(), renewed.end(), table->records[i]->topic))
+                records.push_back(table->records[i]);
+        }
+
+        // The broker forgot the identifiers with the session. Restore packets are packed by size
+        // and each gets a new identifier, published in a new table before the packets go out.
+        if (useSubscriptionIds() && !records.empty())
+        {
+            size_t count = records.size();
+            for (size_t begin = 0; begin < count;)
+            {
+                size_t topics = subscribePacketTopics(&records[begin], count - begin);
+                assignSubscriptionId(&records[begin], topics);
+                begin += topics;
+            }
+            const SubscriptionTable *current = _subscriptions.writerView();
+            SubscriptionTable *next = new SubscriptionTable();
+            next->records = current->records;
+            next->overlapping = current->overlapping;
+            next->rebuildIndex();
+            _subscriptions.replace(next);
+        }
+    }
+    if (records.empty())
+        return;
+
+    if (_enableSerialLogs)
+        MQTTC_LOG_I( "MQTT: Restoring %u subscription(s)", (unsigned)records.size());
+    {
+        std::lock_guard<std::mutex> lock(_resubscribeMutex);
+        _resubscribe.records.swap(records);
+        _resubscribe.startUs = esp_timer_get_time();
+    }
+    continueResubscribe();
+}
+
+void ESP32MQTTClient::continueResubscribe()
+{
+    std::unique_lock<std::mutex> lock(_resubscribeMutex);
+    // One task sends at a time, the other one leaves the window to it
+    if (_resubscribe.startUs == 0 || _resubscribe.sending)
+        return;
+    _resubscribe.sending = true;
+    _resubscribe.retry = false;
+    uint32_t round = _resubscribeRound;
+
+    // Keep up to _resubscribeWindow packets in flight instead of waiting for each SUBACK
+    while (_resubscribe.inFlight.size() < _resubscribeWindow && _resubscribe.next < _resubscribe.records.size())
+    {
+        size_t begin = _resubscribe.next;
+        size_t topics = subscribePacketTopics(&_resubscribe.records[begin], _resubscribe.records.size() - begin);
+        std::vector<TopicSubscriptionPtr> packet(_resubscribe.records.begin() + begin, _resubscribe.records.begin() + begin + topics);
+
+        // esp-mqtt is called without the lock: the MQTT task may hold its internal lock
+        // while it waits for ours in onResubscribeAck()
+        lock.unlock();
+        int msgId = sendSubscribe(packet.data(), topics);
+        lock.lock();
+        if (_resubscribeRound != round)
+            return; // Disconnected meanwhile, the next connect starts over
+
+        if (msgId < 0) {
+            // Typically the outbox is full or the connection just dropped, the housekeeping timer tries again
+            if (_enableSerialLogs)
+                MQTTC_LOG_W( "MQTT! Restoring subscriptions paused, %u not sent", (unsigned)(_resubscribe.records.size() - begin));
+            _resubscribe.sending = false;
+            _resubscribe.retry = true;
+            lock.unlock();
+            if (createHousekeepingTimer(ResubscribeRetryMs))
+                startHousekeeping();
+            return;
+        }
+
+        // Sent from the housekeeping timer, the SUBACK may have been processed already
+        bool acked = false;
+        {
+            std::lock_guard<std::mutex> writeLock(_subscriptions.writeMutex());
+            for (size_t i = 0; i < topics; i++)
+                _pendingSubscriptions.push_back({msgId, packet[i]->topic, packet[i]->requestedQos});
+            std::vector<int>::iterator early = std::find(_earlySubAcks.begin(), _earlySubAcks.end(), msgId);
+            if (early != _earlySubAcks.end()) {
+                _earlySubAcks.erase(early);
+                acked = true;
+            }
+        }
+        _resubscribe.next += topics;
+        if (!acked) {
+            _resubscribe.inFlight.push_back(msgId);
+            continue;
+        }
+
+        lock.unlock();
+        onSubscribeAck(msgId);
+        lock.lock();
+        if (_resubscribeRound != round)
+            return;
+    }
+    _resubscribe.sending = false;
+
+    if (_resubscribe.inFlight.empty() && _resubscribe.next == _resubscribe.records.size())
+    {
+        uint32_t elapsedMs = (esp_timer_get_time() - _resubscribe.startUs) / 1000;
+        _stats.resubscribeMs.record(elapsedMs);
+        if (_enableSerialLogs)
+            MQTTC_LOG_I( "MQTT: %u subscription(s) restored in %u ms", (unsigned)_resubscribe.records.size(), (unsigned)elapsedMs);
+        _resubscribe = ResubscribeState();
+    }
+}
+
+void ESP32MQTTClient::onResubscribeAck(int msgId)
+{
+    {
+        std::lock_guard<std::mutex> lock(_resubscribeMutex);
+        if (_resubscribe.startUs == 0)
+            return;
+        std::vector<int>::iterator it = std::find(_resubscribe.inFlight.begin(), _resubscribe.inFlight.end(), msgId);
+        if (it == _resubscribe.inFlight.end())
+            return;
+        _resubscribe.inFlight.erase(it);
+    }
+    continueResubscribe();
+}
+
+bool ESP32MQTTClient::retryResubscribe()
+{
+    {
+        std::lock_guard<std::mutex> lock(_resubscribeMutex);
+        if (!_resubscribe.retry)
+            return false;
+    }
+    continueResubscribe();
+    std::lock_guard<std::mutex> lock(_resubscribeMutex);
+    return _resubscribe.retry;
+}
+
+bool ESP32MQTTClient::enableAsyncDispatch(const MqttDispatchConfig &config)
+{
+    if (!_dispatchQueue.start(config))
+    {
+        if (_enableSerialLogs)
+            MQTTC_LOG_W( "MQTT! async dispatch not started, already enabled or invalid config");
+        return false;
+    }
+
+    if (_enableSerialLogs)
+        MQTTC_LOG_I( "MQTT: async dispatch with %u worker(s), queue length %u", (unsigned)config.workers, (unsigned)config.queueLength);
+    return true;
+}
+
+bool ESP32MQTTClient::enableOfflineQueue(const MqttOfflineQueueConfig &config)
+{
+    if (!_offlineQueue.begin(config))
+    {
+        if (_enableSerialLogs)
+            MQTTC_LOG_W( "MQTT! offline queue not enabled, already enabled or %u bytes not available", (unsigned)config.capacity);
+        return false;
+    }
+
+    if (!createHousekeepingTimer(config.drainIntervalMs > 0 ? config.drainIntervalMs : 1))
+    {
+        _offlineQueue.end();
+        if (_enableSerialLogs)
+            MQTTC_LOG_W( "MQTT! offline queue not enabled, timer creation failed");
+        return false;
+    }
+
+    if (_enableSerialLogs)
+        MQTTC_LOG_I( "MQTT: offline queue of %u bytes enabled", (unsigned)_offlineQueue.config().capacity);
+    return true;
+}
+
+bool ESP32MQTTClient::enablePersistentOutbox(MqttOutboxStorage *storage, const MqttOutboxConfig &config)
+{
+    if (!_outbox.begin(storage, config))
+    {
+        if (_enableSerialLogs)
+            MQTTC_LOG_W( "MQTT! persistent outbox not enabled, already enabled or storage not usable");
+        return false;
+    }
+
+    if (_enableSerialLogs)
+        MQTTC_LOG_I( "MQTT: persistent outbox enabled, %u message(s) to replay", (unsigned)_outbox.getStats().messages);
+    return true;
+}
+
+bool ESP32MQTTClient::enablePublishTracking(const MqttPublishTrackerConfig &config)
+{
+    if (!_publishTracker.begin(config))
+    {
+        if (_enableSerialLogs)
+            MQTTC_LOG_W( "MQTT! publish tracking not enabled, already enabled or capacity 0");
+        return false;
+    }
+
+    esp_timer_create_args_t args = {};
+    args.callback = &ESP32MQTTClient::onPublishTimer;
+    args.arg = this;
+    args.dispatch_method = ESP_TIMER_TASK;
+    args.name = "mqtt_publish";
+    uint64_t periodUs = (uint64_t)config.timeoutMs * 1000 / 4;
+    if (periodUs < 10000)
+        periodUs = 10000;
+    if (esp_timer_create(&args, &_publishTimer) != ESP_OK || esp_timer_start_periodic(_publishTimer, periodUs) != ESP_OK)
+    {
+        if (_publishTimer != nullptr)
+            esp_timer_delete(_publishTimer);
+        _publishTimer = nullptr;
+        _publishTracker.end();
+        if (_enableSerialLogs)
+            MQTTC_LOG_W( "MQTT! publish tracking not enabled, timer creation failed");
+        return false;
+    }
+
+    if (_enableSerialLogs)
+        MQTTC_LOG_I( "MQTT: tracking up to %u publish(es), timeout %u ms", (unsigned)config.capacity, (unsigned)config.timeoutMs);
+    return true;
+}
+
+int ESP32MQTTClient::publishTracked(const std::string &topic, const std::string &payload, int qos, bool retain, MqttPublishCallback onComplete)
+{
+    if (!isConnected())
+    {
+        if (_enableSerialLogs)
+            MQTTC_LOG_I( "Trying to publish when disconnected, skipping.");
+        _stats.publishFailures.fetch_add(1, std::memory_order_relaxed);
+        return -1;
+    }
+
+    bool track = onComplete && qos > 0;
+    if (track && !_publishTracker.isEnabled())
+    {
+        if (_enableSerialLogs)
+            MQTTC_LOG_W( "MQTT! Publish on [%s] not tracked, call enablePublishTracking() first", topic.c_str());
+        return -1;
+    }
+    if (track && !_publishTracker.reserve())
+    {
+        if (_enableSerialLogs)
+            MQTTC_LOG_W( "MQTT! In-flight table full, publish on [%s] rejected", topic.c_str());
+        _stats.publishFailures.fetch_add(1, std::memory_order_relaxed);
+        return -1;
+    }
+
+    int64_t startUs = esp_timer_get_time();
+    int msgId = sendPublish(topic.c_str(), topic.size(), payload.data(), payload.size(), qos, retain);
+    countPublish(msgId, payload.size());
+    if (msgId < 0)
+    {
+        if (track)
+            _publishTracker.cancel();
+        if (_enableSerialLogs)
+            MQTTC_LOG_W( "Publish failed, is the message too long ? (see setMaxPacketSize())");
+        return -1;
+    }
+
+    if (_enableSerialLogs)
+        MQTTC_LOG_MSG_I("MQTT << [%.*s] %.*s (%u bytes)", topic.data(), topic.size(), payload.data(), payload.size());
+
+    if (track)
+        _publishTracker.add(msgId, startUs, std::move(onComplete));
+    else if (onComplete)
+        onComplete(msgId, MqttPublishResult::Sent, 0);
+    return msgId;
+}
+
+void ESP32MQTTClient::onPublishTimer(void *arg)
+{
+    ESP32MQTTClient *client = static_cast<ESP32MQTTClient *>(arg);
+    size_t expired = client->_publishTracker.expire(esp_timer_get_time());
+    if (expired > 0 && client->_enableSerialLogs)
+        MQTTC_LOG_W( "MQTT! %u publish(es) not acknowledged within %u ms", (unsigned)expired, (unsigned)client->_publishTracker.config().timeoutMs);
+}
+
+bool ESP32MQTTClient::enableRequests(const MqttRequestConfig &config)
+{
+    std::string replyTopic = config.replyTopic;
+    if (replyTopic.empty() && _mqttClientName != nullptr)
+        replyTopic = std::string(_mqttClientName) + "/reply";
+    if (replyTopic.empty() || replyTopic.find_first_of("+#") != std::string::npos)
+    {
+        if (_enableSerialLogs)
+            MQTTC_LOG_W( "MQTT! requests not enabled, no client name or wildcard in the reply topic");
+        return false;
+    }
+    if (!_requests.begin(config.capacity))
+    {
+        if (_enableSerialLogs)
+            MQTTC_LOG_W( "MQTT! requests not enabled, already enabled or capacity not within 1..%u", (unsigned)MqttRequestTable::kMaxCapacity);
+        return false;
+    }
+
+    esp_timer_create_args_t args = {};
+    args.callback = &ESP32MQTTClient::onRequestTimer;
+    args.arg = this;
+    args.dispatch_method = ESP_TIMER_TASK;
+    args.name = "mqtt_request";
+    if (esp_timer_create(&args, &_requestTimer) != ESP_OK)
+    {
+        _requestTimer = nullptr;
+        _requests.end();
+        if (_enableSerialLogs)
+            MQTTC_LOG_W( "MQTT! requests not enabled, timer creation failed");
+        return false;
+    }
+
+    _replyTopic = replyTopic;
+    _replyQos = config.replyQos;
+    _requestTickUs = (uint64_t)(config.tickMs > 0 ? config.tickMs : 1) * 1000;
+    if (_enableSerialLogs)
+        MQTTC_LOG_I( "MQTT: up to %u request(s), responses on [%s/+]", (unsigned)config.capacity, _replyTopic.c_str());
+    return true;
+}
+
+uint32_t ESP32MQTTClient::request(const std::string &topic, const std::string &payload, uint32_t timeoutMs,
+                                  MqttResponseCallback callback, int qos)
+{
+    if (!_requests.isEnabled())
+    {
+        if (_enableSerialLogs)
+            MQTTC_LOG_W( "MQTT! Request on [%s] not sent, call enableRequests() first", topic.c_str());
+        return 0;
+    }
+    if (!isConnected())
+    {
+        if (_enableSerialLogs)
+            MQTTC_LOG_I( "Trying to publish when disconnected, skipping.");
+        _stats.publishFailures.fetch_add(1, std::memory_order_relaxed);
+        return 0;
+    }
+
+    // Entered before publishing, the response may arrive before the publish returns
+    int64_t startUs = esp_timer_get_time();
+    uint32_t id = _requests.add(startUs, timeoutMs, std::move(callback));
+    if (id == 0)
+    {
+        if (_enableSerialLogs)
+            MQTTC_LOG_W( "MQTT! Correlation table full, request on [%s] rejected", topic.c_str());
+        _stats.publishFailures.fetch_add(1, std::memory_order_relaxed);
+        return 0;
+    }
+    // Fails harmlessly if the timer is already running
+    esp_timer_start_periodic(_requestTimer, _requestTickUs);
+
+    char idText[MqttRequestTable::kIdLength];
+    MqttRequestTable::formatId(id, idText);
+    int msgId;
+    if (_mqtt5)
+    {
+        std::string responseTopic;
+        responseTopic.reserve(_replyTopic.size() + 1 + sizeof(idText));
+        responseTopic.append(_replyTopic).append(1, '/').append(idText, sizeof(idText));
+        RequestProperties properties = {responseTopic.c_str(), idText, (uint16_t)sizeof(idText)};
+        msgId = sendPublish(topic.c_str(), topic.size(), payload.data(), payload.size(), qos, false, false, &properties);
+    }
+    else
+    {
+        // MQTT 3.1.1 has no properties, the id travels in the topic and the responder replies to _replyTopic/<id>
+        std::string requestTopic;
+        requestTopic.reserve(topic.size() + 1 + sizeof(idText));
+        requestTopic.append(topic).append(1, '/').append(idText, sizeof(idText));
+        msgId = sendPublish(requestTopic.c_str(), requestTopic.size(), payload.data(), payload.size(), qos, false);
+    }
+    countPublish(msgId, payload.size());
+    if (msgId < 0)
+    {
+        _requests.cancel(id);
+        if (_enableSerialLogs)
+            MQTTC_LOG_W( "Publish failed, is the message too long ? (see setMaxPacketSize())");
+        return 0;
+    }
+
+    if (_enableSerialLogs)
+        MQTTC_LOG_MSG_I("MQTT << [%.*s] %.*s (%u bytes, request)", topic.data(), topic.size(), payload.data(), payload.size());
+    return id;
+}
+
+void ESP32MQTTClient::onRequestTimer(void *arg)
+{
+    ESP32MQTTClient *client = static_cast<ESP32MQTTClient *>(arg);
+    size_t expired = client->_requests.expire(esp_timer_get_time());
+    if (expired > 0 && client->_enableSerialLogs)
+        MQTTC_LOG_W( "MQTT! %u request(s) timed out", (unsigned)expired);
+
+    if (client->_requests.pending() > 0)
+        return;
+    esp_timer_stop(client->_requestTimer);
+    // request() may have added one and found the timer still running
+    if (client->_requests.pending() > 0)
+        esp_timer_start_periodic(client->_requestTimer, client->_requestTickUs);
+}
+
+void ESP32MQTTClient::onResponse(const MqttMessageView &message)
+{
+    // The correlation data where the responder echoed it, the last topic level otherwise
+    uint32_t id = 0;
+    bool valid;
+    if (message.correlationData != nullptr)
+    {
+        valid = MqttRequestTable::parseId(message.correlationData, message.correlationDataLen, id);
+    }
+    else
+    {
+        size_t idLen = MqttRequestTable::kIdLength;
+        valid = message.topicLen > idLen && message.topic[message.topicLen - idLen - 1] == '/' &&
+                MqttRequestTable::parseId(message.topic + message.topicLen - idLen, idLen, id);
+    }
+
+    if (!_requests.resolve(valid ? id : 0, message, esp_timer_get_time()) && _enableSerialLogs)
+        MQTTC_LOG_W( "MQTT! Response on [%.*s] matches no pending request", (int)message.topicLen, message.topic);
+}
+
+void ESP32MQTTClient::subscribeReplyTopic(bool sessionPresent)
+{
+    std::string filter = _replyTopic + "/+";
+    if (sessionPresent || _autoResubscribe)
+    {
+        // Kept by the broker or restored with the others
+        auto table = _subscriptions.read();
+        if (table->find(filter) >= 0)
+            return;
+    }
+    bool subscribed = subscribe(filter, MessageViewCallback([this](const MqttMessageView &message) {
+        onResponse(message);
+    }), _replyQos);
+    if (!subscribed && _enableSerialLogs)
+        MQTTC_LOG_W( "MQTT! Subscribing to the responses on [%s] failed", filter.c_str());
+}
+
+bool ESP32MQTTClient::enableStatsPublish(const std::string &topic, uint32_t intervalMs, int qos)
+{
+    if (_statsTimer != nullptr || intervalMs == 0)
+        return false;
+
+    esp_timer_create_args_t args = {};
+    args.callback = &ESP32MQTTClient::onStatsTimer;
+    args.arg = this;
+    args.dispatch_method = ESP_TIMER_TASK;
+    args.name = "mqtt_stats";
+    if (esp_timer_create(&args, &_statsTimer) != ESP_OK)
+    {
+        _statsTimer = nullptr;
+        return false;
+    }
+
+    _statsTopic = topic;
+    _statsQos = qos;
+    if (esp_timer_start_periodic(_statsTimer, (uint64_t)intervalMs * 1000) != ESP_OK)
+    {
+        esp_timer_delete(_statsTimer);
+        _statsTimer = nullptr;
+        return false;
+    }
+
+    if (_enableSerialLogs)
+        MQTTC_LOG_I( "MQTT: statistics published to [%s] every %u ms", topic.c_str(), (unsigned)intervalMs);
+    return true;
+}
+
+bool ESP32MQTTClient::publishPersistent(const std::string &topic, const std::string &payload, int qos, bool retain)
+{
+    if (!_outbox.isEnabled())
+        return publish(topic, payload, qos, retain);
+
+    uint32_t id;
+    if (!_outbox.add(topic.data(), topic.size(), payload.data(), payload.size(), qos, retain, id))
+    {
+        if (_enableSerialLogs)
+            MQTTC_LOG_W( "MQTT! Persistent outbox full, message on [%s] dropped", topic.c_str());
+        return false;
+    }
+
+    // If this fails the message is published from the outbox after the next connect
+    if (isConnected())
+    {
+        _outbox.reserve();
+        int msgId = sendPublish(topic.c_str(), topic.size(), payload.data(), payload.size(), qos, retain);
+        countPublish(msgId, payload.size());
+        if (msgId >= 0)
+            _outbox.markSent(id, msgId, esp_timer_get_time());
+        else
+            _outbox.cancel();
     }
 
-    return false;
+    if (_enableSerialLogs)
+        MQTTC_LOG_I( "MQTT << [%s] stored in persistent outbox (id=%u)", topic.c_str(), (unsigned)id);
+
+    return true;
 }
 
 bool ESP32MQTTClient::unsubscribe(const std::string &topic)
@@ -222,31 +1398,98 @@ bool ESP32MQTTClient::unsubscribe(const std::string &topic)
         return false;
     }
 
-    for (std::size_t i = 0; i < _topicSubscriptionList.size(); i++)
     {
-        if (_topicSubscriptionList[i].topic == topic)
-        {
-            if (esp_mqtt_client_unsubscribe(_mqtt_client, topic.c_str()) != -1)
-            {
-                _topicSubscriptionList.erase(_topicSubscriptionList.begin() + i);
-                i--;
+        auto table = _subscriptions.read();
+        if (table->find(topic) < 0)
+            return true;
+    }
 
-                if (_enableSerialLogs)
-                    MQTTC_LOG_I( "MQTT: Unsubscribed from %s", topic.c_str());
-            }
-            else
-            {
-                if (_enableSerialLogs)
-                    MQTTC_LOG_W( "MQTT! unsubscribe failed");
+    if (esp_mqtt_client_unsubscribe(_mqtt_client, topic.c_str()) < 0)
+    {
+        if (_enableSerialLogs)
+            MQTTC_LOG_W( "MQTT! unsubscribe failed");
 
-                return false;
-            }
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_subscriptions.writeMutex());
+        const SubscriptionTable *current = _subscriptions.writerView();
+        int index = current->find(topic);
+        if (index >= 0)
+        {
+            SubscriptionTable *next = new SubscriptionTable();
+            next->records = current->records;
+            next->records.erase(next->records.begin() + index);
+            next->overlapping = current->overlapping;
+            next->overlapping.erase(next->overlapping.begin() + index);
+            next->rebuildIndex();
+            if (current->overlapping[index])
+                next->removeOverlaps(topic);
+            _subscriptions.replace(next);
         }
     }
 
+    if (_enableSerialLogs)
+        MQTTC_LOG_I( "MQTT: Unsubscribed from %s", topic.c_str());
+
     return true;
 }
 
+int ESP32MQTTClient::SubscriptionTable::find(const std::string &topic) const
+{
+    return find(topic, MqttTopicIndex::hash(topic));
+}
+
+int ESP32MQTTClient::SubscriptionTable::find(const std::string &topic, uint32_t topicHash) const
+{
+    MqttTopicIndex::Value value = index.find(topicHash, [this, &topic](MqttTopicIndex::Value candidate) {
+        return records[candidate]->topic == topic;
+    });
+    return value == MqttTopicIndex::npos ? -1 : (int)value;
+}
+
+void ESP32MQTTClient::SubscriptionTable::rebuildIndex()
+{
+    trie.clear();
+    index.reset(records.size());
+    byId.reset(records.size());
+    streamCount = 0;
+    for (std::size_t i = 0; i < records.size(); i++) {
+        trie.insert(records[i]->topic, i);
+        index.insert(records[i]->topicHash, i);
+        if (records[i]->subscriptionId != 0)
+            byId.insert(records[i]->subscriptionId, i);
+        if (records[i]->stream)
+            streamCount++;
+    }
+}
+
+void ESP32MQTTClient::SubscriptionTable::addOverlaps(std::size_t added)
+{
+    // A new filter can only set flags, of the filters it overlaps and its own
+    bool found = false;
+    forEachOverlap(records[added]->topic, [this, added, &found](std::size_t i) {
+        if (i != added) {
+            overlapping[i] = true;
+            found = true;
+        }
+    });
+    overlapping[added] = found;
+}
+
+void ESP32MQTTClient::SubscriptionTable::removeOverlaps(const std::string &removed)
+{
+    forEachOverlap(removed, [this](std::size_t i) {
+        bool found = false;
+        forEachOverlap(records[i]->topic, [i, &found](std::size_t other) {
+            if (other != i)
+                found = true;
+        });
+        overlapping[i] = found;
+    });
+}
+
 void ESP32MQTTClient::setKeepAlive(uint16_t keepAliveSeconds)
 {
 #if ESP_IDF_VERSION < ESP_IDF_VERSION_VAL(5, 0, 0)
@@ -374,6 +1617,13 @@ bool ESP32MQTTClient::loopStart()
         _mqtt_config.session.disable_clean_session = _disableMQTTCleanSession;
         _mqtt_config.buffer.out_size = _mqttMaxOutPacketSize;
         _mqtt_config.buffer.size = _mqttMaxInPacketSize;
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 1, 0)
+        _mqtt_config.outbox.limit = _mqttOutboxLimit;
+#endif // IDF CHECK
+#ifdef ESP32MQTTCLIENT_MQTT5
+        if (_mqtt5)
+            _mqtt_config.session.protocol_ver = MQTT_PROTOCOL_V_5;
+#endif
 
         _mqtt_client = esp_mqtt_client_init(&_mqtt_config);
         err = esp_mqtt_client_register_event(_mqtt_client, MQTT_EVENT_ANY, handleMQTT, this);
@@ -422,98 +1672,520 @@ void ESP32MQTTClient::disconnect()
     }
 }
 
-/**
- * Matching MQTT topics, handling the eventual presence of a single wildcard character
- *
- * @param topic1 is the topic may contain a wildcard
- * @param topic2 must not contain wildcards
- * @return true on MQTT topic match, false otherwise
- */
-bool ESP32MQTTClient::mqttTopicMatch(const std::string &topic1, const std::string &topic2)
+void ESP32MQTTClient::onMessageReceivedCallback(const MqttMessageView &message)
+{
+    // Payloads are passed on by length and the esp-mqtt buffer is never written to, so
+    // binary data (CBOR, protobuf, ...) including NUL bytes arrives unchanged. Messages
+    // larger than the input buffer are reassembled in onDataEvent() instead of truncated.
+
+    // Logging
+    if (_enableSerialLogs)
+        MQTTC_LOG_MSG_I("MQTT >> [%.*s] %.*s (%u bytes)", message.topic, message.topicLen, message.payload, message.payloadLen);
+
+    int64_t start = esp_timer_get_time();
+    if (_dispatchQueue.isRunning()) {
+        enqueueMessage(message);
+        _stats.dispatchUs.record(esp_timer_get_time() - start);
+        return;
+    }
+
+    MessageStrings strings;
+    invokeGlobalCallbacks(message, strings);
+
+    // The snapshot stays valid while callbacks run, even if they (un)subscribe
+    auto table = _subscriptions.read();
+
+    matchSubscriptions(*table, message);
+
+    // Send the message to subscribers
+    for (std::size_t n = 0; n < _matchedSubscriptions.size(); n++)
+        invokeCallbacks(*table->records[_matchedSubscriptions[n]], message, strings);
+
+    _stats.dispatchUs.record(esp_timer_get_time() - start);
+}
+
+void ESP32MQTTClient::matchSubscriptions(const SubscriptionTable &table, const MqttMessageView &message)
 {
-    size_t i = 0;
+    _matchedSubscriptions.clear();
+    if (message.subscriptionId != 0 && !table.byId.empty())
+    {
+        // The identifier names a candidate, the topic confirms it: a stale or swapped identifier
+        // fails the check. A matching filter that overlaps no other is the only one for the topic.
+        MqttTopicIndex::Value i = table.byId.find(message.subscriptionId, [&table, &message](MqttTopicIndex::Value candidate) {
+            const std::string &filter = table.records[candidate]->topic;
+            return mqttTopicMatches(filter.data(), filter.size(), message.topic, message.topicLen);
+        });
+        if (i != MqttTopicIndex::npos && !table.overlapping[i])
+        {
+            _matchedSubscriptions.push_back(i);
+            _directDispatches.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        _fallbackDispatches.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Sorting keeps the subscription order for delivery
+    table.trie.match(message.topic, message.topicLen, [this](MqttTopicTrie::Value i) {
+        _matchedSubscriptions.push_back(i);
+    });
+    std::sort(_matchedSubscriptions.begin(), _matchedSubscriptions.end());
+}
 
-    if ((i = topic1.find('#')) != std::string::npos)
+void ESP32MQTTClient::enqueueMessage(const MqttMessageView &message)
+{
+    auto table = _subscriptions.read();
+    matchSubscriptions(*table, message);
+
+    bool hasGlobalCallbacks = _globalMessageViewCallback || _globalMessageReceivedCallback;
+    if (_matchedSubscriptions.empty() && !hasGlobalCallbacks)
+        return;
+
+    // The view points into the esp-mqtt buffer, workers get one shared copy
+    std::shared_ptr<QueuedMessage> queued(new QueuedMessage());
+    queued->strings.prepare(message);
+    queued->header = message;
+    queued->header.topic = queued->strings.topic.data();
+    queued->header.payload = queued->strings.payload.data();
+    if (message.responseTopic != nullptr)
     {
-        std::string t1a = topic1.substr(0, i);
-        std::string t1b = topic1.substr(i + 1);
-        if ((t1a.length() == 0 || topic2.rfind(t1a, 0) == 0) &&
-            (t1b.length() == 0 || (topic2.size() >= t1b.size() && topic2.compare(topic2.size() - t1b.size(), t1b.size(), t1b) == 0)))
-            return true;
+        queued->responseTopic.assign(message.responseTopic, message.responseTopicLen);
+        queued->header.responseTopic = queued->responseTopic.data();
     }
-    else if ((i = topic1.find('+')) != std::string::npos)
+    if (message.correlationData != nullptr)
     {
-        std::string t1a = topic1.substr(0, i);
-        std::string t1b = topic1.substr(i + 1);
+        queued->correlationData.assign(message.correlationData, message.correlationDataLen);
+        queued->header.correlationData = queued->correlationData.data();
+    }
 
-        if ((t1a.length() == 0 || topic2.rfind(t1a, 0) == 0) &&
-            (t1b.length() == 0 || (topic2.size() >= t1b.size() && topic2.compare(topic2.size() - t1b.size(), t1b.size(), t1b) == 0)))
+    if (hasGlobalCallbacks) {
+        _dispatchQueue.push(this, [this, queued]() {
+            invokeGlobalCallbacks(queued->header, queued->strings);
+        });
+    }
+
+    for (std::size_t n = 0; n < _matchedSubscriptions.size(); n++)
+    {
+        // Holding the record keeps the callbacks alive after unsubscribe()
+        TopicSubscriptionPtr record = table->records[_matchedSubscriptions[n]];
+        if (!record->callback && !record->callbackWithTopic && !record->callbackView)
+            continue;
+        if (!_dispatchQueue.push(record->orderKey, [record, queued]() {
+                invokeCallbacks(*record, queued->header, queued->strings);
+            }))
         {
-            if (topic2.substr(t1a.length(), topic2.length() - t1b.length() - t1a.length()).find('/') == std::string::npos)
-                return true;
+            if (_enableSerialLogs)
+                MQTTC_LOG_W( "MQTT! dispatch queue full, message on [%s] dropped", record->topic.c_str());
         }
     }
-    else
+}
+
+void ESP32MQTTClient::MessageStrings::prepare(const MqttMessageView &message)
+{
+    if (!ready) {
+        topic.assign(message.topic, message.topicLen);
+        if (message.payloadLen > 0)
+            payload.assign(message.payload, message.payloadLen);
+        ready = true;
+    }
+}
+
+void ESP32MQTTClient::invokeGlobalCallbacks(const MqttMessageView &message, MessageStrings &strings)
+{
+    if (_globalMessageViewCallback) {
+        _globalMessageViewCallback(message);
+    }
+
+    if (_globalMessageReceivedCallback) {
+        strings.prepare(message);
+        _globalMessageReceivedCallback(strings.topic, strings.payload);
+    }
+}
+
+void ESP32MQTTClient::invokeCallbacks(const TopicSubscriptionRecord &record, const MqttMessageView &message, MessageStrings &strings)
+{
+    int64_t start = esp_timer_get_time();
+    if (record.callbackView != nullptr)
+        record.callbackView(message); // Call the callback
+    if (record.callback != nullptr)
+    {
+        strings.prepare(message);
+        record.callback(strings.payload); // Call the callback
+    }
+    if (record.callbackWithTopic != nullptr)
     {
-        return topic1 == topic2;
+        strings.prepare(message);
+        record.callbackWithTopic(strings.topic, strings.payload); // Call the callback
     }
 
-    return false;
+    uint32_t elapsed = esp_timer_get_time() - start;
+    record.messages.fetch_add(1, std::memory_order_relaxed);
+    mqttAtomicMax(record.maxCallbackUs, elapsed);
+#ifdef ESP32MQTTCLIENT_PROFILE_CALLBACKS
+    record.callbackUs.record(elapsed);
+#endif
+}
+
+bool ESP32MQTTClient::reserveReassemblyBuffer(size_t size)
+{
+    if (_reassemblyCapacity >= size)
+        return true;
+
+    free(_reassemblyBuffer);
+    // Prefer PSRAM for large buffers, heap_caps_malloc fails if there is none
+    _reassemblyBuffer = (char *)heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (_reassemblyBuffer == nullptr)
+        _reassemblyBuffer = (char *)malloc(size);
+    _reassemblyCapacity = _reassemblyBuffer ? size : 0;
+
+    return _reassemblyBuffer != nullptr;
+}
+
+bool ESP32MQTTClient::createHousekeepingTimer(uint32_t periodMs)
+{
+    if (_housekeepingTimer != nullptr)
+        return true;
+
+    esp_timer_create_args_t args = {};
+    args.callback = &ESP32MQTTClient::onHousekeepingTimer;
+    args.arg = this;
+    args.dispatch_method = ESP_TIMER_TASK;
+    args.name = "mqtt_housekeeping";
+    _housekeepingPeriodUs = (uint64_t)periodMs * 1000;
+    return esp_timer_create(&args, &_housekeepingTimer) == ESP_OK;
+}
+
+void ESP32MQTTClient::startHousekeeping()
+{
+    // Fails harmlessly if the timer is already running
+    if (_housekeepingTimer != nullptr)
+        esp_timer_start_periodic(_housekeepingTimer, _housekeepingPeriodUs);
 }
 
-void ESP32MQTTClient::onMessageReceivedCallback(const char *topic, char *payload, unsigned int length)
+void ESP32MQTTClient::onHousekeepingTimer(void *arg)
 {
+    static_cast<ESP32MQTTClient *>(arg)->onHousekeeping();
+}
 
-    // Convert the payload into a String
-    unsigned int strTerminationPos;
-    if (strlen(topic) + length + 9 >= _mqttMaxInPacketSize)
+void ESP32MQTTClient::onHousekeeping()
+{
+    if (isConnected())
     {
-        strTerminationPos = length;
+        bool draining = drainOfflineQueue();
+        bool restoring = retryResubscribe();
+        if (draining || restoring)
+            return;
+    }
 
-        if (_enableSerialLogs)
-            MQTTC_LOG_W( "MQTT! Your message may be truncated, please set setMaxPacketSize() to a higher value.");
+    esp_timer_stop(_housekeepingTimer);
+    // A publish may have queued a message, or a restore paused, and found the timer still running
+    bool paused;
+    {
+        std::lock_guard<std::mutex> lock(_resubscribeMutex);
+        paused = _resubscribe.retry;
     }
-    else
-        strTerminationPos = length;
+    if (isConnected() && (!_offlineQueue.empty() || paused))
+        startHousekeeping();
+}
+
+bool ESP32MQTTClient::drainOfflineQueue()
+{
+    if (!_offlineQueue.isEnabled())
+        return false;
+
+    size_t sent = _offlineQueue.drain(_offlineQueue.config().drainBurst, esp_timer_get_time(), [this](const MqttOfflineMessage &message) {
+        if (!isConnected())
+            return false;
+        int msgId = sendPublish(message.topic, message.topicLen, message.payload, message.payloadLen, message.qos, message.retain);
+        countPublish(msgId, message.payloadLen);
+        return msgId >= 0;
+    });
+
+    if (sent > 0 && _enableSerialLogs)
+        MQTTC_LOG_I( "MQTT: Sent %u queued message(s)", (unsigned)sent);
 
-    // Second, we add the string termination code at the end of the payload and we convert it to a String object
+    return !_offlineQueue.empty();
+}
+
+void ESP32MQTTClient::replayOutbox()
+{
+    if (!_outbox.isEnabled())
+        return;
+
+    size_t sent = _outbox.replay(esp_timer_get_time(), [this](const MqttOfflineMessage &message) {
+        int msgId = sendPublish(message.topic, message.topicLen, message.payload, message.payloadLen, message.qos, message.retain);
+        countPublish(msgId, message.payloadLen);
+        return msgId;
+    });
+
+    if (sent > 0 && _enableSerialLogs)
+        MQTTC_LOG_I( "MQTT: Replayed %u message(s) from the persistent outbox", (unsigned)sent);
+}
+
+bool ESP32MQTTClient::hasMessageCallbacks(const SubscriptionTable &table, const MqttMessageView &message)
+{
+    if (_globalMessageReceivedCallback || _globalMessageViewCallback)
+        return true;
 
+    bool found = false;
+    table.trie.match(message.topic, message.topicLen, [&table, &found](MqttTopicTrie::Value i) {
+        const TopicSubscriptionRecord &record = *table.records[i];
+        if (record.callback || record.callbackWithTopic || record.callbackView)
+            found = true;
+    });
+    return found;
+}
 
-    std::string payloadStr;
-    if (payload)
+void ESP32MQTTClient::beginStreams(const SubscriptionTable &table, const MqttMessageView &message, size_t totalLen)
+{
+    MqttMessageChunk header;
+    header.topic = message.topic;
+    header.topicLen = message.topicLen;
+    header.data = nullptr;
+    header.dataLen = 0;
+    header.offset = 0;
+    header.totalLen = totalLen;
+    header.qos = message.qos;
+    header.retain = message.retain;
+    header.msgId = message.msgId;
+
+    _activeStreams.clear();
+    _matchedSubscriptions.clear();
+    table.trie.match(message.topic, message.topicLen, [this, &table](MqttTopicTrie::Value i) {
+        if (table.records[i]->stream)
+            _matchedSubscriptions.push_back(i);
+    });
+    std::sort(_matchedSubscriptions.begin(), _matchedSubscriptions.end());
+
+    for (std::size_t n = 0; n < _matchedSubscriptions.size(); n++)
     {
-        payload[strTerminationPos] = '\0';
-        payloadStr = std::string(payload);
+        // Holding a reference keeps the handlers alive across fragments, even after unsubscribe()
+        std::shared_ptr<StreamSubscription> stream = table.records[_matchedSubscriptions[n]]->stream;
+        if (stream->onBegin && !stream->onBegin(header))
+            continue;
+        _activeStreams.push_back(stream);
     }
-    else
+}
+
+void ESP32MQTTClient::feedStreams(const char *data, size_t offset, size_t length)
+{
+    if (_activeStreams.empty())
+        return;
+
+    MqttMessageChunk chunk;
+    chunk.topic = _fragment.header.topic;
+    chunk.topicLen = _fragment.header.topicLen;
+    chunk.data = data;
+    chunk.dataLen = length;
+    chunk.offset = offset;
+    chunk.totalLen = _fragment.totalLen;
+    chunk.qos = _fragment.header.qos;
+    chunk.retain = _fragment.header.retain;
+    chunk.msgId = _fragment.header.msgId;
+
+    for (std::size_t i = 0; i < _activeStreams.size(); i++)
+    {
+        if (_activeStreams[i]->onChunk && !_activeStreams[i]->onChunk(chunk))
+        {
+            // Handler gave up on this message
+            std::shared_ptr<StreamSubscription> stream = _activeStreams[i];
+            _activeStreams.erase(_activeStreams.begin() + i);
+            i--;
+            if (stream->onEnd)
+                stream->onEnd(false);
+        }
+    }
+}
+
+void ESP32MQTTClient::endStreams(bool complete)
+{
+    for (std::size_t i = 0; i < _activeStreams.size(); i++)
     {
-        payloadStr = "";
+        if (_activeStreams[i]->onEnd)
+            _activeStreams[i]->onEnd(complete);
     }
-    std::string topicStr(topic);
-    // Logging
-    if (_enableSerialLogs)
-        MQTTC_LOG_I( "MQTT >> [%s] %s", topic, payloadStr.c_str());
+    _activeStreams.clear();
+}
 
-    if (_globalMessageReceivedCallback) {
-        _globalMessageReceivedCallback(topicStr, payloadStr);
+void ESP32MQTTClient::onDataEvent(esp_mqtt_event_handle_t event)
+{
+    size_t offset = event->current_data_offset;
+    size_t length = event->data_len;
+    size_t totalLen = event->total_data_len;
+    _stats.bytesIn.fetch_add(length, std::memory_order_relaxed);
+
+    if (offset == 0)
+    {
+        // A new message while the previous one is incomplete: esp-mqtt gave up on it
+        if (_fragment.mode != FragmentMode::None)
+        {
+            if (_enableSerialLogs)
+                MQTTC_LOG_W( "MQTT! Message on [%s] cut short at %u of %u bytes", _fragment.topic.c_str(), (unsigned)_fragment.nextOffset, (unsigned)_fragment.totalLen);
+            if (_fragment.mode != FragmentMode::Drop)
+                _stats.inboundDropped.fetch_add(1, std::memory_order_relaxed);
+            _fragment.mode = FragmentMode::None;
+            _fragment.nextOffset = 0;
+        }
+        // Stream handlers of that message are not handed this one's fragments
+        endStreams(false);
+
+        _stats.messagesIn.fetch_add(1, std::memory_order_relaxed);
+        MqttMessageView message;
+        message.topic = event->topic;
+        message.topicLen = event->topic_len;
+        message.payload = event->data;
+        message.payloadLen = length;
+        message.msgId = event->msg_id;
+        message.responseTopic = nullptr;
+        message.responseTopicLen = 0;
+        message.correlationData = nullptr;
+        message.correlationDataLen = 0;
+#ifdef ESP32MQTTCLIENT_MQTT5
+        message.subscriptionId = _mqtt5 && event->property != nullptr ? event->property->subscribe_id : 0;
+        if (_mqtt5 && event->property != nullptr)
+        {
+            if (event->property->response_topic != nullptr && event->property->response_topic_len > 0)
+            {
+                message.responseTopic = event->property->response_topic;
+                message.responseTopicLen = event->property->response_topic_len;
+            }
+            if (event->property->correlation_data != nullptr && event->property->correlation_data_len > 0)
+            {
+                message.correlationData = event->property->correlation_data;
+                message.correlationDataLen = event->property->correlation_data_len;
+            }
+        }
+#else
+        message.subscriptionId = 0;
+#endif
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(4, 4, 0)
+        message.qos = event->qos;
+        message.retain = event->retain;
+        message.dup = event->dup;
+#else  // IDF CHECK
+        message.qos = 0;
+        message.retain = false;
+        message.dup = false;
+#endif // IDF CHECK
+
+        auto table = _subscriptions.read();
+        bool hasStreams = table->streamCount > 0;
+
+        // Payload fits into the input buffer: deliver straight from it
+        if (length >= totalLen)
+        {
+            _fragment.mode = FragmentMode::None;
+            if (hasStreams)
+            {
+                _fragment.header = message;
+                _fragment.totalLen = totalLen;
+                beginStreams(*table, message, totalLen);
+                feedStreams(event->data, 0, length);
+                endStreams(true);
+            }
+            onMessageReceivedCallback(message);
+            return;
+        }
+
+        // First fragment of a larger message, the following ones carry no topic
+        _fragment.topic.assign(event->topic, event->topic_len);
+        _fragment.header = message;
+        _fragment.header.topic = _fragment.topic.c_str();
+        if (message.responseTopic != nullptr)
+        {
+            _fragment.responseTopic.assign(message.responseTopic, message.responseTopicLen);
+            _fragment.header.responseTopic = _fragment.responseTopic.data();
+        }
+        if (message.correlationData != nullptr)
+        {
+            _fragment.correlationData.assign(message.correlationData, message.correlationDataLen);
+            _fragment.header.correlationData = _fragment.correlationData.data();
+        }
+        _fragment.totalLen = totalLen;
+        _fragment.nextOffset = 0;
+
+        bool regularDelivery = true;
+        if (hasStreams)
+        {
+            beginStreams(*table, _fragment.header, totalLen);
+            // Do not buffer messages only stream subscriptions are interested in
+            regularDelivery = _activeStreams.empty() || hasMessageCallbacks(*table, _fragment.header) || _messageChunkCallback;
+        }
+
+        if (!regularDelivery)
+            _fragment.mode = FragmentMode::Drop;
+        else if (totalLen <= _maxMessageSize && reserveReassemblyBuffer(totalLen))
+            _fragment.mode = FragmentMode::Buffer;
+        else if (_messageChunkCallback)
+            _fragment.mode = FragmentMode::Chunks;
+        else
+        {
+            _fragment.mode = FragmentMode::Drop;
+            _stats.inboundDropped.fetch_add(1, std::memory_order_relaxed);
+            if (_enableSerialLogs)
+                MQTTC_LOG_W( "MQTT! Dropping %u byte message on [%s], see setMaxMessageSize()", (unsigned)totalLen, _fragment.topic.c_str());
+        }
     }
 
-    // Send the message to subscribers
-    for (std::size_t i = 0; i < _topicSubscriptionList.size(); i++)
+    if (_fragment.mode == FragmentMode::None)
+        return;
+
+    if (offset != _fragment.nextOffset || offset + length > _fragment.totalLen)
+    {
+        if (_enableSerialLogs)
+            MQTTC_LOG_W( "MQTT! Unexpected fragment at offset %u on [%s], message dropped", (unsigned)offset, _fragment.topic.c_str());
+        if (_fragment.mode != FragmentMode::Drop)
+            _stats.inboundDropped.fetch_add(1, std::memory_order_relaxed);
+        _fragment.mode = FragmentMode::None;
+        endStreams(false);
+        return;
+    }
+    _fragment.nextOffset = offset + length;
+    bool complete = _fragment.nextOffset == _fragment.totalLen;
+
+    feedStreams(event->data, offset, length);
+
+    switch (_fragment.mode)
     {
-        if (mqttTopicMatch(_topicSubscriptionList[i].topic, std::string(topic)))
+    case FragmentMode::Buffer:
+        memcpy(_reassemblyBuffer + offset, event->data, length);
+        if (complete)
+        {
+            MqttMessageView message = _fragment.header;
+            message.payload = _reassemblyBuffer;
+            message.payloadLen = _fragment.totalLen;
+            onMessageReceivedCallback(message);
+        }
+        break;
+    case FragmentMode::Chunks:
         {
-            if (_topicSubscriptionList[i].callback != nullptr)
-                _topicSubscriptionList[i].callback(payloadStr); // Call the callback
-            if (_topicSubscriptionList[i].callbackWithTopic != nullptr)
-                _topicSubscriptionList[i].callbackWithTopic(topicStr, payloadStr); // Call the callback
+            MqttMessageChunk chunk;
+            chunk.topic = _fragment.header.topic;
+            chunk.topicLen = _fragment.header.topicLen;
+            chunk.data = event->data;
+            chunk.dataLen = length;
+            chunk.offset = offset;
+            chunk.totalLen = _fragment.totalLen;
+            chunk.qos = _fragment.header.qos;
+            chunk.retain = _fragment.header.retain;
+            chunk.msgId = _fragment.header.msgId;
+            _messageChunkCallback(chunk);
         }
+        break;
+    default:
+        break;
+    }
+
+    if (complete)
+    {
+        _fragment.mode = FragmentMode::None;
+        endStreams(true);
     }
 }
 
 void ESP32MQTTClient::onEventCallback(esp_mqtt_event_handle_t event)
 {
     //_event = &event;
+    EventScope scope;
     if (event->client == _mqtt_client)
     {
         switch (event->event_id)
@@ -522,70 +2194,80 @@ void ESP32MQTTClient::onEventCallback(esp_mqtt_event_handle_t event)
             if (_enableSerialLogs)
                 MQTTC_LOG_I( "MQTT -->> onMqttConnect");
             // Clear pending subscriptions on new connection (will be re-subscribed)
-            _pendingSubscriptions.clear();
+            {
+                std::lock_guard<std::mutex> lock(_subscriptions.writeMutex());
+                _pendingSubscriptions.clear();
+                _earlySubAcks.clear();
+            }
+            _stats.connects.fetch_add(1, std::memory_order_relaxed);
+            _stats.connectedSinceUs = esp_timer_get_time();
+            // Topic aliases of the previous connection are void, sendPublish() starts over
+            _connectionEpoch.fetch_add(1);
             setConnectionState(true);
             onMqttConnect(_mqtt_client);
+            if (_requests.isEnabled())
+                subscribeReplyTopic(event->session_present);
+            // After the hook, so subscriptions it renewed itself are not sent twice
+            startResubscribe(event->session_present);
+            replayOutbox();
+            // First burst of the offline backlog right away, the rest paced by the timer
+            if (drainOfflineQueue())
+                startHousekeeping();
             break;
         case MQTT_EVENT_DATA:
+            // Every message is logged once dispatched, see onMessageReceivedCallback()
+            MQTTC_LOG_PROTO("MQTT -->> onMqttEventData");
+            onDataEvent(event);
+            break;
+        case MQTT_EVENT_PUBLISHED:
+            // PUBACK (QoS 1) or PUBCOMP (QoS 2)
+            if (_outbox.isEnabled())
+                _outbox.acknowledge(event->msg_id);
+            if (_publishTracker.isEnabled())
+                _publishTracker.acknowledge(event->msg_id, esp_timer_get_time());
+            break;
+        case MQTT_EVENT_DELETED:
+            // esp-mqtt dropped a QoS 1/2 message it could not get acknowledged (outbox expiry)
             if (_enableSerialLogs)
-                MQTTC_LOG_I( "MQTT -->> onMqttEventData");
-            {
-                std::string topic_str(event->topic, event->topic_len);
-                onMessageReceivedCallback(topic_str.c_str(), event->data, event->data_len);
-            }
+                MQTTC_LOG_W( "MQTT! msg_id %d deleted from the esp-mqtt outbox", event->msg_id);
+            if (_publishTracker.isEnabled())
+                _publishTracker.remove(event->msg_id, MqttPublishResult::Deleted, esp_timer_get_time());
             break;
         case MQTT_EVENT_SUBSCRIBED:
-            {
-                // SUBACK received - find the pending subscription by msg_id
-                int msgId = event->msg_id;
-                std::string topic;
-                bool found = false;
-
-                // Find and remove from pending list
-                for (auto it = _pendingSubscriptions.begin(); it != _pendingSubscriptions.end(); ++it) {
-                    if (it->msgId == msgId) {
-                        topic = it->topic;
-                        found = true;
-                        _pendingSubscriptions.erase(it);
-                        break;
-                    }
-                }
-
-                if (found) {
-                    // Update subscription record with confirmed status
-                    // Note: ESP-IDF doesn't expose granted QoS in the event, assume success
-                    int grantedQos = 0;
-
-                    for (auto& sub : _topicSubscriptionList) {
-                        if (sub.topic == topic) {
-                            sub.confirmed = true;
-                            sub.grantedQos = grantedQos;
-                            break;
-                        }
-                    }
-
-                    if (_enableSerialLogs)
-                        MQTTC_LOG_I( "MQTT: SUBACK received for [%s] (msg_id=%d)", topic.c_str(), msgId);
-
-                    // Notify via callback if set
-                    if (_subscribeAckCallback) {
-                        _subscribeAckCallback(msgId, topic, grantedQos);
-                    }
-                } else {
-                    if (_enableSerialLogs)
-                        MQTTC_LOG_I( "MQTT: SUBACK received for unknown msg_id=%d", msgId);
-                }
-            }
+            onSubscribeAck(event->msg_id);
+            onResubscribeAck(event->msg_id);
             break;
         case MQTT_EVENT_DISCONNECTED:
             MQTTC_LOG_I( "MQTT_EVENT_DISCONNECTED");
             setConnectionState(false);
+            _stats.disconnects.fetch_add(1, std::memory_order_relaxed);
+            {
+                int64_t since = _stats.connectedSinceUs.exchange(0);
+                if (since != 0)
+                    _stats.connectedTotalUs.fetch_add(esp_timer_get_time() - since);
+            }
             // Mark all subscriptions as unconfirmed on disconnect
-            for (auto& sub : _topicSubscriptionList) {
-                sub.confirmed = false;
-                sub.grantedQos = -1;
+            {
+                auto table = _subscriptions.read();
+                for (std::size_t i = 0; i < table->records.size(); i++) {
+                    table->records[i]->confirmed = false;
+                    table->records[i]->grantedQos = -1;
+                }
+            }
+            {
+                std::lock_guard<std::mutex> lock(_subscriptions.writeMutex());
+                _pendingSubscriptions.clear();
+                _earlySubAcks.clear();
             }
-            _pendingSubscriptions.clear();
+            // An unfinished restore starts over after the next connect
+            {
+                std::lock_guard<std::mutex> lock(_resubscribeMutex);
+                _resubscribe = ResubscribeState();
+                _resubscribeRound++;
+            }
+            // A message cut by the disconnect will not be continued
+            _fragment.mode = FragmentMode::None;
+            endStreams(false);
             if (_enableSerialLogs)
                 MQTTC_LOG_W( "MQTT -->> %s disconnected (%lus)", _mqttUri, (unsigned long)(esp_timer_get_time() / 1000000));
             break;
@@ -599,22 +2281,196 @@ void ESP32MQTTClient::onEventCallback(esp_mqtt_event_handle_t event)
     }
 }
 
-bool ESP32MQTTClient::isSubscriptionConfirmed(const std::string &topic) const
+void ESP32MQTTClient::onSubscribeAck(int msgId)
 {
-    for (const auto& sub : _topicSubscriptionList) {
-        if (sub.topic == topic) {
-            return sub.confirmed && sub.grantedQos != 0x80;
+    // A multi-topic SUBSCRIBE (subscribeMany()) has several pending topics with the same msg_id
+    std::vector<std::string> topics;
+    std::vector<int> grantedQos;
+    {
+        std::lock_guard<std::mutex> lock(_subscriptions.writeMutex());
+
+        // Find and remove from pending list. ESP-IDF does not expose the granted QoS in the
+        // event, the requested one is taken as granted, as for a session kept by the broker.
+        for (auto it = _pendingSubscriptions.begin(); it != _pendingSubscriptions.end();) {
+            if (it->msgId == msgId) {
+                topics.push_back(it->topic);
+                grantedQos.push_back(it->requestedQos);
+                it = _pendingSubscriptions.erase(it);
+            } else {
+                ++it;
+            }
+        }
+
+        if (!topics.empty()) {
+            // Update subscription records with confirmed status
+            const SubscriptionTable *table = _subscriptions.writerView();
+            for (std::size_t i = 0; i < topics.size(); i++) {
+                int index = table->find(topics[i]);
+                if (index >= 0) {
+                    table->records[index]->grantedQos = grantedQos[i];
+                    table->records[index]->confirmed = true;
+                }
+            }
+        } else {
+            // subscribe() may not have registered the msg_id yet, keep the last few
+            if (_earlySubAcks.size() >= 8)
+                _earlySubAcks.erase(_earlySubAcks.begin());
+            _earlySubAcks.push_back(msgId);
+        }
+    }
+
+    if (topics.empty()) {
+        if (_enableSerialLogs)
+            MQTTC_LOG_I( "MQTT: SUBACK received for unknown msg_id=%d", msgId);
+        return;
+    }
+
+    for (std::size_t i = 0; i < topics.size(); i++) {
+        if (_enableSerialLogs)
+            MQTTC_LOG_I( "MQTT: SUBACK received for [%s] (msg_id=%d)", topics[i].c_str(), msgId);
+
+        // Notify via callback if set
+        if (_subscribeAckCallback) {
+            _subscribeAckCallback(msgId, topics[i], grantedQos[i]);
         }
     }
+}
+
+bool ESP32MQTTClient::isSubscriptionConfirmed(const std::string &topic) const
+{
+    auto table = _subscriptions.read();
+    int index = table->find(topic);
+    if (index >= 0) {
+        const TopicSubscriptionRecord &sub = *table->records[index];
+        return sub.confirmed && sub.grantedQos != 0x80;
+    }
     return false;
 }
 
 int ESP32MQTTClient::getSubscriptionQos(const std::string &topic) const
 {
-    for (const auto& sub : _topicSubscriptionList) {
-        if (sub.topic == topic) {
-            return sub.grantedQos;
-        }
+    auto table = _subscriptions.read();
+    int index = table->find(topic);
+    if (index >= 0) {
+        return table->records[index]->grantedQos;
     }
     return -2;  // Not found
 }
+
+void ESP32MQTTClient::countPublish(int msgId, size_t payloadLen)
+{
+    if (msgId < 0) {
+        _stats.publishFailures.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    _stats.messagesOut.fetch_add(1, std::memory_order_relaxed);
+    _stats.bytesOut.fetch_add(payloadLen, std::memory_order_relaxed);
+}
+
+MqttClientStats ESP32MQTTClient::getStats() const
+{
+    MqttClientStats stats;
+    stats.messagesIn = _stats.messagesIn.load(std::memory_order_relaxed);
+    stats.bytesIn = _stats.bytesIn.load(std::memory_order_relaxed);
+    stats.messagesOut = _stats.messagesOut.load(std::memory_order_relaxed);
+    stats.bytesOut = _stats.bytesOut.load(std::memory_order_relaxed);
+    stats.publishFailures = _stats.publishFailures.load(std::memory_order_relaxed);
+    stats.inboundDropped = _stats.inboundDropped.load(std::memory_order_relaxed);
+    stats.connects = _stats.connects.load(std::memory_order_relaxed);
+    stats.reconnects = stats.connects > 0 ? stats.connects - 1 : 0;
+    stats.disconnects = _stats.disconnects.load(std::memory_order_relaxed);
+
+    int64_t since = _stats.connectedSinceUs.load();
+    stats.sessionMs = since != 0 ? (esp_timer_get_time() - since) / 1000 : 0;
+    stats.connectedMs = _stats.connectedTotalUs.load() / 1000 + stats.sessionMs;
+    stats.dispatchUs = _stats.dispatchUs.snapshot();
+    stats.resubscribeMs = _stats.resubscribeMs.snapshot();
+    stats.publishAckUs = _publishTracker.latency();
+    stats.requestRttUs = _requests.roundTrip();
+
+    auto table = _subscriptions.read();
+    stats.subscriptions.reserve(table->records.size());
+    for (std::size_t i = 0; i < table->records.size(); i++) {
+        const TopicSubscriptionRecord &record = *table->records[i];
+        MqttSubscriptionStats subscription;
+        subscription.topic = record.topic;
+        subscription.messages = record.messages.load(std::memory_order_relaxed);
+        subscription.maxCallbackUs = record.maxCallbackUs.load(std::memory_order_relaxed);
+        stats.subscriptions.push_back(subscription);
+    }
+    return stats;
+}
+
+void ESP32MQTTClient::onStatsTimer(void *arg)
+{
+    static_cast<ESP32MQTTClient *>(arg)->publishStats();
+}
+
+void ESP32MQTTClient::publishStats()
+{
+    if (!isConnected())
+        return;
+
+    char json[640];
+    size_t length = mqttFormatStatsJson(getStats(), json, sizeof(json));
+    if (length == 0)
+        return;
+
+    int msgId = sendPublish(_statsTopic.c_str(), _statsTopic.size(), json, length, _statsQos, false);
+    countPublish(msgId, length);
+}
+
+std::vector<MqttCallbackProfile> ESP32MQTTClient::getCallbackProfile(size_t count) const
+{
+    std::vector<MqttCallbackProfile> profile;
+#ifdef ESP32MQTTCLIENT_PROFILE_CALLBACKS
+    auto table = _subscriptions.read();
+    profile.reserve(table->records.size());
+    for (std::size_t i = 0; i < table->records.size(); i++) {
+        const TopicSubscriptionRecord &record = *table->records[i];
+        MqttHistogramSnapshot snapshot = record.callbackUs.snapshot();
+        MqttCallbackProfile entry;
+        entry.topic = record.topic;
+        entry.calls = snapshot.count;
+        entry.totalUs = snapshot.sum;
+        entry.meanUs = snapshot.mean();
+        entry.p99Us = snapshot.percentile(99);
+        entry.maxUs = snapshot.max;
+        profile.push_back(entry);
+    }
+
+    std::sort(profile.begin(), profile.end(), [](const MqttCallbackProfile &a, const MqttCallbackProfile &b) {
+        return a.totalUs > b.totalUs;
+    });
+    if (count > 0 && profile.size() > count)
+        profile.resize(count);
+#else
+    (void)count;
+#endif
+    return profile;
+}
+
+void ESP32MQTTClient::logCallbackProfile(size_t count) const
+{
+#ifdef ESP32MQTTCLIENT_PROFILE_CALLBACKS
+    std::vector<MqttCallbackProfile> profile = getCallbackProfile(count);
+    MQTTC_LOG_I( "MQTT: callback profile, %u slowest subscription(s) by total time", (unsigned)profile.size());
+    for (std::size_t i = 0; i < profile.size(); i++) {
+        const MqttCallbackProfile &entry = profile[i];
+        MQTTC_LOG_I( "  [%s] calls=%u total=%lums mean=%uus p99=%uus max=%uus", entry.topic.c_str(), (unsigned)entry.calls,
+                     (unsigned long)(entry.totalUs / 1000), (unsigned)entry.meanUs, (unsigned)entry.p99Us, (unsigned)entry.maxUs);
+    }
+#else
+    (void)count;
+    MQTTC_LOG_W( "MQTT! callback profile not available, build with ESP32MQTTCLIENT_PROFILE_CALLBACKS");
+#endif
+}
+
+void ESP32MQTTClient::resetCallbackProfile()
+{
+#ifdef ESP32MQTTCLIENT_PROFILE_CALLBACKS
+    auto table = _subscriptions.read();
+    for (std::size_t i = 0; i < table->records.size(); i++)
+        table->records[i]->callbackUs.reset();
+#endif
+}
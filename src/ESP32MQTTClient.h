@@ -4,8 +4,30 @@
 #include <string>
 #include <mqtt_client.h>
 #include <functional>
+#include <memory>
+#include <atomic>
+#include <mutex>
 #include "esp_log.h"         
 #include "esp_idf_version.h" // check IDF version
+#include "esp_timer.h"
+#include "ESP32MQTTClientDispatchQueue.h"
+#include "ESP32MQTTClientMessage.h"
+#include "ESP32MQTTClientOfflineQueue.h"
+#include "ESP32MQTTClientOutbox.h"
+#include "ESP32MQTTClientPublishTracker.h"
+#include "ESP32MQTTClientRcu.h"
+#include "ESP32MQTTClientRequestTable.h"
+#include "ESP32MQTTClientStats.h"
+#include "ESP32MQTTClientTopicAlias.h"
+#include "ESP32MQTTClientTopicArena.h"
+#include "ESP32MQTTClientTopicIndex.h"
+#include "ESP32MQTTClientTopicMatch.h"
+#include "ESP32MQTTClientTopicTrie.h"
+
+// MQTT 5 needs esp-mqtt built with CONFIG_MQTT_PROTOCOL_5 (menuconfig), which exists from IDF 5.1 on
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 1, 0) && defined(CONFIG_MQTT_PROTOCOL_5)
+#define ESP32MQTTCLIENT_MQTT5
+#endif
 
 void onMqttConnect(esp_mqtt_client_handle_t client);
 #if ESP_IDF_VERSION < ESP_IDF_VERSION_VAL(5, 0, 0)
@@ -25,19 +47,77 @@ void handleMQTT(void *handler_args, esp_event_base_t base, int32_t event_id, voi
 #endif // // IDF CHECK
 
 
+/**
+ * @brief One fragment of a message too large to be reassembled
+ *
+ * esp-mqtt delivers payloads larger than its input buffer in several
+ * MQTT_EVENT_DATA events. Messages bigger than setMaxMessageSize() are handed
+ * out fragment by fragment; topic stays valid for all fragments of a message,
+ * data only during the callback. The last fragment has offset + dataLen == totalLen.
+ */
+struct MqttMessageChunk
+{
+    const char *topic;
+    size_t topicLen;
+    const char *data;
+    size_t dataLen;
+    size_t offset;   // Position of data within the payload
+    size_t totalLen; // Length of the complete payload
+    int qos;
+    bool retain;
+    int msgId;
+};
+
 typedef std::function<void(const std::string &message)> MessageReceivedCallback;
 typedef std::function<void(const std::string &topicStr, const std::string &message)> MessageReceivedCallbackWithTopic;
+// Zero-copy callback, see MqttMessageView for the lifetime of the data
+typedef std::function<void(const MqttMessageView &message)> MessageViewCallback;
+typedef std::function<void(const MqttMessageChunk &chunk)> MessageChunkCallback;
+
+// Stream subscriptions (subscribeStream()) get every fragment as it arrives, without buffering.
+// onBegin receives the message header (data == nullptr) and returns false to skip the message,
+// onChunk returns false to abort it, onEnd reports whether the whole payload was delivered.
+typedef std::function<bool(const MqttMessageChunk &header)> StreamBeginCallback;
+typedef std::function<bool(const MqttMessageChunk &chunk)> StreamChunkCallback;
+typedef std::function<void(bool complete)> StreamEndCallback;
 
 // Callback for subscription acknowledgment (SUBACK)
 // Parameters: msg_id, topic, granted_qos (0-2 = success, 0x80 = failure)
 typedef std::function<void(int msg_id, const std::string &topic, int granted_qos)> SubscribeAckCallback;
 
+// One topic of ESP32MQTTClient::subscribeMany()
+struct MqttSubscribeRequest
+{
+    std::string topic;
+    uint8_t qos;
+    MessageViewCallback callback;
+};
+
+// Dispatch by MQTT 5 subscription identifier, see ESP32MQTTClient::setSubscriptionIds()
+struct MqttSubscriptionIdStats
+{
+    bool enabled;      // SUBSCRIBE packets carry an identifier
+    bool refused;      // The broker does not support identifiers, esp-mqtt subscribed without
+    uint32_t assigned; // Identifiers handed out, one per SUBSCRIBE packet
+    uint32_t direct;   // Messages dispatched by their identifier, without filter matching
+    uint32_t fallback; // Messages with an identifier that still went through filter matching
+};
+
+// One piece of a payload published with ESP32MQTTClient::publish(topic, segments, count),
+// e.g. a header and a body kept in separate buffers
+struct MqttPayloadSegment
+{
+    const void *data;
+    size_t length;
+};
+
 class ESP32MQTTClient
 {
 private:
     esp_mqtt_client_config_t _mqtt_config; // C so different naming
     esp_mqtt_client_handle_t _mqtt_client;
     MessageReceivedCallbackWithTopic _globalMessageReceivedCallback = nullptr;
+    MessageViewCallback _globalMessageViewCallback = nullptr;
 	
 
     // MQTT related
@@ -54,28 +134,224 @@ private:
 
     int _mqttMaxInPacketSize;
     int _mqttMaxOutPacketSize;
+    size_t _mqttOutboxLimit; // Bytes, 0 = unlimited, see setOutboxLimit()
+    bool _mqtt5;             // Connect with MQTT 5, see enableMqtt5()
+
+    struct StreamSubscription
+    {
+        StreamBeginCallback onBegin;
+        StreamChunkCallback onChunk;
+        StreamEndCallback onEnd;
+    };
 
+    // Not modified once published in a SubscriptionTable, except for the atomic members below
     struct TopicSubscriptionRecord
     {
         std::string topic;
+        uint32_t topicHash; // MqttTopicIndex::hash() of topic
+        uint8_t requestedQos;
+        // MQTT 5 subscription identifier, shared by the topics of one SUBSCRIBE; 0 for none. Renumbered
+        // under the table's write lock when the subscriptions are restored, while other tasks read it
+        std::atomic<uint16_t> subscriptionId;
         MessageReceivedCallback callback;
         MessageReceivedCallbackWithTopic callbackWithTopic;
-        bool confirmed;  // True after SUBACK received
-        int grantedQos;  // QoS granted by broker (-1 = pending, 0x80 = rejected)
+        MessageViewCallback callbackView;
+        std::shared_ptr<StreamSubscription> stream; // Set by subscribeStream()
+        // Dispatch queue ordering key: the first record of the topic, kept by the records replacing it on
+        // re-subscription so that messages already queued are not overtaken
+        const void *orderKey;
+        // Updated in place from the MQTT task, hence atomic
+        std::atomic<bool> confirmed;  // True after SUBACK received
+        std::atomic<int> grantedQos;  // QoS granted by broker (-1 = pending, 0x80 = rejected)
+        // Statistics, updated by whichever task runs the callbacks
+        mutable std::atomic<uint32_t> messages;
+        mutable std::atomic<uint32_t> maxCallbackUs;
+#ifdef ESP32MQTTCLIENT_PROFILE_CALLBACKS
+        mutable MqttHistogram callbackUs; // Duration of every callback run, see getCallbackProfile()
+#endif
+
+        explicit TopicSubscriptionRecord(const std::string &t) : TopicSubscriptionRecord(t, MqttTopicIndex::hash(t)) {}
+        TopicSubscriptionRecord(const std::string &t, uint32_t hash) : topic(t), topicHash(hash), requestedQos(0), subscriptionId(0), orderKey(this), confirmed(false), grantedQos(-1), messages(0), maxCallbackUs(0) {}
+    };
+    typedef std::shared_ptr<TopicSubscriptionRecord> TopicSubscriptionPtr;
+
+    // Snapshot of all subscriptions. subscribe()/unsubscribe() publish a modified copy
+    // (copy-on-write), so the MQTT task dispatches without locking while application
+    // tasks change subscriptions concurrently.
+    struct SubscriptionTable
+    {
+        std::vector<TopicSubscriptionPtr> records;
+        MqttTopicTrie trie;      // Topic filters of records, values are indices into records
+        MqttTopicIndex index;    // Exact filter strings of records, for lookups by filter
+        MqttTopicIndex byId;     // Subscription identifiers of records (used as hash), several records per id
+        std::vector<bool> overlapping; // Per record: another filter matches some of the same topics
+        size_t streamCount = 0;  // Records with a stream handler
+
+        int find(const std::string &topic) const;
+        int find(const std::string &topic, uint32_t topicHash) const;
+        void rebuildIndex(); // Of trie, index and byId from records
+
+        // overlapping is updated as records come and go, after rebuildIndex()
+        void addOverlaps(std::size_t added);
+        void removeOverlaps(const std::string &removed);
+
+        // Calls f(i) for the records whose filter overlaps filter, itself included if present.
+        // An exact filter is looked up in the trie, a wildcard one compared with every filter.
+        template <typename F>
+        void forEachOverlap(const std::string &filter, F f) const
+        {
+            if (filter.find_first_of("+#") == std::string::npos) {
+                trie.match(filter.data(), filter.size(), [&f](MqttTopicTrie::Value i) { f(i); });
+                return;
+            }
+            for (std::size_t i = 0; i < records.size(); i++) {
+                if (mqttTopicFiltersOverlap(filter, records[i]->topic))
+                    f(i);
+            }
+        }
     };
-    std::vector<TopicSubscriptionRecord> _topicSubscriptionList;
+    MqttRcuPointer<SubscriptionTable> _subscriptions;
+
+    // Reused while dispatching so matching does not allocate once warmed up (MQTT task only)
+    std::vector<MqttTopicTrie::Value> _matchedSubscriptions;
 
-    // Track pending subscriptions by msg_id for SUBACK correlation
+    // Track pending subscriptions by msg_id for SUBACK correlation, guarded by _subscriptions.writeMutex()
     struct PendingSubscription {
         int msgId;
         std::string topic;
         uint8_t requestedQos;
     };
     std::vector<PendingSubscription> _pendingSubscriptions;
+    // msg_ids of SUBACKs processed by the MQTT task before subscribe() registered them
+    std::vector<int> _earlySubAcks;
 
     // Callback for SUBACK events
     SubscribeAckCallback _subscribeAckCallback;
 
+    // Reassembly of messages delivered in several MQTT_EVENT_DATA fragments
+    enum class FragmentMode { None, Buffer, Chunks, Drop };
+    struct FragmentState
+    {
+        FragmentMode mode;
+        std::string topic;           // Only the first fragment carries the topic
+        std::string responseTopic;   // And the MQTT 5 properties
+        std::string correlationData;
+        MqttMessageView header;      // qos/retain/dup/msgId of the message in progress
+        size_t totalLen;
+        size_t nextOffset;
+    };
+    FragmentState _fragment;
+
+    // Stream subscriptions receiving the message in progress
+    std::vector<std::shared_ptr<StreamSubscription>> _activeStreams;
+    // std::string copies of a message, built when the first string based callback needs them
+    struct MessageStrings
+    {
+        std::string topic;
+        std::string payload;
+        bool ready = false;
+
+        void prepare(const MqttMessageView &message);
+    };
+
+    // Message copied out of the esp-mqtt buffer for the dispatch workers, shared by all
+    // subscriptions it matched. strings is prepared before queueing, so it is only read.
+    struct QueuedMessage
+    {
+        MqttMessageView header;
+        MessageStrings strings;
+        std::string responseTopic;
+        std::string correlationData;
+    };
+    MqttDispatchQueue _dispatchQueue; // Runs callbacks on worker tasks once enableAsyncDispatch() was called
+
+    // Publishes kept while disconnected, sent in bursts by the housekeeping timer after reconnecting
+    MqttOfflineQueue _offlineQueue;
+    esp_timer_handle_t _housekeepingTimer;
+
+    // publishPersistent() messages awaiting PUBACK/PUBCOMP, kept in flash across resets
+    MqttPersistentOutbox _outbox;
+    uint64_t _housekeepingPeriodUs;
+
+    // publishTracked() messages awaiting PUBACK/PUBCOMP, timed out by _publishTimer
+    MqttPublishTracker _publishTracker;
+    esp_timer_handle_t _publishTimer;
+
+    // request() calls awaiting their response, timed out by _requestTimer while any is pending
+    MqttRequestTable _requests;
+    esp_timer_handle_t _requestTimer;
+    uint64_t _requestTickUs;
+    std::string _replyTopic; // Responses arrive on _replyTopic/<id>
+    uint8_t _replyQos;
+
+    // Counters behind getStats(), relaxed atomics so updating them costs next to nothing
+    struct StatsCounters
+    {
+        std::atomic<uint32_t> messagesIn;
+        std::atomic<uint32_t> bytesIn;
+        std::atomic<uint32_t> messagesOut;
+        std::atomic<uint32_t> bytesOut;
+        std::atomic<uint32_t> publishFailures;
+        std::atomic<uint32_t> inboundDropped;
+        std::atomic<uint32_t> connects;
+        std::atomic<uint32_t> disconnects;
+        std::atomic<int64_t> connectedSinceUs;  // 0 while disconnected
+        std::atomic<uint64_t> connectedTotalUs;  // Of the sessions that ended
+        MqttHistogram dispatchUs;
+        MqttHistogram resubscribeMs;
+
+        StatsCounters();
+    };
+    StatsCounters _stats;
+    // Restore of the subscriptions after a clean-session reconnect, sent from the MQTT task
+    // and, once sending failed, from the housekeeping timer
+    struct ResubscribeState
+    {
+        std::vector<TopicSubscriptionPtr> records; // To restore, in table order
+        size_t next = 0;                           // First record not sent yet
+        std::vector<int> inFlight;                 // msg_ids of restore packets awaiting SUBACK
+        int64_t startUs = 0;                       // Of MQTT_EVENT_CONNECTED, 0 when not restoring
+        bool sending = false;                      // A task is in continueResubscribe()
+        bool retry = false;                        // Sending failed, the housekeeping timer tries again
+    };
+    ResubscribeState _resubscribe;
+    uint32_t _resubscribeRound;      // Counts connects and disconnects, a restore does not outlive its round
+    std::mutex _resubscribeMutex;    // Guards the two above, never held across esp-mqtt calls
+    bool _autoResubscribe;
+    size_t _resubscribeWindow;
+
+    // Topics of internTopic(), kept for the lifetime of the client
+    MqttTopicArena _topicArena;
+
+    // Outbound topic aliases (MQTT 5), looked up and published under _propertyMutex
+    MqttTopicAliasTable _topicAliases;
+    std::mutex _propertyMutex; // Keeps the publish properties and their publish together
+    std::atomic<uint32_t> _connectionEpoch; // Counts MQTT_EVENT_CONNECTED, aliases do not outlive a connection
+    uint32_t _aliasEpoch;                   // Connection the aliases in _topicAliases belong to
+
+    // MQTT 5 subscription identifiers, see setSubscriptionIds()
+    bool _subscriptionIds;
+    std::atomic<bool> _subscriptionIdsRefused;
+    std::atomic<uint16_t> _lastSubscriptionId;
+    std::atomic<uint32_t> _subscriptionIdsAssigned;
+    std::atomic<uint32_t> _directDispatches;
+    std::atomic<uint32_t> _fallbackDispatches;
+    std::mutex _subscribePropertyMutex; // Keeps the subscribe property and its subscribe together
+
+    // Segments of publish(topic, segments, count) are gathered here, reused by whichever task gets it
+    std::mutex _gatherMutex;
+    std::vector<char> _gatherBuffer;
+
+    // Periodic publish of the statistics, see enableStatsPublish()
+    esp_timer_handle_t _statsTimer;
+    std::string _statsTopic;
+    int _statsQos;
+
+    size_t _maxMessageSize;
+    char *_reassemblyBuffer; // Reused for every fragmented message, PSRAM when available
+    size_t _reassemblyCapacity;
+    MessageChunkCallback _messageChunkCallback;
+
     // General behaviour related
     bool _enableSerialLogs;
     bool _drasticResetOnConnectionFailures;
@@ -101,15 +377,326 @@ public:
 	void setCaCert(const char * caCert);
 	void setKey(const char * clientKey);
     void setOnMessageCallback(MessageReceivedCallbackWithTopic callback);
+    void setOnMessageCallback(MessageViewCallback callback); // Zero-copy variant, called before the std::string one
     void setConnectionState(bool state);
     void setAutoReconnect(bool choice);
     bool setMaxOutPacketSize(const uint16_t size);
     bool setMaxPacketSize(const uint16_t size); // override the default value of 1024
+    void setMaxMessageSize(size_t size);         // Largest fragmented message reassembled before delivery (default 4096)
+    void setOnMessageChunkCallback(MessageChunkCallback callback); // Receives messages larger than setMaxMessageSize() fragment by fragment
     bool publish(const std::string &topic, const std::string &payload, int qos = 0, bool retain = false);
+    bool publish(const std::string &topic, const std::string &payload, int qos, bool retain, uint32_t offlineTtlMs); // offlineTtlMs: lifetime in the offline queue, 0 for the configured default
+    bool publish(const char *topic, const char *payload, int qos = 0, bool retain = false);                             // Text payload, e.g. string literals, without std::string copies
+    bool publish(const char *topic, const uint8_t *payload, size_t length, int qos = 0, bool retain = false);           // Binary payload, no std::string needed
+
+    /**
+     * @brief Publish a payload made of several buffers, e.g. a header and a body
+     *
+     * esp-mqtt takes one buffer per message, so the segments are copied back to back
+     * into a buffer the client keeps and reuses; once it has grown to the largest
+     * payload, publishing does not allocate. A publish running concurrently on
+     * another task uses a temporary buffer instead. Otherwise the same as publish().
+     */
+    bool publish(const char *topic, const MqttPayloadSegment *segments, size_t count, int qos = 0, bool retain = false);
+
+    /**
+     * @brief Publish without waiting for the network
+     *
+     * The message is put into the esp-mqtt outbox (esp_mqtt_client_enqueue()) and
+     * written by the MQTT task, so the caller does not block on the socket even for
+     * QoS 0. While disconnected it stays in the outbox until the connection is back
+     * or esp-mqtt expires it. Does not go through the offline queue.
+     *
+     * @return false if the outbox limit (setOutboxLimit()) is reached or esp-mqtt rejected the message
+     */
+    bool publishAsync(const std::string &topic, const std::string &payload, int qos = 0, bool retain = false);
+
+    /**
+     * @brief Bound the memory held by the esp-mqtt outbox
+     *
+     * From IDF 5.1 on, esp-mqtt rejects enqueued messages and QoS 1/2 publishes
+     * that would make the outbox exceed bytes; with IDF 5.0 publishAsync() checks
+     * the outbox size itself before enqueueing. Must be called before loopStart().
+     *
+     * @param bytes 0 for no limit (default)
+     * @return false before IDF 5.0, which cannot report the outbox size
+     */
+    bool setOutboxLimit(size_t bytes);
+
+    /**
+     * @brief Copy topic into the client once, for publish() and subscribe() without string handling
+     *
+     * The topic is stored with its length and hash in an arena that grows in small
+     * chunks and lives as long as the client; interning the same topic again returns
+     * the same handle. Publishing through a handle does no formatting, hashing or
+     * allocation. Can be called from any task, also before loopStart().
+     *
+     * @return Invalid handle (isValid() false) if the topic is empty, longer than 65535 bytes or memory ran out;
+     *         publish() and subscribe() fail with it
+     */
+    MqttTopicHandle internTopic(const std::string &topic);
+    bool publish(MqttTopicHandle topic, const std::string &payload, int qos = 0, bool retain = false);
+    bool publish(MqttTopicHandle topic, const char *payload, int qos = 0, bool retain = false);
+    bool publish(MqttTopicHandle topic, const uint8_t *payload, size_t length, int qos = 0, bool retain = false);
+    bool publish(MqttTopicHandle topic, const MqttPayloadSegment *segments, size_t count, int qos = 0, bool retain = false);
+    bool subscribe(MqttTopicHandle topic, MessageViewCallback messageReceivedCallback, uint8_t qos = 0); // Hash of the handle reused for the subscription table
+
+    /**
+     * @brief Connect with MQTT 5 instead of 3.1.1
+     *
+     * Needs esp-mqtt built with MQTT 5 support (CONFIG_MQTT_PROTOCOL_5 in menuconfig,
+     * IDF 5.1 or later). Must be called before loopStart().
+     *
+     * @return false if esp-mqtt has no MQTT 5 support
+     */
+    bool enableMqtt5();
+    bool isMqtt5() const { return _mqtt5; }
+
+    /**
+     * @brief Send the topics of QoS 0 publishes as MQTT 5 topic aliases
+     *
+     * The first publish to a topic sends it along with an alias, later ones only the
+     * two byte alias. Up to maximum topics get an alias, fewer if the broker's Topic
+     * Alias Maximum is lower; then the least recently published topic gives up its
+     * alias. Aliases start over with every connection. QoS 1/2 messages and
+     * publishAsync() always carry the topic, esp-mqtt may resend them on a later
+     * connection. Needs enableMqtt5(). Must be called before loopStart().
+     *
+     * While a publish is being written, a publish from a callback on the MQTT task
+     * fails instead of waiting (counted in getTopicAliasStats().busy); use
+     * enableAsyncDispatch() to publish from callbacks without that.
+     *
+     * @return false without MQTT 5, if already enabled or maximum is 0
+     */
+    bool enableTopicAliases(uint16_t maximum = 16);
+
+    /**
+     * @brief Alias limit and assigned/reused/evicted counters of the topic aliases
+     */
+    MqttTopicAliasStats getTopicAliasStats() const { return _topicAliases.getStats(); }
+
+    /**
+     * @brief Dispatch MQTT 5 messages by subscription identifier (enabled by default)
+     *
+     * With MQTT 5 every SUBSCRIBE packet carries a new subscription identifier, and
+     * the broker tags each message with the identifier of the subscription it matched.
+     * Such a message goes straight to that subscription, without matching its topic
+     * against all filters, as long as no other filter can match the same topics;
+     * otherwise, and for MQTT 3.1.1, filters are matched as before. If the broker
+     * does not support identifiers, subscriptions are made without. Must be called
+     * before loopStart().
+     */
+    void setSubscriptionIds(bool enabled) { _subscriptionIds = enabled; }
+    MqttSubscriptionIdStats getSubscriptionIdStats() const;
+
     bool subscribe(const std::string &topic, MessageReceivedCallback messageReceivedCallback, uint8_t qos = 0);
     bool subscribe(const std::string &topic, MessageReceivedCallbackWithTopic messageReceivedCallback, uint8_t qos = 0);
+    bool subscribe(const std::string &topic, MessageViewCallback messageReceivedCallback, uint8_t qos = 0); // Zero-copy variant, no allocation per message
+    bool subscribeStream(const std::string &topic, StreamBeginCallback onBegin, StreamChunkCallback onChunk, StreamEndCallback onEnd, uint8_t qos = 0); // Fragments are forwarded as they arrive, memory use is bounded by the input buffer
     bool unsubscribe(const std::string &topic);                                       // Unsubscribes from the topic, if it exists, and removes it from the CallbackList.
 
+    /**
+     * @brief Subscribe to several topics with as few SUBSCRIBE packets as possible
+     *
+     * Topics are packed into multi-topic SUBSCRIBE packets that fit into the output
+     * buffer (setMaxOutPacketSize()); the SUBACK of a packet confirms all of its
+     * topics. Before IDF 5.1 every topic is sent in its own packet. Otherwise the
+     * same as calling subscribe() for each request.
+     * @return false if esp-mqtt rejected a packet, its topics are not subscribed
+     */
+    bool subscribeMany(const MqttSubscribeRequest *requests, size_t count);
+    bool subscribeMany(const std::vector<MqttSubscribeRequest> &requests) { return subscribeMany(requests.data(), requests.size()); }
+
+    /**
+     * @brief Restore the subscriptions after reconnecting (enabled by default)
+     *
+     * After a connect without session present, every subscription the onMqttConnect()
+     * hook did not renew itself is subscribed again, packed as by subscribeMany(),
+     * with up to window packets awaiting their SUBACK at a time. The time until the
+     * last one is acknowledged goes into getStats().resubscribeMs. With session
+     * present the broker kept the subscriptions; they are marked confirmed again
+     * with the QoS originally requested.
+     */
+    void setAutoResubscribe(bool enabled, size_t window = 4);
+
+    /**
+     * @brief Run message callbacks on worker tasks instead of the MQTT task
+     *
+     * Messages are copied into a bounded queue drained by config.workers tasks, so a
+     * slow callback no longer delays keepalive, acknowledgements or other topics.
+     * Callbacks of one subscription (and the global callbacks) are called one at a
+     * time, in arrival order; different subscriptions are served in parallel.
+     * Stream and chunk callbacks are still called on the MQTT task.
+     * Must be called before loopStart().
+     *
+     * @param config Queue length, worker count, core, priority, stack and overflow policy
+     * @return false if already enabled or config is invalid
+     */
+    bool enableAsyncDispatch(const MqttDispatchConfig &config = MqttDispatchConfig());
+
+    /**
+     * @brief Queue depth and delivered/dropped counters of the asynchronous dispatch
+     */
+    MqttDispatchStats getDispatchStats() const { return _dispatchQueue.getStats(); }
+
+    /**
+     * @brief Keep publishes made while disconnected and send them after reconnecting
+     *
+     * Messages are copied into a ring buffer preallocated with config.capacity bytes
+     * (optionally in PSRAM); publish() then returns true when the message was queued.
+     * After MQTT_EVENT_CONNECTED the queue is drained in bursts of config.drainBurst
+     * messages every config.drainIntervalMs, oldest first; publishes made while the
+     * backlog drains are queued behind it to keep the order. Expired messages
+     * (config.ttlMs or the offlineTtlMs of publish()) are discarded.
+     * Must be called before loopStart().
+     *
+     * @return false if already enabled or the arena could not be allocated
+     */
+    bool enableOfflineQueue(const MqttOfflineQueueConfig &config = MqttOfflineQueueConfig());
+
+    /**
+     * @brief Fill level and queued/sent/expired/dropped counters of the offline queue
+     */
+    MqttOfflineQueueStats getOfflineQueueStats() const { return _offlineQueue.getStats(); }
+
+    /**
+     * @brief Keep publishPersistent() messages in storage until the broker acknowledged them
+     *
+     * The log in storage is loaded right away; messages left from before a reset are
+     * published after loopStart() connected. Use MqttFileOutboxStorage on a mounted
+     * SPIFFS/LittleFS partition for messages that survive power cycles.
+     * Must be called before loopStart().
+     *
+     * @param storage Not owned, must outlive the client
+     * @return false if already enabled or the log could not be repaired
+     */
+    bool enablePersistentOutbox(MqttOutboxStorage *storage, const MqttOutboxConfig &config = MqttOutboxConfig());
+
+    /**
+     * @brief Publish through the persistent outbox
+     *
+     * The message is written to storage before it is published and removed once
+     * the broker acknowledged it (QoS 1/2), or once it was handed to esp-mqtt (QoS 0).
+     * While disconnected it is only stored and published after the next connect.
+     * Behaves like publish() when the outbox is not enabled.
+     *
+     * @return true if the message was stored (or published), false if the outbox is full
+     */
+    bool publishPersistent(const std::string &topic, const std::string &payload, int qos = 1, bool retain = false);
+
+    /**
+     * @brief Message count, log size and stored/acknowledged/replayed counters of the outbox
+     */
+    MqttOutboxStats getOutboxStats() const { return _outbox.getStats(); }
+
+    /**
+     * @brief Report the acknowledgement of publishTracked() messages
+     *
+     * Preallocates an in-flight table of config.capacity entries mapping msg_id to
+     * completion callback and publish time. Entries not acknowledged within
+     * config.timeoutMs complete as MqttPublishResult::TimedOut; the table is checked
+     * every quarter of the timeout. Acknowledgement latencies go into
+     * getStats().publishAckUs.
+     * Must be called before loopStart().
+     *
+     * @return false if already enabled, capacity is 0 or the timer could not be created
+     */
+    bool enablePublishTracking(const MqttPublishTrackerConfig &config = MqttPublishTrackerConfig());
+
+    /**
+     * @brief Publish and report when the broker acknowledged the message
+     *
+     * onComplete is called once, on the MQTT task for the acknowledgement or on the
+     * timer task for a timeout; for QoS 0 it is called with MqttPublishResult::Sent
+     * before this returns. A QoS 1/2 publish with a callback needs
+     * enablePublishTracking() and a free entry in the in-flight table.
+     * Does not go through the offline queue or the persistent outbox.
+     *
+     * @param onComplete May be nullptr to only get the msg_id
+     * @return msg_id of the message (0 for QoS 0), -1 if it was not published and
+     *         onComplete will not be called
+     */
+    int publishTracked(const std::string &topic, const std::string &payload, int qos, bool retain = false,
+                       MqttPublishCallback onComplete = nullptr);
+
+    /**
+     * @brief In-flight count and completion counters of the publish tracking
+     */
+    MqttPublishTrackerStats getPublishTrackingStats() const { return _publishTracker.getStats(); }
+
+    /**
+     * @brief Set up request() with a correlation table of config.capacity entries
+     *
+     * Responses are expected on config.replyTopic/<id>, subscribed to as
+     * config.replyTopic/+ on every connect. Pending requests are checked for their
+     * timeout every config.tickMs by a timer that only runs while any is pending.
+     * Round trip times go into getStats().requestRttUs.
+     * Must be called before loopStart().
+     *
+     * @return false if already enabled, capacity is 0 or above 256, the reply topic is
+     *         invalid or the timer could not be created
+     */
+    bool enableRequests(const MqttRequestConfig &config = MqttRequestConfig());
+
+    /**
+     * @brief Publish a request and call callback with its response or on timeout
+     *
+     * With MQTT 5 the request goes to topic with the response topic
+     * replyTopic/<id> and the id as correlation data, which the responder echoes.
+     * With MQTT 3.1.1 it goes to topic/<id> and the responder publishes its response
+     * to replyTopic/<id>. id is 8 hex digits. callback is called once, on the task
+     * dispatching the response or on the timer task for a timeout.
+     *
+     * @param timeoutMs Time to wait for the response, at the resolution of config.tickMs
+     * @return Id of the request, 0 if it was not published (not connected, table full,
+     *         enableRequests() not called) and callback will not be called
+     */
+    uint32_t request(const std::string &topic, const std::string &payload, uint32_t timeoutMs,
+                     MqttResponseCallback callback, int qos = 0);
+
+    /**
+     * @brief Pending requests and completion counters of request()
+     */
+    MqttRequestStats getRequestStats() const { return _requests.getStats(); }
+
+    /**
+     * @brief Traffic, connection and dispatch statistics
+     *
+     * Counters are updated with relaxed atomics on the hot paths and can be read
+     * from any task; the snapshot is not taken atomically as a whole.
+     */
+    MqttClientStats getStats() const;
+
+    /**
+     * @brief Publish getStats() as JSON to topic every intervalMs while connected
+     *
+     * The per-subscription statistics are not included. The timer keeps running
+     * while disconnected but skips those periods.
+     *
+     * @return false if already enabled, intervalMs is 0 or the timer could not be created
+     */
+    bool enableStatsPublish(const std::string &topic, uint32_t intervalMs = 60000, int qos = 0);
+
+    /**
+     * @brief Callback durations per subscription, slowest (by total time) first
+     *
+     * Only recorded when the library is built with ESP32MQTTCLIENT_PROFILE_CALLBACKS
+     * defined; otherwise the profiler is compiled out and this returns nothing.
+     *
+     * @param count Number of subscriptions returned at most, 0 for all
+     */
+    std::vector<MqttCallbackProfile> getCallbackProfile(size_t count = 0) const;
+
+    /**
+     * @brief Log the count slowest subscriptions of getCallbackProfile()
+     */
+    void logCallbackProfile(size_t count = 10) const;
+
+    /**
+     * @brief Start the callback profile over, e.g. after startup
+     */
+    void resetCallbackProfile();
+
     /**
      * @brief Set callback for subscription acknowledgments (SUBACK)
      * @param callback Function called when broker acknowledges subscription
@@ -125,6 +712,9 @@ public:
 
     /**
      * @brief Get the granted QoS for a subscription
+     *
+     * ESP-IDF does not report the QoS in the SUBACK, a confirmed subscription has its requested QoS.
+     *
      * @param topic The topic to check
      * @return Granted QoS (0-2), -1 if pending, 0x80 if rejected, -2 if not found
      */
@@ -173,6 +763,57 @@ public:
     void onEventCallback(esp_mqtt_event_handle_t event);
     
 private:
-    void onMessageReceivedCallback(const char *topic, char *payload, unsigned int length);
-    bool mqttTopicMatch(const std::string &topic1, const std::string &topic2);
+    // topicHash is MqttTopicIndex::hash() of the topic if known (interned topics), computed when needed otherwise
+    bool publishBuffer(const char *topic, size_t topicLen, const char *payload, size_t length, int qos, bool retain, uint32_t offlineTtlMs,
+                       const uint32_t *topicHash = nullptr);
+    bool publishSegments(const char *topic, size_t topicLen, const MqttPayloadSegment *segments, size_t count, int qos, bool retain,
+                         const uint32_t *topicHash = nullptr);
+    // MQTT 5 properties of a request() publish
+    struct RequestProperties
+    {
+        const char *responseTopic; // NUL terminated
+        const char *correlationData;
+        uint16_t correlationDataLen;
+    };
+    int sendPublish(const char *topic, size_t topicLen, const char *payload, size_t length, int qos, bool retain, bool enqueue = false,
+                    const RequestProperties *request = nullptr, const uint32_t *topicHash = nullptr); // The esp-mqtt call, with the topic alias and request properties if any
+    bool subscribeRecord(const TopicSubscriptionPtr &record, uint8_t qos);
+    size_t subscribePacketTopics(const TopicSubscriptionPtr *records, size_t count) const; // How many of records fit into one SUBSCRIBE
+    int sendSubscribe(const TopicSubscriptionPtr *records, size_t count);
+    int writeSubscribe(const TopicSubscriptionPtr *records, size_t count, uint16_t subscriptionId); // The esp-mqtt call, with the identifier if not 0
+    bool useSubscriptionIds() const;
+    void assignSubscriptionId(const TopicSubscriptionPtr *records, size_t count); // One new identifier for the records of a SUBSCRIBE
+    void addSubscriptions(const TopicSubscriptionPtr *records, size_t count, int msgId);
+    void startResubscribe(bool sessionPresent);
+    void continueResubscribe();
+    void onResubscribeAck(int msgId);
+    bool retryResubscribe(); // true while the restore still waits for a retry
+    void countPublish(int msgId, size_t payloadLen);
+    static void onPublishTimer(void *arg);
+    static void onRequestTimer(void *arg);
+    void onResponse(const MqttMessageView &message);
+    void subscribeReplyTopic(bool sessionPresent);
+    static void onStatsTimer(void *arg);
+    void publishStats();
+#ifdef ESP32MQTTCLIENT_DEFERRED_LOG
+    static void printDeferredLog(uint8_t level, int64_t timeUs, const char *line);
+#endif
+    void onSubscribeAck(int msgId);
+    void onMessageReceivedCallback(const MqttMessageView &message);
+    void enqueueMessage(const MqttMessageView &message);
+    void matchSubscriptions(const SubscriptionTable &table, const MqttMessageView &message); // Into _matchedSubscriptions, sorted
+    void invokeGlobalCallbacks(const MqttMessageView &message, MessageStrings &strings);
+    static void invokeCallbacks(const TopicSubscriptionRecord &record, const MqttMessageView &message, MessageStrings &strings);
+    void onDataEvent(esp_mqtt_event_handle_t event);
+    bool reserveReassemblyBuffer(size_t size);
+    static void onHousekeepingTimer(void *arg);
+    void onHousekeeping();
+    bool createHousekeepingTimer(uint32_t periodMs);
+    void startHousekeeping();
+    bool drainOfflineQueue();
+    void replayOutbox();
+    bool hasMessageCallbacks(const SubscriptionTable &table, const MqttMessageView &message);
+    void beginStreams(const SubscriptionTable &table, const MqttMessageView &message, size_t totalLen);
+    void feedStreams(const char *data, size_t offset, size_t length);
+    void endStreams(bool complete);
 };
@@ -0,0 +1,203 @@
+#include "ESP32MQTTClientDeferredLog.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+#ifdef ESP_PLATFORM
+#include "freertos/FreeRTOS.h"
+#include "esp_pthread.h"
+#endif
+
+const std::size_t MqttLogRecord::kTextSize;
+
+MqttDeferredLog::MqttDeferredLog(std::size_t slots)
+    : _mask(0), _enqueuePos(0), _dequeuePos(0), _stopping(false), _sink(nullptr),
+      _logged(0), _dropped(0), _printed(0), _droppedReported(0)
+{
+    std::size_t capacity = 1;
+    while (capacity < slots)
+        capacity <<= 1;
+    _slots.reset(new Slot[capacity]);
+    _mask = capacity - 1;
+    for (std::size_t i = 0; i < capacity; i++)
+        _slots[i].sequence.store(i, std::memory_order_relaxed);
+}
+
+// Bounded MPMC queue after Dmitry Vyukov: a slot whose sequence equals the enqueue
+// position is free, one whose sequence is position + 1 holds a complete record
+bool MqttDeferredLog::push(uint8_t level, const char *format, int64_t timeUs,
+                           const char *topic, std::size_t topicLen,
+                           const char *payload, std::size_t payloadLen, std::size_t maxPayload)
+{
+    Slot *slot;
+    std::size_t pos = _enqueuePos.load(std::memory_order_relaxed);
+    for (;;)
+    {
+        slot = &_slots[pos & _mask];
+        std::size_t sequence = slot->sequence.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+        if (diff == 0)
+        {
+            if (_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+        }
+        else if (diff < 0)
+        {
+            _dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        else
+            pos = _enqueuePos.load(std::memory_order_relaxed);
+    }
+
+    MqttLogRecord &record = slot->record;
+    std::size_t storedTopic = topicLen < MqttLogRecord::kTextSize ? topicLen : MqttLogRecord::kTextSize;
+    std::size_t storedPayload = MqttLogRecord::kTextSize - storedTopic;
+    if (storedPayload > maxPayload)
+        storedPayload = maxPayload;
+    if (storedPayload > payloadLen)
+        storedPayload = payloadLen;
+    record.format = format;
+    record.timeUs = timeUs;
+    record.payloadSize = payloadLen;
+    record.topicLen = storedTopic;
+    record.payloadLen = storedPayload;
+    record.level = level;
+    if (storedTopic)
+        memcpy(record.text, topic, storedTopic);
+    if (storedPayload)
+        memcpy(record.text + storedTopic, payload, storedPayload);
+
+    slot->sequence.store(pos + 1, std::memory_order_release);
+    _logged.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+bool MqttDeferredLog::pop(MqttLogRecord &record)
+{
+    Slot &slot = _slots[_dequeuePos & _mask];
+    std::size_t sequence = slot.sequence.load(std::memory_order_acquire);
+    // Empty, or the producer that claimed the slot is still copying
+    if (sequence != _dequeuePos + 1)
+        return false;
+
+    record = slot.record;
+    slot.sequence.store(_dequeuePos + _mask + 1, std::memory_order_release);
+    _dequeuePos++;
+    return true;
+}
+
+std::size_t MqttDeferredLog::format(const MqttLogRecord &record, char *buffer, std::size_t size)
+{
+    if (size == 0)
+        return 0;
+    int length = snprintf(buffer, size, record.format,
+                          (int)record.topicLen, record.text,
+                          (int)record.payloadLen, record.text + record.topicLen,
+                          (unsigned)record.payloadSize);
+    if (length < 0)
+    {
+        buffer[0] = '\0';
+        return 0;
+    }
+    return (std::size_t)length < size ? length : size - 1;
+}
+
+std::size_t MqttDeferredLog::drain(Sink sink)
+{
+    std::size_t printed = 0;
+    MqttLogRecord record;
+    int64_t lastTimeUs = 0;
+    char line[MqttLogRecord::kTextSize + 96];
+    while (pop(record))
+    {
+        format(record, line, sizeof(line));
+        sink(record.level, record.timeUs, line);
+        lastTimeUs = record.timeUs;
+        printed++;
+    }
+    _printed.fetch_add(printed, std::memory_order_relaxed);
+
+    uint32_t dropped = _dropped.load(std::memory_order_relaxed);
+    if (dropped != _droppedReported)
+    {
+        snprintf(line, sizeof(line), "MQTT! %u log record(s) dropped, log ring full", (unsigned)(dropped - _droppedReported));
+        _droppedReported = dropped;
+        sink(2 /* ESP_LOG_WARN */, lastTimeUs, line);
+    }
+    return printed;
+}
+
+bool MqttDeferredLog::start(Sink sink, const MqttDeferredLogConfig &config)
+{
+    if (isRunning() || sink == nullptr)
+        return false;
+
+    _sink = sink;
+    _config = config;
+    _stopping = false;
+
+#ifdef ESP_PLATFORM
+    // std::thread picks up the esp_pthread configuration of the creating task
+    esp_pthread_cfg_t previous;
+    bool hadConfig = esp_pthread_get_cfg(&previous) == ESP_OK;
+    esp_pthread_cfg_t cfg = esp_pthread_get_default_config();
+    cfg.stack_size = config.stackSize;
+    cfg.prio = config.priority;
+    cfg.pin_to_core = config.core < 0 ? tskNO_AFFINITY : config.core;
+    cfg.thread_name = "mqtt_log";
+    esp_pthread_set_cfg(&cfg);
+#endif
+
+    _thread = std::thread(&MqttDeferredLog::drainLoop, this);
+
+#ifdef ESP_PLATFORM
+    if (hadConfig)
+        esp_pthread_set_cfg(&previous);
+    else
+    {
+        esp_pthread_cfg_t defaults = esp_pthread_get_default_config();
+        esp_pthread_set_cfg(&defaults);
+    }
+#endif
+
+    return true;
+}
+
+void MqttDeferredLog::stop()
+{
+    if (!isRunning())
+        return;
+
+    _stopping = true;
+    _thread.join();
+    _thread = std::thread();
+}
+
+void MqttDeferredLog::drainLoop()
+{
+    // The ring is polled: waking the task from push() would need a lock or a
+    // FreeRTOS call on the producer side
+    while (!_stopping.load())
+    {
+        if (drain(_sink) == 0)
+            std::this_thread::sleep_for(std::chrono::milliseconds(_config.idleMs));
+    }
+    drain(_sink);
+}
+
+MqttDeferredLogStats MqttDeferredLog::getStats() const
+{
+    MqttDeferredLogStats stats;
+    stats.logged = _logged.load(std::memory_order_relaxed);
+    stats.dropped = _dropped.load(std::memory_order_relaxed);
+    stats.printed = _printed.load(std::memory_order_relaxed);
+    return stats;
+}
+
+MqttDeferredLog &mqttDeferredLog()
+{
+    static MqttDeferredLog log;
+    return log;
+}
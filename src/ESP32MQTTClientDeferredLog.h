@@ -0,0 +1,140 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+
+/**
+ * @brief One message log call, stored in binary form by MqttDeferredLog
+ *
+ * The format string takes the topic, the payload and the full payload size:
+ * (int topicLen, const char *topic, int payloadLen, const char *payload, unsigned payloadSize),
+ * e.g. "MQTT >> [%.*s] %.*s (%u bytes)". Topic and payload are stored back to back
+ * in text, truncated to what fits.
+ */
+struct MqttLogRecord
+{
+    static const std::size_t kTextSize = 128;
+
+    const char *format;   // String literal, also identifies the call site
+    int64_t timeUs;       // When the call was made
+    uint32_t payloadSize; // Payload length before truncation
+    uint16_t topicLen;    // Bytes of the topic stored at text[0]
+    uint16_t payloadLen;  // Bytes of the payload stored after the topic
+    uint8_t level;        // esp_log_level_t
+    char text[kTextSize];
+};
+
+struct MqttDeferredLogConfig
+{
+    uint32_t idleMs = 20;      // How long the drain task sleeps once the ring is empty
+    uint32_t stackSize = 3072; // Drain task stack, bytes (ESP32 only)
+    int priority = 1;          // Drain task priority (ESP32 only), below the MQTT task
+    int core = -1;             // Core to pin the drain task to, -1 for any (ESP32 only)
+};
+
+struct MqttDeferredLogStats
+{
+    uint32_t logged;  // Records written to the ring
+    uint32_t dropped; // Records lost because the ring was full
+    uint32_t printed; // Records formatted and handed to the sink
+};
+
+/**
+ * @brief Lock-free ring of MqttLogRecord, formatted and printed by a low priority task
+ *
+ * push() copies the arguments into a preallocated slot (no formatting, no
+ * allocation, no lock) and never blocks: when the ring is full the record is
+ * counted as dropped. Any number of tasks may push; records are printed in the
+ * order their slots were claimed.
+ */
+class MqttDeferredLog
+{
+public:
+    // Receives each formatted line; level is an esp_log_level_t, timeUs that of the record
+    typedef void (*Sink)(uint8_t level, int64_t timeUs, const char *line);
+
+    /**
+     * @param slots Capacity in records, rounded up to a power of two
+     */
+    explicit MqttDeferredLog(std::size_t slots = 64);
+    ~MqttDeferredLog() { stop(); }
+
+    MqttDeferredLog(const MqttDeferredLog &) = delete;
+    MqttDeferredLog &operator=(const MqttDeferredLog &) = delete;
+
+    /**
+     * @brief Store one record
+     * @param maxPayload At most this many payload bytes are kept
+     * @return false if the ring was full and the record dropped
+     */
+    bool push(uint8_t level, const char *format, int64_t timeUs,
+              const char *topic, std::size_t topicLen,
+              const char *payload, std::size_t payloadLen, std::size_t maxPayload);
+
+    /**
+     * @brief Take the oldest record, for a single consumer (the drain task or drain())
+     * @return false if the ring is empty
+     */
+    bool pop(MqttLogRecord &record);
+
+    /**
+     * @brief Format and hand all stored records to the sink on the calling task
+     *
+     * Only while the drain task is not running: the ring allows a single consumer.
+     * @return Number of records printed
+     */
+    std::size_t drain(Sink sink);
+
+    /**
+     * @brief Start the task that drains the ring into the sink
+     * @return false if already running or sink is nullptr
+     */
+    bool start(Sink sink, const MqttDeferredLogConfig &config = MqttDeferredLogConfig());
+
+    /**
+     * @brief Stop the drain task, after it printed what is still stored
+     */
+    void stop();
+
+    bool isRunning() const { return _thread.joinable(); }
+    std::size_t capacity() const { return _mask + 1; }
+    MqttDeferredLogStats getStats() const;
+
+    /**
+     * @brief Write the record as its format describes
+     * @return Length of the line, truncated to size - 1
+     */
+    static std::size_t format(const MqttLogRecord &record, char *buffer, std::size_t size);
+
+private:
+    struct Slot
+    {
+        std::atomic<std::size_t> sequence; // Position the slot is ready for, see push()/pop()
+        MqttLogRecord record;
+    };
+
+    void drainLoop();
+
+    std::unique_ptr<Slot[]> _slots;
+    std::size_t _mask;
+    std::atomic<std::size_t> _enqueuePos;
+    std::size_t _dequeuePos; // Consumer only
+
+    std::thread _thread;
+    std::atomic<bool> _stopping;
+    Sink _sink;
+    MqttDeferredLogConfig _config;
+
+    std::atomic<uint32_t> _logged;
+    std::atomic<uint32_t> _dropped;
+    std::atomic<uint32_t> _printed;
+    uint32_t _droppedReported; // Consumer only
+};
+
+/**
+ * @brief The ring behind the MQTTC_LOG_MSG_* macros with ESP32MQTTCLIENT_DEFERRED_LOG
+ */
+MqttDeferredLog &mqttDeferredLog();
@@ -0,0 +1,162 @@
+#include "ESP32MQTTClientDispatchQueue.h"
+
+#include <algorithm>
+
+#ifdef ESP_PLATFORM
+#include "freertos/FreeRTOS.h"
+#include "esp_pthread.h"
+#endif
+
+bool MqttDispatchQueue::start(const MqttDispatchConfig &config)
+{
+    if (isRunning() || config.workers == 0 || config.queueLength == 0)
+        return false;
+
+    _config = config;
+    _stopping = false;
+    _queue.reserve(config.queueLength);
+    _activeKeys.assign(config.workers, nullptr);
+    _maxDepth = 0;
+    _enqueued = 0;
+    _delivered = 0;
+    _dropped = 0;
+
+#ifdef ESP_PLATFORM
+    // std::thread picks up the esp_pthread configuration of the creating task
+    esp_pthread_cfg_t previous;
+    bool hadConfig = esp_pthread_get_cfg(&previous) == ESP_OK;
+    esp_pthread_cfg_t cfg = esp_pthread_get_default_config();
+    cfg.stack_size = config.stackSize;
+    cfg.prio = config.priority;
+    cfg.pin_to_core = config.core < 0 ? tskNO_AFFINITY : config.core;
+    cfg.thread_name = "mqtt_dispatch";
+    esp_pthread_set_cfg(&cfg);
+#endif
+
+    for (std::size_t i = 0; i < config.workers; i++)
+        _workers.push_back(std::thread(&MqttDispatchQueue::workerLoop, this));
+
+#ifdef ESP_PLATFORM
+    if (hadConfig)
+        esp_pthread_set_cfg(&previous);
+    else
+    {
+        esp_pthread_cfg_t defaults = esp_pthread_get_default_config();
+        esp_pthread_set_cfg(&defaults);
+    }
+#endif
+
+    return true;
+}
+
+void MqttDispatchQueue::stop()
+{
+    if (!isRunning())
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+    _workAvailable.notify_all();
+    _spaceAvailable.notify_all();
+
+    for (std::size_t i = 0; i < _workers.size(); i++)
+        _workers[i].join();
+    _workers.clear();
+}
+
+bool MqttDispatchQueue::push(const void *key, Task task)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    if (!isRunning() || _stopping)
+        return false;
+
+    if (_queue.size() >= _config.queueLength)
+    {
+        switch (_config.policy)
+        {
+        case MqttDispatchPolicy::DropNewest:
+            _dropped++;
+            return false;
+        case MqttDispatchPolicy::DropOldest:
+            _queue.erase(_queue.begin());
+            _dropped++;
+            break;
+        case MqttDispatchPolicy::Block:
+            _spaceAvailable.wait(lock, [this]() { return _queue.size() < _config.queueLength || _stopping; });
+            if (_stopping)
+                return false;
+            break;
+        }
+    }
+
+    Entry entry;
+    entry.key = key;
+    entry.task = std::move(task);
+    _queue.push_back(std::move(entry));
+    _enqueued++;
+    _maxDepth = std::max(_maxDepth, _queue.size());
+    lock.unlock();
+
+    _workAvailable.notify_one();
+    return true;
+}
+
+MqttDispatchStats MqttDispatchQueue::getStats() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    MqttDispatchStats stats;
+    stats.depth = _queue.size();
+    stats.maxDepth = _maxDepth;
+    stats.enqueued = _enqueued;
+    stats.delivered = _delivered;
+    stats.dropped = _dropped;
+    return stats;
+}
+
+bool MqttDispatchQueue::isKeyActive(const void *key) const
+{
+    return std::find(_activeKeys.begin(), _activeKeys.end(), key) != _activeKeys.end();
+}
+
+std::size_t MqttDispatchQueue::nextRunnable() const
+{
+    std::size_t i = 0;
+    while (i < _queue.size() && isKeyActive(_queue[i].key))
+        i++;
+    return i;
+}
+
+void MqttDispatchQueue::workerLoop()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (true)
+    {
+        std::size_t index;
+        // Queued tasks are still run when stopping, only an empty queue ends the worker
+        _workAvailable.wait(lock, [this, &index]() {
+            index = nextRunnable();
+            return index < _queue.size() || (_stopping && _queue.empty());
+        });
+        if (index >= _queue.size())
+            return;
+
+        Entry entry = std::move(_queue[index]);
+        _queue.erase(_queue.begin() + index);
+        std::size_t slot = std::find(_activeKeys.begin(), _activeKeys.end(), nullptr) - _activeKeys.begin();
+        _activeKeys[slot] = entry.key;
+        lock.unlock();
+        _spaceAvailable.notify_one();
+
+        entry.task();
+        entry.task = nullptr; // Release captured state before taking the lock again
+
+        lock.lock();
+        _activeKeys[slot] = nullptr;
+        _delivered++;
+        // Tasks of this key may have been skipped by other workers meanwhile
+        if (!_queue.empty())
+            _workAvailable.notify_all();
+    }
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief What to do when a message arrives while the dispatch queue is full
+ */
+enum class MqttDispatchPolicy
+{
+    DropOldest, // Discard the oldest queued message to make room (default)
+    DropNewest, // Discard the arriving message
+    Block       // Wait for a free slot; stalls the MQTT task (and keepalive) meanwhile
+};
+
+/**
+ * @brief Settings of the asynchronous dispatch mode, see ESP32MQTTClient::enableAsyncDispatch()
+ */
+struct MqttDispatchConfig
+{
+    std::size_t queueLength = 16; // Deliveries queued at most (one per message and matching subscription)
+    std::size_t workers = 1;      // Number of worker tasks
+    int core = -1;                // Core the workers are pinned to, -1 for no affinity
+    int priority = 5;             // FreeRTOS priority of the workers
+    std::size_t stackSize = 4096; // Stack of each worker in bytes
+    MqttDispatchPolicy policy = MqttDispatchPolicy::DropOldest;
+};
+
+/**
+ * @brief Counters of the dispatch queue
+ */
+struct MqttDispatchStats
+{
+    std::size_t depth;    // Tasks currently queued
+    std::size_t maxDepth; // Highest depth seen since the queue was started
+    uint32_t enqueued;    // Tasks accepted
+    uint32_t delivered;   // Tasks run to completion
+    uint32_t dropped;     // Tasks discarded because the queue was full
+};
+
+/**
+ * @brief Bounded task queue drained by a pool of worker threads
+ *
+ * Every task carries a key (the subscription it belongs to). Tasks with the same
+ * key run one at a time in the order they were pushed, tasks with different keys
+ * run in parallel on the available workers. A worker skips tasks whose key is
+ * being handled by another worker, so a slow key only holds back its own tasks.
+ *
+ * Workers are std::threads; on ESP32 they are created through esp_pthread with
+ * the configured core, priority and stack size.
+ */
+class MqttDispatchQueue
+{
+public:
+    typedef std::function<void()> Task;
+
+    MqttDispatchQueue() = default;
+    ~MqttDispatchQueue() { stop(); }
+
+    MqttDispatchQueue(const MqttDispatchQueue &) = delete;
+    MqttDispatchQueue &operator=(const MqttDispatchQueue &) = delete;
+
+    /**
+     * @brief Start the workers
+     * @return false if already running or the configuration is invalid
+     */
+    bool start(const MqttDispatchConfig &config);
+
+    /**
+     * @brief Run the tasks still queued, then stop and join the workers
+     */
+    void stop();
+
+    bool isRunning() const { return !_workers.empty(); }
+
+    /**
+     * @brief Queue a task, applying the overflow policy when the queue is full
+     * @param key Tasks with the same key are run in order, one at a time (not nullptr)
+     * @return false if the task was dropped or the queue is not running
+     */
+    bool push(const void *key, Task task);
+
+    MqttDispatchStats getStats() const;
+
+private:
+    struct Entry
+    {
+        const void *key;
+        Task task;
+    };
+
+    void workerLoop();
+    bool isKeyActive(const void *key) const;
+    // Index of the first queued task whose key is idle, _queue.size() if none
+    std::size_t nextRunnable() const;
+
+    MqttDispatchConfig _config;
+    std::vector<std::thread> _workers;
+    std::vector<Entry> _queue;            // FIFO, capacity reserved once at start()
+    std::vector<const void *> _activeKeys; // Keys of the tasks being run, one slot per worker
+    mutable std::mutex _mutex;
+    std::condition_variable _workAvailable;
+    std::condition_variable _spaceAvailable;
+    bool _stopping = false;
+
+    std::size_t _maxDepth = 0;
+    uint32_t _enqueued = 0;
+    uint32_t _delivered = 0;
+    uint32_t _dropped = 0;
+};
@@ -41,6 +41,80 @@
     #endif
 #endif
 
+// Compile-time log level: call sites above it are removed, their arguments are not
+// evaluated. 0 none, 1 error, 2 warn, 3 info, 4 debug, 5 verbose (as esp_log_level_t).
+// Defaults to info, verbose with ESP32MQTTCLIENT_DEBUG.
+#ifndef ESP32MQTTCLIENT_LOG_LEVEL
+    #ifdef ESP32MQTTCLIENT_DEBUG
+        #define ESP32MQTTCLIENT_LOG_LEVEL 5
+    #else
+        #define ESP32MQTTCLIENT_LOG_LEVEL 3
+    #endif
+#endif
+
+// Removed call sites keep their arguments in an unevaluated sizeof, so variables
+// only logged do not turn into unused variable warnings
+static inline int mqttcLogDiscard(const char *, ...) { return 0; }
+#define MQTTC_LOG_DISCARD(...) ((void)sizeof(mqttcLogDiscard(__VA_ARGS__)))
+
+#if ESP32MQTTCLIENT_LOG_LEVEL < 1
+    #undef MQTTC_LOG_E
+    #define MQTTC_LOG_E(...) MQTTC_LOG_DISCARD(__VA_ARGS__)
+#endif
+#if ESP32MQTTCLIENT_LOG_LEVEL < 2
+    #undef MQTTC_LOG_W
+    #define MQTTC_LOG_W(...) MQTTC_LOG_DISCARD(__VA_ARGS__)
+#endif
+#if ESP32MQTTCLIENT_LOG_LEVEL < 3
+    #undef MQTTC_LOG_I
+    #define MQTTC_LOG_I(...) MQTTC_LOG_DISCARD(__VA_ARGS__)
+#endif
+#if ESP32MQTTCLIENT_LOG_LEVEL < 4
+    #undef MQTTC_LOG_D
+    #define MQTTC_LOG_D(...) MQTTC_LOG_DISCARD(__VA_ARGS__)
+#endif
+#if ESP32MQTTCLIENT_LOG_LEVEL < 5
+    #undef MQTTC_LOG_V
+    #define MQTTC_LOG_V(...) MQTTC_LOG_DISCARD(__VA_ARGS__)
+#endif
+
+// Payload bytes shown by the message logs below
+#ifndef ESP32MQTTCLIENT_LOG_PAYLOAD_MAX
+    #define ESP32MQTTCLIENT_LOG_PAYLOAD_MAX 64
+#endif
+
+// Message logs of the hot path (publish, inbound dispatch). The format takes
+// (int topicLen, const char *topic, int payloadLen, const char *payload, unsigned payloadSize),
+// the payload is cut to ESP32MQTTCLIENT_LOG_PAYLOAD_MAX bytes.
+// With ESP32MQTTCLIENT_DEFERRED_LOG the calling task only copies topic and payload
+// into the lock-free ring of ESP32MQTTClientDeferredLog.h; a low priority task
+// formats and prints them later.
+#ifdef ESP32MQTTCLIENT_DEFERRED_LOG
+    #include "ESP32MQTTClientDeferredLog.h"
+    #include "esp_timer.h"
+
+    #define MQTTC_LOG_MSG(level, format, topic, topicLen, payload, payloadLen) \
+        mqttDeferredLog().push(level, format, esp_timer_get_time(), topic, topicLen, payload, payloadLen, ESP32MQTTCLIENT_LOG_PAYLOAD_MAX)
+    #define MQTTC_LOG_MSG_W(format, topic, topicLen, payload, payloadLen) MQTTC_LOG_MSG(ESP_LOG_WARN, format, topic, topicLen, payload, payloadLen)
+    #define MQTTC_LOG_MSG_I(format, topic, topicLen, payload, payloadLen) MQTTC_LOG_MSG(ESP_LOG_INFO, format, topic, topicLen, payload, payloadLen)
+#else
+    #define MQTTC_LOG_MSG_ARGS(topic, topicLen, payload, payloadLen) \
+        (int)(topicLen), (topic), \
+        (int)((payloadLen) < ESP32MQTTCLIENT_LOG_PAYLOAD_MAX ? (payloadLen) : ESP32MQTTCLIENT_LOG_PAYLOAD_MAX), (payload), \
+        (unsigned)(payloadLen)
+    #define MQTTC_LOG_MSG_W(format, topic, topicLen, payload, payloadLen) MQTTC_LOG_W(format, MQTTC_LOG_MSG_ARGS(topic, topicLen, payload, payloadLen))
+    #define MQTTC_LOG_MSG_I(format, topic, topicLen, payload, payloadLen) MQTTC_LOG_I(format, MQTTC_LOG_MSG_ARGS(topic, topicLen, payload, payloadLen))
+#endif
+
+#if ESP32MQTTCLIENT_LOG_LEVEL < 2
+    #undef MQTTC_LOG_MSG_W
+    #define MQTTC_LOG_MSG_W(...) MQTTC_LOG_DISCARD(__VA_ARGS__)
+#endif
+#if ESP32MQTTCLIENT_LOG_LEVEL < 3
+    #undef MQTTC_LOG_MSG_I
+    #define MQTTC_LOG_MSG_I(...) MQTTC_LOG_DISCARD(__VA_ARGS__)
+#endif
+
 // Feature-specific debug flags
 #ifdef ESP32MQTTCLIENT_DEBUG
     #define MQTTC_DEBUG_PROTOCOL
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @brief Non-owning view of an inbound message
+ *
+ * topic and payload point into the receive buffer of esp-mqtt and are only valid
+ * for the duration of the callback. Neither of them is NUL terminated and the
+ * payload may contain binary data; copy what has to outlive the callback.
+ */
+struct MqttMessageView
+{
+    const char *topic;
+    size_t topicLen;
+    const char *payload;
+    size_t payloadLen;
+    int qos;
+    bool retain;
+    bool dup;
+    int msgId;
+    uint16_t subscriptionId;     // MQTT 5 subscription identifier the broker matched, 0 if none
+    const char *responseTopic;   // MQTT 5 response topic, nullptr if none
+    size_t responseTopicLen;
+    const char *correlationData; // MQTT 5 correlation data, nullptr if none
+    size_t correlationDataLen;
+};
@@ -0,0 +1,230 @@
+#include "ESP32MQTTClientOfflineQueue.h"
+
+#include <cstdlib>
+#include <cstring>
+
+#ifdef ESP_PLATFORM
+#include "esp_heap_caps.h"
+#endif
+
+namespace
+{
+    std::size_t alignRecord(std::size_t size)
+    {
+        return (size + 7) & ~static_cast<std::size_t>(7);
+    }
+}
+
+bool MqttOfflineQueue::begin(const MqttOfflineQueueConfig &config)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_arena != nullptr || config.capacity == 0)
+        return false;
+
+    std::size_t capacity = alignRecord(config.capacity);
+#ifdef ESP_PLATFORM
+    if (config.usePsram)
+        _arena = (uint8_t *)heap_caps_malloc(capacity, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+#endif
+    if (_arena == nullptr)
+        _arena = (uint8_t *)malloc(capacity);
+    if (_arena == nullptr)
+        return false;
+
+    _config = config;
+    _config.capacity = capacity;
+    _head = 0;
+    _tail = 0;
+    _wrapEnd = 0;
+    _wrapped = false;
+    _count = 0;
+    _bytesUsed = 0;
+    _queued = 0;
+    _sent = 0;
+    _expired = 0;
+    _dropped = 0;
+    return true;
+}
+
+void MqttOfflineQueue::end()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    free(_arena);
+    _arena = nullptr;
+    _count = 0;
+    _bytesUsed = 0;
+}
+
+bool MqttOfflineQueue::empty() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _count == 0;
+}
+
+MqttOfflineQueue::RecordHeader MqttOfflineQueue::headerAt(std::size_t offset) const
+{
+    RecordHeader header;
+    memcpy(&header, _arena + offset, sizeof(header));
+    return header;
+}
+
+void MqttOfflineQueue::popLocked()
+{
+    RecordHeader header = headerAt(_head);
+    _head += header.size;
+    _bytesUsed -= header.size;
+    _count--;
+
+    if (_count == 0)
+    {
+        _head = 0;
+        _tail = 0;
+        _wrapped = false;
+    }
+    else if (_wrapped && _head == _wrapEnd)
+    {
+        _head = 0;
+        _wrapped = false;
+    }
+}
+
+bool MqttOfflineQueue::reserveLocked(std::size_t size, std::size_t &offset)
+{
+    if (_count == 0)
+    {
+        _head = 0;
+        _tail = 0;
+        _wrapped = false;
+    }
+
+    if (_wrapped)
+    {
+        if (_head - _tail < size)
+            return false;
+        offset = _tail;
+    }
+    else if (_config.capacity - _tail >= size)
+    {
+        offset = _tail;
+    }
+    else if (_head >= size)
+    {
+        // Not enough room behind the newest message, continue at the start of the arena
+        _wrapEnd = _tail;
+        _wrapped = true;
+        offset = 0;
+    }
+    else
+    {
+        return false;
+    }
+
+    _tail = offset + size;
+    return true;
+}
+
+bool MqttOfflineQueue::push(const char *topic, std::size_t topicLen, const char *payload, std::size_t payloadLen,
+                            int qos, bool retain, uint32_t ttlMs, int64_t nowUs)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_arena == nullptr)
+        return false;
+
+    std::size_t size = alignRecord(sizeof(RecordHeader) + topicLen + payloadLen);
+    if (topicLen > UINT16_MAX || size > _config.capacity)
+    {
+        _dropped++;
+        return false;
+    }
+
+    std::size_t offset;
+    while (!reserveLocked(size, offset))
+    {
+        if (_config.policy == MqttOfflinePolicy::DropNewest)
+        {
+            _dropped++;
+            return false;
+        }
+        popLocked();
+        _dropped++;
+    }
+
+    if (ttlMs == 0)
+        ttlMs = _config.ttlMs;
+
+    RecordHeader header;
+    header.size = size;
+    header.seq = _nextSeq++;
+    header.expiresAt = ttlMs ? nowUs + (int64_t)ttlMs * 1000 : 0;
+    header.payloadLen = payloadLen;
+    header.topicLen = topicLen;
+    header.qos = qos;
+    header.retain = retain;
+    memcpy(_arena + offset, &header, sizeof(header));
+    memcpy(_arena + offset + sizeof(header), topic, topicLen);
+    if (payloadLen > 0)
+        memcpy(_arena + offset + sizeof(header) + topicLen, payload, payloadLen);
+
+    _count++;
+    _bytesUsed += size;
+    _queued++;
+    return true;
+}
+
+bool MqttOfflineQueue::copyOldest(int64_t nowUs, MqttOfflineMessage &message, uint32_t &seq)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    while (_count > 0)
+    {
+        RecordHeader header = headerAt(_head);
+        if (header.expiresAt != 0 && header.expiresAt <= nowUs)
+        {
+            popLocked();
+            _expired++;
+            continue;
+        }
+
+        // Both strings get a terminator for esp_mqtt_client_publish()
+        _drainScratch.resize(header.topicLen + header.payloadLen + 2);
+        const uint8_t *data = _arena + _head + sizeof(RecordHeader);
+        char *scratch = &_drainScratch[0];
+        memcpy(scratch, data, header.topicLen);
+        scratch[header.topicLen] = '\0';
+        if (header.payloadLen > 0)
+            memcpy(scratch + header.topicLen + 1, data + header.topicLen, header.payloadLen);
+        scratch[header.topicLen + 1 + header.payloadLen] = '\0';
+
+        message.topic = scratch;
+        message.topicLen = header.topicLen;
+        message.payload = scratch + header.topicLen + 1;
+        message.payloadLen = header.payloadLen;
+        message.qos = header.qos;
+        message.retain = header.retain != 0;
+        seq = header.seq;
+        return true;
+    }
+    return false;
+}
+
+void MqttOfflineQueue::removeSent(uint32_t seq)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _sent++;
+    // The overflow policy may have discarded the message while it was being sent
+    if (_count > 0 && headerAt(_head).seq == seq)
+        popLocked();
+}
+
+MqttOfflineQueueStats MqttOfflineQueue::getStats() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    MqttOfflineQueueStats stats;
+    stats.messages = _count;
+    stats.bytesUsed = _bytesUsed;
+    stats.capacity = _arena ? _config.capacity : 0;
+    stats.queued = _queued;
+    stats.sent = _sent;
+    stats.expired = _expired;
+    stats.dropped = _dropped;
+    return stats;
+}
@@ -0,0 +1,172 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+/**
+ * @brief What to do when a publish does not fit into the offline queue
+ */
+enum class MqttOfflinePolicy
+{
+    DropOldest, // Discard the oldest messages until the new one fits (default)
+    DropNewest  // Reject the new message
+};
+
+/**
+ * @brief Settings of the offline publish queue, see ESP32MQTTClient::enableOfflineQueue()
+ */
+struct MqttOfflineQueueConfig
+{
+    std::size_t capacity = 8192;    // Arena size in bytes, allocated once (topic + payload + 24 bytes per message)
+    bool usePsram = false;          // Allocate the arena in PSRAM when available
+    uint32_t ttlMs = 0;             // Default lifetime of a queued message, 0 = no expiry
+    MqttOfflinePolicy policy = MqttOfflinePolicy::DropOldest;
+    std::size_t drainBurst = 10;    // Messages sent per drain step after reconnecting
+    uint32_t drainIntervalMs = 100; // Pause between drain steps
+};
+
+struct MqttOfflineQueueStats
+{
+    std::size_t messages;  // Messages currently queued
+    std::size_t bytesUsed; // Arena bytes in use
+    std::size_t capacity;  // Arena size
+    uint32_t queued;       // Messages accepted
+    uint32_t sent;         // Messages handed to esp-mqtt after reconnecting
+    uint32_t expired;      // Messages discarded because their TTL elapsed
+    uint32_t dropped;      // Messages discarded by the overflow policy or too large for the arena
+};
+
+/**
+ * @brief Queued publish handed out by MqttOfflineQueue::drain()
+ *
+ * topic and payload are NUL terminated copies, valid during the send callback only.
+ */
+struct MqttOfflineMessage
+{
+    const char *topic;
+    std::size_t topicLen;
+    const char *payload;
+    std::size_t payloadLen;
+    int qos;
+    bool retain;
+};
+
+/**
+ * @brief FIFO of publishes kept in a fixed, preallocated arena
+ *
+ * Messages are stored back to back in a byte ring, so queueing never allocates
+ * and memory use is bounded by the configured capacity. A message that does not
+ * fit at the end of the arena starts over at its beginning; the few bytes left at
+ * the end stay unused until the ring wraps again.
+ *
+ * All methods are thread safe. Times are esp_timer_get_time() values (µs) passed
+ * in by the caller.
+ */
+class MqttOfflineQueue
+{
+public:
+    MqttOfflineQueue() = default;
+    ~MqttOfflineQueue() { end(); }
+
+    MqttOfflineQueue(const MqttOfflineQueue &) = delete;
+    MqttOfflineQueue &operator=(const MqttOfflineQueue &) = delete;
+
+    /**
+     * @brief Allocate the arena
+     * @return false if already enabled, capacity is 0 or the allocation failed
+     */
+    bool begin(const MqttOfflineQueueConfig &config);
+
+    /**
+     * @brief Discard all messages and release the arena
+     */
+    void end();
+
+    bool isEnabled() const { return _arena != nullptr; }
+    const MqttOfflineQueueConfig &config() const { return _config; }
+    bool empty() const;
+
+    /**
+     * @brief Queue a message, applying the overflow policy when the arena is full
+     * @param ttlMs Lifetime of the message, 0 for the configured default
+     * @return false if the message was dropped
+     */
+    bool push(const char *topic, std::size_t topicLen, const char *payload, std::size_t payloadLen,
+              int qos, bool retain, uint32_t ttlMs, int64_t nowUs);
+
+    /**
+     * @brief Hand the oldest messages to send, in order, discarding expired ones
+     *
+     * send is called without the queue lock held, so it may block or publish. A
+     * message is removed once send returns true; draining stops at the first
+     * false, which leaves that message at the head for the next attempt.
+     * Concurrent calls do not block: only one of them drains.
+     *
+     * @param maxMessages Largest number of messages to send
+     * @param send Callable invoked as bool send(const MqttOfflineMessage &)
+     * @return Number of messages sent
+     */
+    template <typename Sender>
+    std::size_t drain(std::size_t maxMessages, int64_t nowUs, Sender &&send)
+    {
+        std::unique_lock<std::mutex> drainLock(_drainMutex, std::try_to_lock);
+        if (!drainLock.owns_lock())
+            return 0;
+
+        std::size_t sent = 0;
+        MqttOfflineMessage message;
+        uint32_t seq;
+        while (sent < maxMessages && copyOldest(nowUs, message, seq))
+        {
+            if (!send(message))
+                break;
+            removeSent(seq);
+            sent++;
+        }
+        return sent;
+    }
+
+    MqttOfflineQueueStats getStats() const;
+
+private:
+    // Stored in front of topic and payload, records are padded to a multiple of 8 bytes
+    struct RecordHeader
+    {
+        uint32_t size; // Whole record including header and padding
+        uint32_t seq;
+        int64_t expiresAt; // 0 = never
+        uint32_t payloadLen;
+        uint16_t topicLen;
+        uint8_t qos;
+        uint8_t retain;
+    };
+
+    RecordHeader headerAt(std::size_t offset) const;
+    void popLocked();
+    bool reserveLocked(std::size_t size, std::size_t &offset);
+    bool copyOldest(int64_t nowUs, MqttOfflineMessage &message, uint32_t &seq);
+    void removeSent(uint32_t seq);
+
+    MqttOfflineQueueConfig _config;
+    uint8_t *_arena = nullptr;
+
+    // Data lives in [_head, _tail), or in [_head, _wrapEnd) followed by [0, _tail) once wrapped
+    std::size_t _head = 0;
+    std::size_t _tail = 0;
+    std::size_t _wrapEnd = 0;
+    bool _wrapped = false;
+    std::size_t _count = 0;
+    std::size_t _bytesUsed = 0;
+    uint32_t _nextSeq = 0;
+
+    uint32_t _queued = 0;
+    uint32_t _sent = 0;
+    uint32_t _expired = 0;
+    uint32_t _dropped = 0;
+
+    mutable std::mutex _mutex;
+    std::mutex _drainMutex;          // Held by the single active drain()
+    std::vector<char> _drainScratch; // Copy of the message being sent, reused
+};
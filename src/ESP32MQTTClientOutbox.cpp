@@ -0,0 +1,498 @@
+#include "ESP32MQTTClientOutbox.h"
+
+#include <cstring>
+#include <unistd.h>
+
+namespace
+{
+    const uint8_t RecordPublish = 1;
+    const uint8_t RecordAck = 2;
+
+    // Largest number of PUBACKs remembered for messages not marked as sent yet
+    const std::size_t MaxEarlyAcks = 8;
+
+    uint32_t crc32Update(uint32_t crc, const void *data, std::size_t length)
+    {
+        const uint8_t *bytes = static_cast<const uint8_t *>(data);
+        crc = ~crc;
+        for (std::size_t i = 0; i < length; i++)
+        {
+            crc ^= bytes[i];
+            for (int bit = 0; bit < 8; bit++)
+                crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1u)));
+        }
+        return ~crc;
+    }
+}
+
+// =============== Storage implementations ==============
+
+bool MqttRamOutboxStorage::read(std::size_t offset, void *data, std::size_t length)
+{
+    if (offset > _data.size() || length > _data.size() - offset)
+        return false;
+    if (length > 0)
+        memcpy(data, &_data[offset], length);
+    return true;
+}
+
+bool MqttRamOutboxStorage::append(const void *data, std::size_t length)
+{
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+    _data.insert(_data.end(), bytes, bytes + length);
+    return true;
+}
+
+bool MqttRamOutboxStorage::replace(const void *data, std::size_t length)
+{
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+    _data.assign(bytes, bytes + length);
+    return true;
+}
+
+MqttFileOutboxStorage::MqttFileOutboxStorage(const std::string &path)
+    : _path(path), _file(nullptr)
+{
+    open();
+}
+
+MqttFileOutboxStorage::~MqttFileOutboxStorage()
+{
+    close();
+}
+
+bool MqttFileOutboxStorage::open()
+{
+    std::string tmpPath = _path + ".tmp";
+    FILE *existing = fopen(_path.c_str(), "rb");
+    if (existing != nullptr)
+    {
+        // Leftover of a compaction that did not finish, the log is still complete
+        fclose(existing);
+        remove(tmpPath.c_str());
+    }
+    else
+    {
+        // Compaction was cut between removing the old log and renaming the new one
+        rename(tmpPath.c_str(), _path.c_str());
+    }
+
+    _file = fopen(_path.c_str(), "r+b");
+    if (_file == nullptr)
+        _file = fopen(_path.c_str(), "w+b");
+    return _file != nullptr;
+}
+
+void MqttFileOutboxStorage::close()
+{
+    if (_file != nullptr)
+    {
+        fclose(_file);
+        _file = nullptr;
+    }
+}
+
+std::size_t MqttFileOutboxStorage::size()
+{
+    if (_file == nullptr || fseek(_file, 0, SEEK_END) != 0)
+        return 0;
+    long end = ftell(_file);
+    return end > 0 ? (std::size_t)end : 0;
+}
+
+bool MqttFileOutboxStorage::read(std::size_t offset, void *data, std::size_t length)
+{
+    if (_file == nullptr || fseek(_file, (long)offset, SEEK_SET) != 0)
+        return false;
+    return fread(data, 1, length, _file) == length;
+}
+
+bool MqttFileOutboxStorage::append(const void *data, std::size_t length)
+{
+    if (_file == nullptr || fseek(_file, 0, SEEK_END) != 0)
+        return false;
+    if (fwrite(data, 1, length, _file) != length)
+        return false;
+    return fflush(_file) == 0 && fsync(fileno(_file)) == 0;
+}
+
+bool MqttFileOutboxStorage::replace(const void *data, std::size_t length)
+{
+    std::string tmpPath = _path + ".tmp";
+    FILE *tmp = fopen(tmpPath.c_str(), "wb");
+    if (tmp == nullptr)
+        return false;
+    bool written = fwrite(data, 1, length, tmp) == length && fflush(tmp) == 0 && fsync(fileno(tmp)) == 0;
+    fclose(tmp);
+    if (!written)
+    {
+        remove(tmpPath.c_str());
+        return false;
+    }
+
+    close();
+    // SPIFFS cannot rename over an existing file, open() completes the swap if we are cut here
+    if (rename(tmpPath.c_str(), _path.c_str()) != 0)
+    {
+        remove(_path.c_str());
+        rename(tmpPath.c_str(), _path.c_str());
+    }
+    return open();
+}
+
+// =============== MqttPersistentOutbox ==============
+
+bool MqttPersistentOutbox::begin(MqttOutboxStorage *storage, const MqttOutboxConfig &config)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_storage != nullptr || storage == nullptr)
+        return false;
+
+    _storage = storage;
+    _config = config;
+    _entries.clear();
+    _earlyAcks.clear();
+    _reserved = 0;
+    _liveBytes = 0;
+    _nextId = 1;
+    _stored = 0;
+    _acknowledged = 0;
+    _replayed = 0;
+    _compactions = 0;
+    _dropped = 0;
+
+    if (!loadLocked())
+    {
+        _storage = nullptr;
+        _entries.clear();
+        return false;
+    }
+    return true;
+}
+
+void MqttPersistentOutbox::end()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _storage = nullptr;
+    _entries.clear();
+    _liveBytes = 0;
+}
+
+bool MqttPersistentOutbox::loadLocked()
+{
+    std::size_t size = _storage->size();
+    std::size_t offset = 0;
+    std::vector<char> data;
+
+    while (offset + sizeof(RecordHeader) <= size)
+    {
+        RecordHeader header;
+        if (!_storage->read(offset, &header, sizeof(header)))
+            break;
+        if (header.type != RecordPublish && header.type != RecordAck)
+            break;
+
+        std::size_t dataLen = header.type == RecordPublish ? (std::size_t)header.topicLen + header.payloadLen : 0;
+        if (dataLen > size - offset - sizeof(header))
+            break;
+        data.resize(dataLen);
+        if (dataLen > 0 && !_storage->read(offset + sizeof(header), &data[0], dataLen))
+            break;
+
+        uint32_t crc = header.crc;
+        header.crc = 0;
+        uint32_t actual = crc32Update(crc32Update(0, &header, sizeof(header)), data.data(), dataLen);
+        if (actual != crc)
+            break; // Cut by a reset while writing, nothing valid can follow
+
+        std::size_t recordSize = sizeof(header) + dataLen;
+        if (header.type == RecordPublish)
+        {
+            Entry entry;
+            entry.id = header.id;
+            entry.offset = offset;
+            entry.size = recordSize;
+            entry.qos = header.flags & 0x03;
+            entry.msgId = -1;
+            entry.sentAt = 0;
+            _entries.push_back(entry);
+            _liveBytes += recordSize;
+        }
+        else
+        {
+            for (std::size_t i = 0; i < _entries.size(); i++)
+            {
+                if (_entries[i].id == header.id)
+                {
+                    _liveBytes -= _entries[i].size;
+                    _entries.erase(_entries.begin() + i);
+                    break;
+                }
+            }
+        }
+        if (header.id >= _nextId)
+            _nextId = header.id + 1;
+        offset += recordSize;
+    }
+
+    // Records appended after a damaged tail could not be read back, rewrite the log first
+    if (offset < size || (size > _config.maxBytes && size - _liveBytes >= _liveBytes))
+        return compactLocked();
+    return true;
+}
+
+bool MqttPersistentOutbox::appendRecordLocked(const RecordHeader &header, const char *topic, const char *payload)
+{
+    RecordHeader stored = header;
+    stored.crc = 0;
+    uint32_t crc = crc32Update(0, &stored, sizeof(stored));
+    std::size_t dataLen = 0;
+    if (header.type == RecordPublish)
+    {
+        crc = crc32Update(crc, topic, header.topicLen);
+        crc = crc32Update(crc, payload, header.payloadLen);
+        dataLen = (std::size_t)header.topicLen + header.payloadLen;
+    }
+    stored.crc = crc;
+
+    // One append per record, so a reset cannot leave a valid header with partial data behind
+    std::vector<char> record(sizeof(stored) + dataLen);
+    memcpy(&record[0], &stored, sizeof(stored));
+    if (dataLen > 0)
+    {
+        memcpy(&record[sizeof(stored)], topic, header.topicLen);
+        if (header.payloadLen > 0)
+            memcpy(&record[sizeof(stored) + header.topicLen], payload, header.payloadLen);
+    }
+    return _storage->append(record.data(), record.size());
+}
+
+bool MqttPersistentOutbox::add(const char *topic, std::size_t topicLen, const char *payload, std::size_t payloadLen,
+                               int qos, bool retain, uint32_t &id)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_storage == nullptr)
+        return false;
+
+    std::size_t recordSize = sizeof(RecordHeader) + topicLen + payloadLen;
+    if (topicLen > UINT16_MAX || _liveBytes + recordSize > _config.maxBytes)
+    {
+        _dropped++;
+        return false;
+    }
+
+    RecordHeader header;
+    header.type = RecordPublish;
+    header.flags = (qos & 0x03) | (retain ? 0x04 : 0);
+    header.topicLen = topicLen;
+    header.payloadLen = payloadLen;
+    header.id = _nextId;
+    header.crc = 0;
+
+    std::size_t offset = _storage->size();
+    if (!appendRecordLocked(header, topic, payload))
+    {
+        _dropped++;
+        return false;
+    }
+
+    Entry entry;
+    entry.id = _nextId++;
+    entry.offset = offset;
+    entry.size = recordSize;
+    entry.qos = qos;
+    entry.msgId = -1;
+    entry.sentAt = 0;
+    _entries.push_back(entry);
+    _liveBytes += recordSize;
+    _stored++;
+
+    id = entry.id;
+    return true;
+}
+
+void MqttPersistentOutbox::removeLocked(std::size_t index)
+{
+    RecordHeader header;
+    header.type = RecordAck;
+    header.flags = 0;
+    header.topicLen = 0;
+    header.payloadLen = 0;
+    header.id = _entries[index].id;
+    header.crc = 0;
+    // If this fails the message is published once more after a reset, acceptable for QoS 1
+    appendRecordLocked(header, "", "");
+
+    _liveBytes -= _entries[index].size;
+    _entries.erase(_entries.begin() + index);
+    _acknowledged++;
+    compactIfNeededLocked();
+}
+
+void MqttPersistentOutbox::reserve()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _reserved++;
+}
+
+void MqttPersistentOutbox::cancel()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_reserved > 0)
+        _reserved--;
+    // An acknowledgement remembered now belongs to no reservation
+    if (_reserved == 0)
+        _earlyAcks.clear();
+}
+
+void MqttPersistentOutbox::markSent(uint32_t id, int msgId, int64_t nowUs)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    bool acked = false;
+    for (std::size_t n = 0; n < _earlyAcks.size(); n++)
+    {
+        if (_earlyAcks[n] == msgId)
+        {
+            _earlyAcks.erase(_earlyAcks.begin() + n);
+            acked = true;
+            break;
+        }
+    }
+    if (_reserved > 0)
+        _reserved--;
+    if (_reserved == 0)
+        _earlyAcks.clear();
+
+    for (std::size_t i = 0; i < _entries.size(); i++)
+    {
+        if (_entries[i].id != id)
+            continue;
+
+        if (acked || _entries[i].qos == 0)
+        {
+            removeLocked(i);
+        }
+        else
+        {
+            _entries[i].msgId = msgId;
+            _entries[i].sentAt = nowUs;
+        }
+        return;
+    }
+}
+
+bool MqttPersistentOutbox::acknowledge(int msgId)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_storage == nullptr)
+        return false;
+
+    for (std::size_t i = 0; i < _entries.size(); i++)
+    {
+        if (_entries[i].msgId == msgId)
+        {
+            removeLocked(i);
+            return true;
+        }
+    }
+
+    // The publishing task may not have called markSent() yet. Without a reservation the
+    // msg_id belongs to a message that is not in the outbox.
+    if (_reserved == 0)
+        return false;
+    if (_earlyAcks.size() >= MaxEarlyAcks)
+        _earlyAcks.erase(_earlyAcks.begin());
+    _earlyAcks.push_back(msgId);
+    return false;
+}
+
+void MqttPersistentOutbox::compactIfNeededLocked()
+{
+    std::size_t size = _storage->size();
+    if (size > _config.maxBytes && size - _liveBytes >= _liveBytes)
+        compactLocked();
+}
+
+bool MqttPersistentOutbox::compactLocked()
+{
+    std::vector<char> log(_liveBytes);
+    std::vector<std::size_t> offsets(_entries.size());
+    std::size_t offset = 0;
+    for (std::size_t i = 0; i < _entries.size(); i++)
+    {
+        if (!_storage->read(_entries[i].offset, &log[offset], _entries[i].size))
+            return false;
+        offsets[i] = offset;
+        offset += _entries[i].size;
+    }
+
+    if (!_storage->replace(log.data(), log.size()))
+        return false;
+
+    for (std::size_t i = 0; i < _entries.size(); i++)
+        _entries[i].offset = offsets[i];
+    _compactions++;
+    return true;
+}
+
+bool MqttPersistentOutbox::copyNextDue(int64_t nowUs, uint32_t after, MqttOfflineMessage &message, uint32_t &id)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_storage == nullptr)
+        return false;
+
+    int64_t resendAfterUs = (int64_t)_config.resendAfterMs * 1000;
+    for (std::size_t i = 0; i < _entries.size(); i++)
+    {
+        const Entry &entry = _entries[i];
+        if (entry.id <= after)
+            continue;
+        if (entry.msgId >= 0 && nowUs - entry.sentAt < resendAfterUs)
+            continue;
+
+        RecordHeader header;
+        if (!_storage->read(entry.offset, &header, sizeof(header)))
+            return false;
+
+        // Topic and payload get a terminator each for esp_mqtt_client_publish()
+        _replayScratch.resize((std::size_t)header.topicLen + header.payloadLen + 2);
+        char *scratch = &_replayScratch[0];
+        if (!_storage->read(entry.offset + sizeof(header), scratch, header.topicLen))
+            return false;
+        scratch[header.topicLen] = '\0';
+        if (header.payloadLen > 0 && !_storage->read(entry.offset + sizeof(header) + header.topicLen, scratch + header.topicLen + 1, header.payloadLen))
+            return false;
+        scratch[header.topicLen + 1 + header.payloadLen] = '\0';
+
+        message.topic = scratch;
+        message.topicLen = header.topicLen;
+        message.payload = scratch + header.topicLen + 1;
+        message.payloadLen = header.payloadLen;
+        message.qos = header.flags & 0x03;
+        message.retain = (header.flags & 0x04) != 0;
+        id = entry.id;
+        return true;
+    }
+    return false;
+}
+
+void MqttPersistentOutbox::countReplayed()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _replayed++;
+}
+
+MqttOutboxStats MqttPersistentOutbox::getStats() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    MqttOutboxStats stats;
+    stats.messages = _entries.size();
+    stats.liveBytes = _liveBytes;
+    stats.storageBytes = _storage ? _storage->size() : 0;
+    stats.stored = _stored;
+    stats.acknowledged = _acknowledged;
+    stats.replayed = _replayed;
+    stats.compactions = _compactions;
+    stats.dropped = _dropped;
+    return stats;
+}
@@ -0,0 +1,244 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "ESP32MQTTClientOfflineQueue.h"
+
+/**
+ * @brief Byte store holding the log of a MqttPersistentOutbox
+ *
+ * The outbox only appends to the log and occasionally replaces it as a whole
+ * (compaction), which suits flash file systems and keeps wear even.
+ */
+class MqttOutboxStorage
+{
+public:
+    virtual ~MqttOutboxStorage() {}
+
+    virtual std::size_t size() = 0;
+    virtual bool read(std::size_t offset, void *data, std::size_t length) = 0;
+    // Must be durable when it returns
+    virtual bool append(const void *data, std::size_t length) = 0;
+    // Replace the whole content; after a power loss either the old or the new content is found
+    virtual bool replace(const void *data, std::size_t length) = 0;
+};
+
+/**
+ * @brief Storage kept in RAM, does not survive a reset (host tests, devices without flash file system)
+ */
+class MqttRamOutboxStorage : public MqttOutboxStorage
+{
+public:
+    std::size_t size() override { return _data.size(); }
+    bool read(std::size_t offset, void *data, std::size_t length) override;
+    bool append(const void *data, std::size_t length) override;
+    bool replace(const void *data, std::size_t length) override;
+
+    std::vector<uint8_t> &bytes() { return _data; } // Direct access, e.g. to simulate a torn write
+
+private:
+    std::vector<uint8_t> _data;
+};
+
+/**
+ * @brief Storage in a file, e.g. on a mounted SPIFFS or LittleFS partition
+ *
+ * replace() writes "<path>.tmp" and renames it over the log, so an interrupted
+ * compaction is rolled back or completed when the file is opened again.
+ */
+class MqttFileOutboxStorage : public MqttOutboxStorage
+{
+public:
+    explicit MqttFileOutboxStorage(const std::string &path);
+    ~MqttFileOutboxStorage();
+
+    MqttFileOutboxStorage(const MqttFileOutboxStorage &) = delete;
+    MqttFileOutboxStorage &operator=(const MqttFileOutboxStorage &) = delete;
+
+    bool isOpen() const { return _file != nullptr; }
+
+    std::size_t size() override;
+    bool read(std::size_t offset, void *data, std::size_t length) override;
+    bool append(const void *data, std::size_t length) override;
+    bool replace(const void *data, std::size_t length) override;
+
+private:
+    bool open();
+    void close();
+
+    std::string _path;
+    FILE *_file;
+};
+
+struct MqttOutboxConfig
+{
+    std::size_t maxBytes = 16384;     // Largest total size of the messages kept (the log may grow to about twice that)
+    uint32_t resendAfterMs = 60000;   // After reconnecting, publish again what is still unacknowledged this long after it was sent
+};
+
+struct MqttOutboxStats
+{
+    std::size_t messages;     // Messages not acknowledged yet
+    std::size_t liveBytes;    // Log bytes used by those messages
+    std::size_t storageBytes; // Current size of the log
+    uint32_t stored;          // Messages written to the log
+    uint32_t acknowledged;    // Messages removed after PUBACK/PUBCOMP (or sending, for QoS 0)
+    uint32_t replayed;        // Messages published from the log after (re)connecting
+    uint32_t compactions;     // Log rewrites
+    uint32_t dropped;         // Messages rejected because maxBytes was reached or the write failed
+};
+
+/**
+ * @brief Log-structured store of publishes awaiting acknowledgement
+ *
+ * Every message is appended to the log as a record with a CRC and removed by
+ * appending an acknowledgement record, so normal operation never rewrites data.
+ * Loading the log skips acknowledged messages and stops at the first damaged
+ * record (a write cut by a reset). Once the log exceeds maxBytes and at least
+ * half of it is dead, the live records are written to a new log (compaction),
+ * which bounds both the log size and the write amplification.
+ *
+ * Thread safe; storage is only accessed with the internal lock held.
+ */
+class MqttPersistentOutbox
+{
+public:
+    MqttPersistentOutbox() = default;
+
+    MqttPersistentOutbox(const MqttPersistentOutbox &) = delete;
+    MqttPersistentOutbox &operator=(const MqttPersistentOutbox &) = delete;
+
+    /**
+     * @brief Load the log and keep the messages not acknowledged yet
+     * @param storage Not owned, must outlive the outbox
+     */
+    bool begin(MqttOutboxStorage *storage, const MqttOutboxConfig &config);
+    void end();
+    bool isEnabled() const { return _storage != nullptr; }
+
+    /**
+     * @brief Append a message to the log
+     * @param id Set to the id of the stored message
+     */
+    bool add(const char *topic, std::size_t topicLen, const char *payload, std::size_t payloadLen,
+             int qos, bool retain, uint32_t &id);
+
+    /**
+     * @brief Announce a publish of a stored message, ended by markSent() or cancel()
+     *
+     * Its PUBACK may arrive before markSent() records the msg_id. Acknowledgements
+     * of unknown msg_ids are only remembered while a publish is reserved.
+     */
+    void reserve();
+
+    /**
+     * @brief End a reservation whose publish failed
+     */
+    void cancel();
+
+    /**
+     * @brief Record the esp-mqtt msg_id a stored message was published with
+     *
+     * Ends the reservation of reserve(). QoS 0 messages are removed right away,
+     * they are not acknowledged.
+     */
+    void markSent(uint32_t id, int msgId, int64_t nowUs);
+
+    /**
+     * @brief Remove the message published with msgId (MQTT_EVENT_PUBLISHED)
+     * @return false if no stored message has this msg_id (yet)
+     */
+    bool acknowledge(int msgId);
+
+    /**
+     * @brief Publish the stored messages not sent yet, or sent longer than resendAfterMs ago
+     *
+     * send is called without the lock held, in storage order, and returns the
+     * msg_id from esp-mqtt or -1, which stops the replay.
+     *
+     * @param send Callable invoked as int send(const MqttOfflineMessage &)
+     * @return Number of messages published
+     */
+    template <typename Sender>
+    std::size_t replay(int64_t nowUs, Sender &&send)
+    {
+        std::unique_lock<std::mutex> replayLock(_replayMutex, std::try_to_lock);
+        if (!replayLock.owns_lock())
+            return 0;
+
+        std::size_t sent = 0;
+        uint32_t id = 0; // Ids grow in storage order, 0 is never used
+        MqttOfflineMessage message;
+        while (copyNextDue(nowUs, id, message, id))
+        {
+            reserve();
+            int msgId = send(message);
+            if (msgId < 0)
+            {
+                cancel();
+                break;
+            }
+            countReplayed();
+            markSent(id, msgId, nowUs);
+            sent++;
+        }
+        return sent;
+    }
+
+    MqttOutboxStats getStats() const;
+
+private:
+    // Fixed part of every log record, followed by topic and payload for publish records
+    struct RecordHeader
+    {
+        uint8_t type;
+        uint8_t flags; // QoS in bits 0-1, retain in bit 2
+        uint16_t topicLen;
+        uint32_t payloadLen;
+        uint32_t id;
+        uint32_t crc; // Over the header (crc = 0) and the data
+    };
+
+    struct Entry
+    {
+        uint32_t id;
+        std::size_t offset; // Of the record in the log
+        std::size_t size;   // Of the record
+        int qos;
+        int msgId;          // -1 until published in this session
+        int64_t sentAt;
+    };
+
+    bool loadLocked();
+    bool appendRecordLocked(const RecordHeader &header, const char *topic, const char *payload);
+    void removeLocked(std::size_t index);
+    void compactIfNeededLocked();
+    bool compactLocked();
+    // Copy the first message after id 'after' that is due for (re)sending into _replayScratch
+    bool copyNextDue(int64_t nowUs, uint32_t after, MqttOfflineMessage &message, uint32_t &id);
+    void countReplayed();
+
+    MqttOutboxConfig _config;
+    MqttOutboxStorage *_storage = nullptr;
+    std::vector<Entry> _entries; // Storage order
+    std::size_t _liveBytes = 0;
+    uint32_t _nextId = 1;
+    // Publishes between reserve() and markSent()
+    std::size_t _reserved = 0;
+    // PUBACKs that arrived before markSent() recorded the msg_id, kept while _reserved > 0
+    std::vector<int> _earlyAcks;
+
+    uint32_t _stored = 0;
+    uint32_t _acknowledged = 0;
+    uint32_t _replayed = 0;
+    uint32_t _compactions = 0;
+    uint32_t _dropped = 0;
+
+    mutable std::mutex _mutex;
+    std::mutex _replayMutex;
+    std::vector<char> _replayScratch; // Message being replayed, reused
+};
@@ -0,0 +1,226 @@
+#include "ESP32MQTTClientPublishTracker.h"
+
+namespace
+{
+    // Largest number of acknowledgements remembered for entries not filled in yet
+    const std::size_t MaxEarlyAcks = 8;
+
+    uint32_t elapsedUs(int64_t startUs, int64_t nowUs)
+    {
+        int64_t elapsed = nowUs - startUs;
+        if (elapsed < 0)
+            return 0;
+        return elapsed > (int64_t)UINT32_MAX ? UINT32_MAX : (uint32_t)elapsed;
+    }
+}
+
+bool MqttPublishTracker::begin(const MqttPublishTrackerConfig &config)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (!_entries.empty() || config.capacity == 0)
+        return false;
+
+    _config = config;
+    Entry free = {-1, 0, nullptr};
+    _entries.assign(config.capacity, free);
+    _earlyAcks.reserve(MaxEarlyAcks);
+    _expired.reserve(config.capacity);
+    _inFlight = 0;
+    _reserved = 0;
+    return true;
+}
+
+void MqttPublishTracker::end()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    std::vector<Entry>().swap(_entries);
+    _earlyAcks.clear();
+    _inFlight = 0;
+    _reserved = 0;
+}
+
+bool MqttPublishTracker::reserve()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_inFlight + _reserved >= _entries.size())
+    {
+        _rejected++;
+        return false;
+    }
+    _reserved++;
+    return true;
+}
+
+void MqttPublishTracker::cancel()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_reserved > 0)
+        _reserved--;
+    // An acknowledgement remembered now belongs to no reservation
+    if (_reserved == 0)
+        _earlyAcks.clear();
+}
+
+void MqttPublishTracker::add(int msgId, int64_t startUs, MqttPublishCallback callback)
+{
+    Completion completion;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_reserved == 0)
+            return;
+        _reserved--;
+        _tracked++;
+
+        // The MQTT task may have processed the PUBACK while this task was still publishing
+        bool acked = false;
+        int64_t ackUs = 0;
+        for (std::size_t n = 0; n < _earlyAcks.size() && !acked; n++)
+        {
+            if (_earlyAcks[n].msgId == msgId)
+            {
+                ackUs = _earlyAcks[n].timeUs;
+                _earlyAcks.erase(_earlyAcks.begin() + n);
+                acked = true;
+            }
+        }
+        if (_reserved == 0)
+            _earlyAcks.clear();
+
+        if (!acked)
+        {
+            for (std::size_t i = 0; i < _entries.size(); i++)
+            {
+                if (_entries[i].msgId < 0)
+                {
+                    _entries[i].msgId = msgId;
+                    _entries[i].startUs = startUs;
+                    _entries[i].callback = std::move(callback);
+                    _inFlight++;
+                    break;
+                }
+            }
+            return;
+        }
+
+        completion.msgId = msgId;
+        completion.result = MqttPublishResult::Acknowledged;
+        completion.latencyUs = elapsedUs(startUs, ackUs);
+        completion.callback = std::move(callback);
+        _acknowledged++;
+        _latencyUs.record(completion.latencyUs);
+    }
+    complete(completion);
+}
+
+bool MqttPublishTracker::acknowledge(int msgId, int64_t nowUs)
+{
+    Completion completion;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (!takeLocked(msgId, MqttPublishResult::Acknowledged, nowUs, completion))
+        {
+            // Only a publish still in progress can be acknowledged before add()
+            if (_reserved > 0)
+            {
+                if (_earlyAcks.size() >= MaxEarlyAcks)
+                    _earlyAcks.erase(_earlyAcks.begin());
+                EarlyAck ack = {msgId, nowUs};
+                _earlyAcks.push_back(ack);
+            }
+            return false;
+        }
+        _acknowledged++;
+        _latencyUs.record(completion.latencyUs);
+    }
+    complete(completion);
+    return true;
+}
+
+bool MqttPublishTracker::remove(int msgId, MqttPublishResult result, int64_t nowUs)
+{
+    Completion completion;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (!takeLocked(msgId, result, nowUs, completion))
+            return false;
+        if (result == MqttPublishResult::TimedOut)
+            _timedOut++;
+        else if (result == MqttPublishResult::Deleted)
+            _deleted++;
+        else
+            _acknowledged++;
+    }
+    complete(completion);
+    return true;
+}
+
+std::size_t MqttPublishTracker::expire(int64_t nowUs)
+{
+    std::lock_guard<std::mutex> expireLock(_expireMutex);
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_inFlight == 0)
+            return 0;
+
+        int64_t timeoutUs = (int64_t)_config.timeoutMs * 1000;
+        for (std::size_t i = 0; i < _entries.size(); i++)
+        {
+            Entry &entry = _entries[i];
+            if (entry.msgId < 0 || nowUs - entry.startUs < timeoutUs)
+                continue;
+            Completion completion;
+            takeLocked(entry.msgId, MqttPublishResult::TimedOut, nowUs, completion);
+            _expired.push_back(std::move(completion));
+            _timedOut++;
+        }
+    }
+
+    std::size_t count = _expired.size();
+    for (std::size_t i = 0; i < count; i++)
+        complete(_expired[i]);
+    _expired.clear();
+    return count;
+}
+
+MqttPublishTrackerStats MqttPublishTracker::getStats() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    MqttPublishTrackerStats stats;
+    stats.inFlight = _inFlight;
+    stats.capacity = _entries.size();
+    stats.tracked = _tracked;
+    stats.acknowledged = _acknowledged;
+    stats.timedOut = _timedOut;
+    stats.deleted = _deleted;
+    stats.rejected = _rejected;
+    return stats;
+}
+
+bool MqttPublishTracker::takeLocked(int msgId, MqttPublishResult result, int64_t nowUs, Completion &completion)
+{
+    if (msgId < 0)
+        return false; // Would match a free entry
+    for (std::size_t i = 0; i < _entries.size(); i++)
+    {
+        Entry &entry = _entries[i];
+        if (entry.msgId != msgId)
+            continue;
+
+        completion.msgId = msgId;
+        completion.result = result;
+        completion.latencyUs = elapsedUs(entry.startUs, nowUs);
+        completion.callback = std::move(entry.callback);
+        entry.callback = nullptr;
+        entry.msgId = -1;
+        _inFlight--;
+        return true;
+    }
+    return false;
+}
+
+void MqttPublishTracker::complete(Completion &completion)
+{
+    if (completion.callback)
+        completion.callback(completion.msgId, completion.result, completion.latencyUs);
+    completion.callback = nullptr;
+}
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <vector>
+#include "ESP32MQTTClientStats.h"
+
+/**
+ * @brief How a tracked publish ended, see ESP32MQTTClient::publishTracked()
+ */
+enum class MqttPublishResult
+{
+    Acknowledged, // PUBACK (QoS 1) or PUBCOMP (QoS 2) received
+    Sent,         // QoS 0, handed to esp-mqtt; there is no acknowledgement
+    TimedOut,     // No acknowledgement within the configured timeout
+    Deleted       // esp-mqtt discarded the message from its outbox (MQTT_EVENT_DELETED)
+};
+
+// Completion of a tracked publish; latencyUs is the time from publishing to the
+// acknowledgement (to giving up, for TimedOut and Deleted; 0 for Sent)
+typedef std::function<void(int msgId, MqttPublishResult result, uint32_t latencyUs)> MqttPublishCallback;
+
+/**
+ * @brief Settings of the publish tracking, see ESP32MQTTClient::enablePublishTracking()
+ */
+struct MqttPublishTrackerConfig
+{
+    std::size_t capacity = 16;  // Publishes awaiting acknowledgement at most, preallocated
+    uint32_t timeoutMs = 10000; // Time after which an unacknowledged publish is reported as timed out
+};
+
+struct MqttPublishTrackerStats
+{
+    std::size_t inFlight;  // Publishes awaiting acknowledgement
+    std::size_t capacity;  // Size of the in-flight table
+    uint32_t tracked;      // Publishes entered into the table
+    uint32_t acknowledged; // Completed with MqttPublishResult::Acknowledged
+    uint32_t timedOut;     // Completed with MqttPublishResult::TimedOut
+    uint32_t deleted;      // Completed with MqttPublishResult::Deleted
+    uint32_t rejected;     // Publishes refused because the table was full
+};
+
+/**
+ * @brief Fixed table of QoS 1/2 publishes awaiting PUBACK/PUBCOMP
+ *
+ * The publishing task reserves an entry before publishing and fills it with the
+ * msg_id esp-mqtt returned; the MQTT task completes it on MQTT_EVENT_PUBLISHED.
+ * An acknowledgement that arrives before the entry was filled in is remembered
+ * while reservations are open. The table is allocated by begin() and searched
+ * linearly, it is meant for a few dozen entries at most.
+ *
+ * Thread safe. Completion callbacks are invoked without the lock held, on the
+ * task calling add(), acknowledge(), remove() or expire(). Times are
+ * esp_timer_get_time() values (µs) passed in by the caller.
+ */
+class MqttPublishTracker
+{
+public:
+    MqttPublishTracker() = default;
+
+    MqttPublishTracker(const MqttPublishTracker &) = delete;
+    MqttPublishTracker &operator=(const MqttPublishTracker &) = delete;
+
+    /**
+     * @brief Allocate the table
+     * @return false if already enabled or capacity is 0
+     */
+    bool begin(const MqttPublishTrackerConfig &config);
+
+    /**
+     * @brief Forget all entries without calling their callbacks and release the table
+     */
+    void end();
+
+    bool isEnabled() const { return !_entries.empty(); }
+    const MqttPublishTrackerConfig &config() const { return _config; }
+
+    /**
+     * @brief Reserve an entry for a publish about to be made
+     * @return false if the table is full
+     */
+    bool reserve();
+
+    /**
+     * @brief Give a reservation back, the publish failed
+     */
+    void cancel();
+
+    /**
+     * @brief Fill a reserved entry with the msg_id of the publish
+     * @param startUs Time taken right before publishing, the latency is measured from it
+     */
+    void add(int msgId, int64_t startUs, MqttPublishCallback callback);
+
+    /**
+     * @brief Complete the entry of msgId (MQTT_EVENT_PUBLISHED)
+     * @return false if no entry has this msg_id (yet)
+     */
+    bool acknowledge(int msgId, int64_t nowUs);
+
+    /**
+     * @brief Complete the entry of msgId with result, without recording its latency
+     * @return false if no entry has this msg_id
+     */
+    bool remove(int msgId, MqttPublishResult result, int64_t nowUs);
+
+    /**
+     * @brief Complete the entries older than the timeout with MqttPublishResult::TimedOut
+     * @return Number of entries timed out
+     */
+    std::size_t expire(int64_t nowUs);
+
+    MqttPublishTrackerStats getStats() const;
+
+    /**
+     * @brief Acknowledgement latency of the completed publishes, in microseconds
+     */
+    MqttHistogramSnapshot latency() const { return _latencyUs.snapshot(); }
+
+private:
+    struct Entry
+    {
+        int msgId; // -1 for a free entry
+        int64_t startUs;
+        MqttPublishCallback callback;
+    };
+
+    // A completion taken out of the table, reported once the lock is released
+    struct Completion
+    {
+        int msgId;
+        MqttPublishResult result;
+        uint32_t latencyUs;
+        MqttPublishCallback callback;
+    };
+
+    // Acknowledgement that arrived before add() filled in its entry
+    struct EarlyAck
+    {
+        int msgId;
+        int64_t timeUs;
+    };
+
+    bool takeLocked(int msgId, MqttPublishResult result, int64_t nowUs, Completion &completion);
+    static void complete(Completion &completion);
+
+    MqttPublishTrackerConfig _config;
+    std::vector<Entry> _entries;
+    std::size_t _inFlight = 0;
+    std::size_t _reserved = 0;
+    std::vector<EarlyAck> _earlyAcks;
+    std::vector<Completion> _expired; // Reused by expire(), guarded by _expireMutex
+    MqttHistogram _latencyUs;
+
+    uint32_t _tracked = 0;
+    uint32_t _acknowledged = 0;
+    uint32_t _timedOut = 0;
+    uint32_t _deleted = 0;
+    uint32_t _rejected = 0;
+
+    mutable std::mutex _mutex;
+    std::mutex _expireMutex; // Held by the single active expire()
+};
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+/**
+ * @brief Pointer to an immutable object that is replaced as a whole (read-copy-update)
+ *
+ * Readers take a ReadGuard, which costs two atomic operations and never blocks,
+ * and see a consistent snapshot for as long as they hold it. Writers serialize
+ * on writeMutex(), build a modified copy of writerView() and publish it with
+ * replace(). Replaced objects are deleted once no reader is active anymore,
+ * either right away by the writer or later by the last reader leaving, so a
+ * writer never waits for readers. This allows readers to call code that
+ * writes (e.g. a message callback subscribing to another topic).
+ *
+ * The writer mutex is only used by writers and the internal reclaim step;
+ * code holding it must not block on anything a reader might be waiting for.
+ */
+template <typename T>
+class MqttRcuPointer
+{
+public:
+    class ReadGuard
+    {
+    public:
+        ReadGuard(ReadGuard &&other) : _owner(other._owner), _value(other._value) { other._owner = nullptr; }
+        ~ReadGuard()
+        {
+            if (_owner)
+                _owner->leaveRead();
+        }
+
+        const T *get() const { return _value; }
+        const T *operator->() const { return _value; }
+        const T &operator*() const { return *_value; }
+
+    private:
+        friend class MqttRcuPointer;
+        ReadGuard(const MqttRcuPointer *owner, const T *value) : _owner(owner), _value(value) {}
+        ReadGuard(const ReadGuard &) = delete;
+        ReadGuard &operator=(const ReadGuard &) = delete;
+
+        const MqttRcuPointer *_owner;
+        const T *_value;
+    };
+
+    explicit MqttRcuPointer(T *initial) : _current(initial), _readers(0), _retiredCount(0) {}
+
+    ~MqttRcuPointer()
+    {
+        delete _current.load();
+        for (std::size_t i = 0; i < _retired.size(); i++)
+            delete _retired[i];
+    }
+
+    MqttRcuPointer(const MqttRcuPointer &) = delete;
+    MqttRcuPointer &operator=(const MqttRcuPointer &) = delete;
+
+    /**
+     * @brief Enter a read-side section, lock-free
+     */
+    ReadGuard read() const
+    {
+        _readers.fetch_add(1);
+        return ReadGuard(this, _current.load());
+    }
+
+    /**
+     * @brief Mutex serializing writers, also guards any state the owner keeps next to the object
+     */
+    std::mutex &writeMutex() const { return _writeMutex; }
+
+    /**
+     * @brief Current object, only to be used while holding writeMutex()
+     */
+    const T *writerView() const { return _current.load(); }
+
+    /**
+     * @brief Publish a new object, must be called while holding writeMutex()
+     * @param next Replacement, ownership is taken
+     */
+    void replace(T *next)
+    {
+        T *old = _current.exchange(next);
+        std::lock_guard<std::mutex> lock(_reclaimMutex);
+        _retired.push_back(old);
+        _retiredCount.store(_retired.size());
+        reclaimLocked();
+    }
+
+private:
+    void leaveRead() const
+    {
+        if (_readers.fetch_sub(1) == 1 && _retiredCount.load() > 0)
+        {
+            // Last reader out frees what writers could not; never block the read side
+            if (_reclaimMutex.try_lock())
+            {
+                reclaimLocked();
+                _reclaimMutex.unlock();
+            }
+        }
+    }
+
+    // A reader registers before loading the pointer, so once the count was seen at
+    // zero after an exchange, no reader can still hold an object retired before it.
+    void reclaimLocked() const
+    {
+        if (_readers.load() != 0)
+            return;
+        for (std::size_t i = 0; i < _retired.size(); i++)
+            delete _retired[i];
+        _retired.clear();
+        _retiredCount.store(0);
+    }
+
+    std::atomic<T *> _current;
+    mutable std::atomic<int> _readers;
+    mutable std::atomic<std::size_t> _retiredCount;
+    mutable std::mutex _writeMutex;
+    mutable std::mutex _reclaimMutex;
+    mutable std::vector<T *> _retired;
+};
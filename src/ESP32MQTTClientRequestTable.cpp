@@ -0,0 +1,207 @@
+#include "ESP32MQTTClientRequestTable.h"
+
+const std::size_t MqttRequestTable::kMaxCapacity;
+const std::size_t MqttRequestTable::kIdLength;
+
+namespace
+{
+    // Uses of an entry are counted in the upper 24 bits of the id
+    const uint32_t IndexBits = 8;
+    const uint32_t UsesMask = 0xFFFFFFu;
+
+    uint32_t elapsedUs(int64_t startUs, int64_t nowUs)
+    {
+        int64_t elapsed = nowUs - startUs;
+        if (elapsed < 0)
+            return 0;
+        return elapsed > (int64_t)UINT32_MAX ? UINT32_MAX : (uint32_t)elapsed;
+    }
+}
+
+bool MqttRequestTable::begin(std::size_t capacity)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (!_entries.empty() || capacity == 0 || capacity > kMaxCapacity)
+        return false;
+
+    Entry free = {0, 0, 0, nullptr};
+    _entries.assign(capacity, free);
+    _uses.assign(capacity, 1);
+    _free.clear();
+    _free.reserve(capacity);
+    // Hand out the first entries first
+    for (std::size_t i = capacity; i > 0; i--)
+        _free.push_back((uint8_t)(i - 1));
+    _expired.reserve(capacity);
+    return true;
+}
+
+void MqttRequestTable::end()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    std::vector<Entry>().swap(_entries);
+    std::vector<uint8_t>().swap(_free);
+    std::vector<uint32_t>().swap(_uses);
+}
+
+uint32_t MqttRequestTable::add(int64_t startUs, uint32_t timeoutMs, MqttResponseCallback callback)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_free.empty())
+    {
+        _rejected++;
+        return 0;
+    }
+
+    std::size_t index = _free.back();
+    _free.pop_back();
+    uint32_t uses = _uses[index];
+    // 0 is no id, skip it when the count wraps
+    _uses[index] = ((uses + 1) & UsesMask) ? (uses + 1) & UsesMask : 1;
+
+    Entry &entry = _entries[index];
+    entry.id = (uses << IndexBits) | (uint32_t)index;
+    entry.startUs = startUs;
+    entry.deadlineUs = startUs + (int64_t)timeoutMs * 1000;
+    entry.callback = std::move(callback);
+    _sent++;
+    return entry.id;
+}
+
+void MqttRequestTable::cancel(uint32_t id)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    Entry *entry = findLocked(id);
+    if (entry == nullptr)
+        return;
+    _sent--;
+    releaseLocked(*entry);
+}
+
+bool MqttRequestTable::resolve(uint32_t id, const MqttMessageView &response, int64_t nowUs)
+{
+    MqttResponseCallback callback;
+    uint32_t roundTripUs;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        Entry *entry = findLocked(id);
+        if (entry == nullptr)
+        {
+            _unmatched++;
+            return false;
+        }
+        roundTripUs = elapsedUs(entry->startUs, nowUs);
+        callback = std::move(entry->callback);
+        releaseLocked(*entry);
+        _answered++;
+        _roundTripUs.record(roundTripUs);
+    }
+    if (callback)
+        callback(MqttRequestResult::Response, response, roundTripUs);
+    return true;
+}
+
+std::size_t MqttRequestTable::expire(int64_t nowUs)
+{
+    std::lock_guard<std::mutex> expireLock(_expireMutex);
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_free.size() == _entries.size())
+            return 0;
+
+        for (std::size_t i = 0; i < _entries.size(); i++)
+        {
+            Entry &entry = _entries[i];
+            if (entry.id == 0 || nowUs < entry.deadlineUs)
+                continue;
+            Completion completion;
+            completion.result = MqttRequestResult::TimedOut;
+            completion.roundTripUs = elapsedUs(entry.startUs, nowUs);
+            completion.callback = std::move(entry.callback);
+            releaseLocked(entry);
+            _expired.push_back(std::move(completion));
+            _timedOut++;
+        }
+    }
+
+    MqttMessageView none = {};
+    std::size_t count = _expired.size();
+    for (std::size_t i = 0; i < count; i++)
+    {
+        if (_expired[i].callback)
+            _expired[i].callback(_expired[i].result, none, _expired[i].roundTripUs);
+    }
+    _expired.clear();
+    return count;
+}
+
+std::size_t MqttRequestTable::pending() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _entries.size() - _free.size();
+}
+
+MqttRequestStats MqttRequestTable::getStats() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    MqttRequestStats stats;
+    stats.pending = _entries.size() - _free.size();
+    stats.capacity = _entries.size();
+    stats.sent = _sent;
+    stats.answered = _answered;
+    stats.timedOut = _timedOut;
+    stats.rejected = _rejected;
+    stats.unmatched = _unmatched;
+    return stats;
+}
+
+void MqttRequestTable::formatId(uint32_t id, char *text)
+{
+    static const char digits[] = "0123456789abcdef";
+    for (std::size_t i = kIdLength; i > 0; i--)
+    {
+        text[i - 1] = digits[id & 0xF];
+        id >>= 4;
+    }
+}
+
+bool MqttRequestTable::parseId(const char *text, std::size_t length, uint32_t &id)
+{
+    if (text == nullptr || length != kIdLength)
+        return false;
+
+    uint32_t value = 0;
+    for (std::size_t i = 0; i < length; i++)
+    {
+        char c = text[i];
+        uint32_t digit;
+        if (c >= '0' && c <= '9')
+            digit = c - '0';
+        else if (c >= 'a' && c <= 'f')
+            digit = c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F')
+            digit = c - 'A' + 10;
+        else
+            return false;
+        value = (value << 4) | digit;
+    }
+    if (value == 0)
+        return false;
+    id = value;
+    return true;
+}
+
+MqttRequestTable::Entry *MqttRequestTable::findLocked(uint32_t id)
+{
+    std::size_t index = id & ((1u << IndexBits) - 1);
+    if (id == 0 || index >= _entries.size() || _entries[index].id != id)
+        return nullptr;
+    return &_entries[index];
+}
+
+void MqttRequestTable::releaseLocked(Entry &entry)
+{
+    _free.push_back((uint8_t)(&entry - _entries.data()));
+    entry.id = 0;
+    entry.callback = nullptr;
+}
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "ESP32MQTTClientMessage.h"
+#include "ESP32MQTTClientStats.h"
+
+/**
+ * @brief How a request ended, see ESP32MQTTClient::request()
+ */
+enum class MqttRequestResult
+{
+    Response, // The response arrived
+    TimedOut  // No response within the timeout of the request
+};
+
+// Completion of a request. response is the response message for MqttRequestResult::Response
+// and all empty otherwise, valid during the call only; roundTripUs is the time from sending
+// the request to the response (to giving up, for TimedOut)
+typedef std::function<void(MqttRequestResult result, const MqttMessageView &response, uint32_t roundTripUs)> MqttResponseCallback;
+
+/**
+ * @brief Settings of request(), see ESP32MQTTClient::enableRequests()
+ */
+struct MqttRequestConfig
+{
+    std::size_t capacity = 8; // Requests awaiting their response at most, preallocated; up to 256
+    std::string replyTopic;   // Responses arrive on replyTopic/<id>, empty for "<client name>/reply"
+    uint8_t replyQos = 1;     // QoS of the subscription to replyTopic/+
+    uint32_t tickMs = 50;     // Period of the timer checking the timeouts while requests are pending
+};
+
+struct MqttRequestStats
+{
+    std::size_t pending;  // Requests awaiting their response
+    std::size_t capacity; // Size of the correlation table
+    uint32_t sent;        // Requests entered into the table and published
+    uint32_t answered;    // Completed with MqttRequestResult::Response
+    uint32_t timedOut;    // Completed with MqttRequestResult::TimedOut
+    uint32_t rejected;    // Requests refused because the table was full
+    uint32_t unmatched;   // Responses to no pending request: late, duplicate or malformed id
+};
+
+/**
+ * @brief Fixed correlation table of requests awaiting their response
+ *
+ * Every request gets an entry and an id that encodes the entry: the low 8 bits
+ * are its index, the upper 24 bits count the uses of the entry, so a late
+ * response to an earlier request in the same entry finds nothing. Looking up a
+ * response is a direct index. On the wire the id is 8 hex digits (formatId()).
+ * The table is allocated by begin() and does not allocate afterwards, except
+ * for what copying the callbacks takes.
+ *
+ * Thread safe. Completion callbacks are invoked without the lock held, on the
+ * task calling resolve() or expire(). Times are esp_timer_get_time() values
+ * (µs) passed in by the caller.
+ */
+class MqttRequestTable
+{
+public:
+    static const std::size_t kMaxCapacity = 256;
+    static const std::size_t kIdLength = 8; // Hex digits of a formatted id
+
+    MqttRequestTable() = default;
+
+    MqttRequestTable(const MqttRequestTable &) = delete;
+    MqttRequestTable &operator=(const MqttRequestTable &) = delete;
+
+    /**
+     * @brief Allocate the table
+     * @return false if already enabled, capacity is 0 or above kMaxCapacity
+     */
+    bool begin(std::size_t capacity);
+
+    /**
+     * @brief Forget all entries without calling their callbacks and release the table
+     */
+    void end();
+
+    bool isEnabled() const { return !_entries.empty(); }
+
+    /**
+     * @brief Enter a request about to be sent
+     * @param startUs Time taken right before sending, the round trip is measured from it
+     * @return Id of the request, 0 if the table is full
+     */
+    uint32_t add(int64_t startUs, uint32_t timeoutMs, MqttResponseCallback callback);
+
+    /**
+     * @brief Remove a request without calling its callback, sending it failed
+     */
+    void cancel(uint32_t id);
+
+    /**
+     * @brief Complete the request id with its response
+     * @return false if no request with this id is pending
+     */
+    bool resolve(uint32_t id, const MqttMessageView &response, int64_t nowUs);
+
+    /**
+     * @brief Complete the requests past their timeout with MqttRequestResult::TimedOut
+     * @return Number of requests timed out
+     */
+    std::size_t expire(int64_t nowUs);
+
+    std::size_t pending() const;
+    MqttRequestStats getStats() const;
+
+    /**
+     * @brief Round trip time of the answered requests, in microseconds
+     */
+    MqttHistogramSnapshot roundTrip() const { return _roundTripUs.snapshot(); }
+
+    // Id as kIdLength lowercase hex digits, not NUL terminated
+    static void formatId(uint32_t id, char *text);
+    // false unless text is kIdLength hex digits of an id other than 0
+    static bool parseId(const char *text, std::size_t length, uint32_t &id);
+
+private:
+    struct Entry
+    {
+        uint32_t id; // 0 for a free entry
+        int64_t startUs;
+        int64_t deadlineUs;
+        MqttResponseCallback callback;
+    };
+
+    // A completion taken out of the table, reported once the lock is released
+    struct Completion
+    {
+        MqttRequestResult result;
+        uint32_t roundTripUs;
+        MqttResponseCallback callback;
+    };
+
+    Entry *findLocked(uint32_t id);
+    void releaseLocked(Entry &entry);
+
+    std::vector<Entry> _entries;
+    std::vector<uint8_t> _free;       // Indices of the free entries, used as a stack
+    std::vector<uint32_t> _uses;      // Per entry, upper 24 bits of its next id
+    std::vector<Completion> _expired; // Reused by expire(), guarded by _expireMutex
+    MqttHistogram _roundTripUs;
+
+    uint32_t _sent = 0;
+    uint32_t _answered = 0;
+    uint32_t _timedOut = 0;
+    uint32_t _rejected = 0;
+    uint32_t _unmatched = 0;
+
+    mutable std::mutex _mutex;
+    std::mutex _expireMutex; // Held by the single active expire()
+};
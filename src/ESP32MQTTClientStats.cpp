@@ -0,0 +1,103 @@
+#include "ESP32MQTTClientStats.h"
+
+#include <cinttypes>
+#include <cstdio>
+
+const std::size_t MqttHistogramSnapshot::kBuckets;
+
+uint32_t MqttHistogramSnapshot::percentile(double p) const
+{
+    if (count == 0)
+        return 0;
+
+    // Rank of the value looked for, 1 based
+    uint64_t rank = (uint64_t)(p / 100.0 * count + 0.5);
+    if (rank < 1)
+        rank = 1;
+    if (rank > count)
+        rank = count;
+
+    uint64_t seen = 0;
+    for (std::size_t i = 0; i < kBuckets; i++)
+    {
+        seen += buckets[i];
+        if (seen >= rank)
+        {
+            uint32_t bound = MqttHistogram::bucketUpperBound(i);
+            return bound < max ? bound : max;
+        }
+    }
+    return max;
+}
+
+std::size_t MqttHistogram::bucketOf(uint32_t value)
+{
+    if (value == 0)
+        return 0;
+    std::size_t bucket = 32 - __builtin_clz(value);
+    return bucket < MqttHistogramSnapshot::kBuckets ? bucket : MqttHistogramSnapshot::kBuckets - 1;
+}
+
+uint32_t MqttHistogram::bucketUpperBound(std::size_t bucket)
+{
+    if (bucket == 0)
+        return 0;
+    if (bucket >= MqttHistogramSnapshot::kBuckets - 1)
+        return UINT32_MAX;
+    return (1u << bucket) - 1;
+}
+
+void MqttHistogram::record(uint32_t value)
+{
+    _buckets[bucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+    _count.fetch_add(1, std::memory_order_relaxed);
+    _sum.fetch_add(value, std::memory_order_relaxed);
+    mqttAtomicMax(_max, value);
+}
+
+MqttHistogramSnapshot MqttHistogram::snapshot() const
+{
+    MqttHistogramSnapshot snapshot;
+    for (std::size_t i = 0; i < MqttHistogramSnapshot::kBuckets; i++)
+        snapshot.buckets[i] = _buckets[i].load(std::memory_order_relaxed);
+    snapshot.count = _count.load(std::memory_order_relaxed);
+    snapshot.sum = _sum.load(std::memory_order_relaxed);
+    snapshot.max = _max.load(std::memory_order_relaxed);
+    return snapshot;
+}
+
+void MqttHistogram::reset()
+{
+    for (std::size_t i = 0; i < MqttHistogramSnapshot::kBuckets; i++)
+        _buckets[i].store(0, std::memory_order_relaxed);
+    _count.store(0, std::memory_order_relaxed);
+    _sum.store(0, std::memory_order_relaxed);
+    _max.store(0, std::memory_order_relaxed);
+}
+
+std::size_t mqttFormatStatsJson(const MqttClientStats &stats, char *buffer, std::size_t size)
+{
+    int length = snprintf(buffer, size,
+                          "{\"msgsIn\":%" PRIu32 ",\"bytesIn\":%" PRIu32 ",\"msgsOut\":%" PRIu32 ",\"bytesOut\":%" PRIu32
+                          ",\"publishFailures\":%" PRIu32 ",\"inboundDropped\":%" PRIu32
+                          ",\"connects\":%" PRIu32 ",\"reconnects\":%" PRIu32 ",\"disconnects\":%" PRIu32
+                          ",\"connectedS\":%" PRIu64 ",\"sessionS\":%" PRIu64
+                          ",\"dispatchUs\":{\"count\":%" PRIu32 ",\"mean\":%" PRIu32 ",\"p50\":%" PRIu32 ",\"p99\":%" PRIu32 ",\"max\":%" PRIu32 "}"
+                          ",\"resubscribeMs\":{\"count\":%" PRIu32 ",\"p50\":%" PRIu32 ",\"max\":%" PRIu32 "}"
+                          ",\"publishAckUs\":{\"count\":%" PRIu32 ",\"p50\":%" PRIu32 ",\"p99\":%" PRIu32 ",\"max\":%" PRIu32 "}"
+                          ",\"requestRttUs\":{\"count\":%" PRIu32 ",\"p50\":%" PRIu32 ",\"p99\":%" PRIu32 ",\"max\":%" PRIu32 "}}",
+                          stats.messagesIn, stats.bytesIn, stats.messagesOut, stats.bytesOut,
+                          stats.publishFailures, stats.inboundDropped,
+                          stats.connects, stats.reconnects, stats.disconnects,
+                          stats.connectedMs / 1000, stats.sessionMs / 1000,
+                          stats.dispatchUs.count, stats.dispatchUs.mean(), stats.dispatchUs.percentile(50),
+                          stats.dispatchUs.percentile(99), stats.dispatchUs.max,
+                          stats.resubscribeMs.count, stats.resubscribeMs.percentile(50), stats.resubscribeMs.max,
+                          stats.publishAckUs.count, stats.publishAckUs.percentile(50), stats.publishAckUs.percentile(99),
+                          stats.publishAckUs.max,
+                          stats.requestRttUs.count, stats.requestRttUs.percentile(50), stats.requestRttUs.percentile(99),
+                          stats.requestRttUs.max);
+    if (length < 0 || (std::size_t)length >= size)
+        return 0;
+    return length;
+}
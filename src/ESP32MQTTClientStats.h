@@ -0,0 +1,130 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Copy of an MqttHistogram at one point in time
+ *
+ * Bucket 0 counts values of 0, bucket i (i > 0) values in [2^(i-1), 2^i), the
+ * last bucket also everything larger.
+ */
+struct MqttHistogramSnapshot
+{
+    static const std::size_t kBuckets = 24;
+
+    uint32_t buckets[kBuckets];
+    uint32_t count; // Values recorded
+    uint64_t sum;   // Of all values, for the mean
+    uint32_t max;   // Largest value recorded
+
+    /**
+     * @brief Estimate of the given percentile (0-100)
+     * @return Upper bound of the bucket the percentile falls into, at most max; 0 if empty
+     */
+    uint32_t percentile(double p) const;
+    uint32_t mean() const { return count ? (uint32_t)(sum / count) : 0; }
+};
+
+/**
+ * @brief Lock-free histogram with power of two buckets
+ *
+ * record() is a few relaxed atomic increments, cheap enough for the hot path;
+ * values are typically microseconds. Concurrent record() calls are safe, a
+ * snapshot() taken meanwhile may be off by the values being recorded.
+ */
+class MqttHistogram
+{
+public:
+    MqttHistogram() { reset(); }
+
+    MqttHistogram(const MqttHistogram &) = delete;
+    MqttHistogram &operator=(const MqttHistogram &) = delete;
+
+    void record(uint32_t value);
+    MqttHistogramSnapshot snapshot() const;
+    void reset();
+
+    static std::size_t bucketOf(uint32_t value);
+    static uint32_t bucketUpperBound(std::size_t bucket); // Largest value counted in bucket
+
+private:
+    std::atomic<uint32_t> _buckets[MqttHistogramSnapshot::kBuckets];
+    std::atomic<uint32_t> _count;
+    std::atomic<uint64_t> _sum;
+    std::atomic<uint32_t> _max;
+};
+
+// Raise target to value if it is larger
+inline void mqttAtomicMax(std::atomic<uint32_t> &target, uint32_t value)
+{
+    uint32_t current = target.load(std::memory_order_relaxed);
+    while (value > current && !target.compare_exchange_weak(current, value, std::memory_order_relaxed))
+    {
+    }
+}
+
+/**
+ * @brief Per-subscription part of MqttClientStats
+ */
+struct MqttSubscriptionStats
+{
+    std::string topic;      // Topic filter
+    uint32_t messages;      // Messages delivered to the callbacks of this subscription
+    uint32_t maxCallbackUs; // Longest time its callbacks took for one message
+};
+
+/**
+ * @brief Callback durations of one subscription, see ESP32MQTTClient::getCallbackProfile()
+ */
+struct MqttCallbackProfile
+{
+    std::string topic; // Topic filter
+    uint32_t calls;    // Messages the callbacks ran for
+    uint64_t totalUs;  // Time spent in the callbacks
+    uint32_t meanUs;
+    uint32_t p99Us;    // Estimated from power of two buckets
+    uint32_t maxUs;
+};
+
+/**
+ * @brief Counters of an ESP32MQTTClient, see ESP32MQTTClient::getStats()
+ *
+ * Counters start at 0 when the client is created and wrap around at 2^32.
+ */
+struct MqttClientStats
+{
+    uint32_t messagesIn;      // Inbound messages (first fragment of each)
+    uint32_t bytesIn;         // Inbound payload bytes, all fragments
+    uint32_t messagesOut;     // Publishes accepted by esp-mqtt (publish(), offline queue, outbox, stats)
+    uint32_t bytesOut;        // Payload bytes of those
+    uint32_t publishFailures; // Publishes rejected by esp-mqtt or attempted while disconnected
+    uint32_t inboundDropped;  // Inbound messages discarded: larger than setMaxMessageSize() without chunk callback, or broken fragment sequence
+    uint32_t connects;        // MQTT_EVENT_CONNECTED
+    uint32_t reconnects;      // Connects after the first one
+    uint32_t disconnects;     // MQTT_EVENT_DISCONNECTED
+    uint64_t connectedMs;     // Total time connected, including the current session
+    uint64_t sessionMs;       // Time since the current connect, 0 while disconnected
+    // Time the MQTT task spent handing one message to the callbacks (or to the
+    // async dispatch queue), in microseconds
+    MqttHistogramSnapshot dispatchUs;
+    // Time from a clean-session reconnect until every restored subscription was
+    // acknowledged, in milliseconds, see ESP32MQTTClient::setAutoResubscribe()
+    MqttHistogramSnapshot resubscribeMs;
+    // Time from publishing until the PUBACK/PUBCOMP of publishTracked() messages,
+    // in microseconds, see ESP32MQTTClient::enablePublishTracking()
+    MqttHistogramSnapshot publishAckUs;
+    // Time from publishing a request() until its response arrived, in microseconds,
+    // see ESP32MQTTClient::enableRequests()
+    MqttHistogramSnapshot requestRttUs;
+    std::vector<MqttSubscriptionStats> subscriptions;
+};
+
+/**
+ * @brief Write the counters as a compact JSON object, without the per-subscription part
+ * @return Length of the JSON text, or 0 if it does not fit into size bytes
+ */
+std::size_t mqttFormatStatsJson(const MqttClientStats &stats, char *buffer, std::size_t size);
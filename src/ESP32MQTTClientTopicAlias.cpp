@@ -0,0 +1,126 @@
+#include "ESP32MQTTClientTopicAlias.h"
+
+#include <cstring>
+
+bool MqttTopicAliasTable::begin(uint16_t maximum)
+{
+    if (!_entries.empty() || maximum == 0)
+        return false;
+
+    Entry free = {std::string(), 0, 0};
+    _entries.assign(maximum, free);
+    reset();
+    return true;
+}
+
+void MqttTopicAliasTable::end()
+{
+    std::vector<Entry>().swap(_entries);
+    _limit = 0;
+    _used = 0;
+}
+
+void MqttTopicAliasTable::reset()
+{
+    // clear() keeps the capacity of the strings, topics of the same length do not allocate again
+    for (std::size_t i = 0; i < _entries.size(); i++)
+        _entries[i].topic.clear();
+    _limit = (uint16_t)_entries.size();
+    _used = 0;
+}
+
+uint16_t MqttTopicAliasTable::lookup(const char *topic, std::size_t length, uint32_t hash, bool &established)
+{
+    established = false;
+    uint16_t limit = _limit.load(std::memory_order_relaxed);
+    if (limit == 0 || length == 0)
+        return 0;
+
+    _tick++;
+    std::size_t freeEntry = limit;
+    std::size_t oldest = 0;
+    uint32_t oldestAge = 0;
+    for (std::size_t i = 0; i < limit; i++)
+    {
+        Entry &entry = _entries[i];
+        if (entry.topic.empty())
+        {
+            if (freeEntry == limit)
+                freeEntry = i;
+            continue;
+        }
+        if (entry.hash == hash && entry.topic.size() == length && memcmp(entry.topic.data(), topic, length) == 0)
+        {
+            entry.lastUse = _tick;
+            established = true;
+            _reused.fetch_add(1, std::memory_order_relaxed);
+            _bytesSaved.fetch_add(length, std::memory_order_relaxed);
+            return (uint16_t)(i + 1);
+        }
+        // Unsigned difference, correct across a wrap of _tick
+        uint32_t age = _tick - entry.lastUse;
+        if (age >= oldestAge)
+        {
+            oldest = i;
+            oldestAge = age;
+        }
+    }
+
+    std::size_t index = freeEntry;
+    if (index == limit)
+    {
+        index = oldest;
+        _evicted.fetch_add(1, std::memory_order_relaxed);
+    }
+    else
+    {
+        _used.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    Entry &entry = _entries[index];
+    entry.topic.assign(topic, length);
+    entry.hash = hash;
+    entry.lastUse = _tick;
+    _assigned.fetch_add(1, std::memory_order_relaxed);
+    return (uint16_t)(index + 1);
+}
+
+void MqttTopicAliasTable::limitTo(uint16_t alias)
+{
+    if (alias == 0 || alias > _limit.load(std::memory_order_relaxed))
+        return;
+
+    uint16_t limit = alias - 1;
+    uint16_t used = 0;
+    for (std::size_t i = 0; i < _entries.size(); i++)
+    {
+        if (i >= limit)
+            _entries[i].topic.clear();
+        else if (!_entries[i].topic.empty())
+            used++;
+    }
+    _limit = limit;
+    _used = used;
+}
+
+void MqttTopicAliasTable::forget(uint16_t alias)
+{
+    if (alias == 0 || alias > _entries.size() || _entries[alias - 1].topic.empty())
+        return;
+    _entries[alias - 1].topic.clear();
+    _used.fetch_sub(1, std::memory_order_relaxed);
+}
+
+MqttTopicAliasStats MqttTopicAliasTable::getStats() const
+{
+    MqttTopicAliasStats stats;
+    stats.maximum = (uint16_t)_entries.size();
+    stats.limit = _limit.load(std::memory_order_relaxed);
+    stats.used = _used.load(std::memory_order_relaxed);
+    stats.assigned = _assigned.load(std::memory_order_relaxed);
+    stats.reused = _reused.load(std::memory_order_relaxed);
+    stats.evicted = _evicted.load(std::memory_order_relaxed);
+    stats.busy = _busy.load(std::memory_order_relaxed);
+    stats.bytesSaved = _bytesSaved.load(std::memory_order_relaxed);
+    return stats;
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct MqttTopicAliasStats
+{
+    uint16_t maximum;    // Aliases configured with ESP32MQTTClient::enableTopicAliases()
+    uint16_t limit;      // Usable on this connection, lowered to the broker's Topic Alias Maximum
+    uint16_t used;       // Assigned on this connection
+    uint32_t assigned;   // Publishes that sent the topic to set up an alias
+    uint32_t reused;     // Publishes sent with the alias only
+    uint32_t evicted;    // Aliases taken over by another topic, least recently used first
+    uint32_t busy;       // Publishes from the MQTT task that found the table in use and failed
+    uint32_t bytesSaved; // Topic bytes not sent thanks to aliases
+};
+
+/**
+ * @brief Outbound MQTT 5 topic aliases of one connection
+ *
+ * Maps up to maximum topics to the aliases 1..maximum. The first publish of a
+ * topic sends it together with a free alias; later ones send the alias only.
+ * With all aliases in use the least recently used one is reassigned. The broker
+ * announces how many aliases it accepts only in its CONNACK, which esp-mqtt does
+ * not pass on, so the table learns the limit from rejected aliases (limitTo()).
+ * Aliases are only valid within a network connection, reset() forgets them.
+ *
+ * The table is preallocated by begin() and searched linearly over the topic
+ * hashes; it is meant for a few dozen topics. Not thread safe: the client keeps
+ * the lookup and the publish together under its own lock. The statistics can be
+ * read from any task.
+ */
+class MqttTopicAliasTable
+{
+public:
+    MqttTopicAliasTable() = default;
+
+    MqttTopicAliasTable(const MqttTopicAliasTable &) = delete;
+    MqttTopicAliasTable &operator=(const MqttTopicAliasTable &) = delete;
+
+    /**
+     * @brief Allocate the table
+     * @return false if already enabled or maximum is 0
+     */
+    bool begin(uint16_t maximum);
+    void end();
+    bool isEnabled() const { return !_entries.empty(); }
+
+    /**
+     * @brief Forget all aliases and allow maximum of them again, for a new connection
+     */
+    void reset();
+
+    /**
+     * @brief Alias to publish topic with
+     * @param hash MqttTopicIndex::hash() of the topic
+     * @param established Set to true if the broker already knows the alias, the topic can be left out
+     * @return Alias 1..limit, 0 if no alias can be used
+     */
+    uint16_t lookup(const char *topic, std::size_t length, uint32_t hash, bool &established);
+
+    /**
+     * @brief The broker refused alias: use fewer than alias from now on
+     */
+    void limitTo(uint16_t alias);
+
+    /**
+     * @brief Setting up alias failed, the broker does not know it
+     */
+    void forget(uint16_t alias);
+
+    void countBusy() { _busy.fetch_add(1, std::memory_order_relaxed); }
+
+    MqttTopicAliasStats getStats() const;
+
+private:
+    struct Entry
+    {
+        std::string topic; // Empty for a free alias
+        uint32_t hash;
+        uint32_t lastUse;
+    };
+
+    std::vector<Entry> _entries; // Alias n is _entries[n - 1]
+    uint32_t _tick = 0;
+
+    std::atomic<uint16_t> _limit{0};
+    std::atomic<uint16_t> _used{0};
+    std::atomic<uint32_t> _assigned{0};
+    std::atomic<uint32_t> _reused{0};
+    std::atomic<uint32_t> _evicted{0};
+    std::atomic<uint32_t> _busy{0};
+    std::atomic<uint32_t> _bytesSaved{0};
+};
@@ -0,0 +1,70 @@
+#include "ESP32MQTTClientTopicArena.h"
+
+#include <cstdlib>
+#include <cstring>
+
+const std::size_t MqttTopicArena::kMaxTopicLength;
+
+MqttTopicArena::~MqttTopicArena()
+{
+    for (std::size_t i = 0; i < _chunks.size(); i++)
+        free(_chunks[i]);
+}
+
+MqttTopicHandle MqttTopicArena::intern(const char *topic, std::size_t length)
+{
+    if (topic == nullptr || length == 0 || length > kMaxTopicLength)
+        return MqttTopicHandle();
+
+    uint32_t hash = MqttTopicIndex::hash(topic, length);
+    std::lock_guard<std::mutex> lock(_mutex);
+    MqttTopicIndex::Value existing = _index.find(hash, [this, topic, length](MqttTopicIndex::Value candidate) {
+        const MqttTopicHandle &handle = _topics[candidate];
+        return handle.length() == length && memcmp(handle.c_str(), topic, length) == 0;
+    });
+    if (existing != MqttTopicIndex::npos)
+        return _topics[existing];
+
+    char *copy = allocateLocked(length + 1);
+    if (copy == nullptr)
+        return MqttTopicHandle();
+    memcpy(copy, topic, length);
+    copy[length] = '\0';
+
+    MqttTopicHandle handle(copy, hash, (uint16_t)length);
+    _index.insert(hash, _topics.size());
+    _topics.push_back(handle);
+    return handle;
+}
+
+std::size_t MqttTopicArena::size() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _topics.size();
+}
+
+std::size_t MqttTopicArena::bytes() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _bytes;
+}
+
+char *MqttTopicArena::allocateLocked(std::size_t size)
+{
+    if (!_chunks.empty() && _chunkUsed + size <= _chunkSize)
+    {
+        char *data = _chunks.back() + _chunkUsed;
+        _chunkUsed += size;
+        return data;
+    }
+
+    // The rest of the current chunk stays unused
+    std::size_t chunkSize = size > _chunkSize ? size : _chunkSize;
+    char *chunk = (char *)malloc(chunkSize);
+    if (chunk == nullptr)
+        return nullptr;
+    _chunks.push_back(chunk);
+    _chunkUsed = size;
+    _bytes += chunkSize;
+    return chunk;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "ESP32MQTTClientTopicIndex.h"
+
+/**
+ * @brief Topic interned by ESP32MQTTClient::internTopic()
+ *
+ * Points to a NUL terminated copy of the topic kept in a MqttTopicArena, along
+ * with its length and MqttTopicIndex::hash(). Cheap to copy and to pass by value;
+ * valid as long as the arena (the client) that interned it. A default constructed
+ * handle is invalid.
+ */
+class MqttTopicHandle
+{
+public:
+    MqttTopicHandle() : _topic(nullptr), _hash(0), _length(0) {}
+
+    bool isValid() const { return _topic != nullptr; }
+    const char *c_str() const { return _topic; }
+    std::size_t length() const { return _length; }
+    uint32_t hash() const { return _hash; }
+
+    // Topics are interned once per arena, so equal topics share the pointer
+    bool operator==(const MqttTopicHandle &other) const { return _topic == other._topic; }
+    bool operator!=(const MqttTopicHandle &other) const { return _topic != other._topic; }
+
+private:
+    friend class MqttTopicArena;
+    MqttTopicHandle(const char *topic, uint32_t hash, uint16_t length) : _topic(topic), _hash(hash), _length(length) {}
+
+    const char *_topic;
+    uint32_t _hash;
+    uint16_t _length;
+};
+
+/**
+ * @brief Append-only store of interned topics
+ *
+ * Topics are copied back to back into chunks of chunkSize bytes (a longer topic
+ * gets a chunk of its own) that are only released with the arena, so handles
+ * stay valid. Interning a topic again returns the existing handle, found through
+ * a MqttTopicIndex. Thread safe; handles are used without locking.
+ */
+class MqttTopicArena
+{
+public:
+    static const std::size_t kMaxTopicLength = 65535; // Longest topic MQTT can encode
+
+    explicit MqttTopicArena(std::size_t chunkSize = 512) : _chunkSize(chunkSize), _chunkUsed(0), _bytes(0) {}
+    ~MqttTopicArena();
+
+    MqttTopicArena(const MqttTopicArena &) = delete;
+    MqttTopicArena &operator=(const MqttTopicArena &) = delete;
+
+    /**
+     * @brief Handle of topic, copied into the arena the first time
+     * @return Invalid handle if topic is empty, longer than kMaxTopicLength or out of memory
+     */
+    MqttTopicHandle intern(const char *topic, std::size_t length);
+    MqttTopicHandle intern(const std::string &topic) { return intern(topic.data(), topic.size()); }
+
+    std::size_t size() const;  // Topics interned
+    std::size_t bytes() const; // Chunk memory allocated
+
+private:
+    char *allocateLocked(std::size_t size);
+
+    std::size_t _chunkSize;
+    std::vector<char *> _chunks; // The last one is filled
+    std::size_t _chunkUsed;      // Bytes used in the last chunk
+    std::size_t _bytes;
+    std::vector<MqttTopicHandle> _topics;
+    MqttTopicIndex _index; // Values are indices into _topics
+    mutable std::mutex _mutex;
+};
@@ -0,0 +1,52 @@
+#include "ESP32MQTTClientTopicIndex.h"
+
+const MqttTopicIndex::Value MqttTopicIndex::npos;
+
+// 32 bit FNV-1a
+uint32_t MqttTopicIndex::hash(const char *topic, std::size_t len)
+{
+    uint32_t h = 2166136261u;
+    for (std::size_t i = 0; i < len; i++)
+    {
+        h ^= (uint8_t)topic[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+void MqttTopicIndex::reset(std::size_t count)
+{
+    std::size_t capacity = 8;
+    while (capacity < count * 2)
+        capacity <<= 1;
+    Slot free = {0, npos};
+    _slots.assign(capacity, free);
+    _mask = capacity - 1;
+    _size = 0;
+}
+
+void MqttTopicIndex::insert(uint32_t topicHash, Value value)
+{
+    if (_slots.empty() || (_size + 1) * 2 > _slots.size())
+        grow();
+
+    std::size_t i = topicHash & _mask;
+    while (_slots[i].value != npos)
+        i = (i + 1) & _mask;
+    _slots[i].hash = topicHash;
+    _slots[i].value = value;
+    _size++;
+}
+
+void MqttTopicIndex::grow()
+{
+    // Stored hashes are enough to rehash, the topics are not needed
+    std::vector<Slot> old;
+    old.swap(_slots);
+    reset(old.size() ? old.size() : 4);
+    for (std::size_t i = 0; i < old.size(); i++)
+    {
+        if (old[i].value != npos)
+            insert(old[i].hash, old[i].value);
+    }
+}
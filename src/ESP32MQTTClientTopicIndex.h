@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Hash index for exact topic lookups
+ *
+ * Open addressing with linear probing over (hash, value) slots, kept at most
+ * half full. The index does not store the topics: the owner computes each
+ * topic's hash once, inserts it with an opaque value (an index into its own
+ * list), and confirms candidates with a comparison callback when looking up.
+ * Lookups do not allocate.
+ */
+class MqttTopicIndex
+{
+public:
+    typedef std::size_t Value;
+    static const Value npos = static_cast<Value>(-1);
+
+    static uint32_t hash(const char *topic, std::size_t len);
+    static uint32_t hash(const std::string &topic) { return hash(topic.data(), topic.size()); }
+
+    /**
+     * @brief Remove all entries and make room for count of them
+     */
+    void reset(std::size_t count);
+
+    /**
+     * @brief Add an entry, the topic it stands for must not be in the index yet
+     */
+    void insert(uint32_t topicHash, Value value);
+
+    bool empty() const { return _size == 0; }
+    std::size_t size() const { return _size; }
+
+    /**
+     * @brief Look up a topic by its hash
+     * @param equal Callable invoked as equal(Value) for entries with the same hash,
+     *        returns whether the entry stands for the topic looked up
+     * @return Value of the entry, npos if not found
+     */
+    template <typename Equal>
+    Value find(uint32_t topicHash, Equal &&equal) const
+    {
+        if (_slots.empty())
+            return npos;
+        for (std::size_t i = topicHash & _mask;; i = (i + 1) & _mask)
+        {
+            const Slot &slot = _slots[i];
+            if (slot.value == npos)
+                return npos;
+            if (slot.hash == topicHash && equal(slot.value))
+                return slot.value;
+        }
+    }
+
+private:
+    struct Slot
+    {
+        uint32_t hash;
+        Value value; // npos for a free slot
+    };
+
+    void grow();
+
+    std::vector<Slot> _slots; // Power of two size, or empty
+    std::size_t _mask = 0;
+    std::size_t _size = 0;
+};
@@ -0,0 +1,94 @@
+#include "ESP32MQTTClientTopicMatch.h"
+
+#include <cstring>
+
+bool mqttTopicMatches(const char *filter, std::size_t filterLen, const char *topic, std::size_t topicLen)
+{
+    // Wildcards in the first level never match topics such as "$SYS/..."
+    if (topicLen > 0 && topic[0] == '$' && filterLen > 0 && (filter[0] == '+' || filter[0] == '#'))
+        return false;
+
+    std::size_t f = 0;
+    std::size_t t = 0;
+
+    // Each iteration consumes one level of both the filter and the topic
+    while (true)
+    {
+        if (f < filterLen && filter[f] == '#')
+            return f + 1 == filterLen; // Only valid as the whole, last level
+
+        if (f < filterLen && filter[f] == '+' && (f + 1 == filterLen || filter[f + 1] == '/'))
+        {
+            while (t < topicLen && topic[t] != '/')
+                t++;
+            f++;
+        }
+        else
+        {
+            while (f < filterLen && filter[f] != '/')
+            {
+                if (t >= topicLen || topic[t] != filter[f])
+                    return false;
+                f++;
+                t++;
+            }
+            if (t < topicLen && topic[t] != '/')
+                return false;
+        }
+
+        if (f == filterLen)
+            return t == topicLen;
+
+        // filter[f] is '/' here
+        if (t == topicLen)
+            return filterLen - f == 2 && filter[f + 1] == '#'; // "sport/#" matches "sport"
+
+        f++;
+        t++;
+    }
+}
+
+bool mqttTopicFilterValid(const char *filter, std::size_t filterLen)
+{
+    for (std::size_t f = 0; f < filterLen; f++)
+    {
+        if (filter[f] == '#' && (f == 0 || filter[f - 1] == '/'))
+            return f + 1 == filterLen;
+    }
+    return true;
+}
+
+bool mqttTopicFiltersOverlap(const char *a, std::size_t aLen, const char *b, std::size_t bLen)
+{
+    std::size_t i = 0;
+    std::size_t j = 0;
+
+    // Each iteration compares one level of both filters
+    while (true)
+    {
+        std::size_t iEnd = i;
+        while (iEnd < aLen && a[iEnd] != '/')
+            iEnd++;
+        std::size_t jEnd = j;
+        while (jEnd < bLen && b[jEnd] != '/')
+            jEnd++;
+
+        bool aWild = iEnd - i == 1 && (a[i] == '+' || a[i] == '#');
+        bool bWild = jEnd - j == 1 && (b[j] == '+' || b[j] == '#');
+        if ((aWild && a[i] == '#') || (bWild && b[j] == '#'))
+            return true;
+        if (!aWild && !bWild && (iEnd - i != jEnd - j || memcmp(a + i, b + j, iEnd - i) != 0))
+            return false;
+
+        if (iEnd == aLen && jEnd == bLen)
+            return true;
+        // One filter ends here, the other matches its topics only with a final "/#"
+        if (iEnd == aLen)
+            return bLen - jEnd == 2 && b[jEnd + 1] == '#';
+        if (jEnd == bLen)
+            return aLen - iEnd == 2 && a[iEnd + 1] == '#';
+
+        i = iEnd + 1;
+        j = jEnd + 1;
+    }
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+/**
+ * @brief Match a topic name against a topic filter
+ *
+ * Implements the matching rules of MQTT 3.1.1 / 5.0 section 4.7: any number of
+ * '+' levels, a trailing '#' that also matches the parent level, and topics
+ * starting with '$' not being matched by a leading wildcard. Works on
+ * pointer+length pairs, so neither argument needs to be NUL terminated, and
+ * never allocates.
+ *
+ * @param filter Topic filter, may contain wildcards
+ * @param filterLen Length of the filter in bytes
+ * @param topic Topic name, must not contain wildcards
+ * @param topicLen Length of the topic in bytes
+ * @return true on match, false otherwise (also for malformed filters such as "a/#/b")
+ */
+bool mqttTopicMatches(const char *filter, std::size_t filterLen, const char *topic, std::size_t topicLen);
+
+inline bool mqttTopicMatches(const std::string &filter, const std::string &topic)
+{
+    return mqttTopicMatches(filter.data(), filter.size(), topic.data(), topic.size());
+}
+
+/**
+ * @brief Whether a topic filter is well-formed
+ *
+ * A level starting with '#' must be the whole, last level. '+' and '#' inside
+ * a level are plain characters, as in mqttTopicMatches().
+ *
+ * @return false for filters such as "a/#/b" or "a/#x"
+ */
+bool mqttTopicFilterValid(const char *filter, std::size_t filterLen);
+
+inline bool mqttTopicFilterValid(const std::string &filter)
+{
+    return mqttTopicFilterValid(filter.data(), filter.size());
+}
+
+/**
+ * @brief Whether some topic name could match both topic filters
+ *
+ * Compares the filters level by level, '+' matching any level and '#' any
+ * remainder. Errs on the side of true: the '$' rule is not applied, so
+ * "+/status" and "$SYS/status" count as overlapping. Never allocates.
+ *
+ * @return false only if no topic matches both filters
+ */
+bool mqttTopicFiltersOverlap(const char *a, std::size_t aLen, const char *b, std::size_t bLen);
+
+inline bool mqttTopicFiltersOverlap(const std::string &a, const std::string &b)
+{
+    return mqttTopicFiltersOverlap(a.data(), a.size(), b.data(), b.size());
+}
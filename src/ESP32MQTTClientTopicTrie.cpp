@@ -0,0 +1,111 @@
+#include "ESP32MQTTClientTopicTrie.h"
+#include "ESP32MQTTClientTopicMatch.h"
+
+#include <algorithm>
+
+namespace
+{
+    // Orders child segments without building temporary strings
+    int compareSegment(const std::string &segment, const char *other, std::size_t otherLen)
+    {
+        std::size_t len = std::min(segment.size(), otherLen);
+        int cmp = len ? memcmp(segment.data(), other, len) : 0;
+        if (cmp != 0)
+            return cmp;
+        if (segment.size() == otherLen)
+            return 0;
+        return segment.size() < otherLen ? -1 : 1;
+    }
+}
+
+std::size_t MqttTopicTrie::lowerBound(const Node &node, const char *segment, std::size_t len)
+{
+    std::size_t lo = 0;
+    std::size_t hi = node.children.size();
+    while (lo < hi)
+    {
+        std::size_t mid = lo + (hi - lo) / 2;
+        if (compareSegment(node.children[mid].segment, segment, len) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+const MqttTopicTrie::Node *MqttTopicTrie::findChild(const Node &node, const char *segment, std::size_t len)
+{
+    std::size_t i = lowerBound(node, segment, len);
+    if (i < node.children.size() && compareSegment(node.children[i].segment, segment, len) == 0)
+        return node.children[i].node.get();
+    return nullptr;
+}
+
+MqttTopicTrie::Node &MqttTopicTrie::findOrAddChild(Node &node, const char *segment, std::size_t len)
+{
+    std::size_t i = lowerBound(node, segment, len);
+    if (i < node.children.size() && compareSegment(node.children[i].segment, segment, len) == 0)
+        return *node.children[i].node;
+
+    Child child;
+    child.segment.assign(segment, len);
+    child.node.reset(new Node());
+    Node &added = *child.node;
+    node.children.insert(node.children.begin() + i, std::move(child));
+    return added;
+}
+
+bool MqttTopicTrie::insert(const std::string &filter, Value value)
+{
+    // Would match where mqttTopicMatches() does not
+    if (!mqttTopicFilterValid(filter))
+        return false;
+
+    Node *node = &_root;
+    const char *pos = filter.c_str();
+    const char *end = pos + filter.size();
+
+    while (true)
+    {
+        const char *sep = static_cast<const char *>(memchr(pos, '/', end - pos));
+        const char *segEnd = sep ? sep : end;
+        std::size_t len = segEnd - pos;
+
+        if (len == 1 && *pos == '#')
+        {
+            // Only the last level, checked above
+            node->hashValues.push_back(value);
+            break;
+        }
+
+        if (len == 1 && *pos == '+')
+        {
+            if (!node->plus)
+                node->plus.reset(new Node());
+            node = node->plus.get();
+        }
+        else
+        {
+            node = &findOrAddChild(*node, pos, len);
+        }
+
+        if (sep == nullptr)
+        {
+            node->values.push_back(value);
+            break;
+        }
+        pos = sep + 1;
+    }
+
+    _size++;
+    return true;
+}
+
+void MqttTopicTrie::clear()
+{
+    _root.children.clear();
+    _root.plus.reset();
+    _root.values.clear();
+    _root.hashValues.clear();
+    _size = 0;
+}
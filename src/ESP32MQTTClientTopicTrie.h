@@ -0,0 +1,110 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Level-indexed trie of MQTT topic filters
+ *
+ * Every node stands for one topic level. Exact segments live in a sorted child
+ * list, '+' has a dedicated edge and filters ending in '#' are stored on the
+ * node of their parent level. Matching a topic therefore visits a number of
+ * nodes bounded by the topic depth and the wildcard edges taken, not by the
+ * number of registered filters.
+ *
+ * The trie stores opaque values (indices into the owner's subscription list)
+ * and performs no allocation while matching.
+ */
+class MqttTopicTrie
+{
+public:
+    typedef std::size_t Value;
+
+    /**
+     * @brief Register a filter
+     * @param filter Topic filter, may contain '+' and a trailing '#'
+     * @param value Value reported when a topic matches the filter
+     * @return false if the filter is malformed (see mqttTopicFilterValid()) and was not added
+     */
+    bool insert(const std::string &filter, Value value);
+
+    /**
+     * @brief Remove all filters
+     */
+    void clear();
+
+    bool empty() const { return _size == 0; }
+    std::size_t size() const { return _size; }
+
+    /**
+     * @brief Visit the value of every filter matching a topic
+     *
+     * Topics starting with '$' are not matched by filters whose first level is
+     * a wildcard, as required by the MQTT specification.
+     *
+     * @param topic Topic name (no wildcards), does not need to be NUL terminated
+     * @param topicLen Length of the topic in bytes
+     * @param visit Callable invoked as visit(Value) for each matching filter
+     */
+    template <typename Visitor>
+    void match(const char *topic, std::size_t topicLen, Visitor &&visit) const
+    {
+        const bool sysTopic = topicLen > 0 && topic[0] == '$';
+        matchLevel(_root, topic, topic + topicLen, !sysTopic, visit);
+    }
+
+private:
+    struct Node;
+
+    struct Child
+    {
+        std::string segment;
+        std::unique_ptr<Node> node;
+    };
+
+    struct Node
+    {
+        std::vector<Child> children;   // Exact segments, sorted
+        std::unique_ptr<Node> plus;    // '+' edge
+        std::vector<Value> values;     // Filters ending at this level
+        std::vector<Value> hashValues; // Filters ending with '#' right below this level
+    };
+
+    static std::size_t lowerBound(const Node &node, const char *segment, std::size_t len);
+    static const Node *findChild(const Node &node, const char *segment, std::size_t len);
+    static Node &findOrAddChild(Node &node, const char *segment, std::size_t len);
+
+    // pos is the start of the next topic level, nullptr once all levels were consumed
+    template <typename Visitor>
+    static void matchLevel(const Node &node, const char *pos, const char *end, bool wildcards, Visitor &visit)
+    {
+        if (wildcards)
+        {
+            for (std::size_t i = 0; i < node.hashValues.size(); i++)
+                visit(node.hashValues[i]);
+        }
+
+        if (pos == nullptr)
+        {
+            for (std::size_t i = 0; i < node.values.size(); i++)
+                visit(node.values[i]);
+            return;
+        }
+
+        const char *sep = static_cast<const char *>(memchr(pos, '/', end - pos));
+        const char *segEnd = sep ? sep : end;
+        const char *next = sep ? sep + 1 : nullptr;
+
+        const Node *child = findChild(node, pos, segEnd - pos);
+        if (child)
+            matchLevel(*child, next, end, true, visit);
+        if (wildcards && node.plus)
+            matchLevel(*node.plus, next, end, true, visit);
+    }
+
+    Node _root;
+    std::size_t _size = 0;
+};
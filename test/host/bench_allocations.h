@@ -0,0 +1,30 @@
+#pragma once
+
+#include <benchmark/benchmark.h>
+
+#include <cstdint>
+
+// operator new calls made by the process so far, counted by the replacement in
+// bench_allocations.cpp; plain malloc() (arenas, reassembly buffer) is not included
+uint64_t benchAllocationCount();
+
+/**
+ * @brief Reports an "allocs/op" counter for the timed loop of a benchmark
+ *
+ * Create right before the loop and call report() after it; allocations made by
+ * other threads meanwhile (e.g. dispatch workers) are included.
+ */
+class BenchAllocationCounter
+{
+public:
+    BenchAllocationCounter() : _start(benchAllocationCount()) {}
+
+    void report(benchmark::State &state)
+    {
+        state.counters["allocs/op"] = benchmark::Counter(static_cast<double>(benchAllocationCount() - _start),
+                                                         benchmark::Counter::kAvgIterations);
+    }
+
+private:
+    uint64_t _start;
+};
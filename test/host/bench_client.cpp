@@ -0,0 +1,451 @@
+// Hot paths of ESP32MQTTClient, driven through the fake esp-mqtt client.
+// Every benchmark reports allocs/op next to the time per operation.
+#include <benchmark/benchmark.h>
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "ESP32MQTTClient.h"
+#include "bench_allocations.h"
+#include "fake_mqtt_client.h"
+
+namespace
+{
+    enum FilterMix
+    {
+        ExactFilters,    // Every subscription an exact topic
+        GatewayFilters,  // Mostly exact, every 8th a '+' and every 16th a '#' filter
+        WildcardFilters  // Every subscription a '+' or '#' filter
+    };
+
+    std::string makeFilter(int i, int mix)
+    {
+        std::string dev = "site/dev" + std::to_string(i);
+        if (mix == WildcardFilters)
+            return dev + (i % 2 ? "/#" : "/+/temp");
+        if (mix == GatewayFilters && i % 16 == 15)
+            return dev + "/#";
+        if (mix == GatewayFilters && i % 8 == 7)
+            return dev + "/+/temp";
+        return dev + "/sensor/temp";
+    }
+
+    // Connected client whose fake does not keep records, so it does not distort the numbers
+    struct BenchClient
+    {
+        ESP32MQTTClient client;
+        FakeMqttClient *fake;
+
+        // setup runs before loopStart()
+        explicit BenchClient(const std::function<void(ESP32MQTTClient &)> &setup = nullptr)
+        {
+            client.setURI("mqtt://bench");
+            if (setup)
+                setup(client);
+            client.loopStart();
+            fake = FakeMqttClient::last();
+            fake->setRecording(false);
+            fake->connect();
+        }
+    };
+
+    // Prebuilt MQTT_EVENT_DATA events: 64 topics spread over the subscriptions, 64 byte payloads
+    struct DataEvents
+    {
+        std::vector<std::string> topics;
+        std::string payload;
+        std::vector<esp_mqtt_event_t> events;
+
+        explicit DataEvents(int subscriptions) : payload(64, 'p')
+        {
+            for (int i = 0; i < 64; i++)
+                topics.push_back("site/dev" + std::to_string((i * 7919) % subscriptions) + "/sensor/temp");
+            for (std::size_t i = 0; i < topics.size(); i++)
+            {
+                esp_mqtt_event_t event = {};
+                event.event_id = MQTT_EVENT_DATA;
+                event.topic = &topics[i][0];
+                event.topic_len = topics[i].size();
+                event.data = &payload[0];
+                event.data_len = payload.size();
+                event.total_data_len = payload.size();
+                events.push_back(event);
+            }
+        }
+    };
+}
+
+// MQTT_EVENT_DATA to the end of the zero-copy callbacks; range(0) subscriptions, range(1) FilterMix
+static void BM_DispatchView(benchmark::State &state)
+{
+    BenchClient bench;
+    size_t delivered = 0;
+    for (int i = 0; i < state.range(0); i++)
+        bench.client.subscribe(makeFilter(i, state.range(1)), [&delivered](const MqttMessageView &) { delivered++; });
+    DataEvents data(state.range(0));
+
+    size_t n = 0;
+    BenchAllocationCounter allocations;
+    for (auto _ : state)
+        bench.fake->sendEvent(data.events[n++ % data.events.size()]);
+    allocations.report(state);
+    benchmark::DoNotOptimize(delivered);
+}
+BENCHMARK(BM_DispatchView)->ArgsProduct({{1, 10, 100, 1000}, {ExactFilters, GatewayFilters, WildcardFilters}});
+
+#ifdef ESP32MQTTCLIENT_MQTT5
+// BM_DispatchView over MQTT 5, the broker tagging each message with the subscription
+// identifier it matched; range(2) 0 ignores the identifiers, 1 dispatches by them
+static void BM_DispatchSubscriptionId(benchmark::State &state)
+{
+    const int subscriptions = state.range(0);
+    BenchClient bench([&state](ESP32MQTTClient &client) {
+        client.enableMqtt5();
+        client.setSubscriptionIds(state.range(2) != 0);
+    });
+    size_t delivered = 0;
+    bench.fake->setRecording(true);
+    for (int i = 0; i < subscriptions; i++)
+        bench.client.subscribe(makeFilter(i, state.range(1)), [&delivered](const MqttMessageView &) { delivered++; });
+    std::vector<FakeMqttClient::Subscribe> subscribes = bench.fake->subscribes();
+    bench.fake->setRecording(false);
+
+    DataEvents data(subscriptions);
+    std::vector<esp_mqtt5_event_property_t> properties(data.events.size());
+    for (std::size_t i = 0; i < data.events.size(); i++)
+    {
+        properties[i].subscribe_id = subscribes[(i * 7919) % subscriptions].subscriptionId;
+        data.events[i].property = &properties[i];
+    }
+
+    size_t n = 0;
+    BenchAllocationCounter allocations;
+    for (auto _ : state)
+        bench.fake->sendEvent(data.events[n++ % data.events.size()]);
+    allocations.report(state);
+    benchmark::DoNotOptimize(delivered);
+    state.counters["direct"] = (double)bench.client.getSubscriptionIdStats().direct / state.iterations();
+}
+BENCHMARK(BM_DispatchSubscriptionId)->ArgsProduct({{10, 100, 1000}, {GatewayFilters, WildcardFilters}, {0, 1}});
+#endif
+
+// Same with std::string callbacks, which copy topic and payload once per message
+static void BM_DispatchString(benchmark::State &state)
+{
+    BenchClient bench;
+    size_t delivered = 0;
+    for (int i = 0; i < state.range(0); i++)
+        bench.client.subscribe(makeFilter(i, GatewayFilters), [&delivered](const std::string &, const std::string &) { delivered++; });
+    DataEvents data(state.range(0));
+
+    size_t n = 0;
+    BenchAllocationCounter allocations;
+    for (auto _ : state)
+        bench.fake->sendEvent(data.events[n++ % data.events.size()]);
+    allocations.report(state);
+    benchmark::DoNotOptimize(delivered);
+}
+BENCHMARK(BM_DispatchString)->Arg(1)->Arg(10)->Arg(100)->Arg(1000);
+
+// Cost on the MQTT task of handing messages to the dispatch workers
+static void BM_DispatchAsync(benchmark::State &state)
+{
+    BenchClient bench;
+    MqttDispatchConfig config;
+    config.queueLength = 1024;
+    bench.client.enableAsyncDispatch(config);
+    for (int i = 0; i < state.range(0); i++)
+        bench.client.subscribe(makeFilter(i, GatewayFilters), [](const MqttMessageView &) {});
+    DataEvents data(state.range(0));
+
+    size_t n = 0;
+    BenchAllocationCounter allocations;
+    for (auto _ : state)
+        bench.fake->sendEvent(data.events[n++ % data.events.size()]);
+    allocations.report(state);
+}
+BENCHMARK(BM_DispatchAsync)->Arg(10)->Arg(1000);
+
+// publish() with prebuilt strings; range(0) is the QoS
+static void BM_Publish(benchmark::State &state)
+{
+    BenchClient bench;
+    const std::string topic = "site/dev1/sensor/temp";
+    const std::string payload(64, 'p');
+    int qos = state.range(0);
+
+    BenchAllocationCounter allocations;
+    for (auto _ : state)
+        benchmark::DoNotOptimize(bench.client.publish(topic, payload, qos));
+    allocations.report(state);
+}
+BENCHMARK(BM_Publish)->Arg(0)->Arg(1);
+
+// publish() called with string literals, as in most sketches
+static void BM_PublishLiterals(benchmark::State &state)
+{
+    BenchClient bench;
+    BenchAllocationCounter allocations;
+    for (auto _ : state)
+        benchmark::DoNotOptimize(bench.client.publish("site/dev1/sensor/temp", "{\"temperature\":21.5,\"humidity\":40.2,\"battery\":3.71}"));
+    allocations.report(state);
+}
+BENCHMARK(BM_PublishLiterals);
+
+// publish() of a binary buffer, pointer and length, with string literal topic
+static void BM_PublishBuffer(benchmark::State &state)
+{
+    BenchClient bench;
+    uint8_t frame[64] = {0};
+
+    BenchAllocationCounter allocations;
+    for (auto _ : state)
+        benchmark::DoNotOptimize(bench.client.publish("site/dev1/sensor/raw", frame, sizeof(frame)));
+    allocations.report(state);
+}
+BENCHMARK(BM_PublishBuffer);
+
+// publish() of a header and a body segment, gathered into the reused buffer
+static void BM_PublishSegments(benchmark::State &state)
+{
+    BenchClient bench;
+    uint8_t header[8] = {0};
+    const std::string body(state.range(0), 'p');
+    MqttPayloadSegment segments[] = {{header, sizeof(header)}, {body.data(), body.size()}};
+
+    BenchAllocationCounter allocations;
+    for (auto _ : state)
+        benchmark::DoNotOptimize(bench.client.publish("site/dev1/sensor/raw", segments, 2));
+    allocations.report(state);
+}
+BENCHMARK(BM_PublishSegments)->Arg(64)->Arg(1024);
+
+// publish() to one of 40 device topics, the topic formatted for every call as firmware
+// typically does, against the same topics interned once
+static void BM_PublishFormattedTopic(benchmark::State &state)
+{
+    BenchClient bench;
+    int device = 0;
+
+    BenchAllocationCounter allocations;
+    for (auto _ : state)
+    {
+        char topic[64];
+        snprintf(topic, sizeof(topic), "site/dev%d/sensor/temp", 100 + device);
+        device = (device + 1) % 40;
+        benchmark::DoNotOptimize(bench.client.publish(topic, "21.5"));
+    }
+    allocations.report(state);
+}
+BENCHMARK(BM_PublishFormattedTopic);
+
+static void BM_PublishInternedTopic(benchmark::State &state)
+{
+    BenchClient bench;
+    std::vector<MqttTopicHandle> topics;
+    for (int i = 0; i < 40; i++)
+        topics.push_back(bench.client.internTopic("site/dev" + std::to_string(100 + i) + "/sensor/temp"));
+    int device = 0;
+
+    BenchAllocationCounter allocations;
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(bench.client.publish(topics[device], "21.5"));
+        device = (device + 1) % 40;
+    }
+    allocations.report(state);
+}
+BENCHMARK(BM_PublishInternedTopic);
+
+#ifdef ESP32MQTTCLIENT_MQTT5
+// Bytes on the wire per publish of 8 byte readings to 8 topics of a gateway, round robin,
+// as the fake counts the PUBLISH packets: MQTT 3.1.1 (0), MQTT 5 (1), MQTT 5 with up to
+// range(1) topic aliases, which the fake accepts like Mosquitto's default of 10 (2)
+static void BM_PublishTopicAlias(benchmark::State &state)
+{
+    const int mode = state.range(0);
+    BenchClient bench([&state, mode](ESP32MQTTClient &client) {
+        if (mode > 0)
+            client.enableMqtt5();
+        if (mode > 1)
+            client.enableTopicAliases(state.range(1));
+    });
+    std::vector<MqttTopicHandle> topics;
+    for (int i = 0; i < 8; i++)
+        topics.push_back(bench.client.internTopic("plant/building-7/line-3/cell-" + std::to_string(i) + "/vibration/rms"));
+    const uint8_t reading[8] = {};
+    int next = 0;
+
+    uint64_t bytesBefore = bench.fake->bytesWritten();
+    BenchAllocationCounter allocations;
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(bench.client.publish(topics[next], reading, sizeof(reading)));
+        next = (next + 1) % topics.size();
+    }
+    allocations.report(state);
+    state.counters["bytes/op"] = (double)(bench.fake->bytesWritten() - bytesBefore) / state.iterations();
+}
+BENCHMARK(BM_PublishTopicAlias)->Args({0, 0})->Args({1, 0})->Args({2, 4})->Args({2, 8});
+#endif
+
+// publish() while disconnected, copied into the offline queue (drop oldest once full)
+static void BM_PublishOfflineQueued(benchmark::State &state)
+{
+    BenchClient bench;
+    bench.client.enableOfflineQueue();
+    bench.fake->disconnect();
+    const std::string topic = "site/dev1/sensor/temp";
+    const std::string payload(64, 'p');
+
+    BenchAllocationCounter allocations;
+    for (auto _ : state)
+        benchmark::DoNotOptimize(bench.client.publish(topic, payload, 1));
+    allocations.report(state);
+}
+BENCHMARK(BM_PublishOfflineQueued);
+
+// Caller side of publish() and publishAsync() for a QoS 0 message while the fake spends
+// range(0) µs writing each packet it is handed directly, like a socket on a slow link.
+// publishAsync() only enqueues; the fake keeps a copy of each message like the esp-mqtt
+// outbox does, which is what its allocs/op count. The outbox is emptied outside of the timing.
+static void BM_PublishBlockingWrite(benchmark::State &state)
+{
+    BenchClient bench;
+    bench.fake->setWriteDelay(state.range(0));
+    const std::string topic = "site/dev1/sensor/temp";
+    const std::string payload(64, 'p');
+
+    BenchAllocationCounter allocations;
+    for (auto _ : state)
+        benchmark::DoNotOptimize(bench.client.publish(topic, payload));
+    allocations.report(state);
+}
+BENCHMARK(BM_PublishBlockingWrite)->Arg(0)->Arg(200);
+
+static void BM_PublishAsync(benchmark::State &state)
+{
+    BenchClient bench;
+    bench.fake->setWriteDelay(state.range(0));
+    bench.fake->setRecording(true);
+    const std::string topic = "site/dev1/sensor/temp";
+    const std::string payload(64, 'p');
+
+    BenchAllocationCounter allocations;
+    int queued = 0;
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(bench.client.publishAsync(topic, payload));
+        if (++queued == 256)
+        {
+            state.PauseTiming();
+            bench.fake->sendEnqueued();
+            bench.fake->clearRecords();
+            queued = 0;
+            state.ResumeTiming();
+        }
+    }
+    allocations.report(state);
+}
+BENCHMARK(BM_PublishAsync)->Arg(0)->Arg(200);
+
+// request() and its response over MQTT 3.1.1: entering the request into the correlation
+// table, publishing it to topic/<id> and resolving it from the reply topic
+static void BM_RequestRoundTrip(benchmark::State &state)
+{
+    BenchClient bench([](ESP32MQTTClient &client) {
+        MqttRequestConfig config;
+        config.replyTopic = "bench/reply";
+        client.enableRequests(config);
+    });
+    const std::string topic = "site/dev1/cmd";
+    const std::string payload(64, 'p');
+    std::string replyTopic = "bench/reply/00000000";
+    esp_mqtt_event_t event = {};
+    event.event_id = MQTT_EVENT_DATA;
+    event.topic = &replyTopic[0];
+    event.topic_len = replyTopic.size();
+    event.data = &replyTopic[0];
+    event.data_len = 4;
+    event.total_data_len = 4;
+    size_t answered = 0;
+    MqttResponseCallback callback = [&answered](MqttRequestResult, const MqttMessageView &, uint32_t) { answered++; };
+
+    BenchAllocationCounter allocations;
+    for (auto _ : state)
+    {
+        uint32_t id = bench.client.request(topic, payload, 1000, callback);
+        MqttRequestTable::formatId(id, &replyTopic[replyTopic.size() - MqttRequestTable::kIdLength]);
+        bench.fake->sendEvent(event);
+    }
+    allocations.report(state);
+    if (answered != (size_t)state.iterations())
+        state.SkipWithError("responses not matched");
+}
+BENCHMARK(BM_RequestRoundTrip);
+
+// subscribe() of an existing topic and its SUBACK, with range(0) subscriptions
+static void BM_SubscribeAndAck(benchmark::State &state)
+{
+    BenchClient bench;
+    std::vector<std::string> filters;
+    for (int i = 0; i < state.range(0); i++)
+    {
+        filters.push_back(makeFilter(i, GatewayFilters));
+        bench.client.subscribe(filters.back(), [](const MqttMessageView &) {});
+        bench.fake->subAck(bench.fake->lastMsgId());
+    }
+
+    size_t n = 0;
+    BenchAllocationCounter allocations;
+    for (auto _ : state)
+    {
+        bench.client.subscribe(filters[n++ % filters.size()], [](const MqttMessageView &) {});
+        bench.fake->subAck(bench.fake->lastMsgId());
+    }
+    allocations.report(state);
+}
+BENCHMARK(BM_SubscribeAndAck)->Arg(1)->Arg(10)->Arg(100)->Arg(1000);
+
+// SUBACK correlation while range(0) other subscriptions still wait for theirs (e.g. right after connecting)
+static void BM_SubAckWithPending(benchmark::State &state)
+{
+    BenchClient bench;
+    for (int i = 0; i < state.range(0); i++)
+        bench.client.subscribe(makeFilter(i, GatewayFilters), [](const MqttMessageView &) {});
+    bench.client.subscribe("bench/extra", [](const MqttMessageView &) {});
+
+    BenchAllocationCounter allocations;
+    for (auto _ : state)
+    {
+        bench.client.subscribe("bench/extra", [](const MqttMessageView &) {});
+        bench.fake->subAck(bench.fake->lastMsgId());
+    }
+    allocations.report(state);
+}
+BENCHMARK(BM_SubAckWithPending)->Arg(1)->Arg(10)->Arg(100)->Arg(1000);
+
+// isSubscriptionConfirmed() and getSubscriptionQos() of one of range(0) subscriptions, as a health check polls them
+static void BM_SubscriptionStateLookup(benchmark::State &state)
+{
+    BenchClient bench;
+    std::vector<std::string> filters;
+    for (int i = 0; i < state.range(0); i++)
+    {
+        filters.push_back(makeFilter(i, GatewayFilters));
+        bench.client.subscribe(filters.back(), [](const MqttMessageView &) {});
+        bench.fake->subAck(bench.fake->lastMsgId());
+    }
+
+    size_t n = 0;
+    BenchAllocationCounter allocations;
+    for (auto _ : state)
+    {
+        const std::string &filter = filters[(n++ * 7919) % filters.size()];
+        benchmark::DoNotOptimize(bench.client.isSubscriptionConfirmed(filter));
+        benchmark::DoNotOptimize(bench.client.getSubscriptionQos(filter));
+    }
+    allocations.report(state);
+}
+BENCHMARK(BM_SubscriptionStateLookup)->Arg(10)->Arg(100)->Arg(1000);
@@ -0,0 +1,200 @@
+// Compares the topic matcher, trie and topic index with the implementations they replaced.
+#include <benchmark/benchmark.h>
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "ESP32MQTTClientTopicIndex.h"
+#include "ESP32MQTTClientTopicMatch.h"
+#include "ESP32MQTTClientTopicTrie.h"
+#include "bench_allocations.h"
+
+namespace
+{
+    // Matcher used by the linear scan before the trie was introduced
+    bool legacyTopicMatch(const std::string &topic1, const std::string &topic2)
+    {
+        size_t i = 0;
+
+        if ((i = topic1.find('#')) != std::string::npos)
+        {
+            std::string t1a = topic1.substr(0, i);
+            std::string t1b = topic1.substr(i + 1);
+            if ((t1a.length() == 0 || topic2.rfind(t1a, 0) == 0) &&
+                (t1b.length() == 0 || (topic2.size() >= t1b.size() && topic2.compare(topic2.size() - t1b.size(), t1b.size(), t1b) == 0)))
+                return true;
+        }
+        else if ((i = topic1.find('+')) != std::string::npos)
+        {
+            std::string t1a = topic1.substr(0, i);
+            std::string t1b = topic1.substr(i + 1);
+
+            if ((t1a.length() == 0 || topic2.rfind(t1a, 0) == 0) &&
+                (t1b.length() == 0 || (topic2.size() >= t1b.size() && topic2.compare(topic2.size() - t1b.size(), t1b.size(), t1b) == 0)))
+            {
+                if (topic2.substr(t1a.length(), topic2.length() - t1b.length() - t1a.length()).find('/') == std::string::npos)
+                    return true;
+            }
+        }
+        else
+        {
+            return topic1 == topic2;
+        }
+
+        return false;
+    }
+
+    // Gateway-like subscription set: mostly exact topics, every 8th a '+' and every 16th a '#' filter
+    std::vector<std::string> makeFilters(int count)
+    {
+        std::vector<std::string> filters;
+        for (int i = 0; i < count; i++)
+        {
+            std::string dev = "site/dev" + std::to_string(i);
+            if (i % 16 == 15)
+                filters.push_back(dev + "/#");
+            else if (i % 8 == 7)
+                filters.push_back(dev + "/+/cmd");
+            else
+                filters.push_back(dev + "/sensor/temp");
+        }
+        return filters;
+    }
+
+    std::vector<std::string> makeTopics(int count)
+    {
+        std::vector<std::string> topics;
+        for (int i = 0; i < 64; i++)
+        {
+            int dev = (i * 7919) % count;
+            topics.push_back("site/dev" + std::to_string(dev) + (i % 2 ? "/sensor/temp" : "/relay/cmd"));
+        }
+        return topics;
+    }
+}
+
+static void BM_LinearScanDispatch(benchmark::State &state)
+{
+    std::vector<std::string> filters = makeFilters(state.range(0));
+    std::vector<std::string> topics = makeTopics(state.range(0));
+    size_t n = 0;
+    BenchAllocationCounter allocations;
+    for (auto _ : state)
+    {
+        const char *topic = topics[n++ % topics.size()].c_str();
+        int matches = 0;
+        for (size_t i = 0; i < filters.size(); i++)
+        {
+            if (legacyTopicMatch(filters[i], std::string(topic)))
+                matches++;
+        }
+        benchmark::DoNotOptimize(matches);
+    }
+    allocations.report(state);
+}
+BENCHMARK(BM_LinearScanDispatch)->Arg(1)->Arg(10)->Arg(150)->Arg(1000);
+
+static void BM_TrieDispatch(benchmark::State &state)
+{
+    std::vector<std::string> filters = makeFilters(state.range(0));
+    std::vector<std::string> topics = makeTopics(state.range(0));
+    MqttTopicTrie trie;
+    for (size_t i = 0; i < filters.size(); i++)
+        trie.insert(filters[i], i);
+
+    size_t n = 0;
+    BenchAllocationCounter allocations;
+    for (auto _ : state)
+    {
+        const std::string &topic = topics[n++ % topics.size()];
+        int matches = 0;
+        trie.match(topic.c_str(), topic.size(), [&matches](MqttTopicTrie::Value) { matches++; });
+        benchmark::DoNotOptimize(matches);
+    }
+    allocations.report(state);
+}
+BENCHMARK(BM_TrieDispatch)->Arg(1)->Arg(10)->Arg(150)->Arg(1000);
+
+// Lookup of a subscription by its filter string (isSubscriptionConfirmed(), SUBACK, unsubscribe())
+static void BM_LinearFilterLookup(benchmark::State &state)
+{
+    std::vector<std::string> filters = makeFilters(state.range(0));
+    size_t n = 0;
+    BenchAllocationCounter allocations;
+    for (auto _ : state)
+    {
+        const std::string &filter = filters[(n++ * 7919) % filters.size()];
+        size_t found = filters.size();
+        for (size_t i = 0; i < filters.size(); i++)
+        {
+            if (filters[i] == filter)
+            {
+                found = i;
+                break;
+            }
+        }
+        benchmark::DoNotOptimize(found);
+    }
+    allocations.report(state);
+}
+BENCHMARK(BM_LinearFilterLookup)->Arg(10)->Arg(100)->Arg(1000);
+
+static void BM_IndexFilterLookup(benchmark::State &state)
+{
+    std::vector<std::string> filters = makeFilters(state.range(0));
+    MqttTopicIndex index;
+    index.reset(filters.size());
+    for (size_t i = 0; i < filters.size(); i++)
+        index.insert(MqttTopicIndex::hash(filters[i]), i);
+
+    size_t n = 0;
+    BenchAllocationCounter allocations;
+    for (auto _ : state)
+    {
+        const std::string &filter = filters[(n++ * 7919) % filters.size()];
+        size_t found = index.find(MqttTopicIndex::hash(filter), [&](MqttTopicIndex::Value v) { return filters[v] == filter; });
+        benchmark::DoNotOptimize(found);
+    }
+    allocations.report(state);
+}
+BENCHMARK(BM_IndexFilterLookup)->Arg(10)->Arg(100)->Arg(1000);
+
+namespace
+{
+    struct MatchCase
+    {
+        const char *filter;
+        const char *topic;
+    };
+
+    const MatchCase matchCases[] = {
+        {"site/dev12/sensor/temp", "site/dev12/sensor/temp"},
+        {"site/dev12/+/cmd", "site/dev12/relay/cmd"},
+        {"site/#", "site/dev12/sensor/temp"},
+        {"site/dev13/sensor/temp", "site/dev12/sensor/temp"},
+    };
+}
+
+static void BM_LegacyTopicMatch(benchmark::State &state)
+{
+    const MatchCase &c = matchCases[state.range(0)];
+    std::string filter(c.filter);
+    BenchAllocationCounter allocations;
+    for (auto _ : state)
+        benchmark::DoNotOptimize(legacyTopicMatch(filter, std::string(c.topic)));
+    allocations.report(state);
+}
+BENCHMARK(BM_LegacyTopicMatch)->DenseRange(0, 3);
+
+static void BM_TopicMatch(benchmark::State &state)
+{
+    const MatchCase &c = matchCases[state.range(0)];
+    size_t filterLen = strlen(c.filter);
+    size_t topicLen = strlen(c.topic);
+    BenchAllocationCounter allocations;
+    for (auto _ : state)
+        benchmark::DoNotOptimize(mqttTopicMatches(c.filter, filterLen, c.topic, topicLen));
+    allocations.report(state);
+}
+BENCHMARK(BM_TopicMatch)->DenseRange(0, 3);
@@ -0,0 +1,755 @@
+#include "fake_mqtt_client.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+
+#include "ESP32MQTTClient.h"
+#include "esp_heap_caps.h"
+
+std::function<void(esp_mqtt_client_handle_t client)> fakeOnMqttConnect;
+
+namespace
+{
+    std::atomic<FakeMqttClient *> lastClient(nullptr);
+}
+
+// =============== Application functions the library expects ==============
+
+void onMqttConnect(esp_mqtt_client_handle_t client)
+{
+    if (fakeOnMqttConnect)
+        fakeOnMqttConnect(client);
+}
+
+void handleMQTT(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data)
+{
+    (void)base;
+    (void)event_id;
+    static_cast<ESP32MQTTClient *>(handler_args)->onEventCallback(static_cast<esp_mqtt_event_handle_t>(event_data));
+}
+
+// =============== FakeMqttClient ==============
+
+FakeMqttClient *FakeMqttClient::last()
+{
+    return lastClient.load();
+}
+
+FakeMqttClient *FakeMqttClient::from(esp_mqtt_client_handle_t handle)
+{
+    return reinterpret_cast<FakeMqttClient *>(handle);
+}
+
+FakeMqttClient::FakeMqttClient(const esp_mqtt_client_config_t &config)
+    : _config(config), _handler(nullptr), _handlerArg(nullptr), _started(false),
+      _nextMsgId(1), _failPublishes(0), _failSubscribes(0), _recording(true),
+      _writeDelayUs(0), _bytesWritten(0), _protocolErrors(0), _topicAliasMaximum(10),
+      _subscriptionIdsAvailable(true)
+{
+#ifdef CONFIG_MQTT_PROTOCOL_5
+    memset(&_publishProperty, 0, sizeof(_publishProperty));
+    memset(&_subscribeProperty, 0, sizeof(_subscribeProperty));
+#endif
+    lastClient = this;
+}
+
+FakeMqttClient::~FakeMqttClient()
+{
+    FakeMqttClient *self = this;
+    lastClient.compare_exchange_strong(self, nullptr);
+}
+
+esp_err_t FakeMqttClient::start()
+{
+    if (_started)
+        return ESP_FAIL;
+    _started = true;
+    return ESP_OK;
+}
+
+esp_err_t FakeMqttClient::stop()
+{
+    if (!_started)
+        return ESP_FAIL;
+    _started = false;
+    return ESP_OK;
+}
+
+int FakeMqttClient::publish(const char *topic, const char *data, int len, int qos, int retain)
+{
+    // esp-mqtt writes the packet on the calling task
+    uint32_t delayUs = _writeDelayUs.load();
+    if (delayUs > 0)
+    {
+        std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now() + std::chrono::microseconds(delayUs);
+        while (std::chrono::steady_clock::now() < end)
+        {
+        }
+    }
+
+    Publish publish;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_failPublishes > 0)
+        {
+            _failPublishes--;
+            return -1;
+        }
+        // Like esp-mqtt 5.1+, -2 once a QoS 1/2 message would take the outbox past its limit
+        if (qos > 0 && _config.outbox.limit > 0)
+        {
+            std::size_t length = len <= 0 && data != nullptr ? strlen(data) : (std::size_t)len;
+            if (outboxSizeLocked() + strlen(topic) + length > _config.outbox.limit)
+                return -2;
+        }
+
+        // Benchmarks do not keep records, only the byte count
+        if (!_recording)
+            return writeLocked(topic, data, len, qos, retain, nullptr);
+
+        writeLocked(topic, data, len, qos, retain, &publish);
+        _bytesWritten += publish.packetBytes;
+        if (qos > 0)
+            _unacked.push_back(_publishes.size());
+        _publishes.push_back(publish);
+    }
+
+    if (_publishHook)
+        _publishHook(publish);
+    return publish.msgId;
+}
+
+int FakeMqttClient::enqueue(const char *topic, const char *data, int len, int qos, int retain, bool store)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_failPublishes > 0)
+    {
+        _failPublishes--;
+        return -1;
+    }
+    // QoS 0 messages are only kept when asked to, esp-mqtt drops them otherwise
+    if (qos == 0 && !store)
+        return 0;
+    if (!_recording)
+        return qos > 0 ? _nextMsgId++ : 0;
+
+    if (len <= 0 && data != nullptr)
+        len = strlen(data);
+    // Like esp-mqtt 5.1+, -2 once the outbox would exceed its limit
+    if (_config.outbox.limit > 0 && outboxSizeLocked() + strlen(topic) + len > _config.outbox.limit)
+        return -2;
+    Publish publish;
+    writeLocked(topic, data, len, qos, retain, &publish);
+    _enqueued.push_back(publish);
+    return publish.msgId;
+}
+
+int FakeMqttClient::writeLocked(const char *topic, const char *data, int len, int qos, int retain, Publish *publish)
+{
+    // Like esp-mqtt, a length of 0 means data is a C string
+    if (len <= 0 && data != nullptr)
+        len = strlen(data);
+    if (data == nullptr)
+        len = 0;
+    std::size_t topicLen = topic ? strlen(topic) : 0;
+    int msgId = qos > 0 ? _nextMsgId++ : 0;
+    uint16_t topicAlias = 0;
+    const std::string *aliasTopic = nullptr;
+
+    // Variable header: topic, packet id and with MQTT 5 the properties
+    std::size_t properties = 0;
+#ifdef CONFIG_MQTT_PROTOCOL_5
+    topicAlias = _publishProperty.topic_alias;
+    if (topicAlias != 0)
+    {
+        properties += 3;
+        if (_topicAliases.size() <= topicAlias)
+            _topicAliases.resize(topicAlias + 1);
+        if (topicLen == 0)
+        {
+            aliasTopic = &_topicAliases[topicAlias];
+            if (aliasTopic->empty())
+                _protocolErrors++;
+        }
+        else
+        {
+            _topicAliases[topicAlias].assign(topic, topicLen);
+        }
+    }
+    // Identifier byte, two length bytes and the value
+    std::string responseTopic = _publishProperty.response_topic ? _publishProperty.response_topic : "";
+    std::string correlationData(_publishProperty.correlation_data ? _publishProperty.correlation_data : "",
+                                _publishProperty.correlation_data ? _publishProperty.correlation_data_len : 0);
+    if (!responseTopic.empty())
+        properties += 3 + responseTopic.size();
+    if (!correlationData.empty())
+        properties += 3 + correlationData.size();
+    memset(&_publishProperty, 0, sizeof(_publishProperty));
+#endif
+    std::size_t remaining = 2 + topicLen + (qos > 0 ? 2 : 0) + len;
+    if (isMqtt5())
+        remaining += properties + 1;
+    // Fixed header: type and flags, remaining length in 1 to 4 bytes
+    std::size_t lengthBytes = remaining < 128 ? 1 : remaining < 16384 ? 2 : remaining < 2097152 ? 3 : 4;
+
+    if (publish != nullptr)
+    {
+        publish->topic = aliasTopic ? *aliasTopic : std::string(topic ? topic : "", topicLen);
+        publish->payload.assign(data ? data : "", len);
+        publish->qos = qos;
+        publish->retain = retain != 0;
+        publish->msgId = msgId;
+        publish->topicAlias = topicAlias;
+        publish->aliasOnly = aliasTopic != nullptr;
+#ifdef CONFIG_MQTT_PROTOCOL_5
+        publish->responseTopic = responseTopic;
+        publish->correlationData = correlationData;
+#endif
+        publish->packetBytes = 1 + lengthBytes + remaining;
+    }
+    else
+    {
+        _bytesWritten += 1 + lengthBytes + remaining;
+    }
+    return msgId;
+}
+
+std::size_t FakeMqttClient::sendEnqueued()
+{
+    std::vector<Publish> sent;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        sent.swap(_enqueued);
+        for (std::size_t i = 0; i < sent.size(); i++)
+        {
+            _bytesWritten += sent[i].packetBytes;
+            if (sent[i].qos > 0)
+                _unacked.push_back(_publishes.size());
+            _publishes.push_back(sent[i]);
+        }
+    }
+    if (_publishHook)
+    {
+        for (std::size_t i = 0; i < sent.size(); i++)
+            _publishHook(sent[i]);
+    }
+    return sent.size();
+}
+
+std::size_t FakeMqttClient::outboxSize() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return outboxSizeLocked();
+}
+
+std::size_t FakeMqttClient::outboxSizeLocked() const
+{
+    std::size_t size = 0;
+    for (std::size_t i = 0; i < _enqueued.size(); i++)
+        size += _enqueued[i].topic.size() + _enqueued[i].payload.size();
+    for (std::size_t i = 0; i < _unacked.size(); i++)
+        size += _publishes[_unacked[i]].topic.size() + _publishes[_unacked[i]].payload.size();
+    return size;
+}
+
+int FakeMqttClient::takeSubscriptionIdLocked()
+{
+#ifdef CONFIG_MQTT_PROTOCOL_5
+    // esp-mqtt checks the CONNACK before it takes the properties, they stay pending
+    uint16_t subscriptionId = _subscribeProperty.subscribe_id;
+    if (subscriptionId != 0 && !_subscriptionIdsAvailable)
+        return -1;
+    memset(&_subscribeProperty, 0, sizeof(_subscribeProperty));
+    return subscriptionId;
+#else
+    return 0;
+#endif
+}
+
+int FakeMqttClient::subscribe(const char *topic, int qos)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_failSubscribes > 0)
+    {
+        _failSubscribes--;
+        return -1;
+    }
+    // Like esp-mqtt 5.1+, -2 once the packet would take the outbox past its limit
+    if (_config.outbox.limit > 0 && outboxSizeLocked() + strlen(topic) > _config.outbox.limit)
+        return -2;
+    int subscriptionId = takeSubscriptionIdLocked();
+    if (subscriptionId < 0)
+        return -1;
+    if (!_recording)
+        return _nextMsgId++;
+    Subscribe subscribe = {topic, qos, _nextMsgId++, (uint16_t)subscriptionId};
+    _subscribes.push_back(subscribe);
+    return subscribe.msgId;
+}
+
+int FakeMqttClient::subscribeMultiple(const esp_mqtt_topic_t *topics, int count)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_failSubscribes > 0)
+    {
+        _failSubscribes--;
+        return -1;
+    }
+    if (_config.outbox.limit > 0)
+    {
+        std::size_t size = outboxSizeLocked();
+        for (int i = 0; i < count; i++)
+            size += strlen(topics[i].filter);
+        if (size > _config.outbox.limit)
+            return -2;
+    }
+    int subscriptionId = takeSubscriptionIdLocked();
+    if (subscriptionId < 0)
+        return -1;
+    int msgId = _nextMsgId++;
+    if (_recording)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            Subscribe subscribe = {topics[i].filter, topics[i].qos, msgId, (uint16_t)subscriptionId};
+            _subscribes.push_back(subscribe);
+        }
+    }
+    return msgId;
+}
+
+int FakeMqttClient::unsubscribe(const char *topic)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _unsubscribes.push_back(topic);
+    return _nextMsgId++;
+}
+
+#ifdef CONFIG_MQTT_PROTOCOL_5
+esp_err_t FakeMqttClient::setPublishProperty(const esp_mqtt5_publish_property_config_t &property)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (!isMqtt5() || property.topic_alias > _topicAliasMaximum)
+        return ESP_FAIL;
+    _publishProperty = property;
+    return ESP_OK;
+}
+
+esp_err_t FakeMqttClient::setSubscribeProperty(const esp_mqtt5_subscribe_property_config_t &property)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (!isMqtt5())
+        return ESP_FAIL;
+    _subscribeProperty = property;
+    return ESP_OK;
+}
+#endif
+
+esp_err_t FakeMqttClient::registerEvent(esp_event_handler_t handler, void *arg)
+{
+    _handler = handler;
+    _handlerArg = arg;
+    return ESP_OK;
+}
+
+void FakeMqttClient::sendEvent(esp_mqtt_event_t &event)
+{
+    event.client = handle();
+    if (_handler != nullptr)
+        _handler(_handlerArg, "MQTT_EVENTS", event.event_id, &event);
+}
+
+void FakeMqttClient::connect(bool sessionPresent)
+{
+    {
+        // Topic aliases only live as long as the network connection
+        std::lock_guard<std::mutex> lock(_mutex);
+        _topicAliases.clear();
+    }
+    esp_mqtt_event_t event = {};
+    event.event_id = MQTT_EVENT_CONNECTED;
+    event.session_present = sessionPresent;
+    sendEvent(event);
+}
+
+void FakeMqttClient::disconnect()
+{
+    {
+        // The session is gone, esp-mqtt will not report these anymore
+        std::lock_guard<std::mutex> lock(_mutex);
+        _unacked.clear();
+        _topicAliases.clear();
+    }
+    esp_mqtt_event_t event = {};
+    event.event_id = MQTT_EVENT_DISCONNECTED;
+    sendEvent(event);
+}
+
+void FakeMqttClient::deliver(const std::string &topic, const std::string &payload, int qos, bool retain,
+                             std::size_t fragmentSize, int msgId, uint16_t subscriptionId)
+{
+#ifdef CONFIG_MQTT_PROTOCOL_5
+    // esp-mqtt passes the properties with every fragment
+    esp_mqtt5_event_property_t property = {};
+    property.subscribe_id = subscriptionId;
+    deliverEvents(topic, payload, qos, retain, fragmentSize, msgId, &property);
+#else
+    (void)subscriptionId;
+    deliverEvents(topic, payload, qos, retain, fragmentSize, msgId, nullptr);
+#endif
+}
+
+void FakeMqttClient::deliverWithProperties(const std::string &topic, const std::string &payload, const std::string &responseTopic,
+                                           const std::string &correlationData, int qos)
+{
+#ifdef CONFIG_MQTT_PROTOCOL_5
+    // Copies like the topic and payload, not NUL terminated in the esp-mqtt buffer either
+    std::vector<char> responseBuffer(responseTopic.begin(), responseTopic.end());
+    std::vector<char> correlationBuffer(correlationData.begin(), correlationData.end());
+    esp_mqtt5_event_property_t property = {};
+    property.response_topic = responseBuffer.empty() ? nullptr : responseBuffer.data();
+    property.response_topic_len = (int)responseBuffer.size();
+    property.correlation_data = correlationBuffer.empty() ? nullptr : correlationBuffer.data();
+    property.correlation_data_len = (uint16_t)correlationBuffer.size();
+    deliverEvents(topic, payload, qos, false, 0, 0, &property);
+#else
+    (void)responseTopic;
+    (void)correlationData;
+    deliverEvents(topic, payload, qos, false, 0, 0, nullptr);
+#endif
+}
+
+void FakeMqttClient::deliverEvents(const std::string &topic, const std::string &payload, int qos, bool retain,
+                                   std::size_t fragmentSize, int msgId, void *property)
+{
+    // Copies, so that the library cannot get away with writing into them
+    std::vector<char> topicBuffer(topic.begin(), topic.end());
+    std::vector<char> data(payload.begin(), payload.end());
+    if (fragmentSize == 0 || fragmentSize > payload.size())
+        fragmentSize = payload.size();
+
+    std::size_t offset = 0;
+    do
+    {
+        std::size_t length = std::min(fragmentSize, payload.size() - offset);
+        esp_mqtt_event_t event = {};
+        event.event_id = MQTT_EVENT_DATA;
+        // Only the first fragment carries the topic
+        event.topic = offset == 0 && !topicBuffer.empty() ? topicBuffer.data() : nullptr;
+        event.topic_len = offset == 0 ? topicBuffer.size() : 0;
+        event.data = data.empty() ? nullptr : data.data() + offset;
+        event.data_len = length;
+        event.total_data_len = payload.size();
+        event.current_data_offset = offset;
+        event.msg_id = msgId;
+        event.qos = qos;
+        event.retain = retain;
+#ifdef CONFIG_MQTT_PROTOCOL_5
+        event.property = static_cast<esp_mqtt5_event_property_t *>(property);
+#else
+        (void)property;
+#endif
+        sendEvent(event);
+        offset += length;
+    } while (offset < payload.size());
+}
+
+void FakeMqttClient::subAck(int msgId)
+{
+    esp_mqtt_event_t event = {};
+    event.event_id = MQTT_EVENT_SUBSCRIBED;
+    event.msg_id = msgId;
+    sendEvent(event);
+}
+
+void FakeMqttClient::pubAck(int msgId)
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (std::size_t i = 0; i < _unacked.size(); i++)
+        {
+            if (_publishes[_unacked[i]].msgId == msgId)
+            {
+                _unacked.erase(_unacked.begin() + i);
+                break;
+            }
+        }
+    }
+    esp_mqtt_event_t event = {};
+    event.event_id = MQTT_EVENT_PUBLISHED;
+    event.msg_id = msgId;
+    sendEvent(event);
+}
+
+std::size_t FakeMqttClient::ackAllPublishes()
+{
+    std::vector<int> msgIds;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (std::size_t i = 0; i < _unacked.size(); i++)
+            msgIds.push_back(_publishes[_unacked[i]].msgId);
+    }
+    for (std::size_t i = 0; i < msgIds.size(); i++)
+        pubAck(msgIds[i]);
+    return msgIds.size();
+}
+
+void FakeMqttClient::error(esp_mqtt_error_type_t type)
+{
+    esp_mqtt_error_codes_t codes = {};
+    codes.error_type = type;
+    esp_mqtt_event_t event = {};
+    event.event_id = MQTT_EVENT_ERROR;
+    event.error_handle = &codes;
+    sendEvent(event);
+}
+
+std::vector<FakeMqttClient::Publish> FakeMqttClient::publishes() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _publishes;
+}
+
+std::vector<FakeMqttClient::Subscribe> FakeMqttClient::subscribes() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _subscribes;
+}
+
+std::vector<std::string> FakeMqttClient::unsubscribes() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _unsubscribes;
+}
+
+void FakeMqttClient::clearRecords()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _publishes.clear();
+    _unacked.clear();
+    _enqueued.clear();
+    _subscribes.clear();
+    _unsubscribes.clear();
+}
+
+// =============== esp-mqtt API ==============
+
+esp_mqtt_client_handle_t esp_mqtt_client_init(const esp_mqtt_client_config_t *config)
+{
+    return (new FakeMqttClient(*config))->handle();
+}
+
+esp_err_t esp_mqtt_client_start(esp_mqtt_client_handle_t client)
+{
+    return FakeMqttClient::from(client)->start();
+}
+
+esp_err_t esp_mqtt_client_stop(esp_mqtt_client_handle_t client)
+{
+    return FakeMqttClient::from(client)->stop();
+}
+
+esp_err_t esp_mqtt_client_destroy(esp_mqtt_client_handle_t client)
+{
+    delete FakeMqttClient::from(client);
+    return ESP_OK;
+}
+
+int esp_mqtt_client_publish(esp_mqtt_client_handle_t client, const char *topic, const char *data, int len, int qos, int retain)
+{
+    return FakeMqttClient::from(client)->publish(topic, data, len, qos, retain);
+}
+
+int esp_mqtt_client_enqueue(esp_mqtt_client_handle_t client, const char *topic, const char *data, int len, int qos, int retain, bool store)
+{
+    return FakeMqttClient::from(client)->enqueue(topic, data, len, qos, retain, store);
+}
+
+int esp_mqtt_client_get_outbox_size(esp_mqtt_client_handle_t client)
+{
+    return (int)FakeMqttClient::from(client)->outboxSize();
+}
+
+int esp_mqtt_client_subscribe(esp_mqtt_client_handle_t client, const char *topic, int qos)
+{
+    return FakeMqttClient::from(client)->subscribe(topic, qos);
+}
+
+int esp_mqtt_client_subscribe_multiple(esp_mqtt_client_handle_t client, const esp_mqtt_topic_t *topic_list, int size)
+{
+    return FakeMqttClient::from(client)->subscribeMultiple(topic_list, size);
+}
+
+int esp_mqtt_client_unsubscribe(esp_mqtt_client_handle_t client, const char *topic)
+{
+    return FakeMqttClient::from(client)->unsubscribe(topic);
+}
+
+#ifdef CONFIG_MQTT_PROTOCOL_5
+esp_err_t esp_mqtt5_client_set_publish_property(esp_mqtt5_client_handle_t client, const esp_mqtt5_publish_property_config_t *property)
+{
+    return FakeMqttClient::from(client)->setPublishProperty(*property);
+}
+
+esp_err_t esp_mqtt5_client_set_subscribe_property(esp_mqtt5_client_handle_t client, const esp_mqtt5_subscribe_property_config_t *property)
+{
+    return FakeMqttClient::from(client)->setSubscribeProperty(*property);
+}
+#endif
+
+esp_err_t esp_mqtt_client_register_event(esp_mqtt_client_handle_t client, esp_mqtt_event_id_t event, esp_event_handler_t event_handler, void *event_handler_arg)
+{
+    (void)event;
+    return FakeMqttClient::from(client)->registerEvent(event_handler, event_handler_arg);
+}
+
+// =============== esp_timer, heap_caps and esp_log ==============
+
+struct esp_timer
+{
+    esp_timer_cb_t callback;
+    void *arg;
+    bool active;
+    bool periodic;
+    uint64_t period;
+    int64_t due;
+};
+
+namespace
+{
+    std::atomic<int64_t> fakeNow(1000000); // Time 0 is rarely a good test case
+    std::mutex timerMutex;
+    std::vector<esp_timer *> timers;
+}
+
+void FakeEsp::advanceTime(int64_t us)
+{
+    int64_t target = fakeNow + us;
+    for (;;)
+    {
+        esp_timer *next = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(timerMutex);
+            for (std::size_t i = 0; i < timers.size(); i++)
+            {
+                if (timers[i]->active && timers[i]->due <= target && (next == nullptr || timers[i]->due < next->due))
+                    next = timers[i];
+            }
+            if (next == nullptr)
+                break;
+
+            fakeNow = std::max(fakeNow.load(), next->due);
+            if (next->periodic)
+                next->due += next->period > 0 ? next->period : 1;
+            else
+                next->active = false;
+        }
+        // Without the lock, the callback usually stops or restarts timers
+        next->callback(next->arg);
+    }
+    fakeNow = target;
+}
+
+std::size_t FakeEsp::activeTimers()
+{
+    std::lock_guard<std::mutex> lock(timerMutex);
+    std::size_t active = 0;
+    for (std::size_t i = 0; i < timers.size(); i++)
+        active += timers[i]->active ? 1 : 0;
+    return active;
+}
+
+void FakeEsp::reset()
+{
+    fakeNow = 1000000;
+}
+
+int64_t esp_timer_get_time(void)
+{
+    return fakeNow;
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *create_args, esp_timer_handle_t *out_handle)
+{
+    if (create_args == nullptr || create_args->callback == nullptr || out_handle == nullptr)
+        return ESP_ERR_INVALID_ARG;
+
+    esp_timer *timer = new esp_timer();
+    timer->callback = create_args->callback;
+    timer->arg = create_args->arg;
+    timer->active = false;
+    timer->periodic = false;
+    timer->period = 0;
+    timer->due = 0;
+
+    std::lock_guard<std::mutex> lock(timerMutex);
+    timers.push_back(timer);
+    *out_handle = timer;
+    return ESP_OK;
+}
+
+static esp_err_t startTimer(esp_timer_handle_t timer, uint64_t us, bool periodic)
+{
+    std::lock_guard<std::mutex> lock(timerMutex);
+    if (timer->active)
+        return ESP_ERR_INVALID_STATE;
+    timer->active = true;
+    timer->periodic = periodic;
+    timer->period = us;
+    timer->due = fakeNow + us;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us)
+{
+    return startTimer(timer, timeout_us, false);
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period)
+{
+    return startTimer(timer, period, true);
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer)
+{
+    std::lock_guard<std::mutex> lock(timerMutex);
+    if (!timer->active)
+        return ESP_ERR_INVALID_STATE;
+    timer->active = false;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer)
+{
+    std::lock_guard<std::mutex> lock(timerMutex);
+    if (timer->active)
+        return ESP_ERR_INVALID_STATE;
+    timers.erase(std::remove(timers.begin(), timers.end(), timer), timers.end());
+    delete timer;
+    return ESP_OK;
+}
+
+bool esp_timer_is_active(esp_timer_handle_t timer)
+{
+    std::lock_guard<std::mutex> lock(timerMutex);
+    return timer->active;
+}
+
+void *heap_caps_malloc(size_t size, uint32_t caps)
+{
+    if (caps & MALLOC_CAP_SPIRAM)
+        return nullptr;
+    return malloc(size);
+}
+
+void esp_log_write(esp_log_level_t, const char *, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+}
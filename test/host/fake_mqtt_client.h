@@ -0,0 +1,168 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "esp_timer.h"
+#include "mqtt_client.h"
+
+/**
+ * @brief Scriptable stand-in for an esp-mqtt client on the host
+ *
+ * Every esp_mqtt_client_init() creates one. It records what the library sends
+ * (publishes, subscriptions) and injects events into the handler registered with
+ * esp_mqtt_client_register_event(), synchronously on the calling thread, the way
+ * the MQTT task would. No network or broker is involved; msg_ids count up from 1.
+ */
+class FakeMqttClient
+{
+public:
+    struct Publish
+    {
+        std::string topic;
+        std::string payload;
+        int qos;
+        bool retain;
+        int msgId; // 0 for QoS 0
+        uint16_t topicAlias;     // MQTT 5 topic alias sent with the message, 0 for none
+        bool aliasOnly;          // Only the alias was sent, topic is the one the broker resolved it to
+        std::string responseTopic;   // MQTT 5 response topic sent with the message, empty for none
+        std::string correlationData; // MQTT 5 correlation data, empty for none
+        std::size_t packetBytes; // Size of the PUBLISH packet on the wire
+    };
+
+    struct Subscribe
+    {
+        std::string topic;
+        int qos;
+        int msgId; // Shared by the topics of a multi-topic SUBSCRIBE
+        uint16_t subscriptionId; // MQTT 5 subscription identifier, like msgId one per packet; 0 for none
+    };
+
+    // The client created last, nullptr before the first esp_mqtt_client_init()
+    static FakeMqttClient *last();
+    static FakeMqttClient *from(esp_mqtt_client_handle_t handle);
+    esp_mqtt_client_handle_t handle() { return reinterpret_cast<esp_mqtt_client_handle_t>(this); }
+
+    // Events, delivered to the registered handler
+
+    void connect(bool sessionPresent = false);
+    void disconnect();
+    // Delivered in fragments of at most fragmentSize bytes, like a payload larger than the input buffer;
+    // subscriptionId is the identifier of the subscription the broker matched (MQTT 5)
+    void deliver(const std::string &topic, const std::string &payload, int qos = 0, bool retain = false,
+                 std::size_t fragmentSize = 0, int msgId = 0, uint16_t subscriptionId = 0);
+    // Delivered with the MQTT 5 response topic and correlation data properties, in one piece
+    void deliverWithProperties(const std::string &topic, const std::string &payload, const std::string &responseTopic,
+                               const std::string &correlationData, int qos = 0);
+    void subAck(int msgId);
+    void pubAck(int msgId);
+    std::size_t ackAllPublishes(); // PUBACK for every QoS 1/2 publish not acknowledged yet
+    void error(esp_mqtt_error_type_t type);
+    void sendEvent(esp_mqtt_event_t &event);
+
+    // Script esp-mqtt's answers
+
+    void failPublishes(int count) { std::lock_guard<std::mutex> lock(_mutex); _failPublishes = count; }   // The next count publishes return -1
+    void failSubscribes(int count) { std::lock_guard<std::mutex> lock(_mutex); _failSubscribes = count; } // The next count SUBSCRIBE packets return -1
+    void setPublishHook(std::function<void(const Publish &)> hook) { _publishHook = hook; }                // Called for every accepted publish
+    void setRecording(bool record) { std::lock_guard<std::mutex> lock(_mutex); _recording = record; }      // Benchmarks turn keeping records off
+    void setWriteDelay(uint32_t us) { _writeDelayUs = us; } // esp_mqtt_client_publish() spins this long, like a socket write on a slow link
+    void setTopicAliasMaximum(uint16_t maximum) { std::lock_guard<std::mutex> lock(_mutex); _topicAliasMaximum = maximum; } // Announced by the broker in CONNACK, 10 like Mosquitto
+    void setSubscriptionIdsAvailable(bool available) { std::lock_guard<std::mutex> lock(_mutex); _subscriptionIdsAvailable = available; } // Also from CONNACK, true like Mosquitto
+
+    // What the MQTT task does with enqueued messages
+
+    std::size_t sendEnqueued(); // Writes the esp_mqtt_client_enqueue() messages, they show up in publishes() from then on
+    std::size_t outboxSize() const; // Bytes of enqueued and unacknowledged QoS 1/2 messages
+
+    // What the library did, copies taken under the lock
+
+    std::vector<Publish> publishes() const;
+    std::vector<Subscribe> subscribes() const;
+    std::vector<std::string> unsubscribes() const;
+    void clearRecords();
+
+    uint64_t bytesWritten() const { std::lock_guard<std::mutex> lock(_mutex); return _bytesWritten; } // PUBLISH packets, also counted while not recording
+    int protocolErrors() const { std::lock_guard<std::mutex> lock(_mutex); return _protocolErrors; }  // Publishes with an alias the broker does not know
+
+    int lastMsgId() const { std::lock_guard<std::mutex> lock(_mutex); return _nextMsgId - 1; } // Also counted while not recording
+    const esp_mqtt_client_config_t &config() const { return _config; }
+    bool isStarted() const { return _started; }
+
+    // esp-mqtt API backend
+
+    explicit FakeMqttClient(const esp_mqtt_client_config_t &config);
+    ~FakeMqttClient();
+    esp_err_t start();
+    esp_err_t stop();
+    int publish(const char *topic, const char *data, int len, int qos, int retain);
+    int enqueue(const char *topic, const char *data, int len, int qos, int retain, bool store);
+    int subscribe(const char *topic, int qos);
+    int subscribeMultiple(const esp_mqtt_topic_t *topics, int count);
+    int unsubscribe(const char *topic);
+#ifdef CONFIG_MQTT_PROTOCOL_5
+    esp_err_t setPublishProperty(const esp_mqtt5_publish_property_config_t &property);
+    esp_err_t setSubscribeProperty(const esp_mqtt5_subscribe_property_config_t &property);
+#endif
+    esp_err_t registerEvent(esp_event_handler_t handler, void *arg);
+
+private:
+    std::size_t outboxSizeLocked() const;
+    bool isMqtt5() const { return _config.session.protocol_ver == MQTT_PROTOCOL_V_5; }
+    // Takes the pending MQTT 5 properties and resolves the topic alias the way the broker does; fills in
+    // publish or, without one, only adds the packet size to the byte count. Returns the msg_id.
+    int writeLocked(const char *topic, const char *data, int len, int qos, int retain, Publish *publish);
+    // Subscription identifier of the SUBSCRIBE being sent, -1 if esp-mqtt refuses to send it
+    int takeSubscriptionIdLocked();
+    void deliverEvents(const std::string &topic, const std::string &payload, int qos, bool retain, std::size_t fragmentSize,
+                       int msgId, void *property);
+
+    esp_mqtt_client_config_t _config;
+    esp_event_handler_t _handler;
+    void *_handlerArg;
+    bool _started;
+
+    mutable std::mutex _mutex;
+    int _nextMsgId;
+    int _failPublishes;
+    int _failSubscribes;
+    bool _recording;
+    std::vector<Publish> _publishes;
+    std::vector<std::size_t> _unacked; // Indices into _publishes
+    std::vector<Publish> _enqueued;    // Not written yet
+    std::atomic<uint32_t> _writeDelayUs;
+    std::vector<Subscribe> _subscribes;
+    std::vector<std::string> _unsubscribes;
+    std::function<void(const Publish &)> _publishHook;
+    uint64_t _bytesWritten;
+    int _protocolErrors;
+    uint16_t _topicAliasMaximum;
+    std::vector<std::string> _topicAliases; // Of this connection, indexed by alias
+    bool _subscriptionIdsAvailable;
+#ifdef CONFIG_MQTT_PROTOCOL_5
+    esp_mqtt5_publish_property_config_t _publishProperty; // Pending, all zero once used
+    esp_mqtt5_subscribe_property_config_t _subscribeProperty; // Same for the next SUBSCRIBE
+#endif
+};
+
+/**
+ * @brief Fake clock and esp_timer backend
+ *
+ * esp_timer_get_time() only moves when advanceTime() is called, which also runs
+ * the callbacks of the timers that fall due, on the calling thread.
+ */
+namespace FakeEsp
+{
+    void advanceTime(int64_t us);
+    std::size_t activeTimers();
+    // Reset the clock; call with no client alive
+    void reset();
+}
+
+// Application side of the library, onMqttConnect() calls this if set
+extern std::function<void(esp_mqtt_client_handle_t client)> fakeOnMqttConnect;
@@ -0,0 +1,8 @@
+// Host build shim: subset of the ESP-IDF API used by ESP32MQTTClient
+#pragma once
+
+#include <stdint.h>
+#include "esp_err.h"
+
+typedef const char *esp_event_base_t;
+typedef void (*esp_event_handler_t)(void *event_handler_arg, esp_event_base_t event_base, int32_t event_id, void *event_data);
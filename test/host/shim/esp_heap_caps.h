@@ -0,0 +1,21 @@
+// Host build shim: subset of the ESP-IDF API used by ESP32MQTTClient
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MALLOC_CAP_8BIT (1 << 2)
+#define MALLOC_CAP_SPIRAM (1 << 10)
+#define MALLOC_CAP_INTERNAL (1 << 11)
+#define MALLOC_CAP_DEFAULT (1 << 12)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// The host has no PSRAM: requests for MALLOC_CAP_SPIRAM fail, the rest is malloc()
+void *heap_caps_malloc(size_t size, uint32_t caps);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,13 @@
+// Host build shim: subset of the ESP-IDF API used by ESP32MQTTClient
+#pragma once
+
+#define ESP_IDF_VERSION_VAL(major, minor, patch) (((major) << 16) | ((minor) << 8) | (patch))
+
+// The host build follows IDF 5.x, override with -DESP_IDF_VERSION_MAJOR=... to check other branches
+#ifndef ESP_IDF_VERSION_MAJOR
+#define ESP_IDF_VERSION_MAJOR 5
+#define ESP_IDF_VERSION_MINOR 3
+#define ESP_IDF_VERSION_PATCH 0
+#endif
+
+#define ESP_IDF_VERSION ESP_IDF_VERSION_VAL(ESP_IDF_VERSION_MAJOR, ESP_IDF_VERSION_MINOR, ESP_IDF_VERSION_PATCH)
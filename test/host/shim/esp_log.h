@@ -0,0 +1,30 @@
+// Host build shim: subset of the ESP-IDF API used by ESP32MQTTClient
+#pragma once
+
+#include <stdio.h>
+
+typedef enum {
+    ESP_LOG_NONE,
+    ESP_LOG_ERROR,
+    ESP_LOG_WARN,
+    ESP_LOG_INFO,
+    ESP_LOG_DEBUG,
+    ESP_LOG_VERBOSE
+} esp_log_level_t;
+
+#define ESP_LOGE(tag, format, ...) fprintf(stderr, "E (%s) " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) fprintf(stderr, "W (%s) " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) fprintf(stderr, "I (%s) " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) fprintf(stderr, "D (%s) " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGV(tag, format, ...) fprintf(stderr, "V (%s) " format "\n", tag, ##__VA_ARGS__)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Printed to stderr by the fake, regardless of the level
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...);
+
+#ifdef __cplusplus
+}
+#endif
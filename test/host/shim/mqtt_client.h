@@ -0,0 +1,219 @@
+// Host build shim: subset of the esp-mqtt API (IDF 5.x layout) used by ESP32MQTTClient
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_err.h"
+#include "esp_event.h"
+#include "esp_idf_version.h"
+
+// Like the sdkconfig.h of a build with MQTT 5 enabled in menuconfig, which esp-mqtt supports from IDF 5.1 on
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 1, 0) && !defined(CONFIG_MQTT_PROTOCOL_5)
+#define CONFIG_MQTT_PROTOCOL_5 1
+#endif
+
+typedef struct esp_mqtt_client *esp_mqtt_client_handle_t;
+
+#ifdef CONFIG_MQTT_PROTOCOL_5
+typedef struct mqtt5_user_property_list_t *mqtt5_user_property_handle_t;
+
+// MQTT 5 properties of an inbound message, not NUL terminated
+typedef struct esp_mqtt5_event_property_t {
+    bool payload_format_indicator;
+    char *response_topic;
+    int response_topic_len;
+    char *correlation_data;
+    uint16_t correlation_data_len;
+    char *content_type;
+    int content_type_len;
+    uint16_t subscribe_id; // Subscription identifier of the SUBSCRIBE the message matched, 0 if none
+    mqtt5_user_property_handle_t user_property;
+} esp_mqtt5_event_property_t;
+#endif
+
+typedef enum esp_mqtt_event_id_t {
+    MQTT_EVENT_ANY = -1,
+    MQTT_EVENT_ERROR = 0,
+    MQTT_EVENT_CONNECTED,
+    MQTT_EVENT_DISCONNECTED,
+    MQTT_EVENT_SUBSCRIBED,
+    MQTT_EVENT_UNSUBSCRIBED,
+    MQTT_EVENT_PUBLISHED,
+    MQTT_EVENT_DATA,
+    MQTT_EVENT_BEFORE_CONNECT,
+    MQTT_EVENT_DELETED,
+    MQTT_USER_EVENT,
+} esp_mqtt_event_id_t;
+
+typedef enum esp_mqtt_connect_return_code_t {
+    MQTT_CONNECTION_ACCEPTED = 0,
+    MQTT_CONNECTION_REFUSE_PROTOCOL,
+    MQTT_CONNECTION_REFUSE_ID_REJECTED,
+    MQTT_CONNECTION_REFUSE_SERVER_UNAVAILABLE,
+    MQTT_CONNECTION_REFUSE_BAD_USERNAME,
+    MQTT_CONNECTION_REFUSE_NOT_AUTHORIZED
+} esp_mqtt_connect_return_code_t;
+
+typedef enum esp_mqtt_error_type_t {
+    MQTT_ERROR_TYPE_NONE = 0,
+    MQTT_ERROR_TYPE_TCP_TRANSPORT,
+    MQTT_ERROR_TYPE_CONNECTION_REFUSED,
+    MQTT_ERROR_TYPE_SUBSCRIBE_FAILED
+} esp_mqtt_error_type_t;
+
+typedef enum esp_mqtt_protocol_ver_t {
+    MQTT_PROTOCOL_UNDEFINED = 0,
+    MQTT_PROTOCOL_V_3_1,
+    MQTT_PROTOCOL_V_3_1_1,
+    MQTT_PROTOCOL_V_5,
+} esp_mqtt_protocol_ver_t;
+
+typedef struct esp_mqtt_error_codes {
+    esp_err_t esp_tls_last_esp_err;
+    int esp_tls_stack_err;
+    int esp_tls_cert_verify_flags;
+    esp_mqtt_error_type_t error_type;
+    esp_mqtt_connect_return_code_t connect_return_code;
+    int esp_transport_sock_errno;
+} esp_mqtt_error_codes_t;
+
+typedef struct esp_mqtt_event_t {
+    esp_mqtt_event_id_t event_id;
+    esp_mqtt_client_handle_t client;
+    char *data;
+    int data_len;
+    int total_data_len;
+    int current_data_offset;
+    char *topic;
+    int topic_len;
+    int msg_id;
+    int session_present;
+    esp_mqtt_error_codes_t *error_handle;
+    bool retain;
+    int qos;
+    bool dup;
+    esp_mqtt_protocol_ver_t protocol_ver;
+#ifdef CONFIG_MQTT_PROTOCOL_5
+    esp_mqtt5_event_property_t *property;
+#endif
+} esp_mqtt_event_t;
+
+typedef esp_mqtt_event_t *esp_mqtt_event_handle_t;
+
+typedef struct esp_mqtt_client_config_t {
+    struct broker_t {
+        struct address_t {
+            const char *uri;
+            const char *hostname;
+            uint32_t port;
+        } address;
+        struct verification_t {
+            const char *certificate;
+            size_t certificate_len;
+        } verification;
+    } broker;
+    struct credentials_t {
+        const char *username;
+        const char *client_id;
+        struct authentication_t {
+            const char *password;
+            const char *certificate;
+            size_t certificate_len;
+            const char *key;
+            size_t key_len;
+        } authentication;
+    } credentials;
+    struct session_t {
+        struct last_will_t {
+            const char *topic;
+            const char *msg;
+            int msg_len;
+            int qos;
+            int retain;
+        } last_will;
+        bool disable_clean_session;
+        int keepalive;
+        bool disable_keepalive;
+        esp_mqtt_protocol_ver_t protocol_ver;
+    } session;
+    struct network_t {
+        int reconnect_timeout_ms;
+        int timeout_ms;
+        bool disable_auto_reconnect;
+    } network;
+    struct task_t {
+        int priority;
+        int stack_size;
+    } task;
+    struct buffer_t {
+        int size;
+        int out_size;
+    } buffer;
+    struct outbox_config_t {
+        uint64_t limit; // IDF 5.1+
+    } outbox;
+} esp_mqtt_client_config_t;
+
+// Topic of a multi-topic SUBSCRIBE (IDF 5.1+)
+typedef struct topic_t {
+    const char *filter;
+    int qos;
+} esp_mqtt_topic_t;
+
+#ifdef CONFIG_MQTT_PROTOCOL_5
+// MQTT 5 extensions (mqtt5_client.h)
+typedef struct esp_mqtt_client *esp_mqtt5_client_handle_t;
+
+// Properties of the next publish, esp-mqtt forgets them once it was made
+typedef struct {
+    bool payload_format_indicator;
+    uint32_t message_expiry_interval;
+    uint16_t topic_alias;
+    const char *response_topic;
+    const char *correlation_data;
+    uint16_t correlation_data_len;
+    const char *content_type;
+    mqtt5_user_property_handle_t user_property;
+} esp_mqtt5_publish_property_config_t;
+
+// Properties of the next SUBSCRIBE, one set for all of its topics
+typedef struct {
+    uint16_t subscribe_id;
+    bool no_local_flag;
+    bool retain_as_published_flag;
+    uint8_t retain_handle;
+    bool is_share_subscribe;
+    const char *share_name;
+    mqtt5_user_property_handle_t user_property;
+} esp_mqtt5_subscribe_property_config_t;
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Implemented by the scriptable fake (fake_mqtt_client.h)
+esp_mqtt_client_handle_t esp_mqtt_client_init(const esp_mqtt_client_config_t *config);
+esp_err_t esp_mqtt_client_start(esp_mqtt_client_handle_t client);
+esp_err_t esp_mqtt_client_stop(esp_mqtt_client_handle_t client);
+esp_err_t esp_mqtt_client_destroy(esp_mqtt_client_handle_t client);
+int esp_mqtt_client_publish(esp_mqtt_client_handle_t client, const char *topic, const char *data, int len, int qos, int retain);
+int esp_mqtt_client_enqueue(esp_mqtt_client_handle_t client, const char *topic, const char *data, int len, int qos, int retain, bool store);
+int esp_mqtt_client_get_outbox_size(esp_mqtt_client_handle_t client);
+int esp_mqtt_client_subscribe(esp_mqtt_client_handle_t client, const char *topic, int qos);
+int esp_mqtt_client_subscribe_multiple(esp_mqtt_client_handle_t client, const esp_mqtt_topic_t *topic_list, int size);
+int esp_mqtt_client_unsubscribe(esp_mqtt_client_handle_t client, const char *topic);
+#ifdef CONFIG_MQTT_PROTOCOL_5
+// ESP_FAIL if not connected with MQTT 5 or topic_alias is above the broker's Topic Alias Maximum
+esp_err_t esp_mqtt5_client_set_publish_property(esp_mqtt5_client_handle_t client, const esp_mqtt5_publish_property_config_t *property);
+// The subscribe calls return -1 while a subscribe_id is pending and the broker announced no support for them
+esp_err_t esp_mqtt5_client_set_subscribe_property(esp_mqtt5_client_handle_t client, const esp_mqtt5_subscribe_property_config_t *property);
+#endif
+esp_err_t esp_mqtt_client_register_event(esp_mqtt_client_handle_t client, esp_mqtt_event_id_t event, esp_event_handler_t event_handler, void *event_handler_arg);
+
+#ifdef __cplusplus
+}
+#endif
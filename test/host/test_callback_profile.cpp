@@ -0,0 +1,88 @@
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ESP32MQTTClient.h"
+#include "fake_mqtt_client.h"
+
+#ifndef ESP32MQTTCLIENT_PROFILE_CALLBACKS
+#error "Build with ESP32MQTTCLIENT_PROFILE_CALLBACKS"
+#endif
+
+namespace
+{
+    class CallbackProfileTest : public ::testing::Test
+    {
+    protected:
+        void SetUp() override
+        {
+            FakeEsp::reset();
+            client.reset(new ESP32MQTTClient());
+            client->setURI("mqtt://broker.local");
+            client->loopStart();
+            fake = FakeMqttClient::last();
+            fake->connect();
+        }
+
+        std::unique_ptr<ESP32MQTTClient> client;
+        FakeMqttClient *fake;
+    };
+
+    // Callback that takes as long as the payload says, in microseconds of fake time
+    void busy(const MqttMessageView &message)
+    {
+        FakeEsp::advanceTime(std::stoi(std::string(message.payload, message.payloadLen)));
+    }
+}
+
+TEST_F(CallbackProfileTest, SortsSubscriptionsByTotalTime)
+{
+    client->subscribe("a", busy);
+    client->subscribe("b", busy);
+    client->subscribe("c", busy);
+
+    for (int i = 0; i < 100; i++)
+        fake->deliver("a", "10");
+    fake->deliver("b", "5000");
+    for (int i = 0; i < 99; i++)
+        fake->deliver("c", "20");
+    fake->deliver("c", "2000");
+
+    std::vector<MqttCallbackProfile> profile = client->getCallbackProfile();
+    ASSERT_EQ(profile.size(), 3u);
+    EXPECT_EQ(profile[0].topic, "b");
+    EXPECT_EQ(profile[1].topic, "c");
+    EXPECT_EQ(profile[2].topic, "a");
+
+    EXPECT_EQ(profile[1].calls, 100u);
+    EXPECT_EQ(profile[1].totalUs, 99u * 20 + 2000);
+    EXPECT_EQ(profile[1].meanUs, 39u);
+    EXPECT_EQ(profile[1].maxUs, 2000u);
+    EXPECT_EQ(profile[1].p99Us, 31u); // Upper bound of the [16, 32) bucket
+
+    EXPECT_EQ(profile[2].calls, 100u);
+    EXPECT_EQ(profile[2].maxUs, 10u);
+    EXPECT_EQ(profile[2].p99Us, 10u);
+
+    std::vector<MqttCallbackProfile> slowest = client->getCallbackProfile(1);
+    ASSERT_EQ(slowest.size(), 1u);
+    EXPECT_EQ(slowest[0].topic, "b");
+    client->logCallbackProfile(2);
+}
+
+TEST_F(CallbackProfileTest, ResetStartsOver)
+{
+    client->subscribe("a", busy);
+    fake->deliver("a", "100");
+    client->resetCallbackProfile();
+    fake->deliver("a", "7");
+
+    std::vector<MqttCallbackProfile> profile = client->getCallbackProfile();
+    ASSERT_EQ(profile.size(), 1u);
+    EXPECT_EQ(profile[0].calls, 1u);
+    EXPECT_EQ(profile[0].maxUs, 7u);
+    // The always-on statistics are not reset
+    EXPECT_EQ(client->getStats().subscriptions[0].maxCallbackUs, 100u);
+}
@@ -0,0 +1,1406 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ESP32MQTTClient.h"
+#include "fake_mqtt_client.h"
+
+namespace
+{
+    bool waitFor(const std::function<bool()> &condition)
+    {
+        for (int i = 0; i < 2000; i++)
+        {
+            if (condition())
+                return true;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return false;
+    }
+
+    class ClientTest : public ::testing::Test
+    {
+    protected:
+        void SetUp() override
+        {
+            FakeEsp::reset();
+            fakeOnMqttConnect = nullptr;
+            client.reset(new ESP32MQTTClient());
+            client->setURI("mqtt://broker.local:1883", "user", "secret");
+            client->setMqttClientName("host-test");
+        }
+
+        void TearDown() override
+        {
+            client.reset();
+            fakeOnMqttConnect = nullptr;
+        }
+
+        // loopStart() and the CONNECTED event
+        FakeMqttClient &start()
+        {
+            EXPECT_TRUE(client->loopStart());
+            FakeMqttClient *fake = FakeMqttClient::last();
+            EXPECT_NE(fake, nullptr);
+            fake->connect();
+            return *fake;
+        }
+
+        std::unique_ptr<ESP32MQTTClient> client;
+    };
+}
+
+TEST_F(ClientTest, LoopStartConfiguresEspMqtt)
+{
+    client->setMaxPacketSize(2048);
+    client->setKeepAlive(30);
+    client->enableLastWillMessage("dev/status", "offline", true);
+    ASSERT_TRUE(client->loopStart());
+
+    FakeMqttClient *fake = FakeMqttClient::last();
+    ASSERT_NE(fake, nullptr);
+    EXPECT_TRUE(fake->isStarted());
+    EXPECT_TRUE(client->isMyTurn(fake->handle()));
+    const esp_mqtt_client_config_t &config = fake->config();
+    EXPECT_STREQ(config.broker.address.uri, "mqtt://broker.local:1883");
+    EXPECT_STREQ(config.credentials.client_id, "host-test");
+    EXPECT_STREQ(config.credentials.username, "user");
+    EXPECT_STREQ(config.credentials.authentication.password, "secret");
+    EXPECT_EQ(config.buffer.size, 2048);
+    EXPECT_EQ(config.session.keepalive, 30);
+    EXPECT_STREQ(config.session.last_will.topic, "dev/status");
+    EXPECT_EQ(config.session.last_will.msg_len, 7);
+    EXPECT_TRUE(config.session.last_will.retain);
+}
+
+TEST_F(ClientTest, LoopStartFailsWithoutUri)
+{
+    client->setURI(nullptr);
+    EXPECT_FALSE(client->loopStart());
+}
+
+TEST_F(ClientTest, TracksConnectionState)
+{
+    int connects = 0;
+    fakeOnMqttConnect = [&connects](esp_mqtt_client_handle_t) { connects++; };
+
+    FakeMqttClient &fake = start();
+    EXPECT_TRUE(client->isConnected());
+    EXPECT_EQ(connects, 1);
+
+    fake.disconnect();
+    EXPECT_FALSE(client->isConnected());
+    EXPECT_FALSE(client->publish("t", "x"));
+
+    fake.connect();
+    EXPECT_TRUE(client->isConnected());
+    EXPECT_EQ(connects, 2);
+}
+
+TEST_F(ClientTest, PublishReachesEspMqtt)
+{
+    FakeMqttClient &fake = start();
+    EXPECT_TRUE(client->publish("sensors/temp", "21.5", 1, true));
+
+    std::vector<FakeMqttClient::Publish> publishes = fake.publishes();
+    ASSERT_EQ(publishes.size(), 1u);
+    EXPECT_EQ(publishes[0].topic, "sensors/temp");
+    EXPECT_EQ(publishes[0].payload, "21.5");
+    EXPECT_EQ(publishes[0].qos, 1);
+    EXPECT_TRUE(publishes[0].retain);
+
+    fake.failPublishes(1);
+    EXPECT_FALSE(client->publish("sensors/temp", "21.6"));
+}
+
+TEST_F(ClientTest, PublishIsBinarySafe)
+{
+    FakeMqttClient &fake = start();
+    const std::string binary("\x01\0\x02\0", 4);
+    EXPECT_TRUE(client->publish("bin/string", binary));
+
+    const uint8_t frame[] = {0xA5, 0x00, 0x10, 0x00, 0xFF};
+    EXPECT_TRUE(client->publish("bin/buffer", frame, sizeof(frame), 1));
+    EXPECT_TRUE(client->publish("bin/empty", frame, 0));
+
+    std::vector<FakeMqttClient::Publish> publishes = fake.publishes();
+    ASSERT_EQ(publishes.size(), 3u);
+    EXPECT_EQ(publishes[0].payload, binary);
+    EXPECT_EQ(publishes[1].payload, std::string(reinterpret_cast<const char *>(frame), sizeof(frame)));
+    EXPECT_EQ(publishes[1].qos, 1);
+    EXPECT_EQ(publishes[2].payload, "");
+    EXPECT_EQ(client->getStats().bytesOut, 9u);
+}
+
+TEST_F(ClientTest, PublishGathersSegments)
+{
+    FakeMqttClient &fake = start();
+    const uint8_t header[] = {0x02, 0x00};
+    const std::string body = "{\"t\":21.5}";
+    MqttPayloadSegment segments[] = {{header, sizeof(header)}, {nullptr, 0}, {body.data(), body.size()}};
+    EXPECT_TRUE(client->publish("seg/a", segments, 3, 1, true));
+    // A shorter payload through the same, already larger buffer
+    EXPECT_TRUE(client->publish("seg/b", segments, 1));
+    EXPECT_TRUE(client->publish("seg/c", segments, 0));
+
+    std::vector<FakeMqttClient::Publish> publishes = fake.publishes();
+    ASSERT_EQ(publishes.size(), 3u);
+    EXPECT_EQ(publishes[0].payload, std::string("\x02\0", 2) + body);
+    EXPECT_TRUE(publishes[0].retain);
+    EXPECT_EQ(publishes[1].payload, std::string("\x02\0", 2));
+    EXPECT_EQ(publishes[2].payload, "");
+
+    // Also queued while disconnected
+    ASSERT_TRUE(client->enableOfflineQueue());
+    fake.disconnect();
+    fake.clearRecords();
+    EXPECT_TRUE(client->publish("seg/a", segments, 3));
+    fake.connect();
+    publishes = fake.publishes();
+    ASSERT_EQ(publishes.size(), 1u);
+    EXPECT_EQ(publishes[0].payload, std::string("\x02\0", 2) + body);
+}
+
+TEST_F(ClientTest, InternedTopicsPublishAndSubscribe)
+{
+    MqttTopicHandle temp = client->internTopic("site/dev1/sensor/temp");
+    MqttTopicHandle cmd = client->internTopic("site/dev1/cmd");
+    ASSERT_TRUE(temp.isValid());
+    EXPECT_EQ(client->internTopic("site/dev1/sensor/temp"), temp);
+    EXPECT_FALSE(client->internTopic("").isValid());
+
+    FakeMqttClient &fake = start();
+    std::vector<std::string> received;
+    ASSERT_TRUE(client->subscribe(cmd, [&received](const MqttMessageView &message) {
+        received.push_back(std::string(message.payload, message.payloadLen));
+    }, 1));
+    EXPECT_FALSE(client->isSubscriptionConfirmed("site/dev1/cmd"));
+    fake.subAck(fake.lastMsgId());
+    EXPECT_TRUE(client->isSubscriptionConfirmed("site/dev1/cmd"));
+    fake.deliver("site/dev1/cmd", "reboot");
+    EXPECT_EQ(received, std::vector<std::string>{"reboot"});
+
+    const uint8_t raw[] = {1, 0, 2};
+    MqttPayloadSegment segments[] = {{raw, 1}, {raw + 1, 2}};
+    EXPECT_TRUE(client->publish(temp, "21.5"));
+    EXPECT_TRUE(client->publish(temp, std::string("22"), 1, true));
+    EXPECT_TRUE(client->publish(temp, raw, sizeof(raw)));
+    EXPECT_TRUE(client->publish(temp, segments, 2));
+    EXPECT_FALSE(client->publish(MqttTopicHandle(), "x"));
+
+    std::vector<FakeMqttClient::Publish> publishes = fake.publishes();
+    ASSERT_EQ(publishes.size(), 4u);
+    for (std::size_t i = 0; i < publishes.size(); i++)
+        EXPECT_EQ(publishes[i].topic, "site/dev1/sensor/temp");
+    EXPECT_EQ(publishes[0].payload, "21.5");
+    EXPECT_TRUE(publishes[1].retain);
+    EXPECT_EQ(publishes[2].payload, std::string("\x01\0\x02", 3));
+    EXPECT_EQ(publishes[3].payload, std::string("\x01\0\x02", 3));
+}
+
+TEST_F(ClientTest, DispatchesToMatchingSubscriptions)
+{
+    FakeMqttClient &fake = start();
+    std::vector<std::string> received;
+    ASSERT_TRUE(client->subscribe("home/+/temp", [&received](const std::string &topic, const std::string &payload) {
+        received.push_back("plus " + topic + "=" + payload);
+    }));
+    ASSERT_TRUE(client->subscribe("home/#", [&received](const std::string &payload) {
+        received.push_back("hash " + payload);
+    }));
+
+    fake.deliver("home/kitchen/temp", "20");
+    fake.deliver("home/kitchen/humidity", "40");
+    fake.deliver("office/temp", "25");
+
+    ASSERT_EQ(received.size(), 3u);
+    EXPECT_EQ(received[0], "plus home/kitchen/temp=20");
+    EXPECT_EQ(received[1], "hash 20");
+    EXPECT_EQ(received[2], "hash 40");
+}
+
+TEST_F(ClientTest, MalformedFiltersAreRefused)
+{
+    FakeMqttClient &fake = start();
+    EXPECT_FALSE(client->subscribe("a/#/b", [](const std::string &) {}));
+    EXPECT_FALSE(client->subscribeMany({{"a/#x", 0, nullptr}, {"a/b", 0, nullptr}}));
+
+    std::vector<FakeMqttClient::Subscribe> subscribes = fake.subscribes();
+    ASSERT_EQ(subscribes.size(), 1u);
+    EXPECT_EQ(subscribes[0].topic, "a/b");
+    EXPECT_EQ(client->getSubscriptionQos("a/#/b"), -2);
+}
+
+TEST_F(ClientTest, SubAckConfirmsSubscription)
+{
+    FakeMqttClient &fake = start();
+    std::vector<std::string> acked;
+    client->setSubscribeAckCallback([&acked](int, const std::string &topic, int) { acked.push_back(topic); });
+
+    ASSERT_TRUE(client->subscribe("cmd/#", [](const std::string &) {}, 1));
+    std::vector<FakeMqttClient::Subscribe> subscribes = fake.subscribes();
+    ASSERT_EQ(subscribes.size(), 1u);
+    EXPECT_EQ(subscribes[0].topic, "cmd/#");
+    EXPECT_EQ(subscribes[0].qos, 1);
+    EXPECT_FALSE(client->isSubscriptionConfirmed("cmd/#"));
+    EXPECT_EQ(client->getSubscriptionQos("cmd/#"), -1);
+
+    fake.subAck(subscribes[0].msgId);
+    EXPECT_TRUE(client->isSubscriptionConfirmed("cmd/#"));
+    EXPECT_EQ(client->getSubscriptionQos("cmd/#"), 1);
+    ASSERT_EQ(acked.size(), 1u);
+    EXPECT_EQ(acked[0], "cmd/#");
+
+    fake.disconnect();
+    EXPECT_FALSE(client->isSubscriptionConfirmed("cmd/#"));
+    EXPECT_EQ(client->getSubscriptionQos("unknown"), -2);
+}
+
+TEST_F(ClientTest, UnsubscribeStopsDelivery)
+{
+    FakeMqttClient &fake = start();
+    int calls = 0;
+    client->subscribe("a/b", [&calls](const std::string &) { calls++; });
+    fake.deliver("a/b", "1");
+
+    ASSERT_TRUE(client->unsubscribe("a/b"));
+    ASSERT_EQ(fake.unsubscribes().size(), 1u);
+    fake.deliver("a/b", "2");
+    EXPECT_EQ(calls, 1);
+}
+
+TEST_F(ClientTest, SubscriptionLookupsFollowTableChanges)
+{
+    FakeMqttClient &fake = start();
+    for (int i = 0; i < 50; i++)
+    {
+        client->subscribe("dev/" + std::to_string(i), [](const MqttMessageView &) {});
+        fake.subAck(fake.lastMsgId());
+    }
+    // Re-subscribing keeps one record, unsubscribing moves the records behind it
+    client->subscribe("dev/7", [](const MqttMessageView &) {});
+    ASSERT_TRUE(client->unsubscribe("dev/3"));
+
+    EXPECT_EQ(client->getSubscriptionQos("dev/3"), -2);
+    EXPECT_EQ(client->getSubscriptionQos("dev/7"), -1);
+    EXPECT_FALSE(client->isSubscriptionConfirmed("dev/7"));
+    for (int i = 0; i < 50; i++)
+    {
+        if (i != 3 && i != 7)
+            EXPECT_TRUE(client->isSubscriptionConfirmed("dev/" + std::to_string(i))) << i;
+    }
+
+    fake.subAck(fake.subscribes()[50].msgId);
+    EXPECT_TRUE(client->isSubscriptionConfirmed("dev/7"));
+    EXPECT_EQ(client->getStats().subscriptions.size(), 49u);
+}
+
+TEST_F(ClientTest, SubscribeManyPacksTopicsIntoPackets)
+{
+    FakeMqttClient &fake = start();
+    std::vector<std::string> acked;
+    client->setSubscribeAckCallback([&acked](int, const std::string &topic, int) { acked.push_back(topic); });
+    int calls = 0;
+    std::vector<MqttSubscribeRequest> requests;
+    for (int i = 0; i < 150; i++)
+        requests.push_back({"site/dev" + std::to_string(i) + "/sensor/temp", (uint8_t)(i % 2), [&calls](const MqttMessageView &) { calls++; }});
+
+    ASSERT_TRUE(client->subscribeMany(requests));
+
+    // Every topic once, in order, packets within the 512 byte output buffer
+    std::vector<FakeMqttClient::Subscribe> subscribes = fake.subscribes();
+    ASSERT_EQ(subscribes.size(), requests.size());
+    std::vector<int> packets;
+    size_t packetSize = 0;
+    for (size_t i = 0; i < subscribes.size(); i++)
+    {
+        EXPECT_EQ(subscribes[i].topic, requests[i].topic);
+        EXPECT_EQ(subscribes[i].qos, requests[i].qos);
+        if (packets.empty() || packets.back() != subscribes[i].msgId)
+        {
+            packets.push_back(subscribes[i].msgId);
+            packetSize = 7;
+        }
+        packetSize += 2 + subscribes[i].topic.size() + 1;
+        EXPECT_LE(packetSize, 512u);
+    }
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 1, 0)
+    EXPECT_GT(packets.size(), 1u);
+    EXPECT_LT(packets.size(), 20u);
+#else
+    EXPECT_EQ(packets.size(), requests.size()); // One packet per topic
+#endif
+
+    // One SUBACK confirms every topic of its packet
+    fake.subAck(packets[0]);
+    EXPECT_TRUE(client->isSubscriptionConfirmed(requests[0].topic));
+    EXPECT_FALSE(client->isSubscriptionConfirmed(requests.back().topic));
+    for (size_t i = 1; i < packets.size(); i++)
+        fake.subAck(packets[i]);
+    EXPECT_EQ(acked.size(), requests.size());
+    for (size_t i = 0; i < requests.size(); i++)
+        EXPECT_TRUE(client->isSubscriptionConfirmed(requests[i].topic)) << requests[i].topic;
+
+    fake.deliver("site/dev42/sensor/temp", "21.5");
+    fake.deliver("site/dev149/sensor/temp", "19.0");
+    EXPECT_EQ(calls, 2);
+}
+
+TEST_F(ClientTest, SubscribeManyDropsTopicsOfRejectedPacket)
+{
+    FakeMqttClient &fake = start();
+    std::vector<MqttSubscribeRequest> requests;
+    for (int i = 0; i < 60; i++)
+        requests.push_back({"site/dev" + std::to_string(i) + "/sensor/temp", 1, [](const MqttMessageView &) {}});
+
+    fake.failSubscribes(1);
+    EXPECT_FALSE(client->subscribeMany(requests));
+
+    std::vector<FakeMqttClient::Subscribe> subscribes = fake.subscribes();
+    ASSERT_FALSE(subscribes.empty());
+    size_t rejected = requests.size() - subscribes.size();
+    EXPECT_GT(rejected, 0u);
+    EXPECT_EQ(client->getSubscriptionQos(requests[0].topic), -2);
+    EXPECT_EQ(client->getSubscriptionQos(requests[rejected - 1].topic), -2);
+    EXPECT_EQ(client->getSubscriptionQos(requests[rejected].topic), -1);
+    EXPECT_EQ(client->getStats().subscriptions.size(), subscribes.size());
+}
+
+TEST_F(ClientTest, ReconnectRestoresSubscriptionsPipelined)
+{
+    FakeMqttClient &fake = start();
+    client->setAutoResubscribe(true, 2);
+    std::vector<MqttSubscribeRequest> requests;
+    for (int i = 0; i < 80; i++)
+        requests.push_back({"site/dev" + std::to_string(i) + "/sensor/temp", 1, [](const MqttMessageView &) {}});
+    ASSERT_TRUE(client->subscribeMany(requests));
+    for (const FakeMqttClient::Subscribe &subscribe : fake.subscribes())
+        fake.subAck(subscribe.msgId);
+
+    fake.disconnect();
+    fake.clearRecords();
+    fake.connect(false);
+
+    // Two packets in flight, the next one sent as each SUBACK arrives
+    std::vector<int> acked;
+    for (;;)
+    {
+        std::vector<int> inFlight;
+        for (const FakeMqttClient::Subscribe &subscribe : fake.subscribes())
+        {
+            if (std::find(acked.begin(), acked.end(), subscribe.msgId) == acked.end() &&
+                std::find(inFlight.begin(), inFlight.end(), subscribe.msgId) == inFlight.end())
+                inFlight.push_back(subscribe.msgId);
+        }
+        if (inFlight.empty())
+            break;
+        EXPECT_LE(inFlight.size(), 2u);
+        EXPECT_EQ(client->getStats().resubscribeMs.count, 0u);
+        FakeEsp::advanceTime(10000);
+        fake.subAck(inFlight[0]);
+        acked.push_back(inFlight[0]);
+    }
+
+    std::vector<FakeMqttClient::Subscribe> subscribes = fake.subscribes();
+    ASSERT_EQ(subscribes.size(), requests.size());
+    for (size_t i = 0; i < requests.size(); i++)
+    {
+        EXPECT_EQ(subscribes[i].topic, requests[i].topic);
+        EXPECT_EQ(subscribes[i].qos, 1);
+        EXPECT_TRUE(client->isSubscriptionConfirmed(requests[i].topic));
+    }
+    MqttHistogramSnapshot resubscribeMs = client->getStats().resubscribeMs;
+    EXPECT_EQ(resubscribeMs.count, 1u);
+    EXPECT_EQ(resubscribeMs.max, 10 * acked.size());
+}
+
+TEST_F(ClientTest, ReconnectRetriesAFailedRestore)
+{
+    FakeMqttClient &fake = start();
+    client->subscribe("a/1", [](const MqttMessageView &) {}, 1);
+    client->subscribe("b/1", [](const MqttMessageView &) {}, 2);
+    for (const FakeMqttClient::Subscribe &subscribe : fake.subscribes())
+        fake.subAck(subscribe.msgId);
+
+    fake.disconnect();
+    fake.clearRecords();
+    fake.failSubscribes(1);
+    fake.connect(false);
+    EXPECT_TRUE(fake.subscribes().empty());
+
+    // The housekeeping timer sends the rest
+    FakeEsp::advanceTime(1000000);
+    std::vector<FakeMqttClient::Subscribe> subscribes = fake.subscribes();
+    ASSERT_FALSE(subscribes.empty());
+    for (const FakeMqttClient::Subscribe &subscribe : subscribes)
+        fake.subAck(subscribe.msgId);
+    FakeEsp::advanceTime(1000000);
+    ASSERT_EQ(fake.subscribes().size(), 2u);
+    EXPECT_EQ(client->getSubscriptionQos("a/1"), 1);
+    EXPECT_EQ(client->getSubscriptionQos("b/1"), 2);
+    EXPECT_EQ(client->getStats().resubscribeMs.count, 1u);
+
+    // Nothing left to retry
+    fake.clearRecords();
+    FakeEsp::advanceTime(5000000);
+    EXPECT_TRUE(fake.subscribes().empty());
+}
+
+TEST_F(ClientTest, ReconnectSkipsRestoreWithSessionPresent)
+{
+    FakeMqttClient &fake = start();
+    client->subscribe("a/b", [](const MqttMessageView &) {}, 1);
+    fake.subAck(fake.lastMsgId());
+
+    fake.disconnect();
+    EXPECT_FALSE(client->isSubscriptionConfirmed("a/b"));
+    fake.clearRecords();
+    fake.connect(true);
+
+    EXPECT_TRUE(fake.subscribes().empty());
+    EXPECT_TRUE(client->isSubscriptionConfirmed("a/b"));
+    EXPECT_EQ(client->getSubscriptionQos("a/b"), 1);
+
+    // Whether or not the client would restore them
+    client->setAutoResubscribe(false);
+    fake.disconnect();
+    fake.connect(true);
+    EXPECT_TRUE(fake.subscribes().empty());
+    EXPECT_TRUE(client->isSubscriptionConfirmed("a/b"));
+    EXPECT_EQ(client->getSubscriptionQos("a/b"), 1);
+}
+
+TEST_F(ClientTest, ReconnectLeavesSubscriptionsRenewedByTheHookAlone)
+{
+    FakeMqttClient &fake = start();
+    client->subscribe("a/b", [](const MqttMessageView &) {});
+    client->subscribe("c/d", [](const MqttMessageView &) {});
+    fakeOnMqttConnect = [this](esp_mqtt_client_handle_t) { client->subscribe("a/b", [](const MqttMessageView &) {}); };
+
+    fake.disconnect();
+    fake.clearRecords();
+    fake.connect();
+    std::vector<FakeMqttClient::Subscribe> subscribes = fake.subscribes();
+    ASSERT_EQ(subscribes.size(), 2u);
+    EXPECT_EQ(subscribes[0].topic, "a/b");
+    EXPECT_EQ(subscribes[1].topic, "c/d");
+
+    // Nothing restored when disabled
+    client->setAutoResubscribe(false);
+    fakeOnMqttConnect = nullptr;
+    fake.disconnect();
+    fake.clearRecords();
+    fake.connect();
+    EXPECT_TRUE(fake.subscribes().empty());
+}
+
+TEST_F(ClientTest, BinaryAndFragmentedPayloads)
+{
+    FakeMqttClient &fake = start();
+    std::vector<std::string> received;
+    client->subscribe("bin", [&received](const MqttMessageView &message) {
+        received.push_back(std::string(message.payload, message.payloadLen));
+    });
+
+    std::string binary("\x01\x00\x02\x00", 4);
+    fake.deliver("bin", binary);
+    std::string large(3000, 'x');
+    large[1500] = '\0';
+    fake.deliver("bin", large, 0, false, 512);
+
+    ASSERT_EQ(received.size(), 2u);
+    EXPECT_EQ(received[0], binary);
+    EXPECT_EQ(received[1], large);
+}
+
+TEST_F(ClientTest, StreamsOfAMessageCutShortEnd)
+{
+    FakeMqttClient &fake = start();
+    std::vector<std::string> log;
+    ASSERT_TRUE(client->subscribeStream("fw", [&log](const MqttMessageChunk &header) {
+        log.push_back("begin " + std::to_string(header.totalLen));
+        return true;
+    }, [&log](const MqttMessageChunk &chunk) {
+        log.push_back("chunk " + std::to_string(chunk.offset));
+        return true;
+    }, [&log](bool complete) {
+        log.push_back(complete ? "end" : "abort");
+    }));
+
+    // Only the first fragment of 3000 bytes arrives before the next message
+    esp_mqtt_event_t event = {};
+    std::string topic = "fw";
+    std::string data(1000, 'x');
+    event.event_id = MQTT_EVENT_DATA;
+    event.topic = &topic[0];
+    event.topic_len = topic.size();
+    event.data = &data[0];
+    event.data_len = data.size();
+    event.total_data_len = 3000;
+    fake.sendEvent(event);
+    fake.deliver("fw", "small");
+    EXPECT_EQ(log, (std::vector<std::string>{"begin 3000", "chunk 0", "abort", "begin 5", "chunk 0", "end"}));
+
+    // Also once no stream subscription is left
+    log.clear();
+    fake.sendEvent(event);
+    ASSERT_TRUE(client->unsubscribe("fw"));
+    fake.deliver("fw", std::string(2000, 'y'), 0, false, 1000);
+    EXPECT_EQ(log, (std::vector<std::string>{"begin 3000", "chunk 0", "abort"}));
+}
+
+TEST_F(ClientTest, AsyncDispatchRunsCallbacksOnWorkers)
+{
+    ASSERT_TRUE(client->enableAsyncDispatch());
+    FakeMqttClient &fake = start();
+
+    std::atomic<int> calls(0);
+    std::thread::id caller = std::this_thread::get_id();
+    std::atomic<bool> onWorker(false);
+    client->subscribe("t", [&calls, &onWorker, caller](const std::string &) {
+        onWorker = std::this_thread::get_id() != caller;
+        calls++;
+    });
+
+    fake.deliver("t", "x");
+    ASSERT_TRUE(waitFor([&calls]() { return calls == 1; }));
+    EXPECT_TRUE(onWorker);
+}
+
+TEST_F(ClientTest, AsyncDispatchKeepsOrderAcrossResubscribe)
+{
+    MqttDispatchConfig config;
+    config.workers = 2;
+    ASSERT_TRUE(client->enableAsyncDispatch(config));
+    FakeMqttClient &fake = start();
+
+    std::mutex mutex;
+    std::vector<std::string> order;
+    std::atomic<bool> started(false), release(false);
+    auto callback = [&](const std::string &payload) {
+        if (payload == "1") {
+            started = true;
+            while (!release)
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        order.push_back(payload);
+    };
+    client->subscribe("t", callback);
+    fake.deliver("t", "1");
+    ASSERT_TRUE(waitFor([&started]() { return started.load(); }));
+
+    // The new record of the topic must not let the second message overtake the first on the idle worker
+    client->subscribe("t", callback, 1);
+    fake.deliver("t", "2");
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    release = true;
+    ASSERT_TRUE(waitFor([&]() { std::lock_guard<std::mutex> lock(mutex); return order.size() == 2; }));
+    EXPECT_EQ(order, (std::vector<std::string>{"1", "2"}));
+}
+
+TEST_F(ClientTest, OfflineQueueDrainsInBurstsAfterConnect)
+{
+    MqttOfflineQueueConfig config;
+    config.drainBurst = 2;
+    config.drainIntervalMs = 100;
+    ASSERT_TRUE(client->enableOfflineQueue(config));
+    ASSERT_TRUE(client->loopStart());
+    FakeMqttClient &fake = *FakeMqttClient::last();
+
+    for (int i = 0; i < 5; i++)
+        EXPECT_TRUE(client->publish("q", std::to_string(i)));
+    EXPECT_EQ(client->getOfflineQueueStats().messages, 5u);
+
+    fake.connect();
+    EXPECT_EQ(fake.publishes().size(), 2u);
+    // Publishes made meanwhile line up behind the backlog
+    EXPECT_TRUE(client->publish("q", "5"));
+
+    FakeEsp::advanceTime(100000);
+    EXPECT_EQ(fake.publishes().size(), 4u);
+    FakeEsp::advanceTime(200000);
+
+    std::vector<FakeMqttClient::Publish> publishes = fake.publishes();
+    ASSERT_EQ(publishes.size(), 6u);
+    for (int i = 0; i < 6; i++)
+        EXPECT_EQ(publishes[i].payload, std::to_string(i));
+    EXPECT_EQ(FakeEsp::activeTimers(), 0u);
+}
+
+TEST_F(ClientTest, PersistentOutboxSurvivesRestart)
+{
+    MqttRamOutboxStorage storage;
+    ASSERT_TRUE(client->enablePersistentOutbox(&storage));
+    ASSERT_TRUE(client->loopStart());
+    EXPECT_TRUE(client->publishPersistent("meter", "1"));
+    EXPECT_TRUE(client->publishPersistent("meter", "2"));
+
+    // Reset before anything was acknowledged
+    client.reset(new ESP32MQTTClient());
+    client->setURI("mqtt://broker.local");
+    ASSERT_TRUE(client->enablePersistentOutbox(&storage));
+    EXPECT_EQ(client->getOutboxStats().messages, 2u);
+
+    FakeMqttClient &fake = start();
+    ASSERT_EQ(fake.publishes().size(), 2u);
+    EXPECT_EQ(fake.ackAllPublishes(), 2u);
+    EXPECT_EQ(client->getOutboxStats().messages, 0u);
+}
+
+TEST_F(ClientTest, PublishAsyncGoesThroughTheOutbox)
+{
+    FakeMqttClient &fake = start();
+    EXPECT_TRUE(client->publishAsync("sensor/temp", "21.5"));
+    EXPECT_TRUE(client->publishAsync("sensor/hum", std::string("4\0", 2), 1, true));
+    // Written by the MQTT task, not by the caller
+    EXPECT_TRUE(fake.publishes().empty());
+    EXPECT_EQ(fake.sendEnqueued(), 2u);
+
+    std::vector<FakeMqttClient::Publish> publishes = fake.publishes();
+    ASSERT_EQ(publishes.size(), 2u);
+    EXPECT_EQ(publishes[0].topic, "sensor/temp");
+    EXPECT_EQ(publishes[0].qos, 0);
+    EXPECT_EQ(publishes[1].payload, std::string("4\0", 2));
+    EXPECT_TRUE(publishes[1].retain);
+    EXPECT_EQ(fake.ackAllPublishes(), 1u);
+    EXPECT_EQ(client->getStats().messagesOut, 2u);
+
+    // Kept in the outbox while disconnected
+    fake.disconnect();
+    EXPECT_TRUE(client->publishAsync("sensor/temp", "22.0"));
+    fake.connect();
+    EXPECT_EQ(fake.sendEnqueued(), 1u);
+}
+
+TEST_F(ClientTest, PublishAsyncRespectsOutboxLimit)
+{
+    ASSERT_TRUE(client->setOutboxLimit(40));
+    FakeMqttClient &fake = start();
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 1, 0)
+    EXPECT_EQ(fake.config().outbox.limit, 40u);
+#endif
+
+    const std::string payload(10, 'p'); // 20 bytes with the topic
+    EXPECT_TRUE(client->publishAsync("sensor/tp", payload));
+    EXPECT_TRUE(client->publishAsync("sensor/tp", payload));
+    EXPECT_FALSE(client->publishAsync("sensor/tp", payload));
+    EXPECT_EQ(client->getStats().publishFailures, 1u);
+
+    // Room again once the MQTT task sent them
+    fake.sendEnqueued();
+    EXPECT_TRUE(client->publishAsync("sensor/tp", payload));
+}
+
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 1, 0)
+TEST_F(ClientTest, PublishesAtTheOutboxLimitFail)
+{
+    ASSERT_TRUE(client->setOutboxLimit(40));
+    MqttPublishTrackerConfig config;
+    config.capacity = 4;
+    ASSERT_TRUE(client->enablePublishTracking(config));
+    FakeMqttClient &fake = start();
+
+    // esp-mqtt returns -2 instead of a msg_id once QoS 1/2 messages fill the outbox
+    const std::string payload(10, 'p'); // 20 bytes with the topic
+    MqttPublishCallback ignore = [](int, MqttPublishResult, uint32_t) {};
+    int first = client->publishTracked("sensor/tp", payload, 1, false, ignore);
+    ASSERT_GT(first, 0);
+    EXPECT_TRUE(client->publish("sensor/tp", payload, 1));
+    EXPECT_FALSE(client->publish("sensor/tp", payload, 1));
+    EXPECT_EQ(client->publishTracked("sensor/tp", payload, 1, false, ignore), -1);
+    EXPECT_TRUE(client->publish("sensor/tp", payload, 0));
+
+    MqttClientStats stats = client->getStats();
+    EXPECT_EQ(stats.publishFailures, 2u);
+    EXPECT_EQ(stats.messagesOut, 3u);
+    MqttPublishTrackerStats tracking = client->getPublishTrackingStats();
+    EXPECT_EQ(tracking.inFlight, 1u);
+    EXPECT_EQ(tracking.tracked, 1u);
+
+    fake.pubAck(first);
+    EXPECT_EQ(client->getPublishTrackingStats().inFlight, 0u);
+    EXPECT_TRUE(client->publish("sensor/tp", payload, 1));
+}
+
+TEST_F(ClientTest, SubscribesAtTheOutboxLimitFail)
+{
+    ASSERT_TRUE(client->setOutboxLimit(40));
+    FakeMqttClient &fake = start();
+    ASSERT_TRUE(client->subscribe("a/1", [](const MqttMessageView &) {}, 1));
+    fake.subAck(fake.lastMsgId());
+
+    // esp-mqtt returns -2 for a SUBSCRIBE that does not fit into the outbox either
+    const std::string payload(10, 'p'); // 20 bytes with the topic
+    ASSERT_TRUE(client->publish("sensor/tp", payload, 1));
+    ASSERT_TRUE(client->publish("sensor/tp", payload, 1));
+    EXPECT_FALSE(client->subscribe("b/1", [](const MqttMessageView &) {}, 1));
+    EXPECT_EQ(client->getSubscriptionQos("b/1"), -2);
+
+    // A restore into a full outbox waits for room
+    fake.disconnect();
+    fake.clearRecords();
+    ASSERT_TRUE(client->publishAsync("sensor/tp", payload, 1));
+    ASSERT_TRUE(client->publishAsync("sensor/tp", payload, 1));
+    fake.connect(false);
+    EXPECT_TRUE(fake.subscribes().empty());
+    fake.sendEnqueued();
+    fake.ackAllPublishes();
+    FakeEsp::advanceTime(1000000);
+    ASSERT_EQ(fake.subscribes().size(), 1u);
+    fake.subAck(fake.subscribes()[0].msgId);
+    EXPECT_TRUE(client->isSubscriptionConfirmed("a/1"));
+    EXPECT_EQ(client->getStats().resubscribeMs.count, 1u);
+}
+#endif
+
+TEST_F(ClientTest, TopicAliasesNeedMqtt5)
+{
+    EXPECT_FALSE(client->enableTopicAliases());
+    EXPECT_FALSE(client->isMqtt5());
+    FakeMqttClient &fake = start();
+    EXPECT_NE(fake.config().session.protocol_ver, MQTT_PROTOCOL_V_5);
+    EXPECT_TRUE(client->publish("site/dev1/temp", "21.5"));
+    EXPECT_TRUE(client->publish("site/dev1/temp", "21.5"));
+    EXPECT_EQ(fake.publishes()[1].topicAlias, 0u);
+}
+
+#ifdef ESP32MQTTCLIENT_MQTT5
+TEST_F(ClientTest, TopicAliasesShortenRepeatedPublishes)
+{
+    ASSERT_TRUE(client->enableMqtt5());
+    EXPECT_FALSE(client->enableTopicAliases(0));
+    ASSERT_TRUE(client->enableTopicAliases(2));
+    FakeMqttClient &fake = start();
+    EXPECT_EQ(fake.config().session.protocol_ver, MQTT_PROTOCOL_V_5);
+
+    const char *topics[] = {"site/dev1/temp", "site/dev1/temp", "site/dev1/hum", "site/dev1/temp", "site/dev1/volt", "site/dev1/hum"};
+    for (const char *topic : topics)
+        ASSERT_TRUE(client->publish(topic, "1"));
+
+    std::vector<FakeMqttClient::Publish> publishes = fake.publishes();
+    ASSERT_EQ(publishes.size(), 6u);
+    for (std::size_t i = 0; i < publishes.size(); i++)
+        EXPECT_EQ(publishes[i].topic, topics[i]);
+    EXPECT_EQ(fake.protocolErrors(), 0);
+    EXPECT_EQ(publishes[0].topicAlias, 1u);
+    EXPECT_FALSE(publishes[0].aliasOnly);
+    EXPECT_TRUE(publishes[1].aliasOnly);
+    EXPECT_LT(publishes[1].packetBytes, publishes[0].packetBytes);
+    EXPECT_EQ(publishes[2].topicAlias, 2u);
+    EXPECT_TRUE(publishes[3].aliasOnly);
+    // hum was used longest ago and gives up its alias
+    EXPECT_EQ(publishes[4].topicAlias, 2u);
+    EXPECT_FALSE(publishes[4].aliasOnly);
+    EXPECT_EQ(publishes[5].topicAlias, 1u);
+    EXPECT_FALSE(publishes[5].aliasOnly);
+
+    MqttTopicAliasStats stats = client->getTopicAliasStats();
+    EXPECT_EQ(stats.assigned, 4u);
+    EXPECT_EQ(stats.reused, 2u);
+    EXPECT_EQ(stats.evicted, 2u);
+    EXPECT_EQ(stats.bytesSaved, 28u);
+
+    // Aliases do not outlive the connection
+    fake.disconnect();
+    fake.connect();
+    ASSERT_TRUE(client->publish("site/dev1/hum", "1"));
+    EXPECT_FALSE(fake.publishes().back().aliasOnly);
+    EXPECT_EQ(fake.publishes().back().topicAlias, 1u);
+    EXPECT_EQ(fake.protocolErrors(), 0);
+}
+
+TEST_F(ClientTest, InternedTopicsShareAliasesWithStrings)
+{
+    ASSERT_TRUE(client->enableMqtt5());
+    ASSERT_TRUE(client->enableTopicAliases(2));
+    FakeMqttClient &fake = start();
+    MqttTopicHandle temp = client->internTopic("site/dev1/temp");
+
+    // The handle's hash finds the alias the string topic established, and the other way round
+    ASSERT_TRUE(client->publish("site/dev1/temp", "1"));
+    ASSERT_TRUE(client->publish(temp, "2"));
+    MqttPayloadSegment segments[] = {{"3", 1}};
+    ASSERT_TRUE(client->publish(temp, segments, 1));
+    ASSERT_TRUE(client->publish("site/dev1/temp", "4"));
+
+    std::vector<FakeMqttClient::Publish> publishes = fake.publishes();
+    ASSERT_EQ(publishes.size(), 4u);
+    EXPECT_FALSE(publishes[0].aliasOnly);
+    for (std::size_t i = 1; i < publishes.size(); i++)
+    {
+        EXPECT_EQ(publishes[i].topicAlias, publishes[0].topicAlias);
+        EXPECT_TRUE(publishes[i].aliasOnly);
+    }
+    EXPECT_EQ(fake.protocolErrors(), 0);
+}
+
+TEST_F(ClientTest, TopicAliasesFollowTheBrokerLimit)
+{
+    ASSERT_TRUE(client->enableMqtt5());
+    ASSERT_TRUE(client->enableTopicAliases(4));
+    FakeMqttClient &fake = start();
+    fake.setTopicAliasMaximum(1);
+
+    ASSERT_TRUE(client->publish("a/1", "x"));
+    ASSERT_TRUE(client->publish("a/2", "x"));
+    ASSERT_TRUE(client->publish("a/2", "x"));
+    ASSERT_TRUE(client->publish("a/1", "x"));
+
+    std::vector<FakeMqttClient::Publish> publishes = fake.publishes();
+    ASSERT_EQ(publishes.size(), 4u);
+    EXPECT_EQ(publishes[0].topicAlias, 1u);
+    // Alias 2 refused, sent with the topic and then given alias 1
+    EXPECT_EQ(publishes[1].topicAlias, 0u);
+    EXPECT_EQ(publishes[1].topic, "a/2");
+    EXPECT_EQ(publishes[2].topicAlias, 1u);
+    EXPECT_FALSE(publishes[2].aliasOnly);
+    EXPECT_FALSE(publishes[3].aliasOnly);
+    EXPECT_EQ(publishes[3].topic, "a/1");
+    EXPECT_EQ(client->getTopicAliasStats().limit, 1u);
+    EXPECT_EQ(fake.protocolErrors(), 0);
+
+    // A broker without topic aliases
+    fake.setTopicAliasMaximum(0);
+    fake.disconnect();
+    fake.connect();
+    ASSERT_TRUE(client->publish("a/1", "x"));
+    ASSERT_TRUE(client->publish("a/1", "x"));
+    EXPECT_EQ(fake.publishes().back().topicAlias, 0u);
+    EXPECT_EQ(client->getTopicAliasStats().limit, 0u);
+}
+
+TEST_F(ClientTest, TopicAliasesOnlyForQos0SentRightAway)
+{
+    ASSERT_TRUE(client->enableMqtt5());
+    ASSERT_TRUE(client->enableTopicAliases());
+    FakeMqttClient &fake = start();
+
+    // esp-mqtt may resend these on a later connection, where the alias is unknown
+    ASSERT_TRUE(client->publish("a/1", "x", 1));
+    ASSERT_TRUE(client->publish("a/1", "x", 1));
+    ASSERT_TRUE(client->publishAsync("a/1", "x"));
+    fake.sendEnqueued();
+    for (const FakeMqttClient::Publish &publish : fake.publishes())
+        EXPECT_EQ(publish.topicAlias, 0u);
+    EXPECT_EQ(client->getTopicAliasStats().assigned, 0u);
+}
+
+TEST_F(ClientTest, MqttTaskPublishDoesNotWaitForTopicAliases)
+{
+    ASSERT_TRUE(client->enableMqtt5());
+    ASSERT_TRUE(client->enableTopicAliases());
+    FakeMqttClient &fake = start();
+    std::vector<bool> replies;
+    ASSERT_TRUE(client->subscribe("cmd", [this, &replies](const MqttMessageView &) {
+        replies.push_back(client->publish("cmd/reply", "ok"));
+    }));
+
+    // A message arrives while another task is in the middle of a publish
+    bool delivered = false;
+    fake.setPublishHook([&fake, &delivered](const FakeMqttClient::Publish &publish) {
+        if (publish.topic != "sensor/temp" || delivered)
+            return;
+        delivered = true;
+        std::thread mqttTask([&fake] { fake.deliver("cmd", "reboot"); });
+        mqttTask.join();
+    });
+    ASSERT_TRUE(client->publish("sensor/temp", "21.5"));
+    EXPECT_EQ(replies, std::vector<bool>{false});
+    EXPECT_EQ(client->getTopicAliasStats().busy, 1u);
+
+    // Without contention the callback publishes
+    fake.deliver("cmd", "reboot");
+    EXPECT_EQ(replies, (std::vector<bool>{false, true}));
+    EXPECT_EQ(fake.protocolErrors(), 0);
+}
+
+TEST_F(ClientTest, SubscriptionIdsDispatchWithoutMatching)
+{
+    ASSERT_TRUE(client->enableMqtt5());
+    FakeMqttClient &fake = start();
+    std::vector<std::string> calls;
+    auto record = [&calls](const char *name) {
+        return [&calls, name](const MqttMessageView &message) {
+            calls.push_back(std::string(name) + ":" + std::string(message.topic, message.topicLen));
+        };
+    };
+    ASSERT_TRUE(client->subscribe("site/dev1/#", record("dev1"), 0));
+    ASSERT_TRUE(client->subscribeMany({{"site/dev2/temp", 0, record("temp2")}, {"site/dev2/hum", 0, record("hum2")}}));
+
+    // One identifier per SUBSCRIBE packet
+    std::vector<FakeMqttClient::Subscribe> subscribes = fake.subscribes();
+    ASSERT_EQ(subscribes.size(), 3u);
+    EXPECT_NE(subscribes[0].subscriptionId, 0u);
+    EXPECT_NE(subscribes[1].subscriptionId, subscribes[0].subscriptionId);
+    EXPECT_EQ(subscribes[2].subscriptionId, subscribes[1].subscriptionId);
+
+    fake.deliver("site/dev1/a/b", "1", 0, false, 0, 0, subscribes[0].subscriptionId);
+    fake.deliver("site/dev2/hum", "2", 0, false, 0, 0, subscribes[1].subscriptionId);
+    EXPECT_EQ(calls, (std::vector<std::string>{"dev1:site/dev1/a/b", "hum2:site/dev2/hum"}));
+    EXPECT_EQ(client->getSubscriptionIdStats().direct, 2u);
+
+    // An identifier that does not fit the topic is not trusted
+    calls.clear();
+    fake.deliver("site/dev2/temp", "3", 0, false, 0, 0, subscribes[0].subscriptionId);
+    EXPECT_EQ(calls, (std::vector<std::string>{"temp2:site/dev2/temp"}));
+
+    // Overlapping filters both get the message
+    calls.clear();
+    ASSERT_TRUE(client->subscribe("site/+/temp", record("temp"), 0));
+    fake.deliver("site/dev2/temp", "4", 0, false, 0, 0, subscribes[1].subscriptionId);
+    EXPECT_EQ(calls, (std::vector<std::string>{"temp2:site/dev2/temp", "temp:site/dev2/temp"}));
+    fake.deliver("site/dev2/hum", "5", 0, false, 0, 0, subscribes[1].subscriptionId);
+
+    MqttSubscriptionIdStats stats = client->getSubscriptionIdStats();
+    EXPECT_TRUE(stats.enabled);
+    EXPECT_FALSE(stats.refused);
+    EXPECT_EQ(stats.assigned, 3u);
+    EXPECT_EQ(stats.direct, 3u);
+    EXPECT_EQ(stats.fallback, 2u);
+
+    // Direct again once the overlapping filter is gone
+    ASSERT_TRUE(client->unsubscribe("site/+/temp"));
+    fake.deliver("site/dev2/temp", "6", 0, false, 0, 0, subscribes[1].subscriptionId);
+    EXPECT_EQ(client->getSubscriptionIdStats().direct, 4u);
+}
+
+TEST_F(ClientTest, SubscriptionIdsRenumberedOnRestore)
+{
+    ASSERT_TRUE(client->enableMqtt5());
+    FakeMqttClient &fake = start();
+    int calls = 0;
+    ASSERT_TRUE(client->subscribe("a/1", [&calls](const MqttMessageView &) { calls++; }, 1));
+    ASSERT_TRUE(client->subscribeMany({{"b/1", 1, nullptr}, {"b/2", 1, nullptr}}));
+    ASSERT_TRUE(client->subscribe("c/1", [](const MqttMessageView &) {}, 1));
+    std::vector<FakeMqttClient::Subscribe> before = fake.subscribes();
+    ASSERT_EQ(before.size(), 4u);
+
+    fake.disconnect();
+    fake.clearRecords();
+    fake.connect(false);
+    for (const FakeMqttClient::Subscribe &subscribe : fake.subscribes())
+        fake.subAck(subscribe.msgId);
+
+    // The old identifiers mean nothing to the broker: the restore is packed by size, with a new one
+    std::vector<FakeMqttClient::Subscribe> after = fake.subscribes();
+    ASSERT_EQ(after.size(), before.size());
+    for (std::size_t i = 0; i < after.size(); i++)
+    {
+        EXPECT_EQ(after[i].topic, before[i].topic);
+        EXPECT_EQ(after[i].msgId, after[0].msgId);
+        EXPECT_EQ(after[i].subscriptionId, after[0].subscriptionId);
+        EXPECT_NE(after[i].subscriptionId, before[i].subscriptionId);
+    }
+    EXPECT_NE(after[0].subscriptionId, 0u);
+    EXPECT_EQ(client->getSubscriptionIdStats().assigned, 4u);
+
+    // Messages tagged with the new identifier go straight to their subscription
+    fake.deliver("a/1", "x", 0, false, 0, 0, after[0].subscriptionId);
+    EXPECT_EQ(calls, 1);
+    EXPECT_EQ(client->getSubscriptionIdStats().direct, 1u);
+}
+
+TEST_F(ClientTest, SubscriptionIdsLeftOutIfTheBrokerRefusesThem)
+{
+    ASSERT_TRUE(client->enableMqtt5());
+    FakeMqttClient &fake = start();
+    fake.setSubscriptionIdsAvailable(false);
+    int calls = 0;
+    ASSERT_TRUE(client->subscribe("site/+/temp", [&calls](const MqttMessageView &) { calls++; }, 0));
+    ASSERT_TRUE(client->subscribe("site/dev1/hum", [&calls](const MqttMessageView &) { calls++; }, 0));
+
+    std::vector<FakeMqttClient::Subscribe> subscribes = fake.subscribes();
+    ASSERT_EQ(subscribes.size(), 2u);
+    EXPECT_EQ(subscribes[0].subscriptionId, 0u);
+    EXPECT_EQ(subscribes[1].subscriptionId, 0u);
+    fake.deliver("site/dev1/temp", "1");
+    EXPECT_EQ(calls, 1);
+
+    MqttSubscriptionIdStats stats = client->getSubscriptionIdStats();
+    EXPECT_FALSE(stats.enabled);
+    EXPECT_TRUE(stats.refused);
+    EXPECT_EQ(stats.assigned, 1u);
+    EXPECT_EQ(stats.fallback, 0u);
+}
+
+TEST_F(ClientTest, SubscribeManyLeavesRoomForSubscriptionIds)
+{
+    ASSERT_TRUE(client->enableMqtt5());
+    FakeMqttClient &fake = start();
+    // 101 bytes per topic: 5 of them fill the 512 byte buffer but for the properties
+    std::vector<MqttSubscribeRequest> requests;
+    for (int i = 0; i < 10; i++)
+        requests.push_back({std::string(96, 'a') + "/" + std::to_string(i), 1, nullptr});
+    ASSERT_TRUE(client->subscribeMany(requests));
+
+    std::vector<FakeMqttClient::Subscribe> subscribes = fake.subscribes();
+    ASSERT_EQ(subscribes.size(), requests.size());
+    EXPECT_EQ(subscribes[3].msgId, subscribes[0].msgId);
+    EXPECT_NE(subscribes[4].msgId, subscribes[0].msgId);
+    EXPECT_NE(subscribes[4].subscriptionId, subscribes[0].subscriptionId);
+}
+#endif
+
+TEST_F(ClientTest, TrackedPublishesReportAcknowledgements)
+{
+    MqttPublishTrackerConfig config;
+    config.capacity = 2;
+    config.timeoutMs = 1000;
+    ASSERT_TRUE(client->enablePublishTracking(config));
+    FakeMqttClient &fake = start();
+
+    std::vector<std::pair<int, MqttPublishResult>> completed;
+    MqttPublishCallback record = [&completed](int msgId, MqttPublishResult result, uint32_t) {
+        completed.push_back(std::make_pair(msgId, result));
+    };
+
+    int first = client->publishTracked("cmd", std::string("a\0b", 3), 1, false, record);
+    ASSERT_GT(first, 0);
+    EXPECT_EQ(fake.publishes().back().payload, std::string("a\0b", 3));
+    // QoS 0 completes right away, without a msg_id
+    EXPECT_EQ(client->publishTracked("log", "x", 0, false, record), 0);
+    ASSERT_EQ(completed.size(), 1u);
+    EXPECT_EQ(completed[0].second, MqttPublishResult::Sent);
+
+    FakeEsp::advanceTime(300000);
+    fake.pubAck(first);
+    ASSERT_EQ(completed.size(), 2u);
+    EXPECT_EQ(completed[1], std::make_pair(first, MqttPublishResult::Acknowledged));
+    MqttHistogramSnapshot latency = client->getStats().publishAckUs;
+    EXPECT_EQ(latency.count, 1u);
+    EXPECT_EQ(latency.max, 300000u);
+
+    // PUBACK processed by the MQTT task before publishTracked() returned
+    fake.setPublishHook([&fake](const FakeMqttClient::Publish &publish) { fake.pubAck(publish.msgId); });
+    int early = client->publishTracked("cmd", "b", 1, false, record);
+    fake.setPublishHook(nullptr);
+    ASSERT_EQ(completed.size(), 3u);
+    EXPECT_EQ(completed[2], std::make_pair(early, MqttPublishResult::Acknowledged));
+
+    // Unacknowledged ones time out, a full table rejects further publishes
+    int lost = client->publishTracked("cmd", "c", 1, false, record);
+    int deleted = client->publishTracked("cmd", "d", 2, false, record);
+    EXPECT_EQ(client->publishTracked("cmd", "e", 1, false, record), -1);
+    EXPECT_GT(client->publishTracked("cmd", "untracked", 1), 0);
+    esp_mqtt_event_t event = {};
+    event.event_id = MQTT_EVENT_DELETED;
+    event.msg_id = deleted;
+    fake.sendEvent(event);
+    FakeEsp::advanceTime(1300000);
+    ASSERT_EQ(completed.size(), 5u);
+    EXPECT_EQ(completed[3], std::make_pair(deleted, MqttPublishResult::Deleted));
+    EXPECT_EQ(completed[4], std::make_pair(lost, MqttPublishResult::TimedOut));
+
+    MqttPublishTrackerStats stats = client->getPublishTrackingStats();
+    EXPECT_EQ(stats.inFlight, 0u);
+    EXPECT_EQ(stats.tracked, 4u);
+    EXPECT_EQ(stats.acknowledged, 2u);
+    EXPECT_EQ(stats.timedOut, 1u);
+    EXPECT_EQ(stats.deleted, 1u);
+    EXPECT_EQ(stats.rejected, 1u);
+
+    fake.disconnect();
+    EXPECT_EQ(client->publishTracked("cmd", "f", 1, false, record), -1);
+    EXPECT_EQ(completed.size(), 5u);
+}
+
+TEST_F(ClientTest, TrackedPublishNeedsTrackingForCallbacks)
+{
+    FakeMqttClient &fake = start();
+    EXPECT_EQ(client->publishTracked("cmd", "a", 1, false, [](int, MqttPublishResult, uint32_t) {}), -1);
+    EXPECT_TRUE(fake.publishes().empty());
+    // The msg_id alone needs no tracking
+    EXPECT_GT(client->publishTracked("cmd", "a", 1), 0);
+}
+
+namespace
+{
+    struct Response
+    {
+        MqttRequestResult result;
+        std::string payload;
+        std::string correlationData;
+        uint32_t roundTripUs;
+    };
+
+    MqttResponseCallback recordResponse(std::vector<Response> &responses)
+    {
+        return [&responses](MqttRequestResult result, const MqttMessageView &message, uint32_t roundTripUs) {
+            Response response = {result, std::string(), std::string(), roundTripUs};
+            if (message.payload != nullptr)
+                response.payload.assign(message.payload, message.payloadLen);
+            if (message.correlationData != nullptr)
+                response.correlationData.assign(message.correlationData, message.correlationDataLen);
+            responses.push_back(response);
+        };
+    }
+
+    std::string requestIdText(uint32_t id)
+    {
+        char text[MqttRequestTable::kIdLength];
+        MqttRequestTable::formatId(id, text);
+        return std::string(text, sizeof(text));
+    }
+}
+
+TEST_F(ClientTest, RequestsUseReplyTopicsOnMqtt311)
+{
+    MqttRequestConfig config;
+    config.capacity = 2;
+    ASSERT_TRUE(client->enableRequests(config));
+    EXPECT_FALSE(client->enableRequests(config));
+    FakeMqttClient &fake = start();
+    ASSERT_EQ(fake.subscribes().size(), 1u);
+    EXPECT_EQ(fake.subscribes()[0].topic, "host-test/reply/+");
+    EXPECT_EQ(fake.subscribes()[0].qos, 1);
+
+    std::vector<Response> responses;
+    uint32_t id = client->request("dev1/cmd", "ping", 500, recordResponse(responses));
+    ASSERT_NE(id, 0u);
+    std::string idText = requestIdText(id);
+    EXPECT_EQ(fake.publishes().back().topic, "dev1/cmd/" + idText);
+    EXPECT_EQ(fake.publishes().back().payload, "ping");
+
+    FakeEsp::advanceTime(20000);
+    fake.deliver("host-test/reply/" + idText, "pong");
+    ASSERT_EQ(responses.size(), 1u);
+    EXPECT_EQ(responses[0].result, MqttRequestResult::Response);
+    EXPECT_EQ(responses[0].payload, "pong");
+    EXPECT_EQ(responses[0].roundTripUs, 20000u);
+    MqttHistogramSnapshot roundTrip = client->getStats().requestRttUs;
+    EXPECT_EQ(roundTrip.count, 1u);
+    EXPECT_EQ(roundTrip.max, 20000u);
+
+    // Duplicates and strangers match nothing
+    fake.deliver("host-test/reply/" + idText, "pong");
+    fake.deliver("host-test/reply/status", "?");
+    EXPECT_EQ(responses.size(), 1u);
+
+    // The response may arrive before request() returns
+    fake.setPublishHook([&fake](const FakeMqttClient::Publish &publish) {
+        fake.deliver("host-test/reply/" + publish.topic.substr(publish.topic.rfind('/') + 1), "fast");
+    });
+    ASSERT_NE(client->request("dev1/cmd", "ping", 500, recordResponse(responses)), 0u);
+    fake.setPublishHook(nullptr);
+    ASSERT_EQ(responses.size(), 2u);
+    EXPECT_EQ(responses[1].payload, "fast");
+
+    // Unanswered ones time out, a full table rejects further requests
+    uint32_t lost = client->request("dev1/cmd", "a", 500, recordResponse(responses));
+    ASSERT_NE(client->request("dev1/cmd", "b", 1000, recordResponse(responses)), 0u);
+    EXPECT_EQ(client->request("dev1/cmd", "c", 1000, recordResponse(responses)), 0u);
+    FakeEsp::advanceTime(600000);
+    ASSERT_EQ(responses.size(), 3u);
+    EXPECT_EQ(responses[2].result, MqttRequestResult::TimedOut);
+    EXPECT_EQ(responses[2].payload, "");
+    fake.deliver("host-test/reply/" + requestIdText(lost), "late");
+    FakeEsp::advanceTime(600000);
+    ASSERT_EQ(responses.size(), 4u);
+    EXPECT_EQ(responses[3].result, MqttRequestResult::TimedOut);
+
+    MqttRequestStats stats = client->getRequestStats();
+    EXPECT_EQ(stats.pending, 0u);
+    EXPECT_EQ(stats.capacity, 2u);
+    EXPECT_EQ(stats.sent, 4u);
+    EXPECT_EQ(stats.answered, 2u);
+    EXPECT_EQ(stats.timedOut, 2u);
+    EXPECT_EQ(stats.rejected, 1u);
+    EXPECT_EQ(stats.unmatched, 3u);
+
+    // The reply subscription is restored with the others, not sent twice
+    fake.disconnect();
+    fake.clearRecords();
+    EXPECT_EQ(client->request("dev1/cmd", "d", 500, recordResponse(responses)), 0u);
+    fake.connect(false);
+    ASSERT_EQ(fake.subscribes().size(), 1u);
+    EXPECT_EQ(fake.subscribes()[0].topic, "host-test/reply/+");
+}
+
+TEST_F(ClientTest, ReplySubscriptionRenewedWithoutAutoResubscribe)
+{
+    client->setAutoResubscribe(false);
+    ASSERT_TRUE(client->enableRequests(MqttRequestConfig()));
+    FakeMqttClient &fake = start();
+    ASSERT_EQ(fake.subscribes().size(), 1u);
+
+    // The broker kept it with the session
+    fake.disconnect();
+    fake.clearRecords();
+    fake.connect(true);
+    EXPECT_TRUE(fake.subscribes().empty());
+
+    // A clean session lost it, nothing else restores it
+    fake.disconnect();
+    fake.connect(false);
+    ASSERT_EQ(fake.subscribes().size(), 1u);
+    EXPECT_EQ(fake.subscribes()[0].topic, "host-test/reply/+");
+    fake.subAck(fake.subscribes()[0].msgId);
+
+    std::vector<Response> responses;
+    uint32_t id = client->request("dev1/cmd", "ping", 500, recordResponse(responses));
+    ASSERT_NE(id, 0u);
+    fake.deliver("host-test/reply/" + requestIdText(id), "pong");
+    ASSERT_EQ(responses.size(), 1u);
+    EXPECT_EQ(responses[0].payload, "pong");
+    EXPECT_EQ(client->getStats().subscriptions.size(), 1u);
+}
+
+TEST_F(ClientTest, RequestsNeedEnableRequests)
+{
+    MqttRequestConfig config;
+    config.replyTopic = "dev1/reply/#";
+    EXPECT_FALSE(client->enableRequests(config));
+    config.replyTopic = "dev1/reply";
+    config.capacity = MqttRequestTable::kMaxCapacity + 1;
+    EXPECT_FALSE(client->enableRequests(config));
+
+    FakeMqttClient &fake = start();
+    EXPECT_EQ(client->request("dev1/cmd", "ping", 500, [](MqttRequestResult, const MqttMessageView &, uint32_t) {}), 0u);
+    EXPECT_TRUE(fake.publishes().empty());
+    EXPECT_TRUE(fake.subscribes().empty());
+}
+
+#ifdef ESP32MQTTCLIENT_MQTT5
+TEST_F(ClientTest, RequestsCarryResponseTopicAndCorrelationDataOnMqtt5)
+{
+    ASSERT_TRUE(client->enableMqtt5());
+    ASSERT_TRUE(client->enableTopicAliases(2));
+    MqttRequestConfig config;
+    config.replyTopic = "dev1/rpc";
+    ASSERT_TRUE(client->enableRequests(config));
+    FakeMqttClient &fake = start();
+    EXPECT_EQ(fake.subscribes()[0].topic, "dev1/rpc/+");
+
+    std::vector<Response> responses;
+    uint32_t id = client->request("svc/time", "now?", 500, recordResponse(responses));
+    ASSERT_NE(id, 0u);
+    FakeMqttClient::Publish request = fake.publishes().back();
+    EXPECT_EQ(request.topic, "svc/time");
+    EXPECT_EQ(request.responseTopic, "dev1/rpc/" + requestIdText(id));
+    EXPECT_EQ(request.correlationData, requestIdText(id));
+    // Along with the topic alias
+    EXPECT_EQ(request.topicAlias, 1u);
+
+    // The properties are not left to the next publish
+    ASSERT_TRUE(client->publish("svc/time", "plain"));
+    EXPECT_EQ(fake.publishes().back().responseTopic, "");
+    EXPECT_EQ(fake.publishes().back().correlationData, "");
+
+    // Matched by the echoed correlation data, whatever the topic
+    fake.deliverWithProperties(request.responseTopic, "12:00", "", request.correlationData);
+    ASSERT_EQ(responses.size(), 1u);
+    EXPECT_EQ(responses[0].result, MqttRequestResult::Response);
+    EXPECT_EQ(responses[0].payload, "12:00");
+    EXPECT_EQ(responses[0].correlationData, requestIdText(id));
+    EXPECT_EQ(fake.protocolErrors(), 0);
+}
+
+TEST_F(ClientTest, ResponsePropertiesSurviveAsyncDispatch)
+{
+    ASSERT_TRUE(client->enableMqtt5());
+    FakeMqttClient &fake = start();
+    std::vector<std::string> seen;
+    std::mutex seenMutex;
+    ASSERT_TRUE(client->subscribe("svc/time", [&seen, &seenMutex](const MqttMessageView &message) {
+        std::lock_guard<std::mutex> lock(seenMutex);
+        seen.push_back(std::string(message.responseTopic, message.responseTopicLen) + " " +
+                       std::string(message.correlationData, message.correlationDataLen));
+    }, 0));
+
+    fake.deliverWithProperties("svc/time", "now?", "dev1/rpc/00000100", "00000100");
+    ASSERT_TRUE(client->enableAsyncDispatch());
+    fake.deliverWithProperties("svc/time", "now?", "dev1/rpc/00000200", "00000200");
+    ASSERT_TRUE(waitFor([&seen, &seenMutex] {
+        std::lock_guard<std::mutex> lock(seenMutex);
+        return seen.size() == 2;
+    }));
+    EXPECT_EQ(seen[0], "dev1/rpc/00000100 00000100");
+    EXPECT_EQ(seen[1], "dev1/rpc/00000200 00000200");
+}
+#endif
+
+TEST_F(ClientTest, StatsCountTrafficAndConnections)
+{
+    FakeMqttClient &fake = start();
+    client->subscribe("in/#", [](const MqttMessageView &) {});
+    client->setMaxMessageSize(100);
+
+    fake.deliver("in/a", "12345");
+    fake.deliver("in/b", std::string(300, 'x'), 0, false, 100); // Too large, dropped
+    EXPECT_TRUE(client->publish("out", "abc"));
+    fake.failPublishes(1);
+    EXPECT_FALSE(client->publish("out", "abc"));
+
+    FakeEsp::advanceTime(2500000);
+    fake.disconnect();
+    EXPECT_FALSE(client->publish("out", "abc"));
+    FakeEsp::advanceTime(1000000);
+    fake.connect();
+    FakeEsp::advanceTime(500000);
+
+    MqttClientStats stats = client->getStats();
+    EXPECT_EQ(stats.messagesIn, 2u);
+    EXPECT_EQ(stats.bytesIn, 305u);
+    EXPECT_EQ(stats.messagesOut, 1u);
+    EXPECT_EQ(stats.bytesOut, 3u);
+    EXPECT_EQ(stats.publishFailures, 2u);
+    EXPECT_EQ(stats.inboundDropped, 1u);
+    EXPECT_EQ(stats.connects, 2u);
+    EXPECT_EQ(stats.reconnects, 1u);
+    EXPECT_EQ(stats.disconnects, 1u);
+    EXPECT_EQ(stats.sessionMs, 500u);
+    EXPECT_EQ(stats.connectedMs, 3000u);
+    EXPECT_EQ(stats.dispatchUs.count, 1u);
+
+    ASSERT_EQ(stats.subscriptions.size(), 1u);
+    EXPECT_EQ(stats.subscriptions[0].topic, "in/#");
+    EXPECT_EQ(stats.subscriptions[0].messages, 1u);
+}
+
+TEST_F(ClientTest, StatsTrackSlowestCallbackPerSubscription)
+{
+    FakeMqttClient &fake = start();
+    client->subscribe("slow", [](const MqttMessageView &) { FakeEsp::advanceTime(700); });
+    client->subscribe("fast", [](const MqttMessageView &) {});
+
+    fake.deliver("slow", "1");
+    fake.deliver("fast", "1");
+    fake.deliver("fast", "2");
+
+    MqttClientStats stats = client->getStats();
+    ASSERT_EQ(stats.subscriptions.size(), 2u);
+    EXPECT_EQ(stats.subscriptions[0].messages, 1u);
+    EXPECT_EQ(stats.subscriptions[0].maxCallbackUs, 700u);
+    EXPECT_EQ(stats.subscriptions[1].messages, 2u);
+    EXPECT_EQ(stats.subscriptions[1].maxCallbackUs, 0u);
+    EXPECT_EQ(stats.dispatchUs.count, 3u);
+    EXPECT_EQ(stats.dispatchUs.max, 700u);
+}
+
+TEST_F(ClientTest, StatsArePublishedPeriodically)
+{
+    ASSERT_TRUE(client->enableStatsPublish("dev/stats", 10000, 1));
+    EXPECT_FALSE(client->enableStatsPublish("dev/stats2", 10000));
+    ASSERT_TRUE(client->loopStart());
+    FakeMqttClient &fake = *FakeMqttClient::last();
+
+    // Skipped while disconnected
+    FakeEsp::advanceTime(10000000);
+    EXPECT_TRUE(fake.publishes().empty());
+
+    fake.connect();
+    FakeEsp::advanceTime(20000000);
+    std::vector<FakeMqttClient::Publish> publishes = fake.publishes();
+    ASSERT_EQ(publishes.size(), 2u);
+    EXPECT_EQ(publishes[0].topic, "dev/stats");
+    EXPECT_EQ(publishes[0].qos, 1);
+    EXPECT_NE(publishes[1].payload.find("\"msgsOut\":1,"), std::string::npos);
+    EXPECT_NE(publishes[1].payload.find("\"connects\":1,"), std::string::npos);
+}
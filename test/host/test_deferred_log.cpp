@@ -0,0 +1,175 @@
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ESP32MQTTClientDeferredLog.h"
+
+namespace
+{
+    const char *kFormat = "[%.*s] %.*s (%u bytes)";
+
+    struct Line
+    {
+        uint8_t level;
+        int64_t timeUs;
+        std::string text;
+    };
+
+    std::mutex linesMutex;
+    std::vector<Line> lines;
+
+    void collect(uint8_t level, int64_t timeUs, const char *line)
+    {
+        std::lock_guard<std::mutex> lock(linesMutex);
+        lines.push_back(Line{level, timeUs, line});
+    }
+
+    void clearLines()
+    {
+        std::lock_guard<std::mutex> lock(linesMutex);
+        lines.clear();
+    }
+
+    bool pushText(MqttDeferredLog &log, const std::string &topic, const std::string &payload, int64_t timeUs = 0)
+    {
+        return log.push(3, kFormat, timeUs, topic.data(), topic.size(), payload.data(), payload.size(), 64);
+    }
+}
+
+TEST(DeferredLog, KeepsOrderAndFormats)
+{
+    clearLines();
+    MqttDeferredLog log(4);
+    EXPECT_EQ(log.capacity(), 4u);
+
+    EXPECT_TRUE(pushText(log, "a/b", "one", 100));
+    EXPECT_TRUE(pushText(log, "a/c", std::string("t\0o", 3), 200));
+    EXPECT_EQ(log.drain(collect), 2u);
+
+    ASSERT_EQ(lines.size(), 2u);
+    EXPECT_EQ(lines[0].text, "[a/b] one (3 bytes)");
+    EXPECT_EQ(lines[0].level, 3);
+    EXPECT_EQ(lines[0].timeUs, 100);
+    EXPECT_EQ(lines[1].text, std::string("[a/c] t (3 bytes)")); // %.*s stops at the NUL
+    EXPECT_EQ(lines[1].timeUs, 200);
+
+    // Slots are reused once drained
+    for (int round = 0; round < 3; round++)
+    {
+        for (int i = 0; i < 4; i++)
+            EXPECT_TRUE(pushText(log, "t", std::to_string(i)));
+        EXPECT_EQ(log.drain(collect), 4u);
+    }
+    EXPECT_EQ(lines.size(), 14u);
+    EXPECT_EQ(lines.back().text, "[t] 3 (1 bytes)");
+}
+
+TEST(DeferredLog, TruncatesTopicAndPayload)
+{
+    MqttDeferredLog log(2);
+    MqttLogRecord record;
+
+    std::string payload(1000, 'p');
+    EXPECT_TRUE(pushText(log, "x/y", payload));
+    ASSERT_TRUE(log.pop(record));
+    EXPECT_EQ(record.topicLen, 3);
+    EXPECT_EQ(record.payloadLen, 64);
+    EXPECT_EQ(record.payloadSize, 1000u);
+
+    // A long topic takes the space of the payload first
+    std::string topic(MqttLogRecord::kTextSize - 10, 't');
+    EXPECT_TRUE(pushText(log, topic, payload));
+    ASSERT_TRUE(log.pop(record));
+    EXPECT_EQ(record.topicLen, topic.size());
+    EXPECT_EQ(record.payloadLen, 10);
+
+    std::string hugeTopic(MqttLogRecord::kTextSize * 2, 't');
+    EXPECT_TRUE(pushText(log, hugeTopic, payload));
+    ASSERT_TRUE(log.pop(record));
+    EXPECT_EQ(record.topicLen, MqttLogRecord::kTextSize);
+    EXPECT_EQ(record.payloadLen, 0);
+
+    // The line buffer is cut, not overrun
+    char line[16];
+    EXPECT_EQ(MqttDeferredLog::format(record, line, sizeof(line)), sizeof(line) - 1);
+    EXPECT_EQ(std::string(line), "[" + std::string(14, 't'));
+}
+
+TEST(DeferredLog, DropsWhenFullAndReportsIt)
+{
+    clearLines();
+    MqttDeferredLog log(4);
+    for (int i = 0; i < 6; i++)
+        pushText(log, "t", std::to_string(i), i);
+
+    MqttDeferredLogStats stats = log.getStats();
+    EXPECT_EQ(stats.logged, 4u);
+    EXPECT_EQ(stats.dropped, 2u);
+
+    // The oldest records are kept, followed by one warning about the lost ones
+    EXPECT_EQ(log.drain(collect), 4u);
+    ASSERT_EQ(lines.size(), 5u);
+    EXPECT_EQ(lines[3].text, "[t] 3 (1 bytes)");
+    EXPECT_EQ(lines[4].level, 2);
+    EXPECT_EQ(lines[4].text, "MQTT! 2 log record(s) dropped, log ring full");
+    EXPECT_EQ(log.getStats().printed, 4u);
+
+    // Reported only once
+    EXPECT_EQ(log.drain(collect), 0u);
+    EXPECT_EQ(lines.size(), 5u);
+}
+
+TEST(DeferredLog, DrainTaskPrintsConcurrentProducers)
+{
+    clearLines();
+    MqttDeferredLog log(256);
+    MqttDeferredLogConfig config;
+    config.idleMs = 1;
+    ASSERT_TRUE(log.start(collect, config));
+    EXPECT_FALSE(log.start(collect, config));
+    EXPECT_TRUE(log.isRunning());
+
+    const int producers = 4;
+    const int perProducer = 2000;
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; p++)
+    {
+        threads.push_back(std::thread([&log, p]() {
+            std::string topic = "p" + std::to_string(p);
+            for (int i = 0; i < perProducer; i++)
+            {
+                std::string payload = std::to_string(i);
+                // Retry on a full ring so every record arrives
+                while (!pushText(log, topic, payload))
+                    std::this_thread::yield();
+            }
+        }));
+    }
+    for (std::size_t i = 0; i < threads.size(); i++)
+        threads[i].join();
+    log.stop();
+    EXPECT_FALSE(log.isRunning());
+
+    MqttDeferredLogStats stats = log.getStats();
+    EXPECT_EQ(stats.logged, (uint32_t)(producers * perProducer));
+    EXPECT_EQ(stats.printed, stats.logged);
+
+    // Each producer's records arrive complete and in order
+    std::vector<int> next(producers, 0);
+    for (std::size_t i = 0; i < lines.size(); i++)
+    {
+        if (lines[i].level != 3)
+            continue; // Drop warnings from the retried pushes
+        int producer, value;
+        ASSERT_EQ(sscanf(lines[i].text.c_str(), "[p%d] %d", &producer, &value), 2) << lines[i].text;
+        ASSERT_LT(producer, producers);
+        EXPECT_EQ(value, next[producer]);
+        next[producer] = value + 1;
+    }
+    for (int p = 0; p < producers; p++)
+        EXPECT_EQ(next[p], perProducer);
+}
@@ -0,0 +1,67 @@
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include "ESP32MQTTClient.h"
+#include "ESP32MQTTClientLogging.h"
+#include "fake_mqtt_client.h"
+
+// ESP32MQTTCLIENT_DEBUG compiles the debug logs in, the level removes them again
+#if !defined(ESP32MQTTCLIENT_DEFERRED_LOG) || !defined(ESP32MQTTCLIENT_DEBUG) || ESP32MQTTCLIENT_LOG_LEVEL != 3
+#error "Build with ESP32MQTTCLIENT_DEFERRED_LOG, ESP32MQTTCLIENT_DEBUG and ESP32MQTTCLIENT_LOG_LEVEL=3"
+#endif
+
+namespace
+{
+    std::vector<std::string> lines;
+
+    void collect(uint8_t, int64_t, const char *line)
+    {
+        lines.push_back(line);
+    }
+
+    int evaluated = 0;
+
+    int countEvaluation()
+    {
+        return ++evaluated;
+    }
+}
+
+TEST(DeferredLogClient, MessageLogsGoThroughTheRing)
+{
+    // Started before the client, which then leaves the running drain task alone
+    lines.clear();
+    ASSERT_TRUE(mqttDeferredLog().start(collect));
+    {
+        ESP32MQTTClient client;
+        client.enableDebuggingMessages(true);
+        client.setURI("mqtt://broker.local");
+        client.loopStart();
+        FakeMqttClient &fake = *FakeMqttClient::last();
+        fake.connect();
+
+        client.subscribe("home/temp", [](const MqttMessageView &) {});
+        fake.deliver("home/temp", std::string(200, 'x'));
+        EXPECT_TRUE(client.publish("home/cmd", "on"));
+    }
+    mqttDeferredLog().stop();
+
+    std::vector<std::string> expected = {
+        "MQTT >> [home/temp] " + std::string(ESP32MQTTCLIENT_LOG_PAYLOAD_MAX, 'x') + " (200 bytes)",
+        "MQTT << [home/cmd] on (2 bytes)"};
+    EXPECT_EQ(lines, expected);
+    EXPECT_EQ(mqttDeferredLog().getStats().dropped, 0u);
+}
+
+TEST(DeferredLogClient, LevelRemovesCallSitesBelowIt)
+{
+    evaluated = 0;
+    MQTTC_LOG_D("%d", countEvaluation());
+    MQTTC_LOG_V("%d", countEvaluation());
+    EXPECT_EQ(evaluated, 0);
+
+    MQTTC_LOG_I("%d", countEvaluation());
+    EXPECT_EQ(evaluated, 1);
+}
@@ -0,0 +1,227 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "ESP32MQTTClientDispatchQueue.h"
+
+namespace
+{
+    // Holds tasks back until opened
+    class Gate
+    {
+    public:
+        void open()
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _open = true;
+            _cv.notify_all();
+        }
+
+        void wait()
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _cv.wait(lock, [this]() { return _open; });
+        }
+
+    private:
+        std::mutex _mutex;
+        std::condition_variable _cv;
+        bool _open = false;
+    };
+
+    bool waitFor(const std::function<bool()> &condition)
+    {
+        for (int i = 0; i < 2000; i++)
+        {
+            if (condition())
+                return true;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return condition();
+    }
+
+    MqttDispatchConfig makeConfig(std::size_t workers, std::size_t queueLength, MqttDispatchPolicy policy)
+    {
+        MqttDispatchConfig config;
+        config.workers = workers;
+        config.queueLength = queueLength;
+        config.policy = policy;
+        return config;
+    }
+
+    const int keyA = 1;
+    const int keyB = 2;
+}
+
+TEST(DispatchQueue, RejectsInvalidConfigAndDoubleStart)
+{
+    MqttDispatchQueue queue;
+    EXPECT_FALSE(queue.start(makeConfig(0, 4, MqttDispatchPolicy::DropOldest)));
+    EXPECT_FALSE(queue.start(makeConfig(1, 0, MqttDispatchPolicy::DropOldest)));
+    EXPECT_FALSE(queue.push(&keyA, []() {}));
+
+    EXPECT_TRUE(queue.start(makeConfig(1, 4, MqttDispatchPolicy::DropOldest)));
+    EXPECT_FALSE(queue.start(makeConfig(1, 4, MqttDispatchPolicy::DropOldest)));
+}
+
+TEST(DispatchQueue, StopRunsQueuedTasks)
+{
+    MqttDispatchQueue queue;
+    ASSERT_TRUE(queue.start(makeConfig(2, 64, MqttDispatchPolicy::Block)));
+
+    std::atomic<int> runs(0);
+    for (int i = 0; i < 50; i++)
+        EXPECT_TRUE(queue.push(&keyA, [&runs]() { runs++; }));
+    queue.stop();
+
+    EXPECT_EQ(runs.load(), 50);
+    MqttDispatchStats stats = queue.getStats();
+    EXPECT_EQ(stats.enqueued, 50u);
+    EXPECT_EQ(stats.delivered, 50u);
+    EXPECT_EQ(stats.dropped, 0u);
+    EXPECT_EQ(stats.depth, 0u);
+    EXPECT_FALSE(queue.push(&keyA, []() {}));
+}
+
+TEST(DispatchQueue, KeepsOrderAndExclusivityPerKey)
+{
+    const int keyCount = 4;
+    const int perKey = 300;
+    int keys[keyCount];
+
+    MqttDispatchQueue queue;
+    ASSERT_TRUE(queue.start(makeConfig(4, 32, MqttDispatchPolicy::Block)));
+
+    std::vector<int> seen[keyCount];
+    std::atomic<int> running[keyCount];
+    std::atomic<int> overlaps(0);
+    for (int k = 0; k < keyCount; k++)
+        running[k] = 0;
+
+    for (int i = 0; i < perKey; i++)
+    {
+        for (int k = 0; k < keyCount; k++)
+        {
+            queue.push(&keys[k], [&, k, i]() {
+                if (running[k].fetch_add(1) != 0)
+                    overlaps++;
+                seen[k].push_back(i); // Safe only if tasks of a key never overlap
+                if (i % 7 == 0)
+                    std::this_thread::yield();
+                running[k]--;
+            });
+        }
+    }
+    queue.stop();
+
+    EXPECT_EQ(overlaps.load(), 0);
+    for (int k = 0; k < keyCount; k++)
+    {
+        ASSERT_EQ(seen[k].size(), (std::size_t)perKey);
+        for (int i = 0; i < perKey; i++)
+            EXPECT_EQ(seen[k][i], i);
+    }
+}
+
+TEST(DispatchQueue, SlowKeyDoesNotHoldBackOtherKeys)
+{
+    MqttDispatchQueue queue;
+    ASSERT_TRUE(queue.start(makeConfig(2, 8, MqttDispatchPolicy::DropNewest)));
+
+    Gate gate;
+    std::atomic<int> slowRuns(0);
+    std::atomic<int> fastRuns(0);
+    queue.push(&keyA, [&]() { gate.wait(); slowRuns++; });
+    queue.push(&keyA, [&]() { slowRuns++; });
+    for (int i = 0; i < 5; i++)
+        queue.push(&keyB, [&]() { fastRuns++; });
+
+    // The second task of keyA waits behind the first, keyB passes it on the other worker
+    EXPECT_TRUE(waitFor([&]() { return fastRuns.load() == 5; }));
+    EXPECT_EQ(slowRuns.load(), 0);
+    EXPECT_EQ(queue.getStats().depth, 1u);
+
+    gate.open();
+    queue.stop();
+    EXPECT_EQ(slowRuns.load(), 2);
+}
+
+TEST(DispatchQueue, DropNewestKeepsQueuedTasks)
+{
+    MqttDispatchQueue queue;
+    ASSERT_TRUE(queue.start(makeConfig(1, 2, MqttDispatchPolicy::DropNewest)));
+
+    Gate gate;
+    std::atomic<bool> blocked(false);
+    std::vector<int> order;
+    queue.push(&keyA, [&]() { blocked = true; gate.wait(); });
+    ASSERT_TRUE(waitFor([&]() { return blocked.load(); }));
+
+    for (int i = 0; i < 5; i++)
+        EXPECT_EQ(queue.push(&keyA, [&order, i]() { order.push_back(i); }), i < 2);
+
+    MqttDispatchStats stats = queue.getStats();
+    EXPECT_EQ(stats.depth, 2u);
+    EXPECT_EQ(stats.maxDepth, 2u);
+    EXPECT_EQ(stats.dropped, 3u);
+
+    gate.open();
+    queue.stop();
+    EXPECT_EQ(order, (std::vector<int>{0, 1}));
+}
+
+TEST(DispatchQueue, DropOldestKeepsNewestTasks)
+{
+    MqttDispatchQueue queue;
+    ASSERT_TRUE(queue.start(makeConfig(1, 2, MqttDispatchPolicy::DropOldest)));
+
+    Gate gate;
+    std::atomic<bool> blocked(false);
+    std::vector<int> order;
+    queue.push(&keyA, [&]() { blocked = true; gate.wait(); });
+    ASSERT_TRUE(waitFor([&]() { return blocked.load(); }));
+
+    for (int i = 0; i < 5; i++)
+        EXPECT_TRUE(queue.push(&keyA, [&order, i]() { order.push_back(i); }));
+    EXPECT_EQ(queue.getStats().dropped, 3u);
+
+    gate.open();
+    queue.stop();
+    EXPECT_EQ(order, (std::vector<int>{3, 4}));
+    EXPECT_EQ(queue.getStats().delivered, 3u);
+}
+
+TEST(DispatchQueue, BlockWaitsForFreeSlot)
+{
+    MqttDispatchQueue queue;
+    ASSERT_TRUE(queue.start(makeConfig(1, 1, MqttDispatchPolicy::Block)));
+
+    Gate gate;
+    std::atomic<bool> blocked(false);
+    std::atomic<int> runs(0);
+    queue.push(&keyA, [&]() { blocked = true; gate.wait(); });
+    ASSERT_TRUE(waitFor([&]() { return blocked.load(); }));
+    queue.push(&keyA, [&]() { runs++; }); // Fills the queue
+
+    std::atomic<bool> pushed(false);
+    std::thread producer([&]() {
+        queue.push(&keyA, [&]() { runs++; });
+        pushed = true;
+    });
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    EXPECT_FALSE(pushed.load());
+
+    gate.open();
+    producer.join();
+    EXPECT_TRUE(pushed.load());
+    queue.stop();
+
+    EXPECT_EQ(runs.load(), 2);
+    EXPECT_EQ(queue.getStats().dropped, 0u);
+}
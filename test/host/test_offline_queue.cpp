@@ -0,0 +1,274 @@
+#include <gtest/gtest.h>
+
+#include <deque>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "ESP32MQTTClientOfflineQueue.h"
+
+namespace
+{
+    struct Sent
+    {
+        std::string topic;
+        std::string payload;
+        int qos;
+        bool retain;
+    };
+
+    MqttOfflineQueueConfig makeConfig(std::size_t capacity, MqttOfflinePolicy policy)
+    {
+        MqttOfflineQueueConfig config;
+        config.capacity = capacity;
+        config.policy = policy;
+        return config;
+    }
+
+    bool push(MqttOfflineQueue &queue, const std::string &topic, const std::string &payload,
+              uint32_t ttlMs = 0, int64_t now = 0, int qos = 0, bool retain = false)
+    {
+        return queue.push(topic.data(), topic.size(), payload.data(), payload.size(), qos, retain, ttlMs, now);
+    }
+
+    std::vector<Sent> drainAll(MqttOfflineQueue &queue, int64_t now = 0)
+    {
+        std::vector<Sent> sent;
+        queue.drain(1000, now, [&sent](const MqttOfflineMessage &message) {
+            EXPECT_EQ(message.topic[message.topicLen], '\0');
+            EXPECT_EQ(message.payload[message.payloadLen], '\0');
+            sent.push_back({std::string(message.topic, message.topicLen),
+                            std::string(message.payload, message.payloadLen), message.qos, message.retain});
+            return true;
+        });
+        return sent;
+    }
+
+    // Bytes a message occupies in the arena
+    std::size_t recordSize(const std::string &topic, const std::string &payload)
+    {
+        return (24 + topic.size() + payload.size() + 7) / 8 * 8;
+    }
+}
+
+TEST(OfflineQueue, DisabledUntilBegin)
+{
+    MqttOfflineQueue queue;
+    EXPECT_FALSE(queue.isEnabled());
+    EXPECT_FALSE(push(queue, "a", "b"));
+    EXPECT_FALSE(queue.begin(makeConfig(0, MqttOfflinePolicy::DropOldest)));
+
+    ASSERT_TRUE(queue.begin(makeConfig(256, MqttOfflinePolicy::DropOldest)));
+    EXPECT_FALSE(queue.begin(makeConfig(256, MqttOfflinePolicy::DropOldest)));
+    EXPECT_TRUE(queue.empty());
+    EXPECT_EQ(queue.getStats().capacity, 256u);
+
+    queue.end();
+    EXPECT_FALSE(queue.isEnabled());
+    EXPECT_EQ(queue.getStats().capacity, 0u);
+}
+
+TEST(OfflineQueue, KeepsOrderAndMessageFields)
+{
+    MqttOfflineQueue queue;
+    ASSERT_TRUE(queue.begin(makeConfig(1024, MqttOfflinePolicy::DropOldest)));
+
+    std::string binary("a\0b", 3);
+    EXPECT_TRUE(push(queue, "t/1", "one", 0, 0, 1, true));
+    EXPECT_TRUE(push(queue, "t/2", binary, 0, 0, 2, false));
+    EXPECT_TRUE(push(queue, "t/3", "", 0, 0, 0, false));
+
+    MqttOfflineQueueStats stats = queue.getStats();
+    EXPECT_EQ(stats.messages, 3u);
+    EXPECT_EQ(stats.bytesUsed, recordSize("t/1", "one") + recordSize("t/2", binary) + recordSize("t/3", ""));
+
+    std::vector<Sent> sent = drainAll(queue);
+    ASSERT_EQ(sent.size(), 3u);
+    EXPECT_EQ(sent[0].topic, "t/1");
+    EXPECT_EQ(sent[0].payload, "one");
+    EXPECT_EQ(sent[0].qos, 1);
+    EXPECT_TRUE(sent[0].retain);
+    EXPECT_EQ(sent[1].payload, binary);
+    EXPECT_EQ(sent[1].qos, 2);
+    EXPECT_EQ(sent[2].payload, "");
+
+    stats = queue.getStats();
+    EXPECT_EQ(stats.messages, 0u);
+    EXPECT_EQ(stats.bytesUsed, 0u);
+    EXPECT_EQ(stats.queued, 3u);
+    EXPECT_EQ(stats.sent, 3u);
+}
+
+TEST(OfflineQueue, DropOldestMakesRoom)
+{
+    // Room for exactly four 32 byte records
+    MqttOfflineQueue queue;
+    ASSERT_TRUE(queue.begin(makeConfig(128, MqttOfflinePolicy::DropOldest)));
+    ASSERT_EQ(recordSize("t", "msg-100"), 32u);
+
+    for (int i = 0; i < 6; i++)
+        EXPECT_TRUE(push(queue, "t", "msg-" + std::to_string(100 + i)));
+
+    std::vector<Sent> sent = drainAll(queue);
+    ASSERT_EQ(sent.size(), 4u);
+    EXPECT_EQ(sent[0].payload, "msg-102");
+    EXPECT_EQ(sent[3].payload, "msg-105");
+    EXPECT_EQ(queue.getStats().dropped, 2u);
+}
+
+TEST(OfflineQueue, DropNewestRejectsWhenFull)
+{
+    MqttOfflineQueue queue;
+    ASSERT_TRUE(queue.begin(makeConfig(128, MqttOfflinePolicy::DropNewest)));
+
+    for (int i = 0; i < 6; i++)
+        EXPECT_EQ(push(queue, "t", "msg-" + std::to_string(100 + i)), i < 4);
+
+    std::vector<Sent> sent = drainAll(queue);
+    ASSERT_EQ(sent.size(), 4u);
+    EXPECT_EQ(sent[0].payload, "msg-100");
+    EXPECT_EQ(sent[3].payload, "msg-103");
+    EXPECT_EQ(queue.getStats().dropped, 2u);
+}
+
+TEST(OfflineQueue, RejectsMessageLargerThanArena)
+{
+    MqttOfflineQueue queue;
+    ASSERT_TRUE(queue.begin(makeConfig(64, MqttOfflinePolicy::DropOldest)));
+    EXPECT_TRUE(push(queue, "t", "small"));
+
+    EXPECT_FALSE(push(queue, "t", std::string(64, 'x')));
+    EXPECT_EQ(queue.getStats().dropped, 1u);
+    // The queued message was not sacrificed for one that can never fit
+    EXPECT_EQ(queue.getStats().messages, 1u);
+}
+
+TEST(OfflineQueue, ExpiredMessagesAreDiscarded)
+{
+    MqttOfflineQueueConfig config = makeConfig(512, MqttOfflinePolicy::DropOldest);
+    config.ttlMs = 1000;
+    MqttOfflineQueue queue;
+    ASSERT_TRUE(queue.begin(config));
+
+    EXPECT_TRUE(push(queue, "t", "default ttl", 0, 0));
+    EXPECT_TRUE(push(queue, "t", "short ttl", 10, 0));
+    EXPECT_TRUE(push(queue, "t", "long ttl", 5000, 0));
+
+    std::vector<Sent> sent = drainAll(queue, 1500 * 1000);
+    ASSERT_EQ(sent.size(), 1u);
+    EXPECT_EQ(sent[0].payload, "long ttl");
+    EXPECT_EQ(queue.getStats().expired, 2u);
+}
+
+TEST(OfflineQueue, FailedSendStaysQueued)
+{
+    MqttOfflineQueue queue;
+    ASSERT_TRUE(queue.begin(makeConfig(512, MqttOfflinePolicy::DropOldest)));
+    for (int i = 0; i < 5; i++)
+        push(queue, "t", std::to_string(i));
+
+    int calls = 0;
+    std::size_t sent = queue.drain(10, 0, [&calls](const MqttOfflineMessage &) { return ++calls < 3; });
+    EXPECT_EQ(sent, 2u);
+
+    std::vector<Sent> rest = drainAll(queue);
+    ASSERT_EQ(rest.size(), 3u);
+    EXPECT_EQ(rest[0].payload, "2");
+}
+
+TEST(OfflineQueue, DrainHonoursBurstSize)
+{
+    MqttOfflineQueue queue;
+    ASSERT_TRUE(queue.begin(makeConfig(512, MqttOfflinePolicy::DropOldest)));
+    for (int i = 0; i < 5; i++)
+        push(queue, "t", std::to_string(i));
+
+    EXPECT_EQ(queue.drain(2, 0, [](const MqttOfflineMessage &) { return true; }), 2u);
+    EXPECT_EQ(queue.getStats().messages, 3u);
+}
+
+TEST(OfflineQueue, MessageDroppedWhileSendingIsNotRemovedTwice)
+{
+    MqttOfflineQueue queue;
+    ASSERT_TRUE(queue.begin(makeConfig(128, MqttOfflinePolicy::DropOldest)));
+    for (int i = 0; i < 4; i++)
+        push(queue, "t", "msg-" + std::to_string(100 + i));
+
+    // A publish from another task overflows the arena while the oldest message is out
+    queue.drain(1, 0, [&queue](const MqttOfflineMessage &) {
+        push(queue, "t", "msg-104");
+        return true;
+    });
+
+    std::vector<Sent> rest = drainAll(queue);
+    ASSERT_EQ(rest.size(), 4u);
+    EXPECT_EQ(rest[0].payload, "msg-101");
+    EXPECT_EQ(rest[3].payload, "msg-104");
+}
+
+TEST(OfflineQueue, MatchesReferenceModelAcrossWrapArounds)
+{
+    const std::size_t capacity = 1000;
+    std::mt19937 rng(1234);
+
+    for (int policy = 0; policy < 2; policy++)
+    {
+        MqttOfflineQueue queue;
+        MqttOfflinePolicy p = policy ? MqttOfflinePolicy::DropNewest : MqttOfflinePolicy::DropOldest;
+        ASSERT_TRUE(queue.begin(makeConfig(capacity, p)));
+
+        std::deque<std::string> model;
+        std::size_t modelBytes = 0;
+        int counter = 0;
+
+        for (int step = 0; step < 20000; step++)
+        {
+            if (rng() % 3 != 0)
+            {
+                std::string payload = std::to_string(counter++) + std::string(rng() % 120, 'p');
+                std::size_t size = recordSize("topic", payload);
+                bool accepted = push(queue, "topic", payload);
+
+                // The reference ignores fragmentation, so only check what it can predict
+                if (p == MqttOfflinePolicy::DropNewest)
+                {
+                    if (modelBytes + size > capacity)
+                        ASSERT_FALSE(accepted);
+                }
+                else
+                {
+                    ASSERT_TRUE(accepted);
+                }
+
+                if (accepted)
+                {
+                    model.push_back(payload);
+                    modelBytes += size;
+                    // Drop what the queue dropped to make room, always the oldest
+                    while (queue.getStats().messages < model.size())
+                    {
+                        modelBytes -= recordSize("topic", model.front());
+                        model.pop_front();
+                    }
+                }
+            }
+            else
+            {
+                std::size_t burst = rng() % 4;
+                std::size_t sent = queue.drain(burst, 0, [&model, &modelBytes](const MqttOfflineMessage &message) {
+                    EXPECT_FALSE(model.empty());
+                    EXPECT_EQ(std::string(message.payload, message.payloadLen), model.front());
+                    modelBytes -= recordSize("topic", model.front());
+                    model.pop_front();
+                    return true;
+                });
+                ASSERT_LE(sent, burst);
+            }
+
+            MqttOfflineQueueStats stats = queue.getStats();
+            ASSERT_EQ(stats.messages, model.size());
+            ASSERT_EQ(stats.bytesUsed, modelBytes);
+            ASSERT_LE(stats.bytesUsed, capacity);
+        }
+    }
+}
@@ -0,0 +1,410 @@
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "ESP32MQTTClientOutbox.h"
+
+namespace
+{
+    struct Replayed
+    {
+        std::string topic;
+        std::string payload;
+        int qos;
+        bool retain;
+    };
+
+    uint32_t add(MqttPersistentOutbox &outbox, const std::string &topic, const std::string &payload, int qos = 1, bool retain = false)
+    {
+        uint32_t id = 0;
+        EXPECT_TRUE(outbox.add(topic.data(), topic.size(), payload.data(), payload.size(), qos, retain, id));
+        return id;
+    }
+
+    // Replays everything due, handing out msg_ids from nextMsgId on
+    std::vector<Replayed> replayAll(MqttPersistentOutbox &outbox, int64_t now = 0, int nextMsgId = 100)
+    {
+        std::vector<Replayed> replayed;
+        outbox.replay(now, [&](const MqttOfflineMessage &message) {
+            EXPECT_EQ(message.topic[message.topicLen], '\0');
+            EXPECT_EQ(message.payload[message.payloadLen], '\0');
+            replayed.push_back({std::string(message.topic, message.topicLen),
+                                std::string(message.payload, message.payloadLen), message.qos, message.retain});
+            return message.qos > 0 ? nextMsgId++ : 0;
+        });
+        return replayed;
+    }
+
+    MqttOutboxConfig makeConfig(std::size_t maxBytes)
+    {
+        MqttOutboxConfig config;
+        config.maxBytes = maxBytes;
+        return config;
+    }
+
+    class TempDir
+    {
+    public:
+        TempDir()
+        {
+            char pattern[] = "/tmp/outbox_test_XXXXXX";
+            _path = mkdtemp(pattern);
+        }
+        ~TempDir()
+        {
+            std::string command = "rm -rf " + _path;
+            EXPECT_EQ(system(command.c_str()), 0);
+        }
+        std::string file(const std::string &name) const { return _path + "/" + name; }
+
+    private:
+        std::string _path;
+    };
+
+    bool exists(const std::string &path)
+    {
+        return access(path.c_str(), F_OK) == 0;
+    }
+
+    void writeFile(const std::string &path, const std::string &content)
+    {
+        FILE *file = fopen(path.c_str(), "wb");
+        ASSERT_NE(file, nullptr);
+        fwrite(content.data(), 1, content.size(), file);
+        fclose(file);
+    }
+}
+
+TEST(PersistentOutbox, AcknowledgedMessagesAreRemoved)
+{
+    MqttRamOutboxStorage storage;
+    MqttPersistentOutbox outbox;
+    ASSERT_TRUE(outbox.begin(&storage, MqttOutboxConfig()));
+
+    uint32_t a = add(outbox, "t/a", "1");
+    uint32_t b = add(outbox, "t/b", "2");
+    uint32_t c = add(outbox, "t/c", "3");
+    EXPECT_LT(a, b);
+    EXPECT_LT(b, c);
+
+    outbox.markSent(a, 10, 0);
+    outbox.markSent(b, 11, 0);
+    outbox.markSent(c, 12, 0);
+    EXPECT_TRUE(outbox.acknowledge(11));
+    EXPECT_FALSE(outbox.acknowledge(99));
+
+    MqttOutboxStats stats = outbox.getStats();
+    EXPECT_EQ(stats.messages, 2u);
+    EXPECT_EQ(stats.stored, 3u);
+    EXPECT_EQ(stats.acknowledged, 1u);
+}
+
+TEST(PersistentOutbox, UnacknowledgedMessagesSurviveReload)
+{
+    MqttRamOutboxStorage storage;
+    uint32_t lastId;
+    {
+        MqttPersistentOutbox outbox;
+        ASSERT_TRUE(outbox.begin(&storage, MqttOutboxConfig()));
+        uint32_t first = add(outbox, "t/a", "first", 1, true);
+        add(outbox, "t/b", std::string("bin\0ary", 7), 2);
+        lastId = add(outbox, "t/c", "third");
+        outbox.markSent(first, 5, 0);
+        outbox.acknowledge(5);
+    }
+
+    MqttPersistentOutbox outbox;
+    ASSERT_TRUE(outbox.begin(&storage, MqttOutboxConfig()));
+    EXPECT_EQ(outbox.getStats().messages, 2u);
+
+    std::vector<Replayed> replayed = replayAll(outbox);
+    ASSERT_EQ(replayed.size(), 2u);
+    EXPECT_EQ(replayed[0].topic, "t/b");
+    EXPECT_EQ(replayed[0].payload, std::string("bin\0ary", 7));
+    EXPECT_EQ(replayed[0].qos, 2);
+    EXPECT_FALSE(replayed[0].retain);
+    EXPECT_EQ(replayed[1].payload, "third");
+    EXPECT_EQ(outbox.getStats().replayed, 2u);
+
+    // Ids continue after the ones found in the log
+    EXPECT_GT(add(outbox, "t/d", "new"), lastId);
+}
+
+TEST(PersistentOutbox, RetainFlagIsStored)
+{
+    MqttRamOutboxStorage storage;
+    MqttPersistentOutbox outbox;
+    ASSERT_TRUE(outbox.begin(&storage, MqttOutboxConfig()));
+    add(outbox, "t", "x", 1, true);
+
+    std::vector<Replayed> replayed = replayAll(outbox);
+    ASSERT_EQ(replayed.size(), 1u);
+    EXPECT_TRUE(replayed[0].retain);
+    EXPECT_EQ(replayed[0].qos, 1);
+}
+
+TEST(PersistentOutbox, TornRecordIsDiscardedAndLogRepaired)
+{
+    MqttRamOutboxStorage storage;
+    {
+        MqttPersistentOutbox outbox;
+        ASSERT_TRUE(outbox.begin(&storage, MqttOutboxConfig()));
+        add(outbox, "t/a", "complete");
+        add(outbox, "t/b", "cut by a reset");
+    }
+    storage.bytes().resize(storage.bytes().size() - 5);
+
+    MqttPersistentOutbox outbox;
+    ASSERT_TRUE(outbox.begin(&storage, MqttOutboxConfig()));
+    MqttOutboxStats stats = outbox.getStats();
+    EXPECT_EQ(stats.messages, 1u);
+    EXPECT_EQ(stats.compactions, 1u);
+    EXPECT_EQ(stats.storageBytes, stats.liveBytes);
+
+    // Records appended after the repair are found again
+    add(outbox, "t/c", "after repair");
+    outbox.end();
+    ASSERT_TRUE(outbox.begin(&storage, MqttOutboxConfig()));
+    std::vector<Replayed> replayed = replayAll(outbox);
+    ASSERT_EQ(replayed.size(), 2u);
+    EXPECT_EQ(replayed[0].payload, "complete");
+    EXPECT_EQ(replayed[1].payload, "after repair");
+}
+
+TEST(PersistentOutbox, CorruptedRecordEndsTheLog)
+{
+    MqttRamOutboxStorage storage;
+    std::size_t firstRecordEnd;
+    {
+        MqttPersistentOutbox outbox;
+        ASSERT_TRUE(outbox.begin(&storage, MqttOutboxConfig()));
+        add(outbox, "t/a", "good");
+        firstRecordEnd = storage.size();
+        add(outbox, "t/b", "flipped");
+        add(outbox, "t/c", "unreachable");
+    }
+    storage.bytes()[firstRecordEnd + 20] ^= 0x01;
+
+    MqttPersistentOutbox outbox;
+    ASSERT_TRUE(outbox.begin(&storage, MqttOutboxConfig()));
+    std::vector<Replayed> replayed = replayAll(outbox);
+    ASSERT_EQ(replayed.size(), 1u);
+    EXPECT_EQ(replayed[0].payload, "good");
+}
+
+TEST(PersistentOutbox, RejectsMessagesBeyondMaxBytes)
+{
+    MqttRamOutboxStorage storage;
+    MqttPersistentOutbox outbox;
+    ASSERT_TRUE(outbox.begin(&storage, makeConfig(100)));
+
+    // 16 byte header + 1 byte topic + 23 byte payload = 40 bytes per record
+    std::string payload(23, 'x');
+    uint32_t id;
+    EXPECT_TRUE(outbox.add("t", 1, payload.data(), payload.size(), 1, false, id));
+    EXPECT_TRUE(outbox.add("t", 1, payload.data(), payload.size(), 1, false, id));
+    EXPECT_FALSE(outbox.add("t", 1, payload.data(), payload.size(), 1, false, id));
+    EXPECT_EQ(outbox.getStats().dropped, 1u);
+    EXPECT_EQ(outbox.getStats().liveBytes, 80u);
+}
+
+TEST(PersistentOutbox, CompactionBoundsTheLog)
+{
+    const std::size_t maxBytes = 512;
+    MqttRamOutboxStorage storage;
+    MqttPersistentOutbox outbox;
+    ASSERT_TRUE(outbox.begin(&storage, makeConfig(maxBytes)));
+
+    // A few messages stay pending while many others come and go
+    add(outbox, "pending/1", "kept");
+    add(outbox, "pending/2", "kept");
+    std::size_t written = 0;
+    for (int i = 0; i < 1000; i++)
+    {
+        uint32_t id = add(outbox, "telemetry", "value " + std::to_string(i));
+        outbox.markSent(id, 1000 + i, 0);
+        ASSERT_TRUE(outbox.acknowledge(1000 + i));
+        written += 16 + 9 + 6 + std::to_string(i).size() + 16;
+        ASSERT_LE(storage.size(), 2 * maxBytes + 64);
+    }
+
+    MqttOutboxStats stats = outbox.getStats();
+    EXPECT_EQ(stats.messages, 2u);
+    EXPECT_GT(stats.compactions, 0u);
+    // Each compaction rewrites at most maxBytes and happens after at least maxBytes / 2 were appended
+    EXPECT_LT(stats.compactions * maxBytes, 2 * written + maxBytes);
+
+    outbox.end();
+    ASSERT_TRUE(outbox.begin(&storage, makeConfig(maxBytes)));
+    std::vector<Replayed> replayed = replayAll(outbox);
+    ASSERT_EQ(replayed.size(), 2u);
+    EXPECT_EQ(replayed[0].topic, "pending/1");
+    EXPECT_EQ(replayed[1].topic, "pending/2");
+}
+
+TEST(PersistentOutbox, AckBeforeMarkSentIsApplied)
+{
+    MqttRamOutboxStorage storage;
+    MqttPersistentOutbox outbox;
+    ASSERT_TRUE(outbox.begin(&storage, MqttOutboxConfig()));
+
+    uint32_t id = add(outbox, "t", "fast broker");
+    outbox.reserve();
+    EXPECT_FALSE(outbox.acknowledge(42));
+    outbox.markSent(id, 42, 0);
+    EXPECT_EQ(outbox.getStats().messages, 0u);
+}
+
+TEST(PersistentOutbox, EarlyAcksKeptOnlyDuringAPublish)
+{
+    MqttRamOutboxStorage storage;
+    MqttPersistentOutbox outbox;
+    ASSERT_TRUE(outbox.begin(&storage, MqttOutboxConfig()));
+
+    // PUBACKs of messages that are not in the outbox are not remembered
+    uint32_t first = add(outbox, "t", "a");
+    EXPECT_FALSE(outbox.acknowledge(7));
+    outbox.reserve();
+    outbox.markSent(first, 7, 0);
+    EXPECT_EQ(outbox.getStats().messages, 1u);
+
+    // ... so they cannot push out the early acknowledgement of the next one
+    uint32_t second = add(outbox, "t", "b");
+    for (int msgId = 100; msgId < 120; msgId++)
+        EXPECT_FALSE(outbox.acknowledge(msgId));
+    outbox.reserve();
+    EXPECT_FALSE(outbox.acknowledge(8));
+    outbox.markSent(second, 8, 0);
+    EXPECT_EQ(outbox.getStats().messages, 1u);
+
+    // A failed publish does not leave its remembered acknowledgements behind
+    uint32_t third = add(outbox, "t", "c");
+    outbox.reserve();
+    EXPECT_FALSE(outbox.acknowledge(9));
+    outbox.cancel();
+    outbox.reserve();
+    outbox.markSent(third, 9, 0);
+    EXPECT_EQ(outbox.getStats().messages, 2u);
+}
+
+TEST(PersistentOutbox, QosZeroIsRemovedOnceSent)
+{
+    MqttRamOutboxStorage storage;
+    MqttPersistentOutbox outbox;
+    ASSERT_TRUE(outbox.begin(&storage, MqttOutboxConfig()));
+
+    add(outbox, "t", "fire and forget", 0);
+    EXPECT_EQ(replayAll(outbox).size(), 1u);
+    EXPECT_EQ(outbox.getStats().messages, 0u);
+}
+
+TEST(PersistentOutbox, ReplayResendsOnlyStaleMessages)
+{
+    MqttRamOutboxStorage storage;
+    MqttOutboxConfig config;
+    config.resendAfterMs = 60000;
+    MqttPersistentOutbox outbox;
+    ASSERT_TRUE(outbox.begin(&storage, config));
+
+    uint32_t sent = add(outbox, "t/sent", "x");
+    add(outbox, "t/new", "y");
+    outbox.markSent(sent, 7, 0);
+
+    std::vector<Replayed> replayed = replayAll(outbox, 1000000);
+    ASSERT_EQ(replayed.size(), 1u);
+    EXPECT_EQ(replayed[0].topic, "t/new");
+
+    // Nothing is due right after, the first one once it was unacknowledged for a minute
+    EXPECT_TRUE(replayAll(outbox, 2000000).empty());
+    replayed = replayAll(outbox, 60500000);
+    ASSERT_EQ(replayed.size(), 1u);
+    EXPECT_EQ(replayed[0].topic, "t/sent");
+}
+
+TEST(PersistentOutbox, ReplayStopsAtFirstFailure)
+{
+    MqttRamOutboxStorage storage;
+    MqttPersistentOutbox outbox;
+    ASSERT_TRUE(outbox.begin(&storage, MqttOutboxConfig()));
+    for (int i = 0; i < 3; i++)
+        add(outbox, "t", std::to_string(i));
+
+    int calls = 0;
+    std::size_t sent = outbox.replay(0, [&calls](const MqttOfflineMessage &) { return ++calls == 2 ? -1 : calls; });
+    EXPECT_EQ(sent, 1u);
+
+    std::vector<Replayed> replayed = replayAll(outbox);
+    ASSERT_EQ(replayed.size(), 2u);
+    EXPECT_EQ(replayed[0].payload, "1");
+}
+
+TEST(FileOutboxStorage, MessagesSurviveReopen)
+{
+    TempDir dir;
+    std::string path = dir.file("outbox.log");
+    {
+        MqttFileOutboxStorage storage(path);
+        ASSERT_TRUE(storage.isOpen());
+        MqttPersistentOutbox outbox;
+        ASSERT_TRUE(outbox.begin(&storage, makeConfig(256)));
+        for (int i = 0; i < 20; i++)
+        {
+            uint32_t id = add(outbox, "t", "acked " + std::to_string(i));
+            outbox.markSent(id, i, 0);
+            outbox.acknowledge(i);
+        }
+        add(outbox, "t", "pending");
+        outbox.end();
+        EXPECT_GT(storage.size(), 0u);
+        EXPECT_FALSE(exists(path + ".tmp"));
+    }
+
+    MqttFileOutboxStorage storage(path);
+    MqttPersistentOutbox outbox;
+    ASSERT_TRUE(outbox.begin(&storage, makeConfig(256)));
+    std::vector<Replayed> replayed = replayAll(outbox);
+    ASSERT_EQ(replayed.size(), 1u);
+    EXPECT_EQ(replayed[0].payload, "pending");
+}
+
+TEST(FileOutboxStorage, ReplaceSwapsContent)
+{
+    TempDir dir;
+    std::string path = dir.file("outbox.log");
+    MqttFileOutboxStorage storage(path);
+    ASSERT_TRUE(storage.append("old content", 11));
+    ASSERT_TRUE(storage.replace("new", 3));
+    EXPECT_EQ(storage.size(), 3u);
+    ASSERT_TRUE(storage.append("er", 2));
+
+    char data[5];
+    ASSERT_TRUE(storage.read(0, data, 5));
+    EXPECT_EQ(std::string(data, 5), "newer");
+    EXPECT_FALSE(storage.read(3, data, 5));
+}
+
+TEST(FileOutboxStorage, InterruptedReplaceIsResolvedOnOpen)
+{
+    TempDir dir;
+    std::string path = dir.file("outbox.log");
+
+    // Cut while writing the new log: the old one is kept
+    writeFile(path, "old");
+    writeFile(path + ".tmp", "half writ");
+    {
+        MqttFileOutboxStorage storage(path);
+        EXPECT_EQ(storage.size(), 3u);
+    }
+    EXPECT_FALSE(exists(path + ".tmp"));
+
+    // Cut after removing the old log: the new one takes its place
+    remove(path.c_str());
+    writeFile(path + ".tmp", "compacted");
+    MqttFileOutboxStorage storage(path);
+    EXPECT_EQ(storage.size(), 9u);
+    EXPECT_FALSE(exists(path + ".tmp"));
+}
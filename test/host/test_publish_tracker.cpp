@@ -0,0 +1,156 @@
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include "ESP32MQTTClientPublishTracker.h"
+
+namespace
+{
+    struct Completed
+    {
+        int msgId;
+        MqttPublishResult result;
+        uint32_t latencyUs;
+    };
+
+    struct Recorder
+    {
+        std::vector<Completed> completed;
+
+        MqttPublishCallback callback()
+        {
+            return [this](int msgId, MqttPublishResult result, uint32_t latencyUs) {
+                completed.push_back(Completed{msgId, result, latencyUs});
+            };
+        }
+    };
+
+    MqttPublishTrackerConfig config(std::size_t capacity, uint32_t timeoutMs = 1000)
+    {
+        MqttPublishTrackerConfig c;
+        c.capacity = capacity;
+        c.timeoutMs = timeoutMs;
+        return c;
+    }
+}
+
+TEST(PublishTracker, CompletesAcknowledgedEntries)
+{
+    MqttPublishTracker tracker;
+    EXPECT_FALSE(tracker.begin(config(0)));
+    ASSERT_TRUE(tracker.begin(config(4)));
+    EXPECT_FALSE(tracker.begin(config(4)));
+
+    Recorder recorder;
+    ASSERT_TRUE(tracker.reserve());
+    tracker.add(1, 1000, recorder.callback());
+    ASSERT_TRUE(tracker.reserve());
+    tracker.add(2, 1500, recorder.callback());
+    EXPECT_EQ(tracker.getStats().inFlight, 2u);
+
+    // In any order, once
+    EXPECT_TRUE(tracker.acknowledge(2, 1700));
+    EXPECT_TRUE(tracker.acknowledge(1, 4000));
+    EXPECT_FALSE(tracker.acknowledge(1, 5000));
+    EXPECT_FALSE(tracker.acknowledge(-1, 5000));
+
+    ASSERT_EQ(recorder.completed.size(), 2u);
+    EXPECT_EQ(recorder.completed[0].msgId, 2);
+    EXPECT_EQ(recorder.completed[0].result, MqttPublishResult::Acknowledged);
+    EXPECT_EQ(recorder.completed[0].latencyUs, 200u);
+    EXPECT_EQ(recorder.completed[1].msgId, 1);
+    EXPECT_EQ(recorder.completed[1].latencyUs, 3000u);
+
+    MqttPublishTrackerStats stats = tracker.getStats();
+    EXPECT_EQ(stats.inFlight, 0u);
+    EXPECT_EQ(stats.capacity, 4u);
+    EXPECT_EQ(stats.tracked, 2u);
+    EXPECT_EQ(stats.acknowledged, 2u);
+    MqttHistogramSnapshot latency = tracker.latency();
+    EXPECT_EQ(latency.count, 2u);
+    EXPECT_EQ(latency.max, 3000u);
+}
+
+TEST(PublishTracker, RejectsWhenFull)
+{
+    MqttPublishTracker tracker;
+    ASSERT_TRUE(tracker.begin(config(2)));
+    Recorder recorder;
+
+    // Reservations count against the capacity until they are filled in or cancelled
+    ASSERT_TRUE(tracker.reserve());
+    ASSERT_TRUE(tracker.reserve());
+    EXPECT_FALSE(tracker.reserve());
+    tracker.cancel();
+    tracker.add(1, 0, recorder.callback());
+    ASSERT_TRUE(tracker.reserve());
+    tracker.add(2, 0, recorder.callback());
+    EXPECT_FALSE(tracker.reserve());
+    EXPECT_EQ(tracker.getStats().rejected, 2u);
+
+    // Room again once one is acknowledged
+    EXPECT_TRUE(tracker.acknowledge(1, 10));
+    EXPECT_TRUE(tracker.reserve());
+}
+
+TEST(PublishTracker, MatchesAcknowledgementsArrivingBeforeAdd)
+{
+    MqttPublishTracker tracker;
+    ASSERT_TRUE(tracker.begin(config(4)));
+    Recorder recorder;
+
+    // Without an open reservation the acknowledgement is of an untracked publish
+    EXPECT_FALSE(tracker.acknowledge(7, 100));
+
+    ASSERT_TRUE(tracker.reserve());
+    EXPECT_FALSE(tracker.acknowledge(8, 600));
+    tracker.add(8, 500, recorder.callback());
+    ASSERT_EQ(recorder.completed.size(), 1u);
+    EXPECT_EQ(recorder.completed[0].msgId, 8);
+    EXPECT_EQ(recorder.completed[0].result, MqttPublishResult::Acknowledged);
+    EXPECT_EQ(recorder.completed[0].latencyUs, 100u);
+
+    ASSERT_TRUE(tracker.reserve());
+    tracker.add(7, 700, recorder.callback());
+    EXPECT_EQ(recorder.completed.size(), 1u);
+    EXPECT_EQ(tracker.getStats().inFlight, 1u);
+}
+
+TEST(PublishTracker, TimesOutAndDeletes)
+{
+    MqttPublishTracker tracker;
+    ASSERT_TRUE(tracker.begin(config(4, 10)));
+    Recorder recorder;
+
+    for (int msgId = 1; msgId <= 3; msgId++)
+    {
+        ASSERT_TRUE(tracker.reserve());
+        tracker.add(msgId, msgId * 5000, recorder.callback());
+    }
+
+    EXPECT_EQ(tracker.expire(14999), 0u);
+    EXPECT_EQ(tracker.expire(15000), 1u);
+    EXPECT_TRUE(tracker.remove(3, MqttPublishResult::Deleted, 16000));
+    EXPECT_FALSE(tracker.remove(1, MqttPublishResult::Deleted, 16000));
+    // A late acknowledgement finds nothing
+    EXPECT_FALSE(tracker.acknowledge(1, 17000));
+
+    ASSERT_EQ(recorder.completed.size(), 2u);
+    EXPECT_EQ(recorder.completed[0].msgId, 1);
+    EXPECT_EQ(recorder.completed[0].result, MqttPublishResult::TimedOut);
+    EXPECT_EQ(recorder.completed[0].latencyUs, 10000u);
+    EXPECT_EQ(recorder.completed[1].msgId, 3);
+    EXPECT_EQ(recorder.completed[1].result, MqttPublishResult::Deleted);
+
+    MqttPublishTrackerStats stats = tracker.getStats();
+    EXPECT_EQ(stats.inFlight, 1u);
+    EXPECT_EQ(stats.timedOut, 1u);
+    EXPECT_EQ(stats.deleted, 1u);
+    EXPECT_EQ(stats.acknowledged, 0u);
+    EXPECT_EQ(tracker.latency().count, 0u);
+
+    tracker.end();
+    EXPECT_FALSE(tracker.isEnabled());
+    EXPECT_EQ(tracker.expire(100000), 0u);
+    EXPECT_EQ(recorder.completed.size(), 2u);
+}
@@ -0,0 +1,144 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "ESP32MQTTClientRcu.h"
+
+namespace
+{
+    std::atomic<int> liveTables(0);
+
+    // Every entry equals version, a reader seeing anything else saw a torn or freed table
+    struct Table
+    {
+        int version;
+        std::vector<int> entries;
+
+        explicit Table(int v) : version(v), entries(64, v) { liveTables++; }
+        Table(const Table &other) : version(other.version), entries(other.entries) { liveTables++; }
+        ~Table()
+        {
+            for (size_t i = 0; i < entries.size(); i++)
+                entries[i] = -1;
+            liveTables--;
+        }
+    };
+
+    void writeNext(MqttRcuPointer<Table> &rcu)
+    {
+        std::lock_guard<std::mutex> lock(rcu.writeMutex());
+        Table *next = new Table(*rcu.writerView());
+        next->version++;
+        for (size_t i = 0; i < next->entries.size(); i++)
+            next->entries[i] = next->version;
+        rcu.replace(next);
+    }
+
+    bool consistent(const Table &table)
+    {
+        for (size_t i = 0; i < table.entries.size(); i++)
+        {
+            if (table.entries[i] != table.version)
+                return false;
+        }
+        return true;
+    }
+}
+
+TEST(Rcu, ReaderSeesSnapshotWhileWriterReplaces)
+{
+    liveTables = 0;
+    MqttRcuPointer<Table> rcu(new Table(0));
+
+    auto guard = rcu.read();
+    writeNext(rcu);
+    writeNext(rcu);
+
+    // Old snapshot stays alive and unchanged until the guard is released
+    EXPECT_EQ(0, guard->version);
+    EXPECT_TRUE(consistent(*guard));
+    EXPECT_EQ(3, liveTables.load());
+    EXPECT_EQ(2, rcu.read()->version);
+}
+
+TEST(Rcu, LastReaderReclaims)
+{
+    liveTables = 0;
+    {
+        MqttRcuPointer<Table> rcu(new Table(0));
+        {
+            auto guard = rcu.read();
+            writeNext(rcu);
+            EXPECT_EQ(2, liveTables.load());
+        }
+        EXPECT_EQ(1, liveTables.load());
+    }
+    EXPECT_EQ(0, liveTables.load());
+}
+
+TEST(Rcu, WriterInsideReadSectionDoesNotDeadlock)
+{
+    MqttRcuPointer<Table> rcu(new Table(0));
+    {
+        auto guard = rcu.read();
+        writeNext(rcu); // e.g. a message callback subscribing to another topic
+        EXPECT_EQ(0, guard->version);
+    }
+    EXPECT_EQ(1, rcu.read()->version);
+}
+
+TEST(Rcu, ConcurrentReadersAndWritersStress)
+{
+    liveTables = 0;
+    {
+        MqttRcuPointer<Table> rcu(new Table(0));
+        std::atomic<bool> stop(false);
+        std::atomic<int> inconsistencies(0);
+        std::atomic<long> reads(0);
+
+        std::vector<std::thread> threads;
+        for (int r = 0; r < 4; r++)
+        {
+            threads.push_back(std::thread([&rcu, &stop, &inconsistencies, &reads, r]() {
+                int lastVersion = 0;
+                while (!stop)
+                {
+                    auto guard = rcu.read();
+                    if (!consistent(*guard) || guard->version < lastVersion)
+                        inconsistencies++;
+                    lastVersion = guard->version;
+                    // One reader also writes from inside its read section
+                    if (r == 0 && (reads % 64) == 0)
+                        writeNext(rcu);
+                    reads++;
+                }
+            }));
+        }
+
+        const int writesPerWriter = 2000;
+        for (int w = 0; w < 2; w++)
+        {
+            threads.push_back(std::thread([&rcu]() {
+                for (int i = 0; i < writesPerWriter; i++)
+                    writeNext(rcu);
+            }));
+        }
+
+        threads[4].join();
+        threads[5].join();
+        stop = true;
+        for (int r = 0; r < 4; r++)
+            threads[r].join();
+
+        EXPECT_EQ(0, inconsistencies.load());
+        EXPECT_GE(rcu.read()->version, 2 * writesPerWriter);
+        EXPECT_GT(reads.load(), 0);
+
+        // With no reader left, one more write frees everything retired
+        writeNext(rcu);
+        EXPECT_EQ(1, liveTables.load());
+    }
+    EXPECT_EQ(0, liveTables.load());
+}
@@ -0,0 +1,160 @@
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include "ESP32MQTTClientRequestTable.h"
+
+namespace
+{
+    struct Completed
+    {
+        MqttRequestResult result;
+        std::string payload;
+        uint32_t roundTripUs;
+    };
+
+    struct Recorder
+    {
+        std::vector<Completed> completed;
+
+        MqttResponseCallback callback()
+        {
+            return [this](MqttRequestResult result, const MqttMessageView &response, uint32_t roundTripUs) {
+                std::string payload = response.payload ? std::string(response.payload, response.payloadLen) : std::string();
+                completed.push_back(Completed{result, payload, roundTripUs});
+            };
+        }
+    };
+
+    MqttMessageView response(const std::string &payload)
+    {
+        MqttMessageView view = {};
+        view.payload = payload.data();
+        view.payloadLen = payload.size();
+        return view;
+    }
+}
+
+TEST(RequestTable, ResolvesPendingRequests)
+{
+    MqttRequestTable table;
+    EXPECT_FALSE(table.begin(0));
+    EXPECT_FALSE(table.begin(MqttRequestTable::kMaxCapacity + 1));
+    ASSERT_TRUE(table.begin(4));
+    EXPECT_FALSE(table.begin(4));
+
+    Recorder recorder;
+    uint32_t first = table.add(1000, 500, recorder.callback());
+    uint32_t second = table.add(1500, 500, recorder.callback());
+    ASSERT_NE(first, 0u);
+    ASSERT_NE(second, 0u);
+    EXPECT_NE(first, second);
+    EXPECT_EQ(table.pending(), 2u);
+
+    // In any order, once
+    std::string payload = "pong";
+    EXPECT_TRUE(table.resolve(second, response(payload), 1700));
+    EXPECT_TRUE(table.resolve(first, response(payload), 4000));
+    EXPECT_FALSE(table.resolve(first, response(payload), 5000));
+    EXPECT_FALSE(table.resolve(0, response(payload), 5000));
+
+    ASSERT_EQ(recorder.completed.size(), 2u);
+    EXPECT_EQ(recorder.completed[0].result, MqttRequestResult::Response);
+    EXPECT_EQ(recorder.completed[0].payload, "pong");
+    EXPECT_EQ(recorder.completed[0].roundTripUs, 200u);
+    EXPECT_EQ(recorder.completed[1].roundTripUs, 3000u);
+
+    MqttRequestStats stats = table.getStats();
+    EXPECT_EQ(stats.pending, 0u);
+    EXPECT_EQ(stats.capacity, 4u);
+    EXPECT_EQ(stats.sent, 2u);
+    EXPECT_EQ(stats.answered, 2u);
+    EXPECT_EQ(stats.unmatched, 2u);
+    MqttHistogramSnapshot roundTrip = table.roundTrip();
+    EXPECT_EQ(roundTrip.count, 2u);
+    EXPECT_EQ(roundTrip.max, 3000u);
+}
+
+TEST(RequestTable, ExpiresRequestsPastTheirTimeout)
+{
+    MqttRequestTable table;
+    ASSERT_TRUE(table.begin(4));
+    Recorder recorder;
+
+    table.add(0, 100, recorder.callback());
+    uint32_t later = table.add(0, 300, recorder.callback());
+    EXPECT_EQ(table.expire(99999), 0u);
+    EXPECT_EQ(table.expire(100000), 1u);
+    ASSERT_EQ(recorder.completed.size(), 1u);
+    EXPECT_EQ(recorder.completed[0].result, MqttRequestResult::TimedOut);
+    EXPECT_EQ(recorder.completed[0].payload, "");
+    EXPECT_EQ(recorder.completed[0].roundTripUs, 100000u);
+
+    std::string payload = "late";
+    EXPECT_TRUE(table.resolve(later, response(payload), 200000));
+    EXPECT_EQ(table.expire(1000000), 0u);
+
+    MqttRequestStats stats = table.getStats();
+    EXPECT_EQ(stats.timedOut, 1u);
+    EXPECT_EQ(stats.answered, 1u);
+    // Timeouts are no round trips
+    EXPECT_EQ(table.roundTrip().count, 1u);
+}
+
+TEST(RequestTable, RejectsWhenFullAndReusesEntriesWithNewIds)
+{
+    MqttRequestTable table;
+    ASSERT_TRUE(table.begin(2));
+    Recorder recorder;
+
+    uint32_t first = table.add(0, 100, recorder.callback());
+    ASSERT_NE(table.add(0, 100, recorder.callback()), 0u);
+    EXPECT_EQ(table.add(0, 100, recorder.callback()), 0u);
+    EXPECT_EQ(table.getStats().rejected, 1u);
+
+    // A response to the earlier request in the same entry finds nothing
+    table.cancel(first);
+    uint32_t reused = table.add(0, 100, recorder.callback());
+    ASSERT_NE(reused, 0u);
+    EXPECT_NE(reused, first);
+    std::string payload = "stale";
+    EXPECT_FALSE(table.resolve(first, response(payload), 10));
+    EXPECT_TRUE(table.resolve(reused, response(payload), 10));
+
+    // Cancelled requests do not complete
+    ASSERT_EQ(recorder.completed.size(), 1u);
+    EXPECT_EQ(table.getStats().sent, 2u);
+}
+
+TEST(RequestTable, FormatsAndParsesIds)
+{
+    char text[MqttRequestTable::kIdLength];
+    MqttRequestTable::formatId(0x0102a0ffu, text);
+    EXPECT_EQ(std::string(text, sizeof(text)), "0102a0ff");
+
+    uint32_t id = 0;
+    EXPECT_TRUE(MqttRequestTable::parseId("0102A0FF", 8, id));
+    EXPECT_EQ(id, 0x0102a0ffu);
+    EXPECT_FALSE(MqttRequestTable::parseId("0102a0f", 7, id));
+    EXPECT_FALSE(MqttRequestTable::parseId("0102a0fg", 8, id));
+    EXPECT_FALSE(MqttRequestTable::parseId("00000000", 8, id));
+    EXPECT_FALSE(MqttRequestTable::parseId(nullptr, 8, id));
+    EXPECT_EQ(id, 0x0102a0ffu);
+}
+
+TEST(RequestTable, CallbacksMayAddRequests)
+{
+    MqttRequestTable table;
+    ASSERT_TRUE(table.begin(2));
+
+    // A callback may send the next request right away
+    uint32_t next = 0;
+    uint32_t id = table.add(0, 100, [&table, &next](MqttRequestResult, const MqttMessageView &, uint32_t) {
+        next = table.add(0, 100, nullptr);
+    });
+    std::string payload;
+    EXPECT_TRUE(table.resolve(id, response(payload), 10));
+    EXPECT_NE(next, 0u);
+    EXPECT_EQ(table.pending(), 1u);
+}
@@ -0,0 +1,118 @@
+#include <gtest/gtest.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ESP32MQTTClientStats.h"
+
+TEST(Histogram, BucketsArePowersOfTwo)
+{
+    EXPECT_EQ(MqttHistogram::bucketOf(0), 0u);
+    EXPECT_EQ(MqttHistogram::bucketOf(1), 1u);
+    EXPECT_EQ(MqttHistogram::bucketOf(2), 2u);
+    EXPECT_EQ(MqttHistogram::bucketOf(3), 2u);
+    EXPECT_EQ(MqttHistogram::bucketOf(4), 3u);
+    EXPECT_EQ(MqttHistogram::bucketOf(1023), 10u);
+    EXPECT_EQ(MqttHistogram::bucketOf(1024), 11u);
+    EXPECT_EQ(MqttHistogram::bucketOf(UINT32_MAX), MqttHistogramSnapshot::kBuckets - 1);
+
+    for (std::size_t bucket = 1; bucket + 1 < MqttHistogramSnapshot::kBuckets; bucket++)
+    {
+        uint32_t bound = MqttHistogram::bucketUpperBound(bucket);
+        EXPECT_EQ(MqttHistogram::bucketOf(bound), bucket);
+        EXPECT_EQ(MqttHistogram::bucketOf(bound + 1), bucket + 1);
+    }
+}
+
+TEST(Histogram, CountsSumMaxAndPercentiles)
+{
+    MqttHistogram histogram;
+    EXPECT_EQ(histogram.snapshot().percentile(50), 0u);
+
+    for (uint32_t i = 0; i < 90; i++)
+        histogram.record(10); // Bucket [8, 16)
+    for (uint32_t i = 0; i < 10; i++)
+        histogram.record(1000); // Bucket [512, 1024)
+
+    MqttHistogramSnapshot snapshot = histogram.snapshot();
+    EXPECT_EQ(snapshot.count, 100u);
+    EXPECT_EQ(snapshot.sum, 90u * 10 + 10u * 1000);
+    EXPECT_EQ(snapshot.mean(), 109u);
+    EXPECT_EQ(snapshot.max, 1000u);
+    EXPECT_EQ(snapshot.buckets[MqttHistogram::bucketOf(10)], 90u);
+    EXPECT_EQ(snapshot.percentile(50), 15u);
+    EXPECT_EQ(snapshot.percentile(90), 15u);
+    // Capped at the largest value seen rather than the bucket bound
+    EXPECT_EQ(snapshot.percentile(99), 1000u);
+    EXPECT_EQ(snapshot.percentile(100), 1000u);
+
+    histogram.reset();
+    EXPECT_EQ(histogram.snapshot().count, 0u);
+    EXPECT_EQ(histogram.snapshot().max, 0u);
+}
+
+TEST(Histogram, ConcurrentRecordsAreAllCounted)
+{
+    MqttHistogram histogram;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++)
+    {
+        threads.emplace_back([&histogram, t]() {
+            for (uint32_t i = 0; i < 10000; i++)
+                histogram.record(i + t);
+        });
+    }
+    for (std::size_t i = 0; i < threads.size(); i++)
+        threads[i].join();
+
+    MqttHistogramSnapshot snapshot = histogram.snapshot();
+    EXPECT_EQ(snapshot.count, 40000u);
+    EXPECT_EQ(snapshot.max, 10002u);
+    uint32_t total = 0;
+    for (std::size_t i = 0; i < MqttHistogramSnapshot::kBuckets; i++)
+        total += snapshot.buckets[i];
+    EXPECT_EQ(total, 40000u);
+}
+
+TEST(Stats, FormatsJson)
+{
+    MqttHistogram histogram;
+    histogram.record(100);
+
+    MqttClientStats stats = {};
+    stats.messagesIn = 5;
+    stats.bytesIn = 500;
+    stats.messagesOut = 3;
+    stats.bytesOut = 30;
+    stats.connects = 2;
+    stats.reconnects = 1;
+    stats.connectedMs = 61500;
+    stats.dispatchUs = histogram.snapshot();
+    MqttHistogram resubscribe;
+    resubscribe.record(40);
+    stats.resubscribeMs = resubscribe.snapshot();
+    MqttHistogram publishAck;
+    publishAck.record(2000);
+    publishAck.record(3000);
+    stats.publishAckUs = publishAck.snapshot();
+    MqttHistogram requestRtt;
+    requestRtt.record(15000);
+    stats.requestRttUs = requestRtt.snapshot();
+
+    char json[640];
+    std::size_t length = mqttFormatStatsJson(stats, json, sizeof(json));
+    ASSERT_GT(length, 0u);
+    std::string text(json, length);
+    EXPECT_EQ(text.front(), '{');
+    EXPECT_EQ(text.back(), '}');
+    EXPECT_NE(text.find("\"msgsIn\":5,\"bytesIn\":500,\"msgsOut\":3,\"bytesOut\":30"), std::string::npos);
+    EXPECT_NE(text.find("\"reconnects\":1"), std::string::npos);
+    EXPECT_NE(text.find("\"connectedS\":61"), std::string::npos);
+    EXPECT_NE(text.find("\"dispatchUs\":{\"count\":1,\"mean\":100,\"p50\":100,\"p99\":100,\"max\":100}"), std::string::npos);
+    EXPECT_NE(text.find("\"resubscribeMs\":{\"count\":1,\"p50\":40,\"max\":40}"), std::string::npos);
+    EXPECT_NE(text.find("\"publishAckUs\":{\"count\":2,\"p50\":2047,\"p99\":3000,\"max\":3000}"), std::string::npos);
+    EXPECT_NE(text.find("\"requestRttUs\":{\"count\":1,\"p50\":15000,\"p99\":15000,\"max\":15000}}"), std::string::npos);
+
+    EXPECT_EQ(mqttFormatStatsJson(stats, json, 20), 0u);
+}
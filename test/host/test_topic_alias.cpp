@@ -0,0 +1,99 @@
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include "ESP32MQTTClientTopicAlias.h"
+#include "ESP32MQTTClientTopicIndex.h"
+
+namespace
+{
+    // Alias of topic and whether the broker knows it already
+    std::pair<uint16_t, bool> lookup(MqttTopicAliasTable &table, const std::string &topic)
+    {
+        bool established = false;
+        uint16_t alias = table.lookup(topic.data(), topic.size(), MqttTopicIndex::hash(topic), established);
+        return std::make_pair(alias, established);
+    }
+}
+
+TEST(TopicAlias, AssignsThenReuses)
+{
+    MqttTopicAliasTable table;
+    EXPECT_FALSE(table.begin(0));
+    EXPECT_EQ(lookup(table, "a/b"), std::make_pair((uint16_t)0, false));
+    ASSERT_TRUE(table.begin(3));
+    EXPECT_FALSE(table.begin(3));
+
+    EXPECT_EQ(lookup(table, "site/dev1/temp"), std::make_pair((uint16_t)1, false));
+    EXPECT_EQ(lookup(table, "site/dev1/hum"), std::make_pair((uint16_t)2, false));
+    EXPECT_EQ(lookup(table, "site/dev1/temp"), std::make_pair((uint16_t)1, true));
+    EXPECT_EQ(lookup(table, "site/dev1/hum"), std::make_pair((uint16_t)2, true));
+    EXPECT_EQ(lookup(table, ""), std::make_pair((uint16_t)0, false));
+
+    MqttTopicAliasStats stats = table.getStats();
+    EXPECT_EQ(stats.maximum, 3u);
+    EXPECT_EQ(stats.limit, 3u);
+    EXPECT_EQ(stats.used, 2u);
+    EXPECT_EQ(stats.assigned, 2u);
+    EXPECT_EQ(stats.reused, 2u);
+    EXPECT_EQ(stats.bytesSaved, 14u + 13u);
+
+    // A new connection starts over
+    table.reset();
+    EXPECT_EQ(lookup(table, "site/dev1/hum"), std::make_pair((uint16_t)1, false));
+    EXPECT_EQ(table.getStats().used, 1u);
+}
+
+TEST(TopicAlias, EvictsLeastRecentlyUsed)
+{
+    MqttTopicAliasTable table;
+    ASSERT_TRUE(table.begin(2));
+
+    EXPECT_EQ(lookup(table, "a").first, 1u);
+    EXPECT_EQ(lookup(table, "b").first, 2u);
+    EXPECT_TRUE(lookup(table, "a").second);
+    // b was used longest ago
+    EXPECT_EQ(lookup(table, "c"), std::make_pair((uint16_t)2, false));
+    EXPECT_EQ(lookup(table, "a"), std::make_pair((uint16_t)1, true));
+    EXPECT_EQ(lookup(table, "b"), std::make_pair((uint16_t)2, false));
+    EXPECT_EQ(lookup(table, "a"), std::make_pair((uint16_t)1, true));
+
+    MqttTopicAliasStats stats = table.getStats();
+    EXPECT_EQ(stats.evicted, 2u);
+    EXPECT_EQ(stats.used, 2u);
+
+    // A failed setup leaves the alias free
+    table.forget(2);
+    EXPECT_EQ(table.getStats().used, 1u);
+    EXPECT_EQ(lookup(table, "b"), std::make_pair((uint16_t)2, false));
+}
+
+TEST(TopicAlias, LimitsToWhatTheBrokerAccepts)
+{
+    MqttTopicAliasTable table;
+    ASSERT_TRUE(table.begin(4));
+    EXPECT_EQ(lookup(table, "a").first, 1u);
+    EXPECT_EQ(lookup(table, "b").first, 2u);
+    EXPECT_EQ(lookup(table, "c").first, 3u);
+
+    // The broker refused alias 3
+    table.limitTo(3);
+    MqttTopicAliasStats stats = table.getStats();
+    EXPECT_EQ(stats.limit, 2u);
+    EXPECT_EQ(stats.used, 2u);
+    EXPECT_EQ(lookup(table, "b"), std::make_pair((uint16_t)2, true));
+    EXPECT_EQ(lookup(table, "c"), std::make_pair((uint16_t)1, false));
+
+    // No aliases at all
+    table.limitTo(1);
+    EXPECT_EQ(lookup(table, "c"), std::make_pair((uint16_t)0, false));
+
+    // The next broker may accept more
+    table.reset();
+    EXPECT_EQ(table.getStats().limit, 4u);
+    EXPECT_EQ(lookup(table, "d").first, 1u);
+
+    table.end();
+    EXPECT_FALSE(table.isEnabled());
+    EXPECT_EQ(lookup(table, "d").first, 0u);
+}
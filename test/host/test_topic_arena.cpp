@@ -0,0 +1,58 @@
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include "ESP32MQTTClientTopicArena.h"
+
+TEST(TopicArena, InternsOnce)
+{
+    MqttTopicArena arena;
+    MqttTopicHandle temp = arena.intern("site/dev1/sensor/temp");
+    ASSERT_TRUE(temp.isValid());
+    EXPECT_STREQ(temp.c_str(), "site/dev1/sensor/temp");
+    EXPECT_EQ(temp.length(), 21u);
+    EXPECT_EQ(temp.hash(), MqttTopicIndex::hash("site/dev1/sensor/temp"));
+
+    std::string again = "site/dev1/sensor/temp";
+    EXPECT_EQ(arena.intern(again), temp);
+    EXPECT_EQ(arena.intern(again).c_str(), temp.c_str());
+    EXPECT_NE(arena.intern("site/dev1/sensor/hum"), temp);
+    EXPECT_EQ(arena.size(), 2u);
+
+    // Binary safe, the length counts
+    MqttTopicHandle withNul = arena.intern(std::string("a\0b", 3));
+    EXPECT_EQ(withNul.length(), 3u);
+    EXPECT_NE(arena.intern("a"), withNul);
+}
+
+TEST(TopicArena, RejectsEmptyAndOverlongTopics)
+{
+    MqttTopicArena arena;
+    EXPECT_FALSE(MqttTopicHandle().isValid());
+    EXPECT_FALSE(arena.intern("").isValid());
+    EXPECT_FALSE(arena.intern(nullptr, 3).isValid());
+    EXPECT_FALSE(arena.intern(std::string(MqttTopicArena::kMaxTopicLength + 1, 't')).isValid());
+    EXPECT_TRUE(arena.intern(std::string(MqttTopicArena::kMaxTopicLength, 't')).isValid());
+    EXPECT_EQ(arena.size(), 1u);
+}
+
+TEST(TopicArena, HandlesStayValidWhileChunksAreAdded)
+{
+    MqttTopicArena arena(64);
+    std::vector<MqttTopicHandle> handles;
+    for (int i = 0; i < 200; i++)
+        handles.push_back(arena.intern("site/dev" + std::to_string(i) + "/sensor/temp"));
+    // Longer than a chunk, stored in one of its own
+    MqttTopicHandle longTopic = arena.intern(std::string(100, 'x'));
+    handles.push_back(arena.intern("after/long"));
+
+    EXPECT_EQ(longTopic.length(), 100u);
+    EXPECT_EQ(std::string(longTopic.c_str()), std::string(100, 'x'));
+    for (int i = 0; i < 200; i++)
+        ASSERT_EQ(std::string(handles[i].c_str()), "site/dev" + std::to_string(i) + "/sensor/temp");
+    EXPECT_STREQ(handles.back().c_str(), "after/long");
+    EXPECT_EQ(arena.size(), 202u);
+    // Chunks are filled, not one allocation per topic
+    EXPECT_LT(arena.bytes(), 200u * 64u);
+}
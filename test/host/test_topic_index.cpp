@@ -0,0 +1,88 @@
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include "ESP32MQTTClientTopicIndex.h"
+
+namespace
+{
+    // Index over a list of filters, the way the subscription table uses it
+    struct IndexedList
+    {
+        std::vector<std::string> filters;
+        MqttTopicIndex index;
+
+        void add(const std::string &filter, uint32_t hash)
+        {
+            index.insert(hash, filters.size());
+            filters.push_back(filter);
+        }
+
+        void add(const std::string &filter) { add(filter, MqttTopicIndex::hash(filter)); }
+
+        MqttTopicIndex::Value find(const std::string &filter, uint32_t hash) const
+        {
+            return index.find(hash, [&](MqttTopicIndex::Value v) { return filters[v] == filter; });
+        }
+
+        MqttTopicIndex::Value find(const std::string &filter) const { return find(filter, MqttTopicIndex::hash(filter)); }
+    };
+}
+
+TEST(TopicIndex, FindsExactFiltersOnly)
+{
+    IndexedList list;
+    EXPECT_EQ(list.find("a/b"), MqttTopicIndex::npos);
+
+    list.add("a/b");
+    list.add("a/+");
+    list.add("a/#");
+    list.add("");
+
+    EXPECT_EQ(list.index.size(), 4u);
+    EXPECT_EQ(list.find("a/b"), 0u);
+    EXPECT_EQ(list.find("a/+"), 1u);
+    EXPECT_EQ(list.find("a/#"), 2u);
+    EXPECT_EQ(list.find(""), 3u);
+    // No wildcard matching, no prefixes
+    EXPECT_EQ(list.find("a/c"), MqttTopicIndex::npos);
+    EXPECT_EQ(list.find("a"), MqttTopicIndex::npos);
+    EXPECT_EQ(list.find("a/b/"), MqttTopicIndex::npos);
+}
+
+TEST(TopicIndex, HashIsFnv1a)
+{
+    EXPECT_EQ(MqttTopicIndex::hash(""), 2166136261u);
+    EXPECT_EQ(MqttTopicIndex::hash("a"), 0xe40c292cu);
+    std::string withNul("a\0b", 3);
+    EXPECT_NE(MqttTopicIndex::hash(withNul), MqttTopicIndex::hash("a"));
+}
+
+TEST(TopicIndex, CollidingHashesAreToldApartByTheComparison)
+{
+    IndexedList list;
+    for (int i = 0; i < 20; i++)
+        list.add("dev" + std::to_string(i), 42);
+
+    for (int i = 0; i < 20; i++)
+        EXPECT_EQ(list.find("dev" + std::to_string(i), 42), (MqttTopicIndex::Value)i);
+    EXPECT_EQ(list.find("dev20", 42), MqttTopicIndex::npos);
+}
+
+TEST(TopicIndex, GrowsAndResets)
+{
+    IndexedList list;
+    list.index.reset(2);
+    for (int i = 0; i < 1000; i++)
+        list.add("site/dev" + std::to_string(i) + "/sensor/temp");
+
+    EXPECT_EQ(list.index.size(), 1000u);
+    for (int i = 0; i < 1000; i++)
+        ASSERT_EQ(list.find("site/dev" + std::to_string(i) + "/sensor/temp"), (MqttTopicIndex::Value)i);
+    EXPECT_EQ(list.find("site/dev1000/sensor/temp"), MqttTopicIndex::npos);
+
+    list.index.reset(0);
+    EXPECT_TRUE(list.index.empty());
+    EXPECT_EQ(list.find("site/dev1/sensor/temp"), MqttTopicIndex::npos);
+}
@@ -0,0 +1,215 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "ESP32MQTTClientTopicMatch.h"
+#include "ESP32MQTTClientTopicTrie.h"
+
+namespace
+{
+    std::vector<std::string> splitLevels(const std::string &s)
+    {
+        std::vector<std::string> levels;
+        std::string::size_type start = 0;
+        while (true)
+        {
+            std::string::size_type sep = s.find('/', start);
+            levels.push_back(s.substr(start, sep - start));
+            if (sep == std::string::npos)
+                return levels;
+            start = sep + 1;
+        }
+    }
+
+    // Straightforward level-by-level implementation of MQTT 5.0 section 4.7
+    bool referenceMatch(const std::string &filter, const std::string &topic)
+    {
+        if (!topic.empty() && topic[0] == '$' && !filter.empty() && (filter[0] == '+' || filter[0] == '#'))
+            return false;
+
+        std::vector<std::string> f = splitLevels(filter);
+        std::vector<std::string> t = splitLevels(topic);
+        for (size_t i = 0; i < f.size(); i++)
+        {
+            if (f[i] == "#")
+                return i + 1 == f.size();
+            if (i >= t.size())
+                return false;
+            if (f[i] != "+" && f[i] != t[i])
+                return false;
+        }
+        return f.size() == t.size();
+    }
+
+    std::string randomTopic(std::mt19937 &rng, bool allowWildcards)
+    {
+        static const char *levels[] = {"a", "b", "ab", "", "$SYS", "sensor"};
+        std::uniform_int_distribution<int> depth(1, 5);
+        std::uniform_int_distribution<int> pick(0, 5);
+        std::uniform_int_distribution<int> wildcard(0, 5);
+
+        std::string result;
+        int n = depth(rng);
+        for (int i = 0; i < n; i++)
+        {
+            if (i > 0)
+                result += '/';
+            int w = allowWildcards ? wildcard(rng) : 5;
+            if (w == 0)
+                result += '+';
+            else if (w == 1 && i == n - 1)
+                result += '#';
+            else
+                result += levels[pick(rng)];
+        }
+        return result;
+    }
+}
+
+TEST(TopicMatch, SpecificationExamples)
+{
+    EXPECT_TRUE(mqttTopicMatches("sport/tennis/player1/#", "sport/tennis/player1"));
+    EXPECT_TRUE(mqttTopicMatches("sport/tennis/player1/#", "sport/tennis/player1/ranking"));
+    EXPECT_TRUE(mqttTopicMatches("sport/tennis/player1/#", "sport/tennis/player1/score/wimbledon"));
+    EXPECT_TRUE(mqttTopicMatches("sport/#", "sport"));
+    EXPECT_TRUE(mqttTopicMatches("#", "sport/tennis"));
+    EXPECT_TRUE(mqttTopicMatches("sport/tennis/+", "sport/tennis/player1"));
+    EXPECT_FALSE(mqttTopicMatches("sport/tennis/+", "sport/tennis/player1/ranking"));
+    EXPECT_FALSE(mqttTopicMatches("sport/+", "sport"));
+    EXPECT_TRUE(mqttTopicMatches("sport/+", "sport/"));
+    EXPECT_TRUE(mqttTopicMatches("+/+", "/finance"));
+    EXPECT_TRUE(mqttTopicMatches("/+", "/finance"));
+    EXPECT_FALSE(mqttTopicMatches("+", "/finance"));
+}
+
+TEST(TopicMatch, MultipleWildcards)
+{
+    EXPECT_TRUE(mqttTopicMatches("site/+/sensor/+/value", "site/dev1/sensor/t1/value"));
+    EXPECT_FALSE(mqttTopicMatches("site/+/sensor/+/value", "site/dev1/sensor/t1/raw"));
+    EXPECT_TRUE(mqttTopicMatches("+/+/#", "a/b"));
+    EXPECT_TRUE(mqttTopicMatches("+/+/#", "a/b/c/d"));
+    EXPECT_FALSE(mqttTopicMatches("+/+/#", "a"));
+}
+
+TEST(TopicMatch, DollarTopics)
+{
+    EXPECT_FALSE(mqttTopicMatches("#", "$SYS/broker/uptime"));
+    EXPECT_FALSE(mqttTopicMatches("+/broker/uptime", "$SYS/broker/uptime"));
+    EXPECT_TRUE(mqttTopicMatches("$SYS/#", "$SYS/broker/uptime"));
+    EXPECT_TRUE(mqttTopicMatches("$SYS/+/uptime", "$SYS/broker/uptime"));
+}
+
+TEST(TopicMatch, MalformedFilters)
+{
+    EXPECT_FALSE(mqttTopicMatches("a/#/b", "a/x/b"));
+    EXPECT_FALSE(mqttTopicMatches("a/b", "a/bc"));
+    EXPECT_FALSE(mqttTopicMatches("a/bc", "a/b"));
+}
+
+TEST(TopicMatch, FilterValidity)
+{
+    EXPECT_TRUE(mqttTopicFilterValid("#"));
+    EXPECT_TRUE(mqttTopicFilterValid("a/+/#"));
+    EXPECT_TRUE(mqttTopicFilterValid("a/b#/c"));
+    EXPECT_FALSE(mqttTopicFilterValid("a/#/b"));
+    EXPECT_FALSE(mqttTopicFilterValid("#/"));
+    EXPECT_FALSE(mqttTopicFilterValid("a/#b"));
+}
+
+TEST(TopicMatch, NotNulTerminated)
+{
+    const char topic[] = {'a', '/', 'b', 'X'};
+    EXPECT_TRUE(mqttTopicMatches("a/+", 3, topic, 3));
+    EXPECT_FALSE(mqttTopicMatches("a/b", 3, topic, 4));
+}
+
+TEST(TopicMatch, AgreesWithReferenceOnRandomInput)
+{
+    std::mt19937 rng(1234);
+    for (int i = 0; i < 200000; i++)
+    {
+        std::string filter = randomTopic(rng, true);
+        std::string topic = randomTopic(rng, false);
+        ASSERT_EQ(referenceMatch(filter, topic), mqttTopicMatches(filter, topic))
+            << "filter=" << filter << " topic=" << topic;
+    }
+}
+
+TEST(TopicMatch, TrieAgreesWithMatcherOnRandomInput)
+{
+    std::mt19937 rng(4321);
+    for (int round = 0; round < 200; round++)
+    {
+        MqttTopicTrie trie;
+        std::vector<std::string> filters;
+        for (int i = 0; i < 50; i++)
+        {
+            filters.push_back(randomTopic(rng, true));
+            trie.insert(filters.back(), i);
+        }
+
+        for (int i = 0; i < 50; i++)
+        {
+            std::string topic = randomTopic(rng, false);
+            std::vector<MqttTopicTrie::Value> fromTrie;
+            trie.match(topic.c_str(), topic.size(), [&fromTrie](MqttTopicTrie::Value v) { fromTrie.push_back(v); });
+            std::sort(fromTrie.begin(), fromTrie.end());
+
+            std::vector<MqttTopicTrie::Value> expected;
+            for (size_t f = 0; f < filters.size(); f++)
+            {
+                if (mqttTopicMatches(filters[f], topic))
+                    expected.push_back(f);
+            }
+            ASSERT_EQ(expected, fromTrie) << "topic=" << topic;
+        }
+    }
+}
+
+TEST(TopicMatch, FiltersOverlap)
+{
+    EXPECT_TRUE(mqttTopicFiltersOverlap("a/b", "a/b"));
+    EXPECT_FALSE(mqttTopicFiltersOverlap("a/b", "a/c"));
+    EXPECT_FALSE(mqttTopicFiltersOverlap("a/b", "a/b/c"));
+    EXPECT_TRUE(mqttTopicFiltersOverlap("a/+", "a/b"));
+    EXPECT_TRUE(mqttTopicFiltersOverlap("+/b", "a/+"));
+    EXPECT_FALSE(mqttTopicFiltersOverlap("+/b", "a/c"));
+    EXPECT_FALSE(mqttTopicFiltersOverlap("site/dev1/#", "site/dev10/#"));
+    EXPECT_TRUE(mqttTopicFiltersOverlap("site/dev1/#", "site/+/temp"));
+    // "a/#" also matches "a"
+    EXPECT_TRUE(mqttTopicFiltersOverlap("a", "a/#"));
+    EXPECT_FALSE(mqttTopicFiltersOverlap("a", "a/+"));
+    EXPECT_TRUE(mqttTopicFiltersOverlap("#", "x/y/z"));
+    // Conservative about '$' topics
+    EXPECT_TRUE(mqttTopicFiltersOverlap("+/uptime", "$SYS/uptime"));
+}
+
+TEST(TopicMatch, FiltersOverlapWheneverATopicMatchesBoth)
+{
+    std::mt19937 rng(5678);
+    for (int i = 0; i < 20000; i++)
+    {
+        std::string a = randomTopic(rng, true);
+        std::string b = randomTopic(rng, true);
+        bool overlap = mqttTopicFiltersOverlap(a, b);
+        ASSERT_EQ(overlap, mqttTopicFiltersOverlap(b, a)) << "a=" << a << " b=" << b;
+        for (int n = 0; n < 20 && !overlap; n++)
+        {
+            // Topics of filter a, with random levels in place of the wildcards
+            std::string topic;
+            std::vector<std::string> levels = splitLevels(a);
+            for (std::size_t l = 0; l < levels.size(); l++)
+            {
+                std::string level = levels[l] == "+" || levels[l] == "#" ? randomTopic(rng, false) : levels[l];
+                if (levels[l] == "#" && n % 2 == 0)
+                    break;
+                topic += (l > 0 ? "/" : "") + level;
+            }
+            ASSERT_FALSE(mqttTopicMatches(a, topic) && mqttTopicMatches(b, topic))
+                << "a=" << a << " b=" << b << " topic=" << topic;
+        }
+    }
+}
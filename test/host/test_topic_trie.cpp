@@ -0,0 +1,97 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "ESP32MQTTClientTopicTrie.h"
+
+namespace
+{
+    std::vector<MqttTopicTrie::Value> matchAll(const MqttTopicTrie &trie, const std::string &topic)
+    {
+        std::vector<MqttTopicTrie::Value> result;
+        trie.match(topic.c_str(), topic.size(), [&result](MqttTopicTrie::Value v) { result.push_back(v); });
+        std::sort(result.begin(), result.end());
+        return result;
+    }
+
+    typedef std::vector<MqttTopicTrie::Value> Values;
+}
+
+TEST(TopicTrie, ExactFilters)
+{
+    MqttTopicTrie trie;
+    trie.insert("site/dev1/temp", 0);
+    trie.insert("site/dev1/hum", 1);
+    trie.insert("site/dev2/temp", 2);
+
+    EXPECT_EQ(Values({0}), matchAll(trie, "site/dev1/temp"));
+    EXPECT_EQ(Values({2}), matchAll(trie, "site/dev2/temp"));
+    EXPECT_TRUE(matchAll(trie, "site/dev1").empty());
+    EXPECT_TRUE(matchAll(trie, "site/dev1/temp/x").empty());
+    EXPECT_EQ(3u, trie.size());
+}
+
+TEST(TopicTrie, SingleLevelWildcard)
+{
+    MqttTopicTrie trie;
+    trie.insert("site/+/temp", 0);
+    trie.insert("+/+/+", 1);
+    trie.insert("site/+", 2);
+
+    EXPECT_EQ(Values({0, 1}), matchAll(trie, "site/dev1/temp"));
+    EXPECT_EQ(Values({2}), matchAll(trie, "site/dev1"));
+    EXPECT_EQ(Values({2}), matchAll(trie, "site/"));
+    EXPECT_TRUE(matchAll(trie, "site/dev1/temp/x").empty());
+}
+
+TEST(TopicTrie, MultiLevelWildcardMatchesParentLevel)
+{
+    MqttTopicTrie trie;
+    trie.insert("sport/tennis/#", 0);
+    trie.insert("#", 1);
+
+    EXPECT_EQ(Values({0, 1}), matchAll(trie, "sport/tennis"));
+    EXPECT_EQ(Values({0, 1}), matchAll(trie, "sport/tennis/player1/score"));
+    EXPECT_EQ(Values({1}), matchAll(trie, "sport"));
+}
+
+TEST(TopicTrie, DollarTopicsSkipLeadingWildcards)
+{
+    MqttTopicTrie trie;
+    trie.insert("#", 0);
+    trie.insert("+/broker/uptime", 1);
+    trie.insert("$SYS/#", 2);
+    trie.insert("$SYS/+/uptime", 3);
+
+    EXPECT_EQ(Values({2, 3}), matchAll(trie, "$SYS/broker/uptime"));
+    EXPECT_EQ(Values({0, 1}), matchAll(trie, "SYS/broker/uptime"));
+}
+
+TEST(TopicTrie, RefusesMultiLevelWildcardBeforeTheLastLevel)
+{
+    MqttTopicTrie trie;
+    EXPECT_FALSE(trie.insert("a/#/b", 0));
+    EXPECT_FALSE(trie.insert("#/b", 1));
+    EXPECT_FALSE(trie.insert("a/#b", 2));
+    EXPECT_TRUE(trie.insert("a/b#", 3)); // Not a wildcard inside a level
+    EXPECT_EQ(trie.size(), 1u);
+
+    EXPECT_TRUE(matchAll(trie, "a/x/b").empty());
+    EXPECT_TRUE(matchAll(trie, "a/b").empty());
+    EXPECT_EQ(Values({3}), matchAll(trie, "a/b#"));
+}
+
+TEST(TopicTrie, SameFilterTwiceReportsBothValues)
+{
+    MqttTopicTrie trie;
+    trie.insert("a/b", 4);
+    trie.insert("a/b", 7);
+
+    EXPECT_EQ(Values({4, 7}), matchAll(trie, "a/b"));
+
+    trie.clear();
+    EXPECT_TRUE(trie.empty());
+    EXPECT_TRUE(matchAll(trie, "a/b").empty());
+}
@@ -184,12 +184,19 @@ void test_mqtt_unsubscribe_when_disconnected(void) {
 
 // Test 9: Topic matching logic
 void test_mqtt_topic_matching(void) {
-    // This tests the private mqttTopicMatch method indirectly
-    // through the message received callback system
-    
-    // Note: Direct testing would require making mqttTopicMatch public
-    // or adding a friend test class
-    TEST_ASSERT_TRUE(true);
+    // Exact and single level wildcards, any number of '+'
+    TEST_ASSERT_TRUE(mqttTopicMatches("home/livingroom/temp", "home/livingroom/temp"));
+    TEST_ASSERT_TRUE(mqttTopicMatches("home/+/temp", "home/kitchen/temp"));
+    TEST_ASSERT_TRUE(mqttTopicMatches("+/+/temp", "home/kitchen/temp"));
+    TEST_ASSERT_FALSE(mqttTopicMatches("home/+/temp", "home/kitchen/fridge/temp"));
+
+    // Trailing '#' also matches the parent level
+    TEST_ASSERT_TRUE(mqttTopicMatches("home/#", "home"));
+    TEST_ASSERT_TRUE(mqttTopicMatches("home/#", "home/kitchen/temp"));
+
+    // Leading wildcards do not match '$' topics
+    TEST_ASSERT_FALSE(mqttTopicMatches("#", "$SYS/broker/uptime"));
+    TEST_ASSERT_TRUE(mqttTopicMatches("$SYS/#", "$SYS/broker/uptime"));
 }
 
 // Test 10: Logger integration without custom logger
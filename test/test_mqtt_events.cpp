@@ -57,6 +57,28 @@ esp_mqtt_event_t* createMockEvent(esp_mqtt_event_id_t event_id, const char* topi
     return &mockEvent;
 }
 
+// Helper to create a data event with a binary payload. The client handle is left
+// null, which is what a client that was never started compares against.
+esp_mqtt_event_t* createBinaryDataEvent(const char* topic, char* data, int data_len) {
+    static esp_mqtt_event_t mockEvent;
+    static char topicBuffer[256];
+
+    memset(&mockEvent, 0, sizeof(mockEvent));
+    mockEvent.event_id = MQTT_EVENT_DATA;
+    mockEvent.client = nullptr;
+
+    strncpy(topicBuffer, topic, sizeof(topicBuffer) - 1);
+    mockEvent.topic = topicBuffer;
+    mockEvent.topic_len = strlen(topic);
+
+    mockEvent.data = data;
+    mockEvent.data_len = data_len;
+    mockEvent.total_data_len = data_len;
+    mockEvent.current_data_offset = 0;
+
+    return &mockEvent;
+}
+
 // Helper to create error event
 esp_mqtt_event_t* createMockErrorEvent(esp_mqtt_error_type_t error_type, 
                                        mqtt_connect_return_code_t connect_code = MQTT_CONNECTION_ACCEPTED) {
@@ -251,6 +273,57 @@ void test_mqtt_is_my_turn(void) {
     TEST_ASSERT_FALSE(eventTestClient->isMyTurn(otherHandle));
 }
 
+// Test 10: Binary payload with NUL bytes is delivered completely
+void test_mqtt_data_event_binary_payload(void) {
+    static std::string receivedPayload;
+    static size_t receivedViewLen = 0;
+    receivedPayload.clear();
+    receivedViewLen = 0;
+
+    eventTestClient->setOnMessageCallback([](const std::string &topic, const std::string &payload) {
+        receivedPayload = payload;
+    });
+    eventTestClient->setOnMessageCallback([](const MqttMessageView &message) {
+        receivedViewLen = message.payloadLen;
+    });
+
+    // CBOR-like payload with embedded zeros
+    char payload[] = {(char)0xA2, 0x00, 0x01, 0x00, (char)0xFF, 0x00};
+    esp_mqtt_event_t* event = createBinaryDataEvent("test/binary", payload, sizeof(payload));
+    eventTestClient->onEventCallback(event);
+
+    TEST_ASSERT_EQUAL(sizeof(payload), receivedViewLen);
+    TEST_ASSERT_EQUAL(sizeof(payload), receivedPayload.size());
+    TEST_ASSERT_EQUAL_MEMORY(payload, receivedPayload.data(), sizeof(payload));
+}
+
+// Test 11: Payload filling the whole input buffer does not write past it
+void test_mqtt_data_event_buffer_filling_payload(void) {
+    static std::string receivedPayload;
+    receivedPayload.clear();
+
+    eventTestClient->setOnMessageCallback([](const std::string &topic, const std::string &payload) {
+        receivedPayload = payload;
+    });
+
+    // Receive buffer followed by a canary byte; the payload uses every byte of the buffer
+    const size_t bufferSize = 512;
+    static char buffer[bufferSize + 1];
+    for (size_t i = 0; i < bufferSize; i++) {
+        buffer[i] = (char)('A' + (i % 26));
+    }
+    buffer[bufferSize] = 0x5A;
+
+    esp_mqtt_event_t* event = createBinaryDataEvent("test/full", buffer, bufferSize);
+    eventTestClient->onEventCallback(event);
+
+    TEST_ASSERT_EQUAL_HEX8(0x5A, buffer[bufferSize]);
+    TEST_ASSERT_EQUAL('A', buffer[0]);
+    TEST_ASSERT_EQUAL('A' + ((bufferSize - 1) % 26), buffer[bufferSize - 1]);
+    TEST_ASSERT_EQUAL(bufferSize, receivedPayload.size());
+    TEST_ASSERT_EQUAL_MEMORY(buffer, receivedPayload.data(), bufferSize);
+}
+
 // Test runner
 void run_mqtt_event_tests(void) {
     UNITY_BEGIN();
@@ -264,6 +337,8 @@ void run_mqtt_event_tests(void) {
     RUN_TEST(test_mqtt_event_sequence);
     RUN_TEST(test_mqtt_data_event_null_payload);
     RUN_TEST(test_mqtt_is_my_turn);
+    RUN_TEST(test_mqtt_data_event_binary_payload);
+    RUN_TEST(test_mqtt_data_event_buffer_filling_payload);
     
     UNITY_END();
 }